@@ -1,28 +1,26 @@
 #include "arp.h"
+#include "arp_table.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <libgen.h>
+#include <time.h>
+#include <pthread.h>
 #include <rawnet.h>
-#include <timerms.h>
 #include <arpa/inet.h>
 
 #define IP_PROTOCOL 0x0800 //especificamos protocolo ip
 #define HARDW_TYPE 0x0001 //especificamos que el hardware es eth
 
-#define ARP_TYPE 0x0806 //especificamos que el mensaje es de tipo ARP
 #define ARP_REQUEST 0x0001 //simbolo para ARP request
 #define ARP_REPLY 0x0002 //simbolo para ARP reply
 
 //mac de broadcast
 mac_addr_t UNKNOW_MAC = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00}; //cuando no sabemos la mac a utilizar
 
-
-timerms_t timer;
-long int timeout = 2000; //2 segundos
-long int ecotimeout = 3000; //3 segundos
 //definimos la cabecera
 
 typedef struct arp_message {
@@ -38,77 +36,1526 @@ typedef struct arp_message {
 
 } arp_message_t;
 
+/* Vecina que se está resolviendo, con las tramas que esperan su MAC */
+struct arp_pending {
+    int used;                 /* 0 si está libre */
+    ipv4_addr_t ip;
+    ipv4_addr_t src;          /* Dirección propia para los request */
+    unsigned int gen;         /* Distingue esta resolución de otras
+                                 posteriores de la misma dirección */
+    int tries;                /* Requests enviados */
+    long long int started;    /* Primer request (ms) */
+    long long int deadline;   /* Siguiente reintento, o abandono (ms) */
+    int nframes;
+    unsigned char *frames[ARP_PENDING_MAX]; /* Copias con su headroom */
+    int lens[ARP_PENDING_MAX];
+    uint16_t types[ARP_PENDING_MAX];
+};
+
+/* Dirección propia, con la trama de respuesta ya preparada: basta copiar
+   la MAC e IP de quien pregunta y enviarla con 'eth_send_frame()' */
+struct arp_local {
+    int used;                 /* 0 si está libre */
+    ipv4_addr_t ip;
+    unsigned char reply[ETH_HEADROOM + sizeof(arp_message_t)];
+};
+
+/* Límite de requests a una dirección: cubo de fichas y periodo en que no se
+   pregunta por ella tras abandonarla */
+struct arp_limit {
+    uint32_t ip;              /* 0 si está libre */
+    double tokens;
+    long long int filled;     /* Última vez que se rellenó el cubo (ms) */
+    long long int hold_until; /* Hasta cuándo se falla sin preguntar (ms) */
+};
+
+/* Estado ARP de un interfaz (ver 'arp_open()').
+ *
+ * Cada interfaz tiene su propio cerrojo, así que las resoluciones de
+ * interfaces distintos no se esperan entre sí. Es recursivo porque las
+ * tramas pendientes se entregan a la función de error con él cogido, y ésta
+ * puede volver a enviar. 'done' se avisa cada vez que termina una
+ * resolución, que deja de recibir quien lo hacía por todos o que se va
+ * alguien que esperaba.
+ *
+ * 'eth_recv()' no admite dos llamadas a la vez sobre el mismo interfaz, así
+ * que de todos los que esperan respuestas ('arp_resolve()' de cualquier
+ * vecina y 'arp_forget()') sólo recibe uno, el que pone 'receiving'; los
+ * demás esperan en 'done'.
+ *
+ * La caché de vecinas se consulta sin cerrojo (ver "arp_table.h").
+ */
+struct arp_iface {
+    eth_iface_t *iface;
+    arp_config_t config;
+    arp_table_t *cache;
+    struct arp_pending pending[ARP_PENDING_NEIGHBORS];
+    unsigned int pending_gen;
+    struct arp_local locals[ARP_MAX_ADDRESSES];
+    struct arp_limit limits[ARP_LIMIT_TARGETS];
+    long long int probing;    /* Hasta cuándo puede llegar la respuesta de
+                                 una vecina conocida a la que se ha vuelto
+                                 a preguntar (ms) */
+    arp_error_handler_t error_handler;
+    void *error_arg;
+    int receiving;            /* 1 si alguien está recibiendo por todos */
+    int waiting;              /* Hilos dentro de 'arp_resolve()' que han
+                                 soltado el cerrojo para esperar */
+    int closing;              /* 1 desde que empieza 'arp_forget()' */
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+};
+
+/* Configuración de los interfaces que se abren sin indicar ninguna */
+static pthread_mutex_t arp_lock = PTHREAD_MUTEX_INITIALIZER;
+static arp_config_t arp_default_config = {
+    ARP_RETRIES, ARP_TIMEOUT, ARP_BACKOFF, ARP_MAX_TIMEOUT, ARP_GIVE_UP,
+    ARP_RATE, ARP_BURST, ARP_HOLD_DOWN
+};
+
+/* Límite global de requests: cubo de fichas de todos los interfaces. Su
+   cerrojo no se coge nunca junto con ningún otro salvo el de un interfaz. */
+static pthread_mutex_t arp_rate_lock = PTHREAD_MUTEX_INITIALIZER;
+static double arp_rate = ARP_RATE_LIMIT;
+static double arp_rate_tokens = ARP_RATE_LIMIT;
+static long long int arp_rate_filled = 0;
+
+/* Tiempos de vida de las entradas y fuentes de aprendizaje, comunes a todos
+   los interfaces. Se leen sin cerrojo (p.ej. al consultar la caché en cada
+   envío), así que sólo se accede a ellos con operaciones atómicas. */
+static long int arp_reachable_time = ARP_REACHABLE_TIME;
+static long int arp_stale_time = ARP_STALE_TIME;
+static int arp_learning = ARP_LEARN_ARP;
+
+
+/* static long long int arp_now ( void );
+ *
+ * DESCRIPCIÓN:
+ *   Devuelve el tiempo actual en milisegundos de un reloj monotónico.
+ */
+static long long int arp_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long int) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/* static int arp_config_check ( arp_config_t * config );
+ *
+ * DESCRIPCIÓN:
+ *   Comprueba que la política de reintentos tiene sentido.
+ *
+ * VALOR DEVUELTO:
+ *   '0' si es válida, '-1' si no.
+ */
+static int arp_config_check(arp_config_t *config) {
+    if ((config->retries < 0) || (config->timeout <= 0) ||
+        (config->backoff < 1.0) || (config->max_timeout < 0) ||
+        (config->give_up < 0) || (config->rate < 0.0) ||
+        ((config->rate > 0.0) && (config->burst < 1)) || (config->hold_down < 0)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* static long int arp_config_wait ( arp_config_t * config, int tries );
+ *
+ * DESCRIPCIÓN:
+ *   Devuelve cuánto se espera la respuesta tras enviar el request número
+ *   'tries' (1 el primero): 'timeout' multiplicado por 'backoff' en cada
+ *   reintento, hasta 'max_timeout'.
+ */
+static long int arp_config_wait(arp_config_t *config, int tries) {
+    double wait = config->timeout;
+    int i;
+    for (i = 1; i < tries; i++) {
+        wait *= config->backoff;
+        if ((config->max_timeout > 0) && (wait >= config->max_timeout)) {
+            break;
+        }
+    }
+    if ((config->max_timeout > 0) && (wait > config->max_timeout)) {
+        wait = config->max_timeout;
+    }
+
+    return (long int) wait;
+}
+
+
+/* static long int arp_config_give_up ( arp_config_t * config );
+ *
+ * DESCRIPCIÓN:
+ *   Devuelve el tiempo máximo de una resolución: lo que tardan en vencer
+ *   todos sus requests ('retries' + 1), o 'give_up' si es menor. Así una
+ *   resolución cuyos requests aplazan los límites (ver 'arp_limit_wait()')
+ *   tampoco espera más de eso.
+ */
+static long int arp_config_give_up(arp_config_t *config) {
+    long int total = 0;
+    int tries;
+    for (tries = 1; tries <= config->retries + 1; tries++) {
+        total += arp_config_wait(config, tries);
+    }
+    if ((config->give_up > 0) && (config->give_up < total)) {
+        total = config->give_up;
+    }
+
+    return total;
+}
+
+
+/* static uint32_t arp_key ( ipv4_addr_t ip );
+ *
+ * DESCRIPCIÓN:
+ *   Devuelve la dirección como clave de la tabla de vecinas.
+ */
+static uint32_t arp_key(ipv4_addr_t ip) {
+    uint32_t key;
+    memcpy(&key, ip, IPv4_ADDR_SIZE);
+
+    return key;
+}
+
+
+/* static long int arp_bucket_check
+ * ( double * tokens, long long int * filled, double rate, double burst,
+ *   long long int now );
+ *
+ * DESCRIPCIÓN:
+ *   Rellena un cubo de fichas con lo que le corresponde desde la última vez
+ *   y mira si queda una ficha. No la gasta: se gasta al enviar (ver
+ *   'arp_limit_charge()').
+ *
+ * VALOR DEVUELTO:
+ *   '0' si hay ficha, o los milisegundos que faltan para la siguiente.
+ */
+static long int arp_bucket_check
+        (double *tokens, long long int *filled, double rate, double burst,
+         long long int now) {
+    *tokens += (now - *filled) * rate / 1000.0;
+    if (*tokens > burst) {
+        *tokens = burst;
+    }
+    *filled = now;
+
+    if (*tokens < 1.0) {
+        return (long int) ((1.0 - *tokens) * 1000.0 / rate) + 1;
+    }
+
+    return 0;
+}
+
+
+/* static struct arp_limit * arp_limit_find
+ * ( struct arp_iface * ctx, ipv4_addr_t ip, int create );
+ *
+ * DESCRIPCIÓN:
+ *   Devuelve el límite de requests de 'ip'. Si no lo hay y 'create' es
+ *   distinto de 0 se crea con el cubo lleno, olvidando si hace falta el de
+ *   la dirección por la que hace más tiempo que no se pregunta. Nunca se
+ *   olvida una dirección retenida tras abandonarla (ver 'arp_held()'): si
+ *   todas lo están no se crea.
+ */
+static struct arp_limit *arp_limit_find(struct arp_iface *ctx, ipv4_addr_t ip, int create) {
+    uint32_t key = arp_key(ip);
+    long long int now = arp_now();
+    struct arp_limit *oldest = NULL;
+    int i;
+    for (i = 0; i < ARP_LIMIT_TARGETS; i++) {
+        struct arp_limit *limit = &ctx->limits[i];
+        if (limit->ip == key) {
+            return limit;
+        }
+        if ((limit->ip != 0) && (now < limit->hold_until)) {
+            continue;
+        }
+        if ((oldest == NULL) || ((oldest->ip != 0) &&
+            ((limit->ip == 0) || (limit->filled < oldest->filled)))) {
+            oldest = limit;
+        }
+    }
+    if (!create || (oldest == NULL)) {
+        return NULL;
+    }
+
+    oldest->ip = key;
+    oldest->tokens = ctx->config.burst;
+    oldest->filled = now;
+    oldest->hold_until = 0;
+
+    return oldest;
+}
+
+
+/* static long int arp_limit_wait
+ * ( struct arp_iface * ctx, ipv4_addr_t ip, long long int now );
+ *
+ * DESCRIPCIÓN:
+ *   Decide si ahora se puede enviar un request por 'ip' según el límite de
+ *   la dirección y el global. No gasta fichas: si se envía hay que llamar
+ *   después a 'arp_limit_charge()'.
+ *
+ *   Si no cabe el límite de otra dirección porque todas las recordadas
+ *   están retenidas, se aplaza hasta que se libere la primera.
+ *
+ * VALOR DEVUELTO:
+ *   '0' si se puede enviar, o los milisegundos que hay que esperar.
+ */
+static long int arp_limit_wait(struct arp_iface *ctx, ipv4_addr_t ip, long long int now) {
+    arp_config_t *config = &ctx->config;
+    if (config->rate > 0.0) {
+        struct arp_limit *limit = arp_limit_find(ctx, ip, 1);
+        if (limit == NULL) {
+            long long int first = ctx->limits[0].hold_until;
+            int i;
+            for (i = 1; i < ARP_LIMIT_TARGETS; i++) {
+                if (ctx->limits[i].hold_until < first) {
+                    first = ctx->limits[i].hold_until;
+                }
+            }
+            return (long int) (first - now) + 1;
+        }
+        long int wait = arp_bucket_check(&limit->tokens, &limit->filled,
+                                         config->rate, config->burst, now);
+        if (wait > 0) {
+            return wait;
+        }
+    }
+
+    pthread_mutex_lock(&arp_rate_lock);
+    long int wait = 0;
+    if (arp_rate > 0.0) {
+        wait = arp_bucket_check(&arp_rate_tokens, &arp_rate_filled,
+                                arp_rate, arp_rate, now);
+    }
+    pthread_mutex_unlock(&arp_rate_lock);
+
+    return wait;
+}
+
+
+/* static void arp_limit_charge ( struct arp_iface * ctx, ipv4_addr_t ip );
+ *
+ * DESCRIPCIÓN:
+ *   Gasta una ficha del límite de 'ip' y otra del global por un request que
+ *   se acaba de enviar.
+ */
+static void arp_limit_charge(struct arp_iface *ctx, ipv4_addr_t ip) {
+    if (ctx->config.rate > 0.0) {
+        struct arp_limit *limit = arp_limit_find(ctx, ip, 0);
+        if (limit != NULL) {
+            limit->tokens -= 1.0;
+        }
+    }
+
+    pthread_mutex_lock(&arp_rate_lock);
+    if (arp_rate > 0.0) {
+        arp_rate_tokens -= 1.0;
+    }
+    pthread_mutex_unlock(&arp_rate_lock);
+}
+
+
+/* static int arp_held ( struct arp_iface * ctx, ipv4_addr_t ip );
+ *
+ * DESCRIPCIÓN:
+ *   Indica si 'ip' se abandonó hace menos de 'hold_down' ms, y por tanto
+ *   hay que fallar sin preguntar por ella.
+ */
+static int arp_held(struct arp_iface *ctx, ipv4_addr_t ip) {
+    struct arp_limit *limit = arp_limit_find(ctx, ip, 0);
+
+    return (limit != NULL) && (arp_now() < limit->hold_until);
+}
+
+
+/* static int arp_cache_state ( arp_neighbor_t * neighbor, long long int now );
+ *
+ * DESCRIPCIÓN:
+ *   Devuelve el estado de la vecina según el tiempo que hace que se
+ *   confirmó. Las estáticas siempre están confirmadas.
+ */
+static int arp_cache_state(arp_neighbor_t *neighbor, long long int now) {
+    if (neighbor->flags & ARP_NEIGHBOR_STATIC) {
+        return ARP_REACHABLE;
+    }
+
+    long long int age = now - neighbor->confirmed;
+    long int reachable = __atomic_load_n(&arp_reachable_time, __ATOMIC_RELAXED);
+    long int stale = __atomic_load_n(&arp_stale_time, __ATOMIC_RELAXED);
+    if (age < reachable) {
+        return ARP_REACHABLE;
+    } else if (age < reachable + stale) {
+        return ARP_STALE;
+    }
+
+    return ARP_EXPIRED;
+}
+
+
+/* static int arp_cache_get
+ * ( struct arp_iface * ctx, ipv4_addr_t ip, arp_neighbor_t * neighbor );
+ *
+ * DESCRIPCIÓN:
+ *   Copia en 'neighbor' la entrada de 'ip' en la caché del interfaz, sin
+ *   coger cerrojos. Si no hay ninguna, 'neighbor->confirmed' queda a -1.
+ *
+ *   Sin el cerrojo del interfaz puede no encontrarse una entrada que se
+ *   está moviendo de sitio: quien vaya a actuar porque no está debe repetir
+ *   la consulta con el cerrojo.
+ *
+ * VALOR DEVUELTO:
+ *   El estado de la entrada ('ARP_EXPIRED' si no hay ninguna).
+ */
+static int arp_cache_get(struct arp_iface *ctx, ipv4_addr_t ip, arp_neighbor_t *neighbor) {
+    if ((ctx == NULL) || !arp_table_lookup(ctx->cache, arp_key(ip), neighbor)) {
+        neighbor->confirmed = -1;
+        return ARP_EXPIRED;
+    }
+
+    return arp_cache_state(neighbor, arp_now());
+}
+
+
+/* static void arp_cache_update
+ * ( struct arp_iface * ctx, ipv4_addr_t ip, mac_addr_t mac, int create );
+ *
+ * DESCRIPCIÓN:
+ *   Guarda (o confirma) la dirección MAC de 'ip'. Si no estaba y 'create'
+ *   es 0 no se hace nada. Si la caché del interfaz está llena se sustituye
+ *   una entrada que no se haya usado recientemente. Las entradas estáticas
+ *   no se cambian.
+ */
+static void arp_cache_update
+        (struct arp_iface *ctx, ipv4_addr_t ip, mac_addr_t mac, int create) {
+    arp_neighbor_t neighbor;
+    if (arp_table_lookup(ctx->cache, arp_key(ip), &neighbor) &&
+        (neighbor.flags & ARP_NEIGHBOR_STATIC)) {
+        return;
+    }
+    memcpy(neighbor.mac, mac, MAC_ADDR_SIZE);
+    neighbor.confirmed = arp_now();
+    neighbor.probed = 0;
+    neighbor.flags = 0;
+    arp_table_update(ctx->cache, arp_key(ip), &neighbor, create);
+}
+
+
+int arp_cache_lookup(arp_iface_t *ctx, ipv4_addr_t ip, mac_addr_t mac) {
+    arp_neighbor_t neighbor;
+    int state = arp_cache_get(ctx, ip, &neighbor);
+    if ((state == ARP_EXPIRED) && (ctx != NULL)) {
+        //Sin el cerrojo podria no verse una entrada que se esta moviendo
+        pthread_mutex_lock(&ctx->lock);
+        state = arp_cache_get(ctx, ip, &neighbor);
+        pthread_mutex_unlock(&ctx->lock);
+    }
+    if (state != ARP_EXPIRED) {
+        memcpy(mac, neighbor.mac, MAC_ADDR_SIZE);
+    }
+
+    return state;
+}
+
 
-int arp_resolve(eth_iface_t *iface, ipv4_addr_t src, ipv4_addr_t destino, mac_addr_t mac) {
+void arp_cache_set_lifetimes(long int reachable, long int stale) {
+    if (reachable >= 0) {
+        __atomic_store_n(&arp_reachable_time, reachable, __ATOMIC_RELAXED);
+    }
+    if (stale >= 0) {
+        __atomic_store_n(&arp_stale_time, stale, __ATOMIC_RELAXED);
+    }
+}
+
+
+void arp_cache_flush(arp_iface_t *ctx) {
+    if (ctx != NULL) {
+        pthread_mutex_lock(&ctx->lock);
+        arp_table_clear(ctx->cache);
+        pthread_mutex_unlock(&ctx->lock);
+    }
+}
+
+
+/* static int arp_send_request
+ * ( eth_iface_t * iface, ipv4_addr_t src, ipv4_addr_t destino,
+ *   mac_addr_t dst, arp_message_t * arp_payload );
+ *
+ * DESCRIPCIÓN:
+ *   Rellena 'arp_payload' con un ARP request por 'destino' y lo envía a
+ *   'dst': por difusión ('MAC_BCAST_ADDR') o, para confirmar una vecina que
+ *   ya se conoce, directamente a su MAC.
+ *
+ * VALOR DEVUELTO:
+ *   Lo mismo que 'eth_send()'.
+ */
+static int arp_send_request
+        (eth_iface_t *iface, ipv4_addr_t src, ipv4_addr_t destino,
+         mac_addr_t dst, arp_message_t *arp_payload) {
 
     //Creamos y rellenamos la estructura de tipo arp_message que se utilizara como payload
-    arp_message_t arp_payload;
-    arp_payload.hard_addr = htons(HARDW_TYPE);// correspondiente a eth
-    arp_payload.protocol_type = htons(IP_PROTOCOL); //correspondiente a ip
-    arp_payload.hard_size = 6;//pq eth tiene 6 octetos
-    arp_payload.protocol_length = 4;
-    arp_payload.opcode = htons(ARP_REQUEST); //1 request; 2 reply
-    eth_getaddr(iface, arp_payload.mac_sender); //guardamos en mac_send la mac de la interfaz abierta
-    memcpy(arp_payload.ip_sender, src,
+    arp_payload->hard_addr = htons(HARDW_TYPE);// correspondiente a eth
+    arp_payload->protocol_type = htons(IP_PROTOCOL); //correspondiente a ip
+    arp_payload->hard_size = 6;//pq eth tiene 6 octetos
+    arp_payload->protocol_length = 4;
+    arp_payload->opcode = htons(ARP_REQUEST); //1 request; 2 reply
+    eth_getaddr(iface, arp_payload->mac_sender); //guardamos en mac_send la mac de la interfaz abierta
+    memcpy(arp_payload->ip_sender, src,
            IPv4_ADDR_SIZE); //hastq que no implementemos la capa ip dejamos esto a 0
-    memcpy(arp_payload.mac_target, UNKNOW_MAC, MAC_ADDR_SIZE); //En c la mejor forma de copiar arrays por ser
-    memcpy(arp_payload.ip_target, destino, IPv4_ADDR_SIZE); //punteros es con memcpy
-    //enviamos en broadcast un arp request
+    memcpy(arp_payload->mac_target, UNKNOW_MAC, MAC_ADDR_SIZE); //En c la mejor forma de copiar arrays por ser
+    memcpy(arp_payload->ip_target, destino, IPv4_ADDR_SIZE); //punteros es con memcpy
+
+    //enviamos el arp request (normalmente en broadcast)
+    return eth_send(iface, dst, ARP_TYPE, (unsigned char *) arp_payload,
+                    sizeof(arp_message_t));
+}
+
+
+/* static struct arp_pending * arp_pending_find
+ * ( struct arp_iface * ctx, ipv4_addr_t ip );
+ *
+ * DESCRIPCIÓN:
+ *   Devuelve la resolución en curso de 'ip' en el interfaz, o NULL.
+ */
+static struct arp_pending *arp_pending_find(struct arp_iface *ctx, ipv4_addr_t ip) {
+    int i;
+    for (i = 0; i < ARP_PENDING_NEIGHBORS; i++) {
+        struct arp_pending *pending = &ctx->pending[i];
+        if (pending->used &&
+            (memcmp(pending->ip, ip, IPv4_ADDR_SIZE) == 0)) {
+            return pending;
+        }
+    }
+
+    return NULL;
+}
+
+
+/* static void arp_pending_release
+ * ( struct arp_iface * ctx, struct arp_pending * pending, mac_addr_t mac );
+ *
+ * DESCRIPCIÓN:
+ *   Termina una resolución: envía sus tramas a 'mac' o, si es NULL, las
+ *   descarta entregándolas a la función de error.
+ */
+static void arp_pending_release
+        (struct arp_iface *ctx, struct arp_pending *pending, mac_addr_t mac) {
+    pending->used = 0;
+    pthread_cond_broadcast(&ctx->done);
+
+    int i;
+    for (i = 0; i < pending->nframes; i++) {
+        if (mac != NULL) {
+            eth_send_frame(ctx->iface, mac, pending->types[i], pending->frames[i], pending->lens[i]);
+        } else if (ctx->error_handler != NULL) {
+            ctx->error_handler(ctx->iface, pending->ip, pending->frames[i], pending->lens[i],
+                               ctx->error_arg);
+        }
+        free(pending->frames[i]);
+    }
+    if ((mac == NULL) && (ctx->error_handler == NULL) && (pending->nframes > 0)) {
+        char ip_str[IPv4_STR_MAX_LENGTH];
+        ipv4_addr_str(pending->ip, ip_str);
+        fprintf(stderr, "arp_send_frame(): %s no responde: %d tramas descartadas\n",
+                ip_str, pending->nframes);
+    }
+    pending->nframes = 0;
+}
+
+
+/* static struct arp_pending * arp_pending_start
+ * ( struct arp_iface * ctx, ipv4_addr_t src, ipv4_addr_t ip );
+ *
+ * DESCRIPCIÓN:
+ *   Empieza a resolver 'ip': envía el primer ARP request y reserva la
+ *   entrada que comparten todos los que esperan su MAC. Si los límites de
+ *   requests no lo permiten todavía, el request se aplaza hasta que lo
+ *   hagan (ver 'arp_iface_timers()').
+ *
+ * VALOR DEVUELTO:
+ *   La nueva resolución, o NULL si no hay sitio o no se ha podido enviar.
+ */
+static struct arp_pending *arp_pending_start
+        (struct arp_iface *ctx, ipv4_addr_t src, ipv4_addr_t ip) {
+    int i;
+    for (i = 0; (i < ARP_PENDING_NEIGHBORS) && ctx->pending[i].used; i++);
+    if (i == ARP_PENDING_NEIGHBORS) {
+        fprintf(stderr, "arp_send_frame(): ERROR: Demasiadas vecinas pendientes\n");
+        return NULL;
+    }
+    struct arp_pending *pending = &ctx->pending[i];
+
+    long long int now = arp_now();
+    long int wait = arp_limit_wait(ctx, ip, now);
+    if (wait == 0) {
+        arp_message_t arp_payload;
+        if (arp_send_request(ctx->iface, src, ip, MAC_BCAST_ADDR, &arp_payload) == -1) {
+            return NULL;
+        }
+        arp_limit_charge(ctx, ip);
+    }
+    pending->used = 1;
+    memcpy(pending->ip, ip, IPv4_ADDR_SIZE);
+    memcpy(pending->src, src, IPv4_ADDR_SIZE);
+    pending->gen = ++ctx->pending_gen;
+    pending->tries = (wait == 0) ? 1 : 0;
+    pending->started = now;
+    pending->deadline = now + ((wait == 0) ? arp_config_wait(&ctx->config, 1) : wait);
+    pending->nframes = 0;
+
+    return pending;
+}
+
+
+/* static int arp_pending_add
+ * ( struct arp_pending * pending, uint16_t type, unsigned char * frame,
+ *   int payload_len );
+ *
+ * DESCRIPCIÓN:
+ *   Guarda una copia de la trama en la cola de la resolución.
+ *
+ * VALOR DEVUELTO:
+ *   'payload_len', o '-1' si 'pending' es NULL o su cola está llena.
+ */
+static int arp_pending_add
+        (struct arp_pending *pending, uint16_t type, unsigned char *frame, int payload_len) {
+    if (pending == NULL) {
+        return -1;
+    }
+    if (pending->nframes == ARP_PENDING_MAX) {
+        fprintf(stderr, "arp_send_frame(): ERROR: Cola de pendientes llena\n");
+        return -1;
+    }
+
+    unsigned char *copy = malloc(ETH_HEADROOM + payload_len);
+    if (copy == NULL) {
+        fprintf(stderr, "arp_send_frame(): ERROR en malloc()\n");
+        return -1;
+    }
+    memcpy(copy + ETH_HEADROOM, frame + ETH_HEADROOM, payload_len);
+    pending->frames[pending->nframes] = copy;
+    pending->lens[pending->nframes] = payload_len;
+    pending->types[pending->nframes] = type;
+    pending->nframes++;
+
+    return payload_len;
+}
+
+
+/* static struct arp_local * arp_local_find
+ * ( struct arp_iface * ctx, ipv4_addr_t ip );
+ *
+ * DESCRIPCIÓN:
+ *   Devuelve la dirección propia 'ip' del interfaz, o NULL si no lo es.
+ */
+static struct arp_local *arp_local_find(struct arp_iface *ctx, ipv4_addr_t ip) {
+    int i;
+    for (i = 0; i < ARP_MAX_ADDRESSES; i++) {
+        struct arp_local *local = &ctx->locals[i];
+        if (local->used &&
+            (memcmp(local->ip, ip, IPv4_ADDR_SIZE) == 0)) {
+            return local;
+        }
+    }
+
+    return NULL;
+}
+
 
-    if (eth_send(iface, MAC_BCAST_ADDR, ARP_TYPE, (unsigned char *) &arp_payload, sizeof(arp_payload)) ==
-        -1) {
-        return -2; //si no se ha podido enviar retornamos -2
+/* static void arp_answer ( struct arp_iface * ctx, arp_message_t * request );
+ *
+ * DESCRIPCIÓN:
+ *   Responde a un ARP request si pregunta por una dirección propia.
+ */
+static void arp_answer(struct arp_iface *ctx, arp_message_t *request) {
+    struct arp_local *local = arp_local_find(ctx, request->ip_target);
+    if (local == NULL) {
+        return;
+    }
+
+    //Se rellena sobre una copia de la plantilla, que 'eth_send_frame()' completa
+    //con la cabecera Ethernet
+    unsigned char frame[sizeof(local->reply)];
+    memcpy(frame, local->reply, sizeof(frame));
+    arp_message_t *reply = (arp_message_t *) (frame + ETH_HEADROOM);
+    memcpy(reply->mac_target, request->mac_sender, MAC_ADDR_SIZE);
+    memcpy(reply->ip_target, request->ip_sender, IPv4_ADDR_SIZE);
+
+    eth_send_frame(ctx->iface, request->mac_sender, ARP_TYPE, frame, sizeof(arp_message_t));
+}
+
+
+/* static void arp_bind
+ * ( struct arp_iface * ctx, ipv4_addr_t ip, mac_addr_t mac, int create );
+ *
+ * DESCRIPCIÓN:
+ *   Guarda en la caché que 'ip' tiene la dirección 'mac', igual que
+ *   'arp_cache_update()', creando siempre la entrada si se estaba
+ *   resolviendo, y envía las tramas que esperaban su MAC. Nunca se aprende
+ *   una dirección propia ni la MAC del propio interfaz.
+ */
+static void arp_bind(struct arp_iface *ctx, ipv4_addr_t ip, mac_addr_t mac, int create) {
+    mac_addr_t my_mac;
+    eth_getaddr(ctx->iface, my_mac);
+    if ((memcmp(mac, my_mac, MAC_ADDR_SIZE) == 0) ||
+        (arp_local_find(ctx, ip) != NULL)) {
+        return;
+    }
+
+    //Si ha vuelto a aparecer ya no hay que fallar sin preguntar
+    struct arp_limit *limit = arp_limit_find(ctx, ip, 0);
+    if (limit != NULL) {
+        limit->hold_until = 0;
+    }
+
+    struct arp_pending *pending = arp_pending_find(ctx, ip);
+    arp_cache_update(ctx, ip, mac, create || (pending != NULL));
+    if (pending != NULL) {
+        arp_pending_release(ctx, pending, mac);
+    }
+}
+
+
+/* static void arp_process
+ * ( struct arp_iface * ctx, arp_message_t * arp_message, int len );
+ *
+ * DESCRIPCIÓN:
+ *   Procesa un mensaje ARP recibido. Una respuesta confirma la entrada de
+ *   su emisor, o la crea si se estaba resolviendo, y envía las tramas que
+ *   esperaban su MAC.
+ */
+static void arp_process(struct arp_iface *ctx, arp_message_t *arp_message, int len) {
+    if ((len < (int) sizeof(arp_message_t)) ||
+        (arp_message->hard_addr != htons(HARDW_TYPE)) ||
+        (arp_message->protocol_type != htons(IP_PROTOCOL))) {
+        return;
+    }
+
+    //Cualquier mensaje (request, reply o gratuito) dice la MAC de su emisor.
+    //Se aprende si asi se ha configurado, si nos pregunta a nosotros (nos va a
+    //querer hablar) o si la estabamos resolviendo; si no, solo se confirma.
+    //Los probes (emisor 0.0.0.0) no dicen nada.
+    if (memcmp(arp_message->ip_sender, IPv4_ZERO_ADDR, IPv4_ADDR_SIZE) != 0) {
+        int create = (__atomic_load_n(&arp_learning, __ATOMIC_RELAXED) & ARP_LEARN_ARP) ||
+                     (arp_local_find(ctx, arp_message->ip_target) != NULL);
+        arp_bind(ctx, arp_message->ip_sender, arp_message->mac_sender, create);
+    }
+
+    if (ntohs(arp_message->opcode) == ARP_REQUEST) {
+        arp_answer(ctx, arp_message);
+    }
+}
+
+
+/* static void arp_drain ( struct arp_iface * ctx );
+ *
+ * DESCRIPCIÓN:
+ *   Procesa, sin esperar, los mensajes ARP que ya hayan llegado.
+ *
+ *   Recibe del interfaz, así que sólo puede llamarse desde donde se recibe
+ *   ('arp_service()'), nunca al enviar: otro hilo puede estar recibiendo
+ *   del mismo interfaz, y 'eth_recv()' no admite dos a la vez. Si un
+ *   'arp_resolve()' está recibiendo por todos no hace nada: ya los recoge
+ *   él.
+ */
+static void arp_drain(struct arp_iface *ctx) {
+    if (ctx->receiving) {
+        return;
     }
-    printf("Enviado arp request\n");
 
     unsigned char buffer[sizeof(arp_message_t)];
-    arp_message_t *arp_message = NULL;
-    int ecoARP = 0;
+    mac_addr_t mac;
+    int buffer_len;
+    while ((buffer_len = eth_recv(ctx->iface, mac, ARP_TYPE, buffer, sizeof(buffer), 0)) > 0) {
+        arp_process(ctx, (arp_message_t *) buffer, buffer_len);
+    }
+}
+
+
+/* static void arp_revalidate
+ * ( struct arp_iface * ctx, ipv4_addr_t src, ipv4_addr_t ip );
+ *
+ * DESCRIPCIÓN:
+ *   Confirma una entrada obsoleta sin bloquear: pregunta otra vez por ella
+ *   por difusión (como mucho una vez cada 'timeout' de la configuración).
+ *   La respuesta se recoge al recibir ('arp_handler()' o 'arp_service()').
+ *   Es el último recurso: si se ha usado antes de caducar ya se le ha
+ *   preguntado directamente (ver 'arp_refresh()').
+ */
+static void arp_revalidate(struct arp_iface *ctx, ipv4_addr_t src, ipv4_addr_t ip) {
+    arp_neighbor_t neighbor;
+    long long int now = arp_now();
+    if (arp_table_lookup(ctx->cache, arp_key(ip), &neighbor) &&
+        (now - neighbor.probed >= ctx->config.timeout) &&
+        (arp_limit_wait(ctx, ip, now) == 0)) {
+        arp_message_t arp_payload;
+        if (arp_send_request(ctx->iface, src, ip, MAC_BCAST_ADDR, &arp_payload) != -1) {
+            arp_limit_charge(ctx, ip);
+            neighbor.probed = now;
+            arp_table_update(ctx->cache, arp_key(ip), &neighbor, 0);
+            ctx->probing = now + ctx->config.timeout;
+        }
+    }
+}
+
+
+/* static void arp_refresh
+ * ( struct arp_iface * ctx, ipv4_addr_t src, ipv4_addr_t ip,
+ *   arp_neighbor_t * neighbor );
+ *
+ * DESCRIPCIÓN:
+ *   Renueva en segundo plano una vecina confirmada que se está usando y
+ *   cuyo tiempo de confirmada se acaba ('neighbor' es la copia que se
+ *   acaba de consultar). En el último 1/ARP_REFRESH_FRACTION de ese tiempo
+ *   se le pregunta directamente a su MAC, sin difusión, como mucho una vez
+ *   cada 'timeout' de la configuración; mientras tanto se sigue usando.
+ *
+ *   Sólo envía la pregunta: la respuesta se recoge al recibir
+ *   ('arp_handler()' o 'arp_service()'), nunca aquí, que se llama al enviar.
+ *   Sólo se coge el cerrojo del interfaz cuando toca preguntar, y sin
+ *   esperarlo: si otro hilo lo tiene se deja para el siguiente envío. Si no
+ *   responde, la entrada pasa a obsoleta y 'arp_revalidate()' pregunta por
+ *   difusión.
+ */
+static void arp_refresh
+        (struct arp_iface *ctx, ipv4_addr_t src, ipv4_addr_t ip, arp_neighbor_t *neighbor) {
+    long long int now = arp_now();
+    long int reachable = __atomic_load_n(&arp_reachable_time, __ATOMIC_RELAXED);
+    long int window = reachable / ARP_REFRESH_FRACTION;
+    if ((neighbor->flags & ARP_NEIGHBOR_STATIC) ||
+        (now - neighbor->confirmed < reachable - window)) {
+        return;
+    }
+
+    //Con una pregunta reciente solo queda esperar a que alguien reciba la respuesta
+    if ((now - neighbor->probed < ctx->config.timeout) ||
+        (pthread_mutex_trylock(&ctx->lock) != 0)) {
+        return;
+    }
+
+    arp_neighbor_t current;
+    if (arp_table_lookup(ctx->cache, arp_key(ip), &current) &&
+        (now - current.probed >= ctx->config.timeout) &&
+        (arp_limit_wait(ctx, ip, now) == 0)) {
+        arp_message_t arp_payload;
+        if (arp_send_request(ctx->iface, src, ip, current.mac, &arp_payload) != -1) {
+            arp_limit_charge(ctx, ip);
+            current.probed = now;
+            arp_table_update(ctx->cache, arp_key(ip), &current, 0);
+            ctx->probing = now + ctx->config.timeout;
+        }
+    }
+
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+
+/* static long int arp_iface_timers ( struct arp_iface * ctx );
+ *
+ * DESCRIPCIÓN:
+ *   Repite los ARP request de las resoluciones cuyo plazo ha vencido y
+ *   abandona las que ya no van a responder, con el cerrojo del interfaz ya
+ *   cogido. No recibe nada, así que se puede llamar al enviar.
+ *
+ * VALOR DEVUELTO:
+ *   Lo mismo que 'arp_service()'.
+ */
+static long int arp_iface_timers(struct arp_iface *ctx) {
+    arp_config_t *config = &ctx->config;
+    long int give_up = arp_config_give_up(config);
+    long long int now = arp_now();
+    long int left = -1;
+    int i;
+    for (i = 0; i < ARP_PENDING_NEIGHBORS; i++) {
+        struct arp_pending *pending = &ctx->pending[i];
+        if (!pending->used) {
+            continue;
+        }
+
+        if (now >= pending->deadline) {
+            //Se abandona tras el ultimo reintento o al pasar el tiempo maximo, y
+            //durante un tiempo se falla enseguida sin volver a preguntar
+            if ((pending->tries > config->retries) ||
+                (now - pending->started >= give_up)) {
+                struct arp_limit *limit = arp_limit_find(ctx, pending->ip, 1);
+                if ((config->hold_down > 0) && (limit != NULL)) {
+                    limit->hold_until = now + config->hold_down;
+                }
+                arp_pending_release(ctx, pending, NULL);
+                continue;
+            }
+
+            //Si los limites no dejan preguntar aun, las tramas siguen esperando
+            long int wait = arp_limit_wait(ctx, pending->ip, now);
+            if (wait > 0) {
+                pending->deadline = now + wait;
+            } else {
+                arp_message_t arp_payload;
+                if (arp_send_request(ctx->iface, pending->src, pending->ip, MAC_BCAST_ADDR,
+                                     &arp_payload) != -1) {
+                    arp_limit_charge(ctx, pending->ip);
+                }
+                pending->tries++;
+                pending->deadline = now + arp_config_wait(config, pending->tries);
+            }
+        }
+
+        //Ningun plazo (tampoco el de un request aplazado) pasa del abandono
+        if (pending->deadline > pending->started + give_up) {
+            pending->deadline = pending->started + give_up;
+        }
+
+        long int pending_left = (long int) (pending->deadline - now);
+        if ((left < 0) || (pending_left < left)) {
+            left = pending_left;
+        }
+    }
+
+    return left;
+}
+
+
+/* static long int arp_iface_service ( struct arp_iface * ctx );
+ *
+ * DESCRIPCIÓN:
+ *   Igual que 'arp_service()', con el cerrojo del interfaz ya cogido:
+ *   recoge las respuestas que ya hayan llegado (ver 'arp_drain()') y
+ *   atiende los plazos vencidos. Sólo se recibe si se espera alguna
+ *   respuesta: de una resolución, o de una vecina conocida a la que se ha
+ *   vuelto a preguntar.
+ */
+static long int arp_iface_service(struct arp_iface *ctx) {
+    int i;
+    int any = (arp_now() < ctx->probing);
+    for (i = 0; (i < ARP_PENDING_NEIGHBORS) && !any; i++) {
+        any = ctx->pending[i].used;
+    }
+    if (!any) {
+        return -1;
+    }
+
+    arp_drain(ctx);
+
+    return arp_iface_timers(ctx);
+}
+
+
+arp_iface_t *arp_open(eth_iface_t *iface, arp_config_t *config) {
+    if (iface == NULL) {
+        fprintf(stderr, "arp_open(): ERROR: iface == NULL\n");
+        return NULL;
+    }
+    if ((config != NULL) && (arp_config_check(config) != 0)) {
+        fprintf(stderr, "arp_open(): ERROR: Configuración inválida\n");
+        return NULL;
+    }
+
+    struct arp_iface *ctx = calloc(1, sizeof(struct arp_iface));
+    if (ctx == NULL) {
+        fprintf(stderr, "arp_open(): ERROR en calloc()\n");
+        return NULL;
+    }
+    ctx->cache = arp_table_create(ARP_CACHE_SIZE);
+    if (ctx->cache == NULL) {
+        free(ctx);
+        return NULL;
+    }
+    ctx->iface = iface;
+    if (config != NULL) {
+        ctx->config = *config;
+    } else {
+        pthread_mutex_lock(&arp_lock);
+        ctx->config = arp_default_config;
+        pthread_mutex_unlock(&arp_lock);
+    }
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&ctx->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    pthread_cond_init(&ctx->done, NULL);
+
+    return ctx;
+}
 
-    timerms_reset(&timer,
-                  timeout); //arrancamos el timer//arrancamos el timer para enviar un arp a los 2 segundos sin respuesta
 
-    //escuchamos a la respuesta mientras que el timer siga vivo
+int arp_set_rate_limit(double rate) {
+    if (rate < 0.0) {
+        fprintf(stderr, "arp_set_rate_limit(): ERROR: rate < 0\n");
+        return -1;
+    }
+
+    pthread_mutex_lock(&arp_rate_lock);
+    arp_rate = rate;
+    if (arp_rate_tokens > rate) {
+        arp_rate_tokens = rate;
+    }
+    pthread_mutex_unlock(&arp_rate_lock);
+
+    return 0;
+}
+
+
+int arp_set_default_config(arp_config_t *config) {
+    if ((config == NULL) || (arp_config_check(config) != 0)) {
+        fprintf(stderr, "arp_set_default_config(): ERROR: Configuración inválida\n");
+        return -1;
+    }
+
+    pthread_mutex_lock(&arp_lock);
+    arp_default_config = *config;
+    pthread_mutex_unlock(&arp_lock);
+
+    return 0;
+}
+
+
+int arp_resolve(arp_iface_t *ctx, ipv4_addr_t src, ipv4_addr_t destino, mac_addr_t mac) {
+    if (ctx == NULL) {
+        fprintf(stderr, "arp_resolve(): ERROR: arp == NULL\n");
+        return -2;
+    }
+
+    //Primero miramos en la cache: si la entrada esta confirmada no hace falta
+    //ni coger el cerrojo
+    arp_neighbor_t neighbor;
+    int state = arp_cache_get(ctx, destino, &neighbor);
+    if (state == ARP_REACHABLE) {
+        memcpy(mac, neighbor.mac, MAC_ADDR_SIZE);
+        arp_refresh(ctx, src, destino, &neighbor);
+        return 1;
+    }
+
+    pthread_mutex_lock(&ctx->lock);
+
+    //Con el cerrojo la consulta es exacta; si se puede usar no hace falta esperar
+    state = arp_cache_get(ctx, destino, &neighbor);
+    if (state != ARP_EXPIRED) {
+        memcpy(mac, neighbor.mac, MAC_ADDR_SIZE);
+        if (state == ARP_STALE) {
+            arp_revalidate(ctx, src, destino);
+        }
+        pthread_mutex_unlock(&ctx->lock);
+        return 1;
+    }
+
+    //Si alguien ya esta preguntando por ella nos unimos a su resolucion en vez
+    //de enviar otro request: la misma respuesta (o el mismo abandono) sirve a todos
+    struct arp_pending *pending = arp_pending_find(ctx, destino);
+    if ((pending == NULL) && (ctx->closing || arp_held(ctx, destino))) {
+        pthread_mutex_unlock(&ctx->lock);
+        return 0; //acaba de no responder (o se esta cerrando): no se pregunta
+    }
+    if (pending == NULL) {
+        pending = arp_pending_start(ctx, src, destino);
+        if (pending == NULL) {
+            pthread_mutex_unlock(&ctx->lock);
+            return -2; //si no se ha podido enviar retornamos -2
+        }
+        if (pending->tries > 0) {
+            printf("Enviado arp request\n"); //si los limites lo han aplazado aun no
+        }
+    }
+    unsigned int gen = pending->gen;
+    long long int start = arp_now();
+    ctx->waiting++;
+
+    unsigned char buffer[sizeof(arp_message_t)];
+    mac_addr_t src_mac;
+    int result;
     while (1) {
+        //Resuelta si la entrada se ha confirmado despues de empezar a esperar
+        arp_cache_get(ctx, destino, &neighbor);
+        if (neighbor.confirmed >= start) {
+            memcpy(mac, neighbor.mac, MAC_ADDR_SIZE);
+            printf("ARP reply recibido\n");
+            result = 1;
+            break;
+        }
+        pending = arp_pending_find(ctx, destino);
+        if ((pending == NULL) || (pending->gen != gen) || ctx->closing) {
+            printf("Time out del ARP request\n");
+            result = 0;
+            break;
+        }
 
+        //Solo uno recibe por todos, sea cual sea la vecina que espera; los
+        //demas esperan a que acabe
+        if (ctx->receiving) {
+            pthread_cond_wait(&ctx->done, &ctx->lock);
+            continue;
+        }
 
-        //si han pasado 2 segundos y no hemos recibido respuesta mandamos otra vez
-        if (timerms_left(&timer) == 0 && ecoARP == 0) {
-            eth_send(iface, MAC_BCAST_ADDR, ARP_TYPE, (unsigned char *) &arp_payload, sizeof(arp_message_t));
-            ecoARP = 1;
-            printf("Enviado eco arp request\n");
-            timerms_reset(&timer, ecotimeout);
+        //Los reintentos y el abandono son los de la resolucion compartida; las
+        //respuestas se reciben aqui abajo
+        long int time_left = arp_iface_timers(ctx);
+        pending = arp_pending_find(ctx, destino);
+        if ((pending == NULL) || (pending->gen != gen)) {
+            continue;
+        }
+        //Nunca mucho seguido, para que arp_forget no tenga que esperarnos
+        if (time_left > ARP_FORGET_TIMEOUT) {
+            time_left = ARP_FORGET_TIMEOUT;
         }
+        ctx->receiving = 1;
 
         //solo recibimos si el mensaje es del tipo arp
-        int buffer_len = eth_recv(iface, mac, ARP_TYPE, buffer, sizeof(arp_message_t),
-                                  timerms_left(&timer));
+        pthread_mutex_unlock(&ctx->lock);
+        int buffer_len = eth_recv(ctx->iface, src_mac, ARP_TYPE, buffer, sizeof(arp_message_t),
+                                  time_left);
+        pthread_mutex_lock(&ctx->lock);
+
+        ctx->receiving = 0;
+        pthread_cond_broadcast(&ctx->done);
+
+        if (buffer_len == -1) {
+            printf("Se Produjo un fallo al enviar el ARP request\n");
+            result = -1;
+            break;
+        }
+
+        //Cualquier mensaje sirve para la cache y para los envios pendientes
+        if (buffer_len > 0) {
+            arp_process(ctx, (arp_message_t *) buffer, buffer_len);
+        }
+    }
+
+    //'arp_forget()' espera a que se vaya el ultimo antes de liberar el estado
+    ctx->waiting--;
+    pthread_cond_broadcast(&ctx->done);
+    pthread_mutex_unlock(&ctx->lock);
+    return result;
+}
+
+
+int arp_send_frame(arp_iface_t *ctx, ipv4_addr_t src, ipv4_addr_t next_hop,
+                   uint16_t type, unsigned char *frame, int payload_len) {
+    if ((ctx == NULL) || (frame == NULL) || (payload_len < 0) || (payload_len > ETH_MTU)) {
+        fprintf(stderr, "arp_send_frame(): ERROR: Trama incorrecta\n");
+        return -1;
+    }
+    eth_iface_t *iface = ctx->iface;
+
+    //Con la MAC confirmada en la cache se envia directamente, sin cerrojo
+    arp_neighbor_t neighbor;
+    int state = arp_cache_get(ctx, next_hop, &neighbor);
+    if (state == ARP_REACHABLE) {
+        arp_refresh(ctx, src, next_hop, &neighbor);
+        return eth_send_frame(iface, neighbor.mac, type, frame, payload_len);
+    }
+
+    pthread_mutex_lock(&ctx->lock);
+
+    //Antes de nada, atender los reintentos que hayan vencido. Al enviar no se
+    //recibe nunca: las respuestas las recoge quien recibe del interfaz
+    arp_iface_timers(ctx);
+
+    //Con el cerrojo la consulta es exacta: si se puede usar se envia ya
+    state = arp_cache_get(ctx, next_hop, &neighbor);
+    if (state != ARP_EXPIRED) {
+        if (state == ARP_STALE) {
+            arp_revalidate(ctx, src, next_hop);
+        }
+        pthread_mutex_unlock(&ctx->lock);
+        return eth_send_frame(iface, neighbor.mac, type, frame, payload_len);
+    }
+
+    //Si no, se guarda la trama hasta que responda, preguntando si aun no se habia hecho
+    //salvo que acabe de no responder: entonces se falla sin preguntar
+    struct arp_pending *pending = arp_pending_find(ctx, next_hop);
+    if ((pending == NULL) && arp_held(ctx, next_hop)) {
+        pthread_mutex_unlock(&ctx->lock);
+        return -1;
+    }
+    if (pending == NULL) {
+        pending = arp_pending_start(ctx, src, next_hop);
+    }
+    int sent = arp_pending_add(pending, type, frame, payload_len);
+
+    pthread_mutex_unlock(&ctx->lock);
+    return sent;
+}
+
+
+long int arp_service(arp_iface_t *ctx) {
+    if (ctx == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&ctx->lock);
+    long int left = arp_iface_service(ctx);
+    pthread_mutex_unlock(&ctx->lock);
+
+    return left;
+}
+
+
+void arp_handler(eth_iface_t *iface, eth_msg_t *msg, void *arg) {
+    struct arp_iface *ctx = arg;
+    if ((ctx == NULL) || (ctx->iface != iface)) {
+        return;
+    }
+    int len = msg->payload_len;
+    if (len > msg->frame_size - ETH_HEADER_SIZE) {
+        len = msg->frame_size - ETH_HEADER_SIZE;
+    }
+
+    pthread_mutex_lock(&ctx->lock);
+    arp_process(ctx, (arp_message_t *) (msg->frame + ETH_HEADER_SIZE), len);
+    pthread_mutex_unlock(&ctx->lock);
+}
+
 
-        if (buffer_len == -1) {  
-            printf("Se Produjo un fallo al enviar el ARP request\n");           
-            return buffer_len;
-        } else if ((buffer_len == 0 && ecoARP == 1)) {
+int arp_add_address(arp_iface_t *ctx, ipv4_addr_t addr) {
+    if (ctx == NULL) {
+        fprintf(stderr, "arp_add_address(): ERROR: arp == NULL\n");
+        return -1;
+    }
+
+    pthread_mutex_lock(&ctx->lock);
+    if (arp_local_find(ctx, addr) != NULL) {
+        pthread_mutex_unlock(&ctx->lock);
+        return 0;
+    }
+
+    int i;
+    for (i = 0; (i < ARP_MAX_ADDRESSES) && ctx->locals[i].used; i++);
+    if (i == ARP_MAX_ADDRESSES) {
+        pthread_mutex_unlock(&ctx->lock);
+        fprintf(stderr, "arp_add_address(): ERROR: Demasiadas direcciones propias\n");
+        return -1;
+    }
+
+    struct arp_local *local = &ctx->locals[i];
+    memcpy(local->ip, addr, IPv4_ADDR_SIZE);
+    memset(local->reply, 0, sizeof(local->reply));
+    arp_message_t *reply = (arp_message_t *) (local->reply + ETH_HEADROOM);
+    reply->hard_addr = htons(HARDW_TYPE);
+    reply->protocol_type = htons(IP_PROTOCOL);
+    reply->hard_size = 6;
+    reply->protocol_length = 4;
+    reply->opcode = htons(ARP_REPLY);
+    eth_getaddr(ctx->iface, reply->mac_sender);
+    memcpy(reply->ip_sender, addr, IPv4_ADDR_SIZE);
+    local->used = 1;
+
+    pthread_mutex_unlock(&ctx->lock);
+    return 0;
+}
+
+
+int arp_prefetch(arp_iface_t *ctx, ipv4_addr_t src, ipv4_addr_t ip) {
+    if (ctx == NULL) {
+        fprintf(stderr, "arp_prefetch(): ERROR: arp == NULL\n");
+        return -1;
+    }
+
+    pthread_mutex_lock(&ctx->lock);
 
-            printf("Time out del ARP request\n");           
-            return buffer_len;
-          
+    //Nada que hacer si ya se conoce o ya se esta preguntando
+    arp_neighbor_t neighbor;
+    if ((arp_cache_get(ctx, ip, &neighbor) != ARP_EXPIRED) ||
+        (arp_pending_find(ctx, ip) != NULL) || arp_held(ctx, ip)) {
+        pthread_mutex_unlock(&ctx->lock);
+        return 0;
+    }
+
+    //Sin sitio libre se deja para cuando se use: no es un error
+    int i;
+    for (i = 0; (i < ARP_PENDING_NEIGHBORS) && ctx->pending[i].used; i++);
+    int started = 0;
+    if (i < ARP_PENDING_NEIGHBORS) {
+        started = (arp_pending_start(ctx, src, ip) != NULL) ? 1 : -1;
+    }
+
+    pthread_mutex_unlock(&ctx->lock);
+    return started;
 }
-        
 
-        if (buffer_len < sizeof(arp_message_t)) {
+
+int arp_cache_load(arp_iface_t *ctx, char *filename) {
+    if ((ctx == NULL) || (filename == NULL)) {
+        return -1;
+    }
+
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        fprintf(stderr, "Error opening ARP neighbors file \"%s\": %s.\n",
+                filename, strerror(errno));
+        return -1;
+    }
+
+    pthread_mutex_lock(&ctx->lock);
+
+    //Las dinamicas se cargan al final de su tiempo de confirmadas: se usan ya,
+    //y el primer envio les pregunta directamente (ver 'arp_refresh()')
+    long long int now = arp_now();
+    long int reachable = __atomic_load_n(&arp_reachable_time, __ATOMIC_RELAXED);
+    long long int confirmed = now - (reachable - reachable / ARP_REFRESH_FRACTION);
+
+    int linenum = 0;
+    int loaded = 0;
+    char line_buf[1024];
+    while (fgets(line_buf, sizeof(line_buf), file) != NULL) {
+        linenum++;
+
+        /* If this line is empty or a comment, just ignore it */
+        if ((line_buf[0] == '\n') || (line_buf[0] == '#')) {
             continue;
         }
-        //eth_recv nos devuelve del tipo undefined char, asi que convertimos antes de copiar
-        arp_message = (arp_message_t *) buffer;
 
-        //comprobamos que proviene de la ip que buscamos y ademas es arp reply
-        if (ntohs(arp_message->opcode) == ARP_REPLY && memcmp(arp_message->ip_sender, destino, IPv4_ADDR_SIZE) == 0) {
+        /* Parse line: Format "<IPv4 addr> <MAC addr> [static]\n" */
+        char ip_str[256];
+        char mac_str[256];
+        char type_str[256] = "dynamic";
+        ipv4_addr_t ip;
+        arp_neighbor_t neighbor;
+        int fields = sscanf(line_buf, "%255s %255s %255s", ip_str, mac_str, type_str);
+        if ((fields < 2) || (ipv4_str_addr(ip_str, ip) != 0) ||
+            (mac_str_addr(mac_str, neighbor.mac) != 0) ||
+            ((strcasecmp(type_str, "static") != 0) && (strcasecmp(type_str, "dynamic") != 0))) {
+            fprintf(stderr, "%s:%d: Invalid ARP neighbor: format must be "
+                            "<IPv4 addr> <MAC addr> [static|dynamic]\n", filename, linenum);
+            continue;
+        }
 
-            memcpy(mac, arp_message->mac_sender, MAC_ADDR_SIZE);
-            printf("ARP reply recibido\n");
-            return 1;
+        int is_static = (strcasecmp(type_str, "static") == 0);
+        neighbor.confirmed = is_static ? now : confirmed;
+        neighbor.probed = 0;
+        neighbor.flags = is_static ? ARP_NEIGHBOR_STATIC : 0;
+        if ((arp_local_find(ctx, ip) == NULL) &&
+            arp_table_update(ctx->cache, arp_key(ip), &neighbor, 1)) {
+            loaded++;
+        }
+    }
+
+    pthread_mutex_unlock(&ctx->lock);
+    fclose(file);
+
+    return loaded;
+}
+
+
+/* Fichero y resultado de 'arp_cache_save()' mientras se recorre la caché */
+struct arp_save {
+    FILE *file;
+    long long int now;
+    int saved;
+};
+
+/* static void arp_save_neighbor
+ * ( uint32_t ip, arp_neighbor_t * neighbor, void * arg );
+ *
+ * DESCRIPCIÓN:
+ *   Escribe una vecina en el fichero de 'arp_cache_save()', salvo que haya
+ *   caducado.
+ */
+static void arp_save_neighbor(uint32_t ip, arp_neighbor_t *neighbor, void *arg) {
+    struct arp_save *save = arg;
+    if ((save->saved < 0) || (arp_cache_state(neighbor, save->now) == ARP_EXPIRED)) {
+        return;
+    }
+
+    ipv4_addr_t addr;
+    char ip_str[IPv4_STR_MAX_LENGTH];
+    char mac_str[MAC_STR_LENGTH];
+    memcpy(addr, &ip, IPv4_ADDR_SIZE);
+    ipv4_addr_str(addr, ip_str);
+    mac_addr_str(neighbor->mac, mac_str);
+    if (fprintf(save->file, "%-15s  %s  %s\n", ip_str, mac_str,
+                (neighbor->flags & ARP_NEIGHBOR_STATIC) ? "static" : "dynamic") < 0) {
+        save->saved = -1;
+        return;
+    }
+    save->saved++;
+}
+
+
+int arp_cache_save(arp_iface_t *ctx, char *filename) {
+    if (filename == NULL) {
+        return -1;
+    }
+
+    //Sin estado ARP no hay nada que guardar: no se toca el fichero, que
+    //tendra lo que se guardo la ultima vez
+    if (ctx == NULL) {
+        return 0;
+    }
+
+    //Se escribe en un fichero temporal que luego sustituye al de verdad, para
+    //que un fallo a medias no lo deje vacio
+    char tmp_name[strlen(filename) + 5];
+    sprintf(tmp_name, "%s.tmp", filename);
+    FILE *file = fopen(tmp_name, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Error opening ARP neighbors file \"%s\": %s.\n",
+                tmp_name, strerror(errno));
+        return -1;
+    }
+
+    fprintf(file, "# %s\n", filename);
+    fprintf(file, "#\n");
+    fprintf(file, "# IPv4 addr       MAC addr           Type\n");
+
+    struct arp_save save = {file, arp_now(), 0};
+    pthread_mutex_lock(&ctx->lock);
+    arp_table_walk(ctx->cache, arp_save_neighbor, &save);
+    pthread_mutex_unlock(&ctx->lock);
+
+    if ((fflush(file) != 0) || (fsync(fileno(file)) != 0)) {
+        save.saved = -1;
+    }
+    if ((fclose(file) != 0) || (save.saved < 0) || (rename(tmp_name, filename) != 0)) {
+        fprintf(stderr, "Error writing ARP neighbors file \"%s\": %s.\n",
+                filename, strerror(errno));
+        unlink(tmp_name);
+        return -1;
+    }
+
+    return save.saved;
+}
+
+
+void arp_set_learning(int flags) {
+    __atomic_store_n(&arp_learning, flags, __ATOMIC_RELAXED);
+}
+
+
+void arp_learn(arp_iface_t *ctx, ipv4_addr_t ip, mac_addr_t mac, int source) {
+    if ((__atomic_load_n(&arp_learning, __ATOMIC_RELAXED) & source) == 0) {
+        return;
+    }
+    if (ctx != NULL) {
+        pthread_mutex_lock(&ctx->lock);
+        arp_bind(ctx, ip, mac, 1);
+        pthread_mutex_unlock(&ctx->lock);
+    }
+}
+
+
+void arp_set_error_handler(arp_iface_t *ctx, arp_error_handler_t handler, void *arg) {
+    if (ctx != NULL) {
+        pthread_mutex_lock(&ctx->lock);
+        ctx->error_handler = handler;
+        ctx->error_arg = arg;
+        pthread_mutex_unlock(&ctx->lock);
+    }
+}
+
+
+/* static void arp_iface_settle ( struct arp_iface * ctx );
+ *
+ * DESCRIPCIÓN:
+ *   Con el cerrojo del interfaz cogido, espera como mucho
+ *   'ARP_FORGET_TIMEOUT' ms a que terminen las resoluciones que tienen
+ *   tramas pendientes: a que respondan (y se envíen sus tramas) o a que se
+ *   abandonen según la configuración. Las que no tienen tramas (p.ej. de
+ *   'arp_prefetch()') se abandonan sin esperar.
+ *
+ *   Como cualquiera que espera respuestas, sólo recibe si no lo está
+ *   haciendo ya otro hilo; si no, espera a que éste las recoja.
+ */
+static void arp_iface_settle(struct arp_iface *ctx) {
+    long long int until = arp_now() + ARP_FORGET_TIMEOUT;
+    unsigned char buffer[sizeof(arp_message_t)];
+    mac_addr_t mac;
+    while (1) {
+        long int time_left = arp_iface_timers(ctx);
+
+        int waiting = 0;
+        int i;
+        for (i = 0; i < ARP_PENDING_NEIGHBORS; i++) {
+            struct arp_pending *pending = &ctx->pending[i];
+            if (pending->used && (pending->nframes == 0)) {
+                arp_pending_release(ctx, pending, NULL);
+            } else if (pending->used) {
+                waiting = 1;
+            }
         }
+        long long int now = arp_now();
+        if (!waiting || (time_left < 0) || (now >= until)) {
+            return;
+        }
+        if (time_left > until - now) {
+            time_left = (long int) (until - now);
+        }
+
+        if (ctx->receiving) {
+            pthread_cond_wait(&ctx->done, &ctx->lock);
+            continue;
+        }
+        ctx->receiving = 1;
+
+        pthread_mutex_unlock(&ctx->lock);
+        int buffer_len = eth_recv(ctx->iface, mac, ARP_TYPE, buffer, sizeof(buffer), time_left);
+        pthread_mutex_lock(&ctx->lock);
+
+        ctx->receiving = 0;
+        pthread_cond_broadcast(&ctx->done);
+
+        if (buffer_len == -1) {
+            return;
+        } else if (buffer_len > 0) {
+            arp_process(ctx, (arp_message_t *) buffer, buffer_len);
+        }
+    }
+}
+
+
+int arp_forget(arp_iface_t *ctx) {
+    if (ctx == NULL) {
+        return 0;
+    }
+
+    //Desde aqui nadie empieza a esperar una respuesta, y los que ya esperaban
+    //se van en cuanto se despiertan
+    pthread_mutex_lock(&ctx->lock);
+    ctx->closing = 1;
+    pthread_cond_broadcast(&ctx->done);
+
+    //Primero se termina de enviar lo pendiente: quien envia y cierra enseguida
+    //(p.ej. la respuesta de un servidor) no debe perder lo que ha enviado.
+    //Lo que quede se descarta con el estado aun vivo, por si la funcion de
+    //error vuelve a enviar por este interfaz
+    arp_iface_settle(ctx);
+    int dropped = 0;
+    int i;
+    for (i = 0; i < ARP_PENDING_NEIGHBORS; i++) {
+        if (ctx->pending[i].used) {
+            dropped += ctx->pending[i].nframes;
+            arp_pending_release(ctx, &ctx->pending[i], NULL);
+        }
+    }
+
+    //El estado no se libera mientras quede alguien dentro de 'arp_resolve()'
+    //(p.ej. el que estaba recibiendo por todos, hasta que vuelva de eth_recv)
+    while (ctx->waiting > 0) {
+        pthread_cond_wait(&ctx->done, &ctx->lock);
+    }
+    pthread_mutex_unlock(&ctx->lock);
+
+    //Lo que la funcion de error haya vuelto a encolar ya no se va a enviar
+    for (i = 0; i < ARP_PENDING_NEIGHBORS; i++) {
+        int k;
+        for (k = 0; k < ctx->pending[i].nframes; k++) {
+            free(ctx->pending[i].frames[k]);
+        }
+    }
+    arp_table_free(ctx->cache);
+    pthread_cond_destroy(&ctx->done);
+    pthread_mutex_destroy(&ctx->lock);
+    free(ctx);
 
+    if (dropped > 0) {
+        fprintf(stderr, "arp_forget(): %d tramas pendientes descartadas\n", dropped);
     }
 
+    return dropped;
 }
@@ -6,11 +6,436 @@
 #include <stdint.h>
 
 
+#define ARP_TYPE 0x0806 //especificamos que el mensaje es de tipo ARP
+
 extern mac_addr_t MAC_BCAST_ADDR;
 
 struct arp_message;
 
-int arp_resolve(eth_iface_t *iface, ipv4_addr_t src, ipv4_addr_t destino, mac_addr_t mac);
+/* Estado ARP de un interfaz (ver 'arp_open()') */
+typedef struct arp_iface arp_iface_t;
+
+/* Caché de vecinas.
+ *
+ * Cada dirección resuelta se guarda junto con el momento en que se confirmó
+ * por última vez. Durante 'ARP_REACHABLE_TIME' se usa sin más; después pasa
+ * a estar obsoleta ("stale"): se sigue usando sin esperar, pero se vuelve a
+ * preguntar por ella, y si en 'ARP_STALE_TIME' no ha llegado respuesta
+ * caduca y la siguiente resolución vuelve a esperar la respuesta.
+ *
+ * Para que una vecina en uso no llegue a caducar, si se usa en la última
+ * parte (1/ARP_REFRESH_FRACTION) de su tiempo de confirmada se le pregunta
+ * directamente a su MAC, sin esperar la respuesta; sólo si no responde se
+ * pregunta por difusión al quedar obsoleta. Estas respuestas se recogen al
+ * recibir del interfaz ('arp_handler()' desde 'ipv4_recv()', o
+ * 'arp_service()'), nunca al enviar.
+ *
+ * Cada estado ARP tiene su propia caché (ver "arp_table.h"), de
+ * 'ARP_CACHE_SIZE' vecinas como mucho, que se consulta sin cerrojos: los
+ * envíos a vecinas confirmadas no compiten entre hilos en la capa ARP. La
+ * trama sale con 'eth_send_frame()', que sólo envía en paralelo por
+ * "packet:", "pipe:" y "tap:"; los demás tipos de enlace serializan sus
+ * envíos con el cerrojo de envío del interfaz (ver 'eth_send_burst()'). */
+#define ARP_CACHE_SIZE 64
+#define ARP_REACHABLE_TIME 30000 /* ms */
+#define ARP_STALE_TIME 60000     /* ms */
+#define ARP_REFRESH_FRACTION 4
+
+/* Política de reintentos de cada interfaz (ver 'arp_open()').
+ *
+ * Tras el primer request se espera 'timeout' ms; cada reintento espera
+ * 'backoff' veces lo anterior, sin pasar de 'max_timeout'. Se abandona tras
+ * 'retries' reintentos sin respuesta o cuando han pasado 'give_up' ms desde
+ * que empezó la resolución, lo que ocurra antes.
+ *
+ * Para no inundar la red preguntando por una vecina que no existe, los
+ * requests a cada dirección pasan por un cubo de fichas ('rate' por
+ * segundo, hasta 'burst' seguidos), además del límite global de
+ * 'arp_set_rate_limit()'. Mientras no quedan fichas el request se aplaza:
+ * las tramas esperan en la cola de la vecina, y la resolución no dura más
+ * de lo que habrían tardado en vencer todos sus requests. Tras abandonar
+ * una dirección, durante 'hold_down' ms se falla enseguida sin volver a
+ * preguntar. Se recuerdan como mucho 'ARP_LIMIT_TARGETS' direcciones por
+ * interfaz; si todas están retenidas, los requests a otras se aplazan. */
+typedef struct arp_config {
+    int retries;          /* Requests que se repiten tras el primero */
+    long int timeout;     /* Espera tras el primer request (ms) */
+    double backoff;       /* Factor de cada espera sobre la anterior (>= 1) */
+    long int max_timeout; /* Tope de cada espera (ms), 0 sin tope */
+    long int give_up;     /* Tiempo máximo de una resolución (ms), 0 sin
+                             más límite que 'retries' */
+    double rate;          /* Requests por segundo a cada dirección, 0 sin
+                             límite */
+    int burst;            /* Requests seguidos a cada dirección (>= 1) */
+    long int hold_down;   /* Tiempo sin preguntar por una dirección que no
+                             ha respondido (ms), 0 ninguno */
+} arp_config_t;
+
+/* Configuración por defecto: 2 s, un reintento de 3 s y abandono a los 5 s */
+#define ARP_RETRIES 1
+#define ARP_TIMEOUT 2000     /* ms */
+#define ARP_BACKOFF 1.5
+#define ARP_MAX_TIMEOUT 0    /* ms */
+#define ARP_GIVE_UP 5000     /* ms */
+#define ARP_RATE 1.0         /* requests/s */
+#define ARP_BURST 3
+#define ARP_HOLD_DOWN 2000   /* ms */
+
+/* Límite global por defecto de requests por segundo, de todos los interfaces
+   (ver 'arp_set_rate_limit()') */
+#define ARP_RATE_LIMIT 100
+
+/* Direcciones de cada interfaz cuyo límite de requests se recuerda. Cuando
+   no caben, se olvida la que lleva más tiempo sin preguntarse, salvo las
+   retenidas tras abandonarlas ('hold_down'). */
+#define ARP_LIMIT_TARGETS 32
+
+/* Espera máxima de 'arp_forget()' a que respondan las vecinas con tramas
+   pendientes, y tiempo máximo que 'arp_resolve()' recibe seguido */
+#define ARP_FORGET_TIMEOUT 500 /* ms */
+
+/* Envíos pendientes de resolución (ver 'arp_send_frame()'): vecinas que se
+   pueden estar resolviendo a la vez, y tramas que se guardan de cada una
+   mientras tanto. */
+#define ARP_PENDING_NEIGHBORS 16
+#define ARP_PENDING_MAX 8
+
+/* Direcciones IPv4 propias por las que se responde (ver 'arp_add_address()') */
+#define ARP_MAX_ADDRESSES 8
+
+/* Fuentes de las que se aprenden vecinas sin preguntar por ellas (ver
+   'arp_set_learning()') */
+#define ARP_LEARN_ARP 0x01  /* Emisor de cualquier mensaje ARP */
+#define ARP_LEARN_IPV4 0x02 /* Origen de datagramas IPv4 de la propia subred */
+
+/* Estado de una entrada de la caché (ver 'arp_cache_lookup()') */
+#define ARP_EXPIRED 0   /* No está, o ha caducado */
+#define ARP_REACHABLE 1 /* Confirmada recientemente */
+#define ARP_STALE 2     /* Se puede usar, pero hay que confirmarla */
+
+
+/* arp_iface_t * arp_open ( eth_iface_t * iface, arp_config_t * config );
+ *
+ * DESCRIPCIÓN:
+ *   Crea un estado ARP para el interfaz (caché, resoluciones pendientes y
+ *   direcciones propias) con la política de reintentos 'config', o la por
+ *   defecto si es 'NULL'. Las demás funciones reciben el manejador devuelto,
+ *   que debe liberarse con 'arp_forget()' antes de cerrar el interfaz.
+ *
+ *   Cada estado tiene su propio cerrojo: se puede resolver en paralelo por
+ *   interfaces distintos.
+ *
+ * VALOR DEVUELTO:
+ *   Manejador del estado ARP del interfaz.
+ *
+ * ERRORES:
+ *   La función devuelve 'NULL' si la configuración no es válida o si no hay
+ *   memoria.
+ */
+arp_iface_t *arp_open(eth_iface_t *iface, arp_config_t *config);
+
+
+/* int arp_set_rate_limit ( double rate );
+ *
+ * DESCRIPCIÓN:
+ *   Cambia el número máximo de ARP requests por segundo que se envían en
+ *   total por todos los interfaces (por defecto 'ARP_RATE_LIMIT'), además
+ *   del límite de cada dirección. Se permiten hasta un segundo de requests
+ *   seguidos. Con 0 no hay límite global.
+ *
+ * VALOR DEVUELTO:
+ *   Devuelve 0 si se ha cambiado, o '-1' si 'rate' es negativo.
+ */
+int arp_set_rate_limit(double rate);
+
+
+/* int arp_set_default_config ( arp_config_t * config );
+ *
+ * DESCRIPCIÓN:
+ *   Cambia la política de reintentos de los interfaces que se abran a
+ *   partir de ahora sin indicar ninguna (p.ej. en 'ipv4_open()').
+ *
+ * VALOR DEVUELTO:
+ *   Devuelve 0 si se ha cambiado, o '-1' si la configuración no es válida.
+ */
+int arp_set_default_config(arp_config_t *config);
+
+
+/* int arp_resolve
+ * ( arp_iface_t * arp, ipv4_addr_t src, ipv4_addr_t destino,
+ *   mac_addr_t mac );
+ *
+ * DESCRIPCIÓN:
+ *   Obtiene la dirección MAC de 'destino'. Si está en la caché se devuelve
+ *   sin enviar nada (y si está obsoleta se pregunta de nuevo por ella sin
+ *   esperar la respuesta). Si no, se envía un ARP request por difusión y se
+ *   espera la respuesta, repitiéndolo según la configuración del interfaz
+ *   (ver 'arp_open()').
+ *
+ *   Si ya se está resolviendo 'destino' (otro hilo que la espera, o tramas
+ *   pendientes de 'arp_send_frame()') no se envía otro request: se espera a
+ *   la misma respuesta. Aunque esperen vecinas distintas, sólo uno de los
+ *   hilos recibe del interfaz cada vez, y procesa las respuestas de todos;
+ *   los demás esperan a que termine.
+ *
+ *   Si 'destino' acaba de abandonarse (ver 'hold_down' en 'arp_config_t') se
+ *   devuelve '0' enseguida, sin preguntar.
+ *
+ * VALOR DEVUELTO:
+ *   '1' si se ha obtenido la dirección, '0' si no ha respondido nadie, '-1'
+ *   si ha fallado la recepción y '-2' si no se ha podido enviar el request.
+ */
+int arp_resolve(arp_iface_t *arp, ipv4_addr_t src, ipv4_addr_t destino, mac_addr_t mac);
+
+
+/* Función a la que se entrega cada trama pendiente que se descarta porque
+   'next_hop' no ha respondido (ver 'arp_set_error_handler()'). La trama
+   sólo es válida durante la llamada. */
+typedef void (*arp_error_handler_t)(eth_iface_t *iface, ipv4_addr_t next_hop,
+                                    unsigned char *frame, int payload_len,
+                                    void *arg);
+
+
+/* int arp_send_frame
+ * ( arp_iface_t * arp, ipv4_addr_t src, ipv4_addr_t next_hop,
+ *   uint16_t type, unsigned char * frame, int payload_len );
+ *
+ * DESCRIPCIÓN:
+ *   Envía una trama construida "in situ" (igual que 'eth_send_frame()') a la
+ *   dirección MAC de 'next_hop', sin bloquearse nunca a esperar un ARP
+ *   reply.
+ *
+ *   Si 'next_hop' no está en la caché se guarda una copia de la trama en su
+ *   cola de pendientes y se pregunta por ella (salvo que ya se esté
+ *   preguntando). Cuando llegue la respuesta se enviarán las tramas de la
+ *   cola; si tras el último reintento no ha respondido, se descartan y se
+ *   entregan a la función de 'arp_set_error_handler()'. Si 'next_hop' acaba
+ *   de abandonarse (ver 'hold_down' en 'arp_config_t') la trama no se
+ *   guarda: se falla enseguida.
+ *
+ *   La respuesta y los reintentos se atienden al recibir del interfaz (ver
+ *   'arp_handler()') y en 'arp_service()'.
+ *
+ * PARÁMETROS:
+ *         'arp': Manejador del estado ARP del interfaz.
+ *         'src': Dirección IPv4 propia, para los ARP request.
+ *    'next_hop': Dirección IPv4 del siguiente salto.
+ *        'type': Valor del campo 'Tipo' de la trama.
+ *       'frame': Buffer de al menos 'ETH_HEADROOM + payload_len' bytes, con
+ *                los datos ya en 'frame + ETH_HEADROOM'.
+ * 'payload_len': Longitud en bytes de los datos a enviar.
+ *
+ * VALOR DEVUELTO:
+ *   El número de bytes de datos enviados o guardados para enviar.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si no se ha podido enviar la trama ni guardar
+ *   (p.ej. porque la cola de 'next_hop' está llena).
+ */
+int arp_send_frame(arp_iface_t *arp, ipv4_addr_t src, ipv4_addr_t next_hop,
+                   uint16_t type, unsigned char *frame, int payload_len);
+
+
+/* long int arp_service ( arp_iface_t * arp );
+ *
+ * DESCRIPCIÓN:
+ *   Procesa los mensajes ARP que ya hayan llegado al interfaz, repite los
+ *   ARP request de las vecinas pendientes cuyo plazo ha vencido, y descarta
+ *   las tramas de las que ya no van a responder. Quien espere tramas por su
+ *   cuenta no debe hacerlo más del tiempo devuelto sin volver a llamarla.
+ *
+ *   Recibe del interfaz: debe llamarse desde el hilo que recibe de él (como
+ *   hace 'ipv4_recv()'), no a la vez que otro 'eth_recv()'. Los envíos
+ *   ('arp_send_frame()') nunca reciben; sólo atienden los reintentos.
+ *
+ * VALOR DEVUELTO:
+ *   Los milisegundos que faltan para el siguiente plazo, o '-1' si no hay
+ *   nada pendiente.
+ */
+long int arp_service(arp_iface_t *arp);
+
+
+/* void arp_handler ( eth_iface_t * iface, eth_msg_t * msg, void * arg );
+ *
+ * DESCRIPCIÓN:
+ *   Procesa un mensaje ARP recibido: las respuestas actualizan la caché y
+ *   liberan las tramas pendientes de la vecina, y los request por una
+ *   dirección propia (ver 'arp_add_address()') se responden. Se registra con
+ *   'eth_register_handler(iface, ARP_TYPE, arp_handler, arp)', con el
+ *   manejador de 'arp_open()', para que se procesen los que lleguen mientras
+ *   se espera otro tipo de trama.
+ */
+void arp_handler(eth_iface_t *iface, eth_msg_t *msg, void *arg);
+
+
+/* int arp_add_address ( arp_iface_t * arp, ipv4_addr_t addr );
+ *
+ * DESCRIPCIÓN:
+ *   Añade una dirección IPv4 propia del interfaz, por la que se responderán
+ *   los ARP request que se reciban. La respuesta se prepara una sola vez
+ *   aquí; al responder sólo se copian la MAC e IP de quien pregunta.
+ *
+ * VALOR DEVUELTO:
+ *   Devuelve 0 si se ha añadido la dirección (o ya estaba).
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si ya hay 'ARP_MAX_ADDRESSES' direcciones.
+ */
+int arp_add_address(arp_iface_t *arp, ipv4_addr_t addr);
+
+
+/* int arp_prefetch ( arp_iface_t * arp, ipv4_addr_t src, ipv4_addr_t ip );
+ *
+ * DESCRIPCIÓN:
+ *   Empieza a resolver 'ip' sin esperar la respuesta, para que el primer
+ *   envío no tenga que hacerlo. La respuesta se recoge como la de
+ *   'arp_send_frame()'. Llamándola para varias vecinas seguidas se resuelven
+ *   todas a la vez.
+ *
+ * VALOR DEVUELTO:
+ *   '1' si se ha preguntado por 'ip', '0' si no hacía falta (ya se conoce o
+ *   se está resolviendo) o no caben más resoluciones a la vez.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si no se ha podido enviar el ARP request.
+ */
+int arp_prefetch(arp_iface_t *arp, ipv4_addr_t src, ipv4_addr_t ip);
+
+
+/* int arp_cache_load ( arp_iface_t * arp, char * filename );
+ *
+ * DESCRIPCIÓN:
+ *   Carga en la caché del interfaz las vecinas de un fichero de texto con
+ *   una por línea: "<IPv4 addr> <MAC addr> [static|dynamic]". Las líneas
+ *   vacías o que empiezan por '#' se ignoran.
+ *
+ *   Las estáticas no caducan ni se sustituyen, ni cambian por lo que se
+ *   reciba. Las dinámicas se usan enseguida, pero al final de su tiempo de
+ *   confirmadas: el primer uso les pregunta directamente a su MAC (ver
+ *   'ARP_REFRESH_FRACTION'), y si ya no responden caducan como cualquier
+ *   otra.
+ *
+ * VALOR DEVUELTO:
+ *   El número de vecinas cargadas, '0' también si el fichero no existe.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si no se ha podido leer el fichero. Las líneas
+ *   incorrectas se avisan por la salida de error y se saltan.
+ */
+int arp_cache_load(arp_iface_t *arp, char *filename);
+
+
+/* int arp_cache_save ( arp_iface_t * arp, char * filename );
+ *
+ * DESCRIPCIÓN:
+ *   Guarda en el fichero, con el formato de 'arp_cache_load()', las vecinas
+ *   de la caché del interfaz que no han caducado. Se escribe primero en
+ *   "<filename>.tmp", que sustituye al fichero sólo cuando está completo.
+ *
+ *   Si 'arp' es 'NULL' (p.ej. porque no se pudo abrir) no se toca el
+ *   fichero.
+ *
+ * VALOR DEVUELTO:
+ *   El número de vecinas guardadas ('0' si 'arp' es 'NULL').
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si no se ha podido escribir el fichero.
+ */
+int arp_cache_save(arp_iface_t *arp, char *filename);
+
+
+/* void arp_set_learning ( int flags );
+ *
+ * DESCRIPCIÓN:
+ *   Elige de dónde se aprenden vecinas sin preguntar por ellas: 'flags' es
+ *   una combinación de 'ARP_LEARN_ARP' (por defecto) y 'ARP_LEARN_IPV4'.
+ *   Con 0 sólo se guardan las que se resuelven y las que preguntan por una
+ *   dirección propia; las que ya están se confirman siempre con cualquier
+ *   mensaje ARP suyo, incluidos los gratuitos. Como los tiempos de vida de
+ *   'arp_cache_set_lifetimes()', es común a todos los interfaces.
+ */
+void arp_set_learning(int flags);
+
+
+/* void arp_learn
+ * ( arp_iface_t * arp, ipv4_addr_t ip, mac_addr_t mac, int source );
+ *
+ * DESCRIPCIÓN:
+ *   Informa de que 'ip' ha enviado una trama desde 'mac' (p.ej. un
+ *   datagrama IPv4 válido de la propia subred, con 'source' igual a
+ *   'ARP_LEARN_IPV4'). Si esa fuente está activada se guarda en la caché
+ *   como confirmada, y se envían las tramas que esperaban su MAC.
+ */
+void arp_learn(arp_iface_t *arp, ipv4_addr_t ip, mac_addr_t mac, int source);
+
+
+/* void arp_set_error_handler
+ * ( arp_iface_t * arp, arp_error_handler_t handler, void * arg );
+ *
+ * DESCRIPCIÓN:
+ *   Cambia la función a la que se entregan las tramas pendientes
+ *   descartadas del interfaz. Con 'NULL' sólo se avisa por la salida de
+ *   error.
+ */
+void arp_set_error_handler(arp_iface_t *arp, arp_error_handler_t handler, void *arg);
+
+
+/* int arp_forget ( arp_iface_t * arp );
+ *
+ * DESCRIPCIÓN:
+ *   Libera el estado ARP del interfaz: descarta las entradas de la caché,
+ *   las tramas pendientes y las direcciones propias.
+ *   Debe llamarse antes de cerrarlo.
+ *
+ *   Antes, si quedan tramas esperando la MAC de su vecina, espera
+ *   recibiendo del interfaz a que responda, como mucho
+ *   'ARP_FORGET_TIMEOUT' ms, para no perder lo último que se ha enviado.
+ *   Sólo se descartan las que quedan después.
+ *
+ *   Los hilos que estén esperando en 'arp_resolve()' vuelven sin dirección
+ *   (el que esté recibiendo, en menos de 'ARP_FORGET_TIMEOUT' ms), y la
+ *   memoria no se libera hasta que han salido. Aparte de ésos, ningún otro
+ *   hilo debe estar usando 'arp' ni recibiendo del interfaz (que llamaría a
+ *   'arp_handler()'), ni hacerlo después.
+ *
+ * VALOR DEVUELTO:
+ *   El número de tramas pendientes que se han descartado.
+ */
+int arp_forget(arp_iface_t *arp);
+
+
+/* int arp_cache_lookup
+ * ( arp_iface_t * arp, ipv4_addr_t ip, mac_addr_t mac );
+ *
+ * DESCRIPCIÓN:
+ *   Consulta la caché sin enviar nada. Si la entrada se puede usar se copia
+ *   su dirección MAC en 'mac'.
+ *
+ * VALOR DEVUELTO:
+ *   'ARP_REACHABLE', 'ARP_STALE' o 'ARP_EXPIRED'.
+ */
+int arp_cache_lookup(arp_iface_t *arp, ipv4_addr_t ip, mac_addr_t mac);
+
+
+/* void arp_cache_set_lifetimes ( long int reachable, long int stale );
+ *
+ * DESCRIPCIÓN:
+ *   Cambia los tiempos de vida, en milisegundos, de las entradas de la
+ *   caché: cuánto se usan sin confirmar, y cuánto más se siguen usando
+ *   mientras se confirman. Un valor negativo deja el que hubiera.
+ *
+ *   Son comunes a todos los interfaces, y pueden cambiarse desde cualquier
+ *   hilo mientras otros envían.
+ */
+void arp_cache_set_lifetimes(long int reachable, long int stale);
+
+
+/* void arp_cache_flush ( arp_iface_t * arp );
+ *
+ * DESCRIPCIÓN:
+ *   Vacía la caché del interfaz.
+ */
+void arp_cache_flush(arp_iface_t *arp);
 
 
 #endif /* _ARP_H */
@@ -39,9 +39,14 @@ int main(int argc, char *argv[]) {
         printf("No se pudo abrir la interfaz\n");
         exit(-1);
     }
+    arp_iface_t *arp = arp_open(iface, NULL);
+    if (arp == NULL) {
+        printf("No se pudo preparar ARP en la interfaz\n");
+        exit(-1);
+    }
     mac_addr_t mac;
 
-    int resolve = arp_resolve(iface, IPv4_ZERO_ADDR, ipv4_addr_dest, mac);
+    int resolve = arp_resolve(arp, IPv4_ZERO_ADDR, ipv4_addr_dest, mac);
 
     if (resolve == -2) {
         printf("No se pudo enviar el mensaje arp request\n");
@@ -53,6 +58,7 @@ int main(int argc, char *argv[]) {
     char mac_str[MAC_ADDR_SIZE];
     mac_addr_str(mac, mac_str);
     printf("ip destino= %s -> Mac destino= %s\n", argv[2], mac_str);
+    arp_forget(arp);
     eth_close(iface);
 
 
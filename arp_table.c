@@ -0,0 +1,357 @@
+#include "arp_table.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Claves especiales: 0.0.0.0 y 255.255.255.255 nunca son vecinas */
+#define ARP_TABLE_EMPTY   0x00000000U /* Nunca usada: acaba la búsqueda */
+#define ARP_TABLE_DELETED 0xFFFFFFFFU /* Borrada: la búsqueda sigue */
+
+#define ARP_TABLE_LINE 64 /* Tamaño de una línea de caché */
+
+/* Entrada de la tabla. Ocupa una línea de caché para que consultar una
+   vecina no invalide las de las demás en otros procesadores. */
+struct arp_slot {
+    uint32_t seq;             /* Impar mientras se está escribiendo */
+    uint32_t ip;              /* Clave, o ARP_TABLE_EMPTY/ARP_TABLE_DELETED */
+    uint8_t mac[MAC_ADDR_SIZE];
+    uint8_t referenced;       /* Consultada desde que pasó la manecilla */
+    uint8_t flags;
+    long long int confirmed;
+    long long int probed;
+} __attribute__((aligned(ARP_TABLE_LINE)));
+
+/* Estructura de una tabla de vecinas */
+struct arp_table {
+    struct arp_slot *slots;
+    uint32_t mask;            /* Número de entradas - 1 (potencia de 2) */
+    int shift;                /* 32 - log2(número de entradas) */
+    int max;                  /* Número máximo de vecinas */
+    int used;                 /* Vecinas guardadas */
+    int deleted;              /* Entradas borradas */
+    uint32_t hand;            /* Manecilla del reloj */
+};
+
+
+/* static uint32_t arp_table_hash ( arp_table_t * table, uint32_t ip );
+ *
+ * DESCRIPCIÓN:
+ *   Devuelve la posición inicial de 'ip' (hash de Fibonacci: se queda con
+ *   los bits altos del producto, que dependen de todos los de la clave).
+ */
+static uint32_t arp_table_hash(arp_table_t *table, uint32_t ip) {
+    return (uint32_t) (ip * 0x9E3779B1U) >> table->shift;
+}
+
+
+/* static void arp_table_write
+ * ( struct arp_slot * slot, uint32_t ip, arp_neighbor_t * neighbor );
+ *
+ * DESCRIPCIÓN:
+ *   Escribe una entrada con el protocolo del seqlock. Con 'neighbor' a NULL
+ *   sólo cambia la clave.
+ */
+static void arp_table_write(struct arp_slot *slot, uint32_t ip, arp_neighbor_t *neighbor) {
+    uint32_t seq = slot->seq;
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store_n(&slot->ip, ip, __ATOMIC_RELAXED);
+    if (neighbor != NULL) {
+        memcpy(slot->mac, neighbor->mac, MAC_ADDR_SIZE);
+        __atomic_store_n(&slot->flags, (uint8_t) neighbor->flags, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->confirmed, neighbor->confirmed, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->probed, neighbor->probed, __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+
+/* static struct arp_slot * arp_table_find ( arp_table_t * table, uint32_t ip );
+ *
+ * DESCRIPCIÓN:
+ *   Busca la entrada de 'ip'. Sólo para el escritor, que no necesita el
+ *   seqlock porque nadie más modifica la tabla.
+ */
+static struct arp_slot *arp_table_find(arp_table_t *table, uint32_t ip) {
+    uint32_t pos = arp_table_hash(table, ip);
+    uint32_t n;
+    for (n = 0; n <= table->mask; n++) {
+        struct arp_slot *slot = &table->slots[(pos + n) & table->mask];
+        if (slot->ip == ip) {
+            return slot;
+        }
+        if (slot->ip == ARP_TABLE_EMPTY) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+
+/* static void arp_table_insert
+ * ( arp_table_t * table, uint32_t ip, arp_neighbor_t * neighbor );
+ *
+ * DESCRIPCIÓN:
+ *   Guarda una vecina que no está en la tabla, en la primera entrada libre
+ *   o borrada de su secuencia de búsqueda. Debe haber sitio.
+ */
+static void arp_table_insert(arp_table_t *table, uint32_t ip, arp_neighbor_t *neighbor) {
+    uint32_t pos = arp_table_hash(table, ip);
+    struct arp_slot *slot;
+    for (;; pos++) {
+        slot = &table->slots[pos & table->mask];
+        if ((slot->ip == ARP_TABLE_EMPTY) || (slot->ip == ARP_TABLE_DELETED)) {
+            break;
+        }
+    }
+
+    if (slot->ip == ARP_TABLE_DELETED) {
+        table->deleted--;
+    }
+    __atomic_store_n(&slot->referenced, 1, __ATOMIC_RELAXED);
+    arp_table_write(slot, ip, neighbor);
+    table->used++;
+}
+
+
+/* static int arp_table_evict ( arp_table_t * table );
+ *
+ * DESCRIPCIÓN:
+ *   Borra una vecina (no estática) que no se haya consultado desde la
+ *   última pasada de la manecilla. Como la manecilla desmarca lo que
+ *   encuentra, en dos vueltas como mucho da con una si la hay.
+ *
+ * VALOR DEVUELTO:
+ *   '1' si se ha borrado alguna, '0' si todas son estáticas.
+ */
+static int arp_table_evict(arp_table_t *table) {
+    uint32_t n;
+    for (n = 0; n < 2 * (table->mask + 1); n++) {
+        struct arp_slot *slot = &table->slots[table->hand];
+        table->hand = (table->hand + 1) & table->mask;
+        if ((slot->ip == ARP_TABLE_EMPTY) || (slot->ip == ARP_TABLE_DELETED) ||
+            (slot->flags & ARP_NEIGHBOR_STATIC)) {
+            continue;
+        }
+        if (__atomic_load_n(&slot->referenced, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&slot->referenced, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        arp_table_write(slot, ARP_TABLE_DELETED, NULL);
+        table->used--;
+        table->deleted++;
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/* static void arp_table_rehash ( arp_table_t * table );
+ *
+ * DESCRIPCIÓN:
+ *   Vuelve a colocar todas las vecinas para quitar las entradas borradas,
+ *   que alargan las búsquedas de direcciones que no están. Si no hay
+ *   memoria se deja como está: las borradas se reutilizan igualmente.
+ */
+static void arp_table_rehash(arp_table_t *table) {
+    uint32_t size = table->mask + 1;
+    struct arp_slot *copy = malloc(table->used * sizeof(struct arp_slot));
+    if ((copy == NULL) && (table->used > 0)) {
+        return;
+    }
+
+    int n = 0;
+    uint32_t i;
+    for (i = 0; i < size; i++) {
+        struct arp_slot *slot = &table->slots[i];
+        if ((slot->ip != ARP_TABLE_EMPTY) && (slot->ip != ARP_TABLE_DELETED)) {
+            copy[n++] = *slot;
+        }
+        if (slot->ip != ARP_TABLE_EMPTY) {
+            arp_table_write(slot, ARP_TABLE_EMPTY, NULL);
+        }
+    }
+    table->used = 0;
+    table->deleted = 0;
+
+    int k;
+    for (k = 0; k < n; k++) {
+        arp_neighbor_t neighbor;
+        memcpy(neighbor.mac, copy[k].mac, MAC_ADDR_SIZE);
+        neighbor.confirmed = copy[k].confirmed;
+        neighbor.probed = copy[k].probed;
+        neighbor.flags = copy[k].flags;
+        arp_table_insert(table, copy[k].ip, &neighbor);
+    }
+
+    free(copy);
+}
+
+
+arp_table_t *arp_table_create(int max_neighbors) {
+    if (max_neighbors <= 0) {
+        fprintf(stderr, "arp_table_create(): ERROR: max_neighbors <= 0\n");
+        return NULL;
+    }
+
+    /* Al menos el doble de entradas que vecinas, para que las búsquedas
+       sean cortas */
+    uint32_t size = 2;
+    int shift = 31;
+    while (size < 2 * (uint32_t) max_neighbors) {
+        size <<= 1;
+        shift--;
+    }
+
+    arp_table_t *table = calloc(1, sizeof(struct arp_table));
+    if (table == NULL) {
+        fprintf(stderr, "arp_table_create(): ERROR en calloc()\n");
+        return NULL;
+    }
+    table->slots = aligned_alloc(ARP_TABLE_LINE, size * sizeof(struct arp_slot));
+    if (table->slots == NULL) {
+        fprintf(stderr, "arp_table_create(): ERROR en aligned_alloc()\n");
+        free(table);
+        return NULL;
+    }
+    memset(table->slots, 0, size * sizeof(struct arp_slot));
+    table->mask = size - 1;
+    table->shift = shift;
+    table->max = max_neighbors;
+
+    return table;
+}
+
+
+int arp_table_lookup(arp_table_t *table, uint32_t ip, arp_neighbor_t *neighbor) {
+    if ((table == NULL) || (ip == ARP_TABLE_EMPTY) || (ip == ARP_TABLE_DELETED)) {
+        return 0;
+    }
+
+    uint32_t pos = arp_table_hash(table, ip);
+    uint32_t n;
+    for (n = 0; n <= table->mask; n++) {
+        struct arp_slot *slot = &table->slots[(pos + n) & table->mask];
+
+        /* Copiar la entrada hasta verla entera sin escrituras a medias */
+        arp_neighbor_t copy;
+        uint32_t key;
+        uint32_t seq;
+        do {
+            seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+            key = __atomic_load_n(&slot->ip, __ATOMIC_RELAXED);
+            memcpy(copy.mac, slot->mac, MAC_ADDR_SIZE);
+            copy.flags = __atomic_load_n(&slot->flags, __ATOMIC_RELAXED);
+            copy.confirmed = __atomic_load_n(&slot->confirmed, __ATOMIC_RELAXED);
+            copy.probed = __atomic_load_n(&slot->probed, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        } while ((seq & 1) || (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq));
+
+        if (key == ip) {
+            /* Sólo se escribe si hace falta, para no ensuciar la línea */
+            if (!__atomic_load_n(&slot->referenced, __ATOMIC_RELAXED)) {
+                __atomic_store_n(&slot->referenced, 1, __ATOMIC_RELAXED);
+            }
+            *neighbor = copy;
+            return 1;
+        }
+        if (key == ARP_TABLE_EMPTY) {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+
+int arp_table_update(arp_table_t *table, uint32_t ip, arp_neighbor_t *neighbor, int create) {
+    if ((table == NULL) || (neighbor == NULL) ||
+        (ip == ARP_TABLE_EMPTY) || (ip == ARP_TABLE_DELETED)) {
+        return 0;
+    }
+
+    struct arp_slot *slot = arp_table_find(table, ip);
+    if (slot != NULL) {
+        arp_table_write(slot, ip, neighbor);
+        return 1;
+    }
+    if (!create) {
+        return 0;
+    }
+
+    if ((table->used >= table->max) && !arp_table_evict(table)) {
+        return 0;
+    }
+    /* Con tres cuartos de las entradas ocupados o borrados se reorganiza */
+    if (4 * (uint32_t) (table->used + table->deleted + 1) > 3 * (table->mask + 1)) {
+        arp_table_rehash(table);
+    }
+    arp_table_insert(table, ip, neighbor);
+
+    return 1;
+}
+
+
+void arp_table_remove(arp_table_t *table, uint32_t ip) {
+    if ((table == NULL) || (ip == ARP_TABLE_EMPTY) || (ip == ARP_TABLE_DELETED)) {
+        return;
+    }
+
+    struct arp_slot *slot = arp_table_find(table, ip);
+    if (slot != NULL) {
+        arp_table_write(slot, ARP_TABLE_DELETED, NULL);
+        table->used--;
+        table->deleted++;
+    }
+}
+
+
+void arp_table_clear(arp_table_t *table) {
+    if (table == NULL) {
+        return;
+    }
+
+    uint32_t i;
+    for (i = 0; i <= table->mask; i++) {
+        if (table->slots[i].ip != ARP_TABLE_EMPTY) {
+            arp_table_write(&table->slots[i], ARP_TABLE_EMPTY, NULL);
+        }
+    }
+    table->used = 0;
+    table->deleted = 0;
+}
+
+
+void arp_table_walk(arp_table_t *table, arp_table_walk_t walk, void *arg) {
+    if ((table == NULL) || (walk == NULL)) {
+        return;
+    }
+
+    uint32_t i;
+    for (i = 0; i <= table->mask; i++) {
+        struct arp_slot *slot = &table->slots[i];
+        if ((slot->ip == ARP_TABLE_EMPTY) || (slot->ip == ARP_TABLE_DELETED)) {
+            continue;
+        }
+        arp_neighbor_t neighbor;
+        memcpy(neighbor.mac, slot->mac, MAC_ADDR_SIZE);
+        neighbor.confirmed = slot->confirmed;
+        neighbor.probed = slot->probed;
+        neighbor.flags = slot->flags;
+        walk(slot->ip, &neighbor, arg);
+    }
+}
+
+
+void arp_table_free(arp_table_t *table) {
+    if (table != NULL) {
+        free(table->slots);
+        free(table);
+    }
+}
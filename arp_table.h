@@ -0,0 +1,119 @@
+#ifndef _ARP_TABLE_H
+#define _ARP_TABLE_H
+
+#include "eth.h"
+#include <stdint.h>
+
+/* Tabla de vecinas de un interfaz: dirección IPv4 -> dirección MAC.
+ *
+ * Es una tabla hash de direccionamiento abierto indexada por la dirección
+ * como 'uint32_t', con una entrada por línea de caché. Las consultas no
+ * cogen ningún cerrojo: cada entrada lleva un contador de secuencia
+ * (seqlock) que el escritor pone impar mientras la modifica, y el lector
+ * repite la copia si lo ha visto cambiar. Así muchos hilos pueden consultar
+ * la misma tabla en cada envío sin estorbarse.
+ *
+ * Las modificaciones, en cambio, deben serializarse por fuera (un solo
+ * escritor a la vez). Mientras se reorganiza la tabla una consulta puede no
+ * encontrar una entrada que sí está, pero nunca devuelve una dirección MAC
+ * equivocada: quien necesite certeza ante un fallo debe repetir la consulta
+ * con el cerrojo de los escritores.
+ *
+ * La tabla tiene un número máximo de vecinas. Cuando está llena, la nueva
+ * sustituye a una que no se haya consultado recientemente (algoritmo del
+ * reloj o "CLOCK": cada consulta marca la entrada, y la manecilla desmarca
+ * las que encuentra marcadas hasta dar con una sin marcar).
+ */
+typedef struct arp_table arp_table_t;
+
+/* Datos de una vecina */
+typedef struct arp_neighbor {
+    mac_addr_t mac;
+    long long int confirmed;  /* Última vez que se confirmó (ms) */
+    long long int probed;     /* Último request para confirmarla (ms), o 0 */
+    int flags;                /* ARP_NEIGHBOR_* */
+} arp_neighbor_t;
+
+/* Entrada estática: no caduca ni se sustituye cuando la tabla está llena */
+#define ARP_NEIGHBOR_STATIC 0x01
+
+/* Función a la que 'arp_table_walk()' pasa cada vecina */
+typedef void (*arp_table_walk_t)(uint32_t ip, arp_neighbor_t *neighbor, void *arg);
+
+
+/* arp_table_t * arp_table_create ( int max_neighbors );
+ *
+ * DESCRIPCIÓN:
+ *   Crea una tabla vacía para 'max_neighbors' vecinas como mucho.
+ *
+ * VALOR DEVUELTO:
+ *   La tabla, o 'NULL' si no hay memoria.
+ */
+arp_table_t * arp_table_create ( int max_neighbors );
+
+
+/* int arp_table_lookup
+ * ( arp_table_t * table, uint32_t ip, arp_neighbor_t * neighbor );
+ *
+ * DESCRIPCIÓN:
+ *   Busca la vecina 'ip' sin coger cerrojos y copia sus datos en
+ *   'neighbor'. Puede llamarse desde cualquier hilo a la vez que se
+ *   modifica la tabla.
+ *
+ * VALOR DEVUELTO:
+ *   '1' si se ha encontrado, '0' si no.
+ */
+int arp_table_lookup ( arp_table_t * table, uint32_t ip, arp_neighbor_t * neighbor );
+
+
+/* int arp_table_update
+ * ( arp_table_t * table, uint32_t ip, arp_neighbor_t * neighbor, int create );
+ *
+ * DESCRIPCIÓN:
+ *   Guarda los datos de la vecina 'ip'. Si no estaba sólo se añade si
+ *   'create' es distinto de 0, sustituyendo a otra si la tabla está llena
+ *   (nunca a una estática).
+ *
+ * VALOR DEVUELTO:
+ *   '1' si se ha guardado, '0' si no estaba y no se ha creado (o todas las
+ *   de la tabla llena son estáticas).
+ */
+int arp_table_update
+( arp_table_t * table, uint32_t ip, arp_neighbor_t * neighbor, int create );
+
+
+/* void arp_table_remove ( arp_table_t * table, uint32_t ip );
+ *
+ * DESCRIPCIÓN:
+ *   Quita la vecina 'ip', si estaba.
+ */
+void arp_table_remove ( arp_table_t * table, uint32_t ip );
+
+
+/* void arp_table_clear ( arp_table_t * table );
+ *
+ * DESCRIPCIÓN:
+ *   Quita todas las vecinas.
+ */
+void arp_table_clear ( arp_table_t * table );
+
+
+/* void arp_table_walk
+ * ( arp_table_t * table, arp_table_walk_t walk, void * arg );
+ *
+ * DESCRIPCIÓN:
+ *   Llama a 'walk' con cada vecina de la tabla, en cualquier orden. Como
+ *   las modificaciones, debe serializarse por fuera; 'walk' no debe
+ *   modificar la tabla.
+ */
+void arp_table_walk ( arp_table_t * table, arp_table_walk_t walk, void * arg );
+
+
+/* void arp_table_free ( arp_table_t * table );
+ *
+ * DESCRIPCIÓN:
+ *   Libera la tabla. Nadie debe estar consultándola.
+ */
+void arp_table_free ( arp_table_t * table );
+
+#endif /* _ARP_TABLE_H */
@@ -1,29 +1,80 @@
 #include "eth.h"
-#include <rawnet.h>
+#include "eth_backend.h"
 #include <timerms.h>
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
 #include <netinet/in.h>
 
 /* Dirección MAC de difusión: FF:FF:FF:FF:FF:FF */
 mac_addr_t MAC_BCAST_ADDR = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
 mac_addr_t MAC_MULTICAST_ADDR = {0x01, 0x00, 0x5e, 0x00, 0x00, 0x09};
 
+/* Trama guardada en la cola de un tipo */
+struct eth_queued_frame {
+    int frame_len;                             /* Bytes de la trama */
+    unsigned char frame[ETH_FRAME_MAX_LENGTH]; /* Trama completa */
+};
+
+/* Destino de las tramas de un tipo que llegan mientras se espera otro */
+struct eth_protocol {
+    uint16_t type;          /* Campo 'Tipo' de las tramas */
+    eth_handler_t handler;  /* Manejador, o NULL si se usa la cola */
+    void *handler_arg;      /* Argumento de 'handler' */
+    struct eth_queued_frame *queue; /* Cola circular de 'queue_len' tramas */
+    int queue_len;
+    int queue_head;         /* Posición de la trama más antigua */
+    int queue_count;        /* Tramas en la cola */
+};
+
 /* Estructura del manejador del interfaz ethernet */
 struct eth_iface {
-    rawiface_t *raw_iface; /* Manejador del interfaz "crudo" */
+    const eth_backend_t *backend; /* Tipo de enlace del interfaz */
+    void *dev;             /* Manejador del interfaz en su tipo de enlace */
+    mac_addr_t groups[ETH_FILTER_MAX_GROUPS]; /* Grupos multicast aceptados */
+    int ngroups;           /* Número de grupos. Con 0 se acepta cualquiera. */
+    struct eth_protocol protocols[ETH_MAX_PROTOCOLS]; /* Tipos registrados */
+    int nprotocols;
+    eth_capture_t *capture; /* Captura asociada, o NULL */
+    int capture_if;        /* Identificador del interfaz en la captura */
+    eth_impair_t *impair;  /* Perturbaciones del enlace, o NULL */
+    eth_stats_t stats;     /* Contadores, actualizados con operaciones
+                              atómicas para poder leerlos desde otro hilo */
+    pthread_mutex_t tx_lock; /* Serializa los envíos cuando el tipo de
+                              enlace o las perturbaciones no admiten varios
+                              hilos a la vez (ver 'eth_tx_lock()') */
+    unsigned char rx_buffer[ETH_FRAME_MAX_LENGTH]; /* Trama prestada por
+                              'eth_recv_burst()' cuando el interfaz no puede
+                              prestar directamente su propia memoria. */
     mac_addr_t mac_address; /* Dirección MAC del interfaz. Se almacena aquí en
                              lugar de consultar al interfaz "en crudo" para
                              evitar una llamada al sistema adcional cada vez
                              que se quiera enviar una trama. */
 };
 
-/* Tamaño de la cabecera Ethernet (sin incluir el campo FCS) */
-#define ETH_HEADER_SIZE 14
-/* Tamaño máximo de una trama Ethernet (sin incluir el campo FCS) */
-#define ETH_FRAME_MAX_LENGTH (ETH_HEADER_SIZE + ETH_MTU)
+/* Tipos de enlace que 'eth_open()' elige por el prefijo del nombre. Si no
+   coincide ninguno se usa 'eth_rawnet_backend'. */
+static const eth_backend_t *eth_backends[] = {
+        &eth_packet_backend,
+        &eth_mmap_backend,
+        &eth_tap_backend,
+        &eth_xdp_backend,
+        &eth_uring_backend,
+        &eth_pipe_backend,
+        &eth_shm_backend,
+        &eth_file_backend,
+        &eth_replay_backend,
+        NULL
+};
+
+/* Intervalo máximo en milisegundos que 'eth_poll()' espera en los
+   descriptores antes de volver a consultar los interfaces que no tienen
+   (p.ej. rawnet). */
+#define ETH_POLL_SLICE 10
 
 /* Cabecera de una trama Ethernet */
 struct eth_frame {
@@ -39,6 +90,325 @@ struct eth_frame {
 };
 
 
+/* static int eth_iface_send
+ * ( eth_iface_t * iface, unsigned char * frames[], int lens[], int num );
+ *
+ * DESCRIPCIÓN:
+ *   Entrega 'num' tramas completas al interfaz subyacente, con el menor
+ *   número de llamadas al sistema que permita su tipo de enlace, y copia a
+ *   la captura las que ha aceptado.
+ *
+ * VALOR DEVUELTO:
+ *   El número de tramas enviadas, o '-1' si no se ha enviado ninguna.
+ */
+static int eth_iface_send
+        (eth_iface_t *iface, unsigned char *frames[], int lens[], int num) {
+    int sent = iface->backend->send(iface->dev, frames, lens, num);
+
+    int i;
+    for (i = 0; (iface->capture != NULL) && (i < sent); i++) {
+        eth_capture_frame(iface->capture, iface->capture_if, ETH_CAPTURE_OUT,
+                          frames[i], lens[i]);
+    }
+
+    return sent;
+}
+
+
+/* static int eth_tx_lock ( eth_iface_t * iface );
+ *
+ * DESCRIPCIÓN:
+ *   Coge el cerrojo de envío del interfaz si hace falta: cuando su tipo de
+ *   enlace no admite envíos simultáneos (anillos de un solo productor como
+ *   "mmap:", "xdp:", "uring:" o "shm:") o cuando tiene perturbaciones,
+ *   cuya etapa tampoco los admite.
+ *
+ * VALOR DEVUELTO:
+ *   1 si lo ha cogido, que debe pasarse a 'eth_tx_unlock()'.
+ */
+static int eth_tx_lock(eth_iface_t *iface) {
+    if (iface->backend->shared_send && (iface->impair == NULL)) {
+        return 0;
+    }
+    pthread_mutex_lock(&iface->tx_lock);
+
+    return 1;
+}
+
+
+/* static void eth_tx_unlock ( eth_iface_t * iface, int locked );
+ *
+ * DESCRIPCIÓN:
+ *   Suelta el cerrojo de envío si 'eth_tx_lock()' lo cogió.
+ */
+static void eth_tx_unlock(eth_iface_t *iface, int locked) {
+    if (locked) {
+        pthread_mutex_unlock(&iface->tx_lock);
+    }
+}
+
+
+/* static int eth_iface_recv
+ * ( eth_iface_t * iface, unsigned char * bufs[], int sizes[], int lens[],
+ *   int num, long int timeout );
+ *
+ * DESCRIPCIÓN:
+ *   Espera como mucho 'timeout' milisegundos a la primera trama y recoge las
+ *   que ya estén disponibles, hasta 'num', sin volver a bloquearse.
+ *
+ *   Si 'bufs[0]' es NULL se pide prestada la trama: se devuelven en
+ *   'bufs'/'sizes' punteros a memoria del interfaz, válidos hasta la
+ *   siguiente recepción.
+ *
+ * VALOR DEVUELTO:
+ *   El número de tramas recibidas, '0' si ha expirado el temporizador o '-1'
+ *   si se ha producido algún error.
+ */
+static int eth_iface_recv
+        (eth_iface_t *iface, unsigned char *bufs[], int sizes[], int lens[],
+         int num, long int timeout) {
+    /* Préstamo de trama: si el interfaz no puede prestar su propia memoria
+       se recibe en el buffer del manejador */
+    const eth_backend_t *backend = iface->backend;
+    if ((bufs[0] == NULL) &&
+        ((backend->can_lend == NULL) || !backend->can_lend(iface->dev))) {
+        bufs[0] = iface->rx_buffer;
+        sizes[0] = ETH_FRAME_MAX_LENGTH;
+        num = 1;
+    }
+
+    /* Antes de esperar, sacar lo pendiente (p.ej. la petición cuya
+       respuesta se va a recibir) */
+    if (backend->flush != NULL) {
+        int locked = eth_tx_lock(iface);
+        backend->flush(iface->dev);
+        eth_tx_unlock(iface, locked);
+    }
+
+    return backend->recv(iface->dev, bufs, sizes, lens, num, timeout);
+}
+
+
+/* static int eth_is_accepted_group ( eth_iface_t * iface, mac_addr_t addr );
+ *
+ * DESCRIPCIÓN:
+ *   Indica si 'addr' es la dirección de difusión o una dirección multicast
+ *   aceptada por el filtro del interfaz (ver 'eth_set_filter()').
+ */
+static int eth_is_accepted_group(eth_iface_t *iface, mac_addr_t addr) {
+    if ((addr[0] & 0x01) == 0) {
+        return 0;
+    }
+    if ((iface->ngroups == 0) || (memcmp(addr, MAC_BCAST_ADDR, MAC_ADDR_SIZE) == 0)) {
+        return 1;
+    }
+
+    int i;
+    for (i = 0; i < iface->ngroups; i++) {
+        if (memcmp(addr, iface->groups[i], MAC_ADDR_SIZE) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/* static void eth_stats_add ( eth_iface_t * iface, eth_stats_t * delta );
+ *
+ * DESCRIPCIÓN:
+ *   Suma 'delta' a los contadores del interfaz. Las funciones en ráfaga
+ *   acumulan sus cuentas en local y las suman una vez por llamada.
+ */
+static void eth_stats_add(eth_iface_t *iface, eth_stats_t *delta) {
+    uint64_t *counters = (uint64_t *) &iface->stats;
+    uint64_t *increments = (uint64_t *) delta;
+
+    size_t i;
+    for (i = 0; i < sizeof(eth_stats_t) / sizeof(uint64_t); i++) {
+        if (increments[i] != 0) {
+            __atomic_fetch_add(&counters[i], increments[i], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+
+/* static long int eth_iface_release ( eth_iface_t * iface );
+ *
+ * DESCRIPCIÓN:
+ *   Entrega al interfaz subyacente las tramas retenidas por la etapa de
+ *   perturbaciones cuyo momento de salida ya ha llegado.
+ *
+ * VALOR DEVUELTO:
+ *   Los milisegundos que faltan para la siguiente trama retenida, o '-1' si
+ *   no queda ninguna (o el interfaz no tiene perturbaciones).
+ */
+static long int eth_iface_release(eth_iface_t *iface) {
+    eth_impair_t *impair = iface->impair;
+    if (impair == NULL) {
+        return -1;
+    }
+
+    unsigned char *frames[ETH_BURST_MAX];
+    int lens[ETH_BURST_MAX];
+    eth_stats_t delta;
+    memset(&delta, 0, sizeof(eth_stats_t));
+
+    int n;
+    while ((n = eth_impair_due(impair, frames, lens, ETH_BURST_MAX)) > 0) {
+        int sent = eth_iface_send(iface, frames, lens, n);
+        if (sent < 0) {
+            sent = 0;
+        }
+        int i;
+        for (i = 0; i < sent; i++) {
+            delta.tx_bytes += lens[i];
+        }
+        delta.tx_frames += sent;
+        delta.tx_errors += n - sent;
+    }
+    if (delta.tx_frames + delta.tx_errors > 0) {
+        eth_stats_add(iface, &delta);
+    }
+
+    return eth_impair_timeleft(impair);
+}
+
+
+/* static struct eth_protocol * eth_find_protocol
+ * ( eth_iface_t * iface, uint16_t type );
+ *
+ * DESCRIPCIÓN:
+ *   Devuelve el registro del tipo de trama indicado, o NULL si no tiene
+ *   manejador ni cola.
+ */
+static struct eth_protocol *eth_find_protocol(eth_iface_t *iface, uint16_t type) {
+    int i;
+    for (i = 0; i < iface->nprotocols; i++) {
+        if (iface->protocols[i].type == type) {
+            return &iface->protocols[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/* static void eth_dispatch
+ * ( eth_iface_t * iface, unsigned char * frame, int frame_len, int size,
+ *   eth_stats_t * delta );
+ *
+ * DESCRIPCIÓN:
+ *   Entrega a su manejador, o copia a su cola, una trama aceptada que no es
+ *   del tipo que se está esperando. 'size' es el número de bytes válidos en
+ *   'frame', que puede ser menor que 'frame_len' si la trama se truncó. Si
+ *   su tipo no está registrado o la cola está llena la trama se descarta y
+ *   se cuenta en 'delta'.
+ */
+static void eth_dispatch
+        (eth_iface_t *iface, unsigned char *frame, int frame_len, int size,
+         eth_stats_t *delta) {
+    struct eth_frame *eth_frame_ptr = (struct eth_frame *) frame;
+    struct eth_protocol *proto = eth_find_protocol(iface, ntohs(eth_frame_ptr->type));
+    if (proto == NULL) {
+        delta->rx_drop_wrong_type++;
+        return;
+    }
+
+    if (proto->handler != NULL) {
+        eth_msg_t msg;
+        memcpy(msg.addr, eth_frame_ptr->src_addr, MAC_ADDR_SIZE);
+        msg.type = proto->type;
+        msg.frame = frame;
+        msg.frame_size = size;
+        msg.payload_len = frame_len - ETH_HEADER_SIZE;
+        proto->handler(iface, &msg, proto->handler_arg);
+        return;
+    }
+
+    if (proto->queue_count == proto->queue_len) {
+        delta->rx_drop_queue_full++;
+        return;
+    }
+    int tail = (proto->queue_head + proto->queue_count) % proto->queue_len;
+    struct eth_queued_frame *queued = &proto->queue[tail];
+    if (size > ETH_FRAME_MAX_LENGTH) {
+        size = ETH_FRAME_MAX_LENGTH;
+    }
+    memcpy(queued->frame, frame, size);
+    queued->frame_len = (frame_len < size) ? frame_len : size;
+    proto->queue_count++;
+}
+
+
+/* static int eth_dequeue
+ * ( struct eth_protocol * proto, eth_msg_t msgs[], int num, int loan );
+ *
+ * DESCRIPCIÓN:
+ *   Saca de la cola del tipo hasta 'num' tramas y las devuelve en 'msgs'
+ *   igual que 'eth_recv_burst()'. Si 'loan' es distinto de 0 las tramas se
+ *   prestan desde la propia cola: sus huecos no se reutilizan hasta la
+ *   siguiente recepción.
+ *
+ * VALOR DEVUELTO:
+ *   El número de tramas devueltas.
+ */
+static int eth_dequeue
+        (struct eth_protocol *proto, eth_msg_t msgs[], int num, int loan) {
+    int i;
+    for (i = 0; (i < num) && (proto->queue_count > 0); i++) {
+        struct eth_queued_frame *queued = &proto->queue[proto->queue_head];
+        proto->queue_head = (proto->queue_head + 1) % proto->queue_len;
+        proto->queue_count--;
+
+        eth_msg_t *msg = &msgs[i];
+        if (loan) {
+            msg->frame = queued->frame;
+            msg->frame_size = ETH_FRAME_MAX_LENGTH;
+        } else {
+            int copy_len = queued->frame_len;
+            if (copy_len > msg->frame_size) {
+                copy_len = msg->frame_size;
+            }
+            memcpy(msg->frame, queued->frame, copy_len);
+        }
+        struct eth_frame *eth_frame_ptr = (struct eth_frame *) queued->frame;
+        memcpy(msg->addr, eth_frame_ptr->src_addr, MAC_ADDR_SIZE);
+        msg->type = proto->type;
+        msg->payload_len = queued->frame_len - ETH_HEADER_SIZE;
+    }
+
+    return i;
+}
+
+
+/* static struct eth_protocol * eth_add_protocol
+ * ( eth_iface_t * iface, uint16_t type );
+ *
+ * DESCRIPCIÓN:
+ *   Añade un registro vacío para el tipo de trama indicado.
+ *
+ * VALOR DEVUELTO:
+ *   El registro, o NULL si el tipo ya estaba registrado o no caben más.
+ */
+static struct eth_protocol *eth_add_protocol(eth_iface_t *iface, uint16_t type) {
+    if (eth_find_protocol(iface, type) != NULL) {
+        fprintf(stderr, "eth_register(): ERROR: tipo 0x%04x ya registrado\n", type);
+        return NULL;
+    }
+    if (iface->nprotocols == ETH_MAX_PROTOCOLS) {
+        fprintf(stderr, "eth_register(): ERROR: demasiados tipos registrados\n");
+        return NULL;
+    }
+
+    struct eth_protocol *proto = &iface->protocols[iface->nprotocols];
+    memset(proto, 0, sizeof(struct eth_protocol));
+    proto->type = type;
+
+    return proto;
+}
+
+
 /* eth_iface_t * eth_open ( char* ifname );
  *
  * DESCRIPCIÓN: 
@@ -62,26 +432,67 @@ struct eth_frame {
  *   La función devuelve 'NULL' si se ha producido algún error. 
  */
 eth_iface_t *eth_open(char *ifname) {
+    if (ifname == NULL) {
+        fprintf(stderr, "eth_open(): ERROR: ifname == NULL\n");
+        return NULL;
+    }
+
+    /* Elegir el tipo de enlace según el prefijo del nombre */
+    int i;
+    for (i = 0; eth_backends[i] != NULL; i++) {
+        const char *prefix = eth_backends[i]->prefix;
+        if (strncmp(ifname, prefix, strlen(prefix)) == 0) {
+            return eth_open_backend(eth_backends[i], ifname + strlen(prefix));
+        }
+    }
+
+    return eth_open_backend(&eth_rawnet_backend, ifname);
+}
+
+
+/* eth_iface_t * eth_open_backend ( const eth_backend_t * backend, char * ifname );
+ *
+ * DESCRIPCIÓN:
+ *   Igual que 'eth_open()', pero con el tipo de enlace indicado en lugar de
+ *   elegirlo por el prefijo de 'ifname'. Permite usar tipos de enlace
+ *   definidos fuera de esta librería.
+ *
+ * VALOR DEVUELTO:
+ *   Manejador de la interfaz Ethernet, o 'NULL' si se ha producido algún
+ *   error.
+ */
+eth_iface_t *eth_open_backend(const eth_backend_t *backend, char *ifname) {
     struct eth_iface *eth_iface;
 
+    if ((backend == NULL) || (ifname == NULL)) {
+        fprintf(stderr, "eth_open(): ERROR: parámetros incorrectos\n");
+        return NULL;
+    }
+
     /* Reservar memoria para el manejador del interfaz Ethernet */
     eth_iface = malloc(sizeof(struct eth_iface));
     if (eth_iface == NULL) {
         fprintf(stderr, "eth_open(): ERROR en malloc()\n");
         return NULL;
     }
+    eth_iface->ngroups = 0;
+    eth_iface->nprotocols = 0;
+    eth_iface->capture = NULL;
+    eth_iface->capture_if = -1;
+    eth_iface->impair = NULL;
+    memset(&eth_iface->stats, 0, sizeof(eth_stats_t));
 
-    /* Abrir el interfaz "en crudo" subyacente */
-    rawiface_t *raw_iface = rawiface_open(ifname);
-    if (raw_iface == NULL) {
-        fprintf(stderr, "eth_open(): ERROR en rawiface_open(): %s\n",
-                rawnet_strerror());
+    /* Abrir el interfaz subyacente */
+    eth_iface->backend = backend;
+    eth_iface->dev = backend->open(ifname);
+    if (eth_iface->dev == NULL) {
+        free(eth_iface);
         return NULL;
     }
-    eth_iface->raw_iface = raw_iface;
+    pthread_mutex_init(&eth_iface->tx_lock, NULL);
 
     /* Copiar la dirección MAC en el manejador */
-    rawiface_getaddr(raw_iface, eth_iface->mac_address);
+    backend->getaddr(eth_iface->dev, eth_iface->mac_address);
 
     return eth_iface;
 }
@@ -109,7 +520,7 @@ char *eth_getname(eth_iface_t *iface) {
     char *iface_name = NULL;
 
     if (iface != NULL) {
-        iface_name = rawiface_getname(iface->raw_iface);
+        iface_name = iface->backend->getname(iface->dev);
     }
 
     return iface_name;
@@ -163,45 +574,166 @@ void eth_getaddr(eth_iface_t *iface, mac_addr_t addr) {
 int eth_send
         (eth_iface_t *iface,
          mac_addr_t dst, uint16_t type, unsigned char *payload, int payload_len) {
-    int bytes_sent;
 
     /* Comprobar parámetros */
     if (iface == NULL) {
         fprintf(stderr, "eth_send(): ERROR: iface == NULL\n");
         return -1;
     }
+    if ((payload_len < 0) || (payload_len > ETH_MTU)) {
+        fprintf(stderr, "eth_send(): ERROR: payload_len = %d\n", payload_len);
+        return -1;
+    }
 
-    /* Crear la Trama Ethernet y rellenar todos los campos */
-    struct eth_frame eth_frame;
-    memcpy(eth_frame.dest_addr, dst, MAC_ADDR_SIZE);
-    memcpy(eth_frame.src_addr, iface->mac_address, MAC_ADDR_SIZE);
-    eth_frame.type = htons(type);
+    /* El payload del llamante no tiene espacio para la cabecera, así que se
+       copia una única vez a una trama del tamaño justo y se envía "in situ". */
+    unsigned char frame[ETH_HEADROOM + payload_len];
+    memcpy(frame + ETH_HEADROOM, payload, payload_len);
 
-    bzero((char *) &(eth_frame.payload), sizeof(ETH_MTU)); //rellenamos a 0
-    memcpy(eth_frame.payload, payload, payload_len);
-    int eth_frame_len = ETH_HEADER_SIZE + payload_len;
+    return eth_send_frame(iface, dst, type, frame, payload_len);
+}
 
-    /* Imprimir trama Ethernet */
-    char *iface_name = eth_getname(iface);
-    char mac_str[MAC_STR_LENGTH];
-    mac_addr_str(dst, mac_str);
-    printf("eth_send(type=0x%04x, payload[%d]) > %s/%s\n",
-           type, payload_len, iface_name, mac_str);
-    print_pkt((unsigned char *) &eth_frame, eth_frame_len, ETH_HEADER_SIZE);
-
-    /* Enviar la trama Ethernet creada con rawnet_send() y comprobar errores */
-    bytes_sent = rawnet_send
-            (iface->raw_iface, (unsigned char *) &eth_frame, eth_frame_len);
-    if (bytes_sent == -1) {
-        fprintf(stderr, "eth_send(): ERROR en rawnet_send(): %s\n",
-                rawnet_strerror());
+
+/* int eth_send_frame
+ * ( eth_iface_t * iface,
+ *   mac_addr_t dst, uint16_t type, unsigned char * frame, int payload_len );
+ *
+ * DESCRIPCIÓN:
+ *   Esta función envía una trama Ethernet construida "in situ" por el
+ *   llamante. A diferencia de 'eth_send()', el payload no se copia: el
+ *   llamante escribe sus datos a partir de 'frame + ETH_HEADROOM' y esta
+ *   función sólo rellena los 'ETH_HEADER_SIZE' bytes iniciales antes de
+ *   entregar la misma memoria al interfaz.
+ *
+ * PARÁMETROS:
+ *       'iface': Manejador de la interfaz Ethernet por la que se quiere
+ *                enviar el paquete.
+ *         'dst': Dirección MAC del equipo destino.
+ *        'type': Valor del campo 'Tipo' de la trama Ethernet a enviar.
+ *       'frame': Buffer de al menos 'ETH_HEADROOM + payload_len' bytes. Los
+ *                datos a enviar deben estar ya en 'frame + ETH_HEADROOM'.
+ * 'payload_len': Longitud en bytes de los datos a enviar.
+ *
+ * VALOR DEVUELTO:
+ *   El número de bytes de datos que han podido ser enviados.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si se ha producido algún error.
+ */
+int eth_send_frame
+        (eth_iface_t *iface,
+         mac_addr_t dst, uint16_t type, unsigned char *frame, int payload_len) {
+    eth_msg_t msg;
+
+    memcpy(msg.addr, dst, MAC_ADDR_SIZE);
+    msg.type = type;
+    msg.frame = frame;
+    msg.frame_size = ETH_HEADROOM + payload_len;
+    msg.payload_len = payload_len;
+
+    if (eth_send_burst(iface, &msg, 1) != 1) {
+        return -1;
+    }
+
+    /* Devolver el número de bytes de datos enviados */
+    return payload_len;
+}
+
+
+/* int eth_send_burst ( eth_iface_t * iface, eth_msg_t msgs[], int num );
+ *
+ * DESCRIPCIÓN:
+ *   Esta función envía hasta 'num' tramas construidas "in situ" (ver
+ *   'eth_send_frame()') con el menor número posible de llamadas al sistema.
+ *   Para cada descriptor se usan los campos 'addr', 'type', 'frame' y
+ *   'payload_len'; sólo se escriben las cabeceras de cada trama.
+ *
+ * PARÁMETROS:
+ *   'iface': Manejador de la interfaz Ethernet por la que se quiere enviar.
+ *    'msgs': Array de descriptores de las tramas a enviar.
+ *     'num': Número de descriptores en 'msgs'. Como mucho se enviarán
+ *            'ETH_BURST_MAX' tramas.
+ *
+ * VALOR DEVUELTO:
+ *   El número de tramas enviadas, que son siempre las primeras del array.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si no se ha podido enviar ninguna trama.
+ */
+int eth_send_burst(eth_iface_t *iface, eth_msg_t msgs[], int num) {
+
+    /* Comprobar parámetros */
+    if ((iface == NULL) || (msgs == NULL) || (num <= 0)) {
+        fprintf(stderr, "eth_send_burst(): ERROR: iface == NULL || num <= 0\n");
         return -1;
     }
+    if (num > ETH_BURST_MAX) {
+        num = ETH_BURST_MAX;
+    }
+
+    unsigned char *frames[num];
+    int lens[num];
+    char *iface_name = eth_getname(iface);
+    int i;
+    for (i = 0; i < num; i++) {
+        eth_msg_t *msg = &msgs[i];
+        if ((msg->frame == NULL) ||
+            (msg->payload_len < 0) || (msg->payload_len > ETH_MTU)) {
+            fprintf(stderr, "eth_send_burst(): ERROR: trama %d incorrecta\n", i);
+            return -1;
+        }
+
+        /* Rellenar únicamente la cabecera; el payload ya está en su sitio */
+        struct eth_frame *eth_frame = (struct eth_frame *) msg->frame;
+        memcpy(eth_frame->dest_addr, msg->addr, MAC_ADDR_SIZE);
+        memcpy(eth_frame->src_addr, iface->mac_address, MAC_ADDR_SIZE);
+        eth_frame->type = htons(msg->type);
+        frames[i] = msg->frame;
+        lens[i] = ETH_HEADER_SIZE + msg->payload_len;
+
+        /* Imprimir trama Ethernet, salvo que se esté capturando */
+        if (iface->capture == NULL) {
+            char mac_str[MAC_STR_LENGTH];
+            mac_addr_str(msg->addr, mac_str);
+            printf("eth_send(type=0x%04x, payload[%d]) > %s/%s\n",
+                   msg->type, msg->payload_len, iface_name, mac_str);
+            print_pkt(msg->frame, lens[i], ETH_HEADER_SIZE);
+        }
+    }
+
+    eth_stats_t delta;
+    memset(&delta, 0, sizeof(eth_stats_t));
+    int locked = eth_tx_lock(iface);
+
+    /* Con perturbaciones las tramas pasan por la etapa, que se las queda;
+       saldrán (y se contarán) al vencer, aquí mismo o en una llamada
+       posterior. Las que descarta se dan por enviadas, como en un enlace
+       real que las pierde. */
+    if (iface->impair != NULL) {
+        for (i = 0; i < num; i++) {
+            if (eth_impair_submit(iface->impair, frames[i], lens[i]) == 0) {
+                delta.tx_drop_impaired++;
+            }
+        }
+        eth_stats_add(iface, &delta);
+        eth_iface_release(iface);
+        eth_tx_unlock(iface, locked);
+        return num;
+    }
 
-    /* Devolver el número de bytes de datos recibidos */
-    return (bytes_sent - ETH_HEADER_SIZE);
+    int sent = eth_iface_send(iface, frames, lens, num);
+    eth_tx_unlock(iface, locked);
+    for (i = 0; i < sent; i++) {
+        delta.tx_bytes += lens[i];
+    }
+    delta.tx_frames = (sent > 0) ? sent : 0;
+    delta.tx_errors = num - delta.tx_frames;
+    eth_stats_add(iface, &delta);
+
+    return sent;
 }
 
+
 /* int eth_recv 
  * ( eth_iface_t * iface, 
  *   mac_addr_t src, uint16_t type, unsigned char buffer[], long int timeout );
@@ -225,7 +757,10 @@ int eth_send
  *             memoria indicada, que debe estar reservada previamente.
  *     'type': Valor del campo 'Tipo' de la trama Ethernet que se desea
  *             recibir. 
- *             Las tramas con un valor 'type' diferente serán descartadas.
+ *             Las tramas con un valor 'type' diferente se entregan a su
+ *             manejador o se guardan en su cola si su tipo se ha registrado
+ *             (ver 'eth_register_handler()' y 'eth_register_queue()'), y se
+ *             descartan en caso contrario.
  *   'buffer': Array donde se almacenarán los datos de la trama recibida.
  *  'buf_len': Longitud del 'buffer' dónde se almacenarán los datos de la trama
  *             recibida. Si se reciben más datos de los que caben el en 'buffer'
@@ -247,7 +782,6 @@ int eth_send
 int eth_recv
         (eth_iface_t *iface, mac_addr_t src, uint16_t type, unsigned char buffer[],
          int buf_len, long int timeout) {
-    int payload_len;
 
     /* Comprobar parámetros */
     if (iface == NULL) {
@@ -255,57 +789,508 @@ int eth_recv
         return -1;
     }
 
+    /* Pedir la trama prestada para copiar los datos una sola vez,
+       directamente al 'buffer' del llamante */
+    eth_msg_t msg;
+    msg.frame = NULL;
+    msg.frame_size = 0;
+
+    int received = eth_recv_burst(iface, type, &msg, 1, timeout);
+    if (received <= 0) {
+        return received;
+    }
+
+    /* Trama recibida con 'tipo' indicado. Copiar datos y dirección MAC origen */
+    memcpy(src, msg.addr, MAC_ADDR_SIZE);
+    int payload_len = msg.payload_len;
+    if (buf_len > payload_len) {
+        buf_len = payload_len;
+    } else if (buf_len < payload_len) {
+        __atomic_fetch_add(&iface->stats.rx_truncated, 1, __ATOMIC_RELAXED);
+    }
+    memcpy(buffer, msg.frame + ETH_HEADROOM, buf_len);
+
+    return payload_len;
+}
+
+
+/* int eth_recv_burst
+ * ( eth_iface_t * iface, uint16_t type, eth_msg_t msgs[], int num,
+ *   long int timeout );
+ *
+ * DESCRIPCIÓN:
+ *   Esta función espera como mucho 'timeout' milisegundos a que llegue alguna
+ *   trama del tipo indicado y devuelve todas las que ya estén disponibles,
+ *   hasta un máximo de 'num', sin volver a bloquearse.
+ *
+ *   Las tramas se escriben directamente en el buffer 'frame' de cada
+ *   descriptor y se rellenan 'addr', 'type' y 'payload_len'. Para no copiar
+ *   tramas descartadas, los buffers pueden intercambiarse entre descriptores
+ *   del mismo array.
+ *
+ *   Si 'msgs[0].frame' es NULL las tramas no se copian: 'frame' y
+ *   'frame_size' pasan a apuntar a memoria del propio interfaz (p.ej. el
+ *   anillo de un interfaz "mmap:"), válida hasta la siguiente recepción.
+ *
+ *   Si el tipo tiene cola (ver 'eth_register_queue()') y contiene tramas, se
+ *   devuelven éstas sin esperar. Las tramas de otros tipos se entregan a su
+ *   manejador o a su cola.
+ *
+ * PARÁMETROS:
+ *     'iface': Manejador de la interfaz Ethernet por la que se desea recibir.
+ *      'type': Valor del campo 'Tipo' de las tramas que se desea recibir.
+ *      'msgs': Array de descriptores con 'frame' y 'frame_size' rellenos.
+ *       'num': Número de descriptores en 'msgs' (como mucho 'ETH_BURST_MAX').
+ *   'timeout': Igual que en 'eth_recv()'.
+ *
+ * VALOR DEVUELTO:
+ *   El número de tramas recibidas, o '0' si ha expirado el temporizador.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si se ha producido algún error.
+ */
+int eth_recv_burst
+        (eth_iface_t *iface, uint16_t type, eth_msg_t msgs[], int num,
+         long int timeout) {
+
+    /* Comprobar parámetros */
+    if ((iface == NULL) || (msgs == NULL) || (num <= 0)) {
+        fprintf(stderr, "eth_recv_burst(): ERROR: iface == NULL || num <= 0\n");
+        return -1;
+    }
+    if (num > ETH_BURST_MAX) {
+        num = ETH_BURST_MAX;
+    }
+
+    int loan = (msgs[0].frame == NULL);
+
+    /* Si ya llegaron tramas de este tipo mientras se esperaba otro,
+       devolverlas sin esperar */
+    struct eth_protocol *proto = eth_find_protocol(iface, type);
+    if ((proto != NULL) && (proto->queue_count > 0)) {
+        return eth_dequeue(proto, msgs, num, loan);
+    }
+
     /* Inicializar temporizador para mantener timeout si se reciben tramas con
        tipo incorrecto. */
     timerms_t timer;
     timerms_reset(&timer, timeout);
 
-    int frame_len;
-    int eth_buf_len = ETH_HEADER_SIZE + buf_len;
-    unsigned char eth_buffer[eth_buf_len];
-    struct eth_frame *eth_frame_ptr = NULL;
-    int is_multicast;
-    int is_target_type;
-    int is_my_mac;
+    unsigned char *bufs[num];
+    int sizes[num];
+    int lens[num];
+    int received = 0;
+    eth_stats_t delta;
+    memset(&delta, 0, sizeof(eth_stats_t));
 
     do {
+        /* No esperar más allá de la salida de la siguiente trama retenida */
         long int time_left = timerms_left(&timer);
+        int locked = eth_tx_lock(iface);
+        long int hold = eth_iface_release(iface);
+        eth_tx_unlock(iface, locked);
+        int held = (hold >= 0) && ((time_left < 0) || (hold < time_left));
+        if (held) {
+            time_left = hold;
+        }
 
-        /* Recibir trama del interfaz Ethernet y procesar errores */
-        frame_len = rawnet_recv(iface->raw_iface, eth_buffer, eth_buf_len,
-                                time_left);
-        if (frame_len < 0) {
-            fprintf(stderr, "eth_recv(): ERROR en rawnet_recv(): %s\n",
-                    rawnet_strerror());
-            return -1;
-        } else if (frame_len == 0) {
+        /* Recibir en los descriptores libres */
+        int i;
+        for (i = received; i < num; i++) {
+            bufs[i - received] = loan ? NULL : msgs[i].frame;
+            sizes[i - received] = loan ? 0 : msgs[i].frame_size;
+        }
+        int n = eth_iface_recv(iface, bufs, sizes, lens, num - received,
+                               time_left);
+        if (n < 0) {
+            delta.rx_errors++;
+            received = -1;
+            break;
+        } else if (n == 0) {
+            if (held) {
+                continue;
+            }
             /* Timeout! */
-            return 0;
-        } else if (frame_len < ETH_HEADER_SIZE) {
-            fprintf(stderr, "eth_recv(): Trama de tamaño invalido: %d bytes\n",
-                    frame_len);
-            continue;
+            break;
         }
 
-        /* Comprobar si es la trama que estamos buscando */
-        eth_frame_ptr = (struct eth_frame *) eth_buffer;
-        is_my_mac = (memcmp(eth_frame_ptr->dest_addr,
-                            iface->mac_address, MAC_ADDR_SIZE) == 0);
-        is_multicast = ((eth_frame_ptr->dest_addr[0] & 0x01) == 0x01);
+        /* Quedarse con las tramas que estamos buscando, compactándolas al
+           principio de la zona libre */
+        int kept = received;
+        for (i = 0; i < n; i++) {
+            eth_msg_t *msg = &msgs[received + i];
+            int frame_len = lens[i];
+            if (loan) {
+                msg->frame = bufs[i];
+                msg->frame_size = sizes[i];
+            }
+            delta.rx_frames++;
+            delta.rx_bytes += frame_len;
+            if (iface->capture != NULL) {
+                int caplen = (frame_len < msg->frame_size) ? frame_len : msg->frame_size;
+                eth_capture_frame(iface->capture, iface->capture_if,
+                                  ETH_CAPTURE_IN, msg->frame, caplen);
+            }
 
-        is_target_type = (ntohs(eth_frame_ptr->type) == type);
+            if (frame_len < ETH_HEADER_SIZE) {
+                delta.rx_drop_runt++;
+                fprintf(stderr, "eth_recv(): Trama de tamaño invalido: %d bytes\n",
+                        frame_len);
+                continue;
+            }
 
-    } while (!( (is_my_mac || is_multicast) && is_target_type));
+            /* Comprobar si es la trama que estamos buscando */
+            struct eth_frame *eth_frame_ptr = (struct eth_frame *) msg->frame;
+            int is_my_mac = (memcmp(eth_frame_ptr->dest_addr,
+                                    iface->mac_address, MAC_ADDR_SIZE) == 0);
+            int is_multicast = eth_is_accepted_group(iface, eth_frame_ptr->dest_addr);
+            if (!(is_my_mac || is_multicast)) {
+                delta.rx_drop_not_for_us++;
+                continue;
+            }
+            if (ntohs(eth_frame_ptr->type) != type) {
+                eth_dispatch(iface, msg->frame, frame_len, msg->frame_size,
+                             &delta);
+                continue;
+            }
+            if (frame_len > msg->frame_size) {
+                delta.rx_truncated++;
+            }
 
-    /* Trama recibida con 'tipo' indicado. Copiar datos y dirección MAC origen */
-    memcpy(src, eth_frame_ptr->src_addr, MAC_ADDR_SIZE);
-    payload_len = frame_len - ETH_HEADER_SIZE;
-    if (buf_len > payload_len) {
-        buf_len = payload_len;
+            if (msg != &msgs[kept]) {
+                unsigned char *frame = msgs[kept].frame;
+                int frame_size = msgs[kept].frame_size;
+                msgs[kept].frame = msg->frame;
+                msgs[kept].frame_size = msg->frame_size;
+                msg->frame = frame;
+                msg->frame_size = frame_size;
+            }
+            memcpy(msgs[kept].addr, eth_frame_ptr->src_addr, MAC_ADDR_SIZE);
+            msgs[kept].type = type;
+            msgs[kept].payload_len = frame_len - ETH_HEADER_SIZE;
+            kept++;
+        }
+        received = kept;
+
+    } while ((received == 0) && (timerms_left(&timer) != 0));
+
+    eth_stats_add(iface, &delta);
+
+    return received;
+}
+
+
+/* int eth_set_filter
+ * ( eth_iface_t * iface, uint16_t types[], int ntypes,
+ *   mac_addr_t groups[], int ngroups );
+ *
+ * DESCRIPCIÓN:
+ *   Esta función restringe las tramas que se reciben por el interfaz a las
+ *   dirigidas a su dirección MAC, a la dirección de difusión o a uno de los
+ *   grupos multicast indicados, y cuyo campo 'Tipo' sea uno de los indicados.
+ *
+ *   En los interfaces nativos ("packet:" y "mmap:") se instala un filtro BPF
+ *   en el núcleo, de modo que el tráfico no deseado ni siquiera llega a la
+ *   aplicación. Con rawnet el filtro de grupos se aplica en 'eth_recv()'.
+ *
+ * PARÁMETROS:
+ *     'iface': Manejador de la interfaz Ethernet.
+ *     'types': Tipos de trama aceptados. Con 'ntypes' igual a 0 se acepta
+ *              cualquier tipo.
+ *    'ntypes': Número de tipos (como mucho 'ETH_FILTER_MAX_TYPES').
+ *    'groups': Direcciones MAC multicast aceptadas. Con 'ngroups' igual a 0
+ *              se acepta cualquier trama multicast.
+ *   'ngroups': Número de grupos (como mucho 'ETH_FILTER_MAX_GROUPS').
+ *
+ * VALOR DEVUELTO:
+ *   Devuelve 0 si el filtro se ha instalado correctamente.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si se ha producido algún error.
+ */
+int eth_set_filter
+        (eth_iface_t *iface, uint16_t types[], int ntypes,
+         mac_addr_t groups[], int ngroups) {
+
+    /* Comprobar parámetros */
+    if ((iface == NULL) ||
+        (ntypes < 0) || (ntypes > ETH_FILTER_MAX_TYPES) ||
+        (ngroups < 0) || (ngroups > ETH_FILTER_MAX_GROUPS)) {
+        fprintf(stderr, "eth_set_filter(): ERROR: parámetros incorrectos\n");
+        return -1;
     }
-    memcpy(buffer, eth_frame_ptr->payload, buf_len);
 
-    return payload_len;
+    const eth_backend_t *backend = iface->backend;
+    if ((backend->set_filter != NULL) &&
+        (backend->set_filter(iface->dev, types, ntypes, groups, ngroups) == -1)) {
+        return -1;
+    }
+
+    /* Los grupos también se comprueban al recibir, por si el interfaz no
+       puede filtrar en el núcleo o ya había tramas encoladas */
+    memcpy(iface->groups, groups, ngroups * sizeof(mac_addr_t));
+    iface->ngroups = ngroups;
+
+    return 0;
+}
+
+
+/* int eth_register_queue ( eth_iface_t * iface, uint16_t type, int queue_len );
+ *
+ * DESCRIPCIÓN:
+ *   Esta función crea una cola de recepción para las tramas del tipo
+ *   indicado. Las tramas de ese tipo que lleguen mientras se espera otro
+ *   (p.ej. paquetes IPv4 durante 'arp_resolve()') se copian a la cola en
+ *   lugar de descartarse, y la siguiente llamada a 'eth_recv()' o
+ *   'eth_recv_burst()' con ese tipo las devuelve sin esperar, en orden de
+ *   llegada. Si la cola está llena se descarta la trama nueva.
+ *
+ * PARÁMETROS:
+ *       'iface': Manejador de la interfaz Ethernet.
+ *        'type': Valor del campo 'Tipo' de las tramas a encolar.
+ *   'queue_len': Número máximo de tramas en la cola. Con 0 se usa
+ *                'ETH_QUEUE_LEN'.
+ *
+ * VALOR DEVUELTO:
+ *   Devuelve 0 si la cola se ha creado correctamente.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si el tipo ya estaba registrado, si se han
+ *   registrado ya 'ETH_MAX_PROTOCOLS' tipos o si no hay memoria.
+ */
+int eth_register_queue(eth_iface_t *iface, uint16_t type, int queue_len) {
+
+    /* Comprobar parámetros */
+    if ((iface == NULL) || (queue_len < 0)) {
+        fprintf(stderr, "eth_register_queue(): ERROR: parámetros incorrectos\n");
+        return -1;
+    }
+    if (queue_len == 0) {
+        queue_len = ETH_QUEUE_LEN;
+    }
+
+    struct eth_protocol *proto = eth_add_protocol(iface, type);
+    if (proto == NULL) {
+        return -1;
+    }
+    proto->queue = malloc(queue_len * sizeof(struct eth_queued_frame));
+    if (proto->queue == NULL) {
+        fprintf(stderr, "eth_register_queue(): ERROR en malloc()\n");
+        return -1;
+    }
+    proto->queue_len = queue_len;
+    iface->nprotocols++;
+
+    return 0;
+}
+
+
+/* int eth_register_handler
+ * ( eth_iface_t * iface, uint16_t type, eth_handler_t handler, void * arg );
+ *
+ * DESCRIPCIÓN:
+ *   Esta función registra una función que procesa inmediatamente las tramas
+ *   del tipo indicado que lleguen mientras se espera otro tipo, en lugar de
+ *   descartarlas (p.ej. responder peticiones ARP mientras se espera un
+ *   paquete IPv4). Las tramas que se esperan explícitamente con ese tipo se
+ *   siguen devolviendo al llamante de 'eth_recv()'.
+ *
+ *   El manejador puede enviar tramas, pero no debe recibir del mismo
+ *   interfaz.
+ *
+ * PARÁMETROS:
+ *     'iface': Manejador de la interfaz Ethernet.
+ *      'type': Valor del campo 'Tipo' de las tramas a procesar.
+ *   'handler': Función a la que se entrega cada trama.
+ *       'arg': Argumento que se pasa a 'handler' en cada llamada.
+ *
+ * VALOR DEVUELTO:
+ *   Devuelve 0 si el manejador se ha registrado correctamente.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si el tipo ya estaba registrado o si se han
+ *   registrado ya 'ETH_MAX_PROTOCOLS' tipos.
+ */
+int eth_register_handler
+        (eth_iface_t *iface, uint16_t type, eth_handler_t handler, void *arg) {
+
+    /* Comprobar parámetros */
+    if ((iface == NULL) || (handler == NULL)) {
+        fprintf(stderr, "eth_register_handler(): ERROR: parámetros incorrectos\n");
+        return -1;
+    }
+
+    struct eth_protocol *proto = eth_add_protocol(iface, type);
+    if (proto == NULL) {
+        return -1;
+    }
+    proto->handler = handler;
+    proto->handler_arg = arg;
+    iface->nprotocols++;
+
+    return 0;
+}
+
+
+/* unsigned char * eth_alloc_frame ( eth_iface_t * iface );
+ *
+ * DESCRIPCIÓN:
+ *   Esta función devuelve una trama de 'ETH_FRAME_MAX_LENGTH' bytes situada
+ *   directamente en el anillo de transmisión del interfaz, para construirla
+ *   "in situ" (datos en 'frame + ETH_HEADROOM') y enviarla después con
+ *   'eth_send_frame()' o 'eth_send_burst()' sin ninguna copia.
+ *
+ *   Toda trama obtenida así debe enviarse: las tramas del anillo salen en
+ *   orden y una trama reservada que no se envía retiene a las siguientes.
+ *
+ * PARÁMETROS:
+ *   'iface': Manejador de la interfaz Ethernet.
+ *
+ * VALOR DEVUELTO:
+ *   Puntero a la trama, o 'NULL' si el interfaz no tiene anillo de
+ *   transmisión. En ese caso el llamante debe usar su propio buffer.
+ */
+unsigned char *eth_alloc_frame(eth_iface_t *iface) {
+    if ((iface == NULL) || (iface->backend->tx_alloc == NULL)) {
+        return NULL;
+    }
+
+    return iface->backend->tx_alloc(iface->dev);
+}
+
+
+/* int eth_flush ( eth_iface_t * iface );
+ *
+ * DESCRIPCIÓN:
+ *   Esta función envía inmediatamente las tramas que el interfaz tenga
+ *   acumuladas en su anillo de transmisión. No es necesario llamarla antes
+ *   de 'eth_recv()', 'eth_poll()' o 'eth_close()', que ya lo hacen, pero sí
+ *   al final de un bucle que sólo envía.
+ *
+ *   También envía las tramas retenidas por las perturbaciones del interfaz
+ *   cuyo momento de salida ya ha llegado (ver 'eth_timeleft()').
+ *
+ * PARÁMETROS:
+ *   'iface': Manejador de la interfaz Ethernet.
+ *
+ * VALOR DEVUELTO:
+ *   El número de tramas que estaban pendientes de envío.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si se ha producido algún error.
+ */
+int eth_flush(eth_iface_t *iface) {
+    if (iface == NULL) {
+        fprintf(stderr, "eth_flush(): ERROR: iface == NULL\n");
+        return -1;
+    }
+
+    int locked = eth_tx_lock(iface);
+    eth_iface_release(iface);
+
+    int pending = 0;
+    if (iface->backend->flush != NULL) {
+        pending = iface->backend->flush(iface->dev);
+    }
+    eth_tx_unlock(iface, locked);
+
+    return pending;
+}
+
+
+/* long int eth_timeleft ( eth_iface_t * iface );
+ *
+ * DESCRIPCIÓN:
+ *   Esta función devuelve cuánto falta para que salga la siguiente trama
+ *   retenida por las perturbaciones del interfaz (ver
+ *   'eth_set_impairment()'). Un bucle que espera por su cuenta no debe
+ *   hacerlo más de esto sin llamar a 'eth_flush()'.
+ *
+ * PARÁMETROS:
+ *   'iface': Manejador de la interfaz Ethernet.
+ *
+ * VALOR DEVUELTO:
+ *   Los milisegundos que faltan (0 si ya debería haber salido), o '-1' si no
+ *   hay tramas retenidas.
+ */
+long int eth_timeleft(eth_iface_t *iface) {
+    if (iface == NULL) {
+        return -1;
+    }
+
+    return eth_impair_timeleft(iface->impair);
+}
+
+
+/* int eth_getfd ( eth_iface_t * iface );
+ *
+ * DESCRIPCIÓN:
+ *   Esta función devuelve el descriptor de fichero en el que esperar con
+ *   poll()/epoll() a que lleguen tramas al interfaz.
+ *
+ * PARÁMETROS:
+ *   'iface': Manejador de la interfaz Ethernet.
+ *
+ * VALOR DEVUELTO:
+ *   El descriptor, o '-1' si el interfaz no tiene ninguno (interfaces de la
+ *   librería rawnet, que sólo se pueden consultar con 'eth_poll()').
+ */
+int eth_getfd(eth_iface_t *iface) {
+    if ((iface == NULL) || (iface->backend->getfd == NULL)) {
+        return -1;
+    }
+
+    return iface->backend->getfd(iface->dev);
+}
+
+
+/* int eth_pending ( eth_iface_t * iface );
+ *
+ * DESCRIPCIÓN:
+ *   Esta función devuelve el número de tramas que esperan en las colas del
+ *   interfaz (ver 'eth_register_queue()'). Estas tramas ya no se notifican
+ *   en el descriptor de 'eth_getfd()'.
+ *
+ * PARÁMETROS:
+ *   'iface': Manejador de la interfaz Ethernet.
+ *
+ * VALOR DEVUELTO:
+ *   El número de tramas encoladas.
+ */
+int eth_pending(eth_iface_t *iface) {
+    int pending = 0;
+
+    if (iface != NULL) {
+        int i;
+        for (i = 0; i < iface->nprotocols; i++) {
+            pending += iface->protocols[i].queue_count;
+        }
+    }
+
+    return pending;
+}
+
+
+/* static long int eth_poll_release ( eth_iface_t * ifaces[], int ifnum );
+ *
+ * DESCRIPCIÓN:
+ *   Saca las tramas pendientes de envío de todos los interfaces.
+ *
+ * VALOR DEVUELTO:
+ *   Los milisegundos que faltan para la siguiente trama retenida en alguno
+ *   de ellos, o '-1' si no queda ninguna.
+ */
+static long int eth_poll_release(eth_iface_t *ifaces[], int ifnum) {
+    long int hold = -1;
+    int i;
+    for (i = 0; i < ifnum; i++) {
+        eth_flush(ifaces[i]);
+        long int left = eth_timeleft(ifaces[i]);
+        if ((left >= 0) && ((hold < 0) || (left < hold))) {
+            hold = left;
+        }
+    }
+    return hold;
 }
 
 
@@ -316,7 +1301,8 @@ int eth_recv
  *   Esta función permite esperar paquetes en múltiples interfaces Ethernet
  *   simultaneamente. Cuando alguna de las interfaces indicadas reciba una
  *   trama, la función devolverá la primera interfaz que tiene una trama
- *   listo para ser recibida mediante la funcion 'eth_recv()'.
+ *   listo para ser recibida mediante la funcion 'eth_recv()'. Un interfaz
+ *   con tramas en alguna de sus colas se considera listo sin esperar.
  *
  *   Esta operación puede escuchar de los interfaces Ethernet indefinidamente
  *   o un tiempo limitado dependiento del parámetro 'timeout'.
@@ -341,26 +1327,190 @@ int eth_recv
 int eth_poll
         (eth_iface_t *ifaces[], int ifnum, long int timeout) {
     int iface_index;
-
-    /* Crear lista de interfaces hardware */
-    rawiface_t *raw_ifaces[ifnum];
     int i;
+
+    /* Las tramas ya encoladas están listas sin esperar */
     for (i = 0; i < ifnum; i++) {
-        raw_ifaces[i] = ifaces[i]->raw_iface;
+        if (eth_pending(ifaces[i]) > 0) {
+            return i;
+        }
     }
 
-    /* Llamar a rawnet_poll() y procesar errores */
-    iface_index = rawnet_poll(raw_ifaces, ifnum, timeout);
-    if (iface_index == -1) {
-        fprintf(stderr, "eth_poll(): ERROR en rawnet_poll(): %s\n",
-                rawnet_strerror());
+    /* Separar los interfaces con descriptor de los que no tienen */
+    struct pollfd pfds[ifnum];
+    void *nofd_devs[ifnum];
+    int nofd_index[ifnum];
+    int nofd_num = 0;
+    int same_backend = 1;
+    long int hold = eth_poll_release(ifaces, ifnum);
+    for (i = 0; i < ifnum; i++) {
+        pfds[i].fd = eth_getfd(ifaces[i]); /* poll() ignora los negativos */
+        pfds[i].events = POLLIN;
+        pfds[i].revents = 0;
+        if (pfds[i].fd == -1) {
+            nofd_devs[nofd_num] = ifaces[i]->dev;
+            nofd_index[nofd_num] = i;
+            nofd_num++;
+        }
+        if (ifaces[i]->backend != ifaces[0]->backend) {
+            same_backend = 0;
+        }
+    }
+
+    if ((nofd_num == ifnum) && same_backend && (hold < 0)) {
+        /* Ninguno tiene descriptor (p.ej. todos rawnet): esperar con la
+           operación de su tipo de enlace */
+        return ifaces[0]->backend->poll(nofd_devs, ifnum, timeout);
+    }
+
+    /* Esperar en los descriptores con poll() por intervalos, consultando
+       entre medias sin bloquear los interfaces que no tienen. */
+    timerms_t timer;
+    timerms_reset(&timer, timeout);
+    do {
+        for (i = 0; i < nofd_num; i++) {
+            eth_iface_t *iface = ifaces[nofd_index[i]];
+            iface_index = iface->backend->poll(&nofd_devs[i], 1, 0);
+            if (iface_index == -1) {
+                return -1;
+            } else if (iface_index >= 0) {
+                return nofd_index[i];
+            }
+        }
+
+        long int time_left = timerms_left(&timer);
+        if ((nofd_num > 0) && ((time_left < 0) || (time_left > ETH_POLL_SLICE))) {
+            time_left = ETH_POLL_SLICE;
+        }
+        if ((hold >= 0) && ((time_left < 0) || (hold < time_left))) {
+            time_left = hold;
+        }
+
+        int ready = poll(pfds, ifnum, (int) time_left);
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "eth_poll(): ERROR en poll(): %s\n",
+                    strerror(errno));
+            return -1;
+        }
+        for (i = 0; (ready > 0) && (i < ifnum); i++) {
+            if (pfds[i].revents != 0) {
+                return i;
+            }
+        }
+        if (hold >= 0) {
+            hold = eth_poll_release(ifaces, ifnum);
+        }
+    } while (timerms_left(&timer) != 0);
+
+    /* Timeout! */
+    return -2;
+}
+
+
+/* int eth_get_stats ( eth_iface_t * iface, eth_stats_t * stats );
+ *
+ * DESCRIPCIÓN:
+ *   Esta función copia en 'stats' los contadores del interfaz desde que se
+ *   abrió. Los contadores se actualizan sin cerrojos, así que puede llamarse
+ *   desde otro hilo mientras se envía y recibe; cada contador es coherente
+ *   por sí mismo, pero no necesariamente con los demás.
+ *
+ * PARÁMETROS:
+ *   'iface': Manejador de la interfaz Ethernet.
+ *   'stats': Estructura donde se copian los contadores.
+ *
+ * VALOR DEVUELTO:
+ *   Devuelve 0 si se han copiado los contadores.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si se ha producido algún error.
+ */
+int eth_get_stats(eth_iface_t *iface, eth_stats_t *stats) {
+    if ((iface == NULL) || (stats == NULL)) {
+        fprintf(stderr, "eth_get_stats(): ERROR: iface == NULL || stats == NULL\n");
+        return -1;
+    }
+
+    uint64_t *counters = (uint64_t *) &iface->stats;
+    uint64_t *copy = (uint64_t *) stats;
+    size_t i;
+    for (i = 0; i < sizeof(eth_stats_t) / sizeof(uint64_t); i++) {
+        copy[i] = __atomic_load_n(&counters[i], __ATOMIC_RELAXED);
+    }
+
+    return 0;
+}
+
+
+/* int eth_set_capture ( eth_iface_t * iface, eth_capture_t * cap );
+ *
+ * DESCRIPCIÓN:
+ *   Asocia el interfaz a una captura pcapng, o la desasocia si 'cap' es
+ *   'NULL'. Las tramas enviadas y recibidas se copian a la captura en lugar
+ *   de imprimirse.
+ *
+ * VALOR DEVUELTO:
+ *   Devuelve 0 si se ha asociado (o desasociado) la captura.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si se ha producido algún error.
+ */
+int eth_set_capture(eth_iface_t *iface, eth_capture_t *cap) {
+    if (iface == NULL) {
+        fprintf(stderr, "eth_set_capture(): ERROR: iface == NULL\n");
+        return -1;
+    }
+
+    if (cap == NULL) {
+        iface->capture = NULL;
+        iface->capture_if = -1;
+        return 0;
+    }
+
+    int if_id = eth_capture_add_iface(cap, eth_getname(iface));
+    if (if_id == -1) {
         return -1;
-    } else if (iface_index == -2) {
-        /* Timeout! */
-        return -2;
     }
+    iface->capture_if = if_id;
+    iface->capture = cap;
 
-    return iface_index;
+    return 0;
+}
+
+
+/* int eth_set_impairment ( eth_iface_t * iface, eth_impair_config_t * config );
+ *
+ * DESCRIPCIÓN:
+ *   Interpone entre 'eth_send()' y el enlace una etapa de perturbaciones con
+ *   la configuración indicada, o la retira si 'config' es 'NULL'. Las tramas
+ *   que tuviera retenida la etapa anterior se descartan.
+ *
+ * VALOR DEVUELTO:
+ *   Devuelve 0 si se ha cambiado la configuración.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si se ha producido algún error.
+ */
+int eth_set_impairment(eth_iface_t *iface, eth_impair_config_t *config) {
+    if (iface == NULL) {
+        fprintf(stderr, "eth_set_impairment(): ERROR: iface == NULL\n");
+        return -1;
+    }
+
+    eth_impair_t *impair = NULL;
+    if (config != NULL) {
+        impair = eth_impair_create(config);
+        if (impair == NULL) {
+            return -1;
+        }
+    }
+    eth_impair_destroy(iface->impair);
+    iface->impair = impair;
+
+    return 0;
 }
 
 
@@ -370,6 +1520,9 @@ int eth_poll
  *   Esta función cierra la interfaz Ethernet especificada y libera la memoria
  *   de su manejador.
  *
+ *   Si el interfaz tiene perturbaciones, antes espera a que salgan las
+ *   tramas que aún estaban retenidas, respetando su retardo.
+ *
  * PARÁMETROS:
  *   'iface': Manejador de la interfaz Ethernet que se desea cerrar.
  *
@@ -383,7 +1536,17 @@ int eth_close(eth_iface_t *iface) {
     int err = -1;
 
     if (iface != NULL) {
-        err = rawiface_close(iface->raw_iface);
+        long int hold;
+        while ((hold = eth_iface_release(iface)) >= 0) {
+            poll(NULL, 0, (int) hold);
+        }
+        err = iface->backend->close(iface->dev);
+        eth_impair_destroy(iface->impair);
+        int i;
+        for (i = 0; i < iface->nprotocols; i++) {
+            free(iface->protocols[i].queue);
+        }
+        pthread_mutex_destroy(&iface->tx_lock);
         free(iface);
     }
 
@@ -3,6 +3,9 @@
 
 #include <stdint.h>
 
+#include "eth_capture.h"
+#include "eth_impair.h"
+
 /* Tamaño en bytes de las direcciones MAC (48 bits == 6 bytes) */
 #define MAC_ADDR_SIZE 6
 
@@ -19,10 +22,81 @@ extern mac_addr_t MAC_MULTICAST_ADDR;
 /* Maximum Transmission Unit (MTU) de la tramas Ethernet. */
 #define ETH_MTU 1500
 
+/* Tamaño de la cabecera Ethernet (sin incluir el campo FCS) */
+#define ETH_HEADER_SIZE 14
+/* Tamaño máximo de una trama Ethernet (sin incluir el campo FCS) */
+#define ETH_FRAME_MAX_LENGTH (ETH_HEADER_SIZE + ETH_MTU)
+
+/* Espacio que deben reservar las capas superiores delante de sus datos para
+   que 'eth_send_frame()' pueda escribir la cabecera Ethernet sin copiar el
+   payload. */
+#define ETH_HEADROOM ETH_HEADER_SIZE
+
 /* Manejador de un interfaz ethernet. Esta es una estructura opaca que no debe
    ser accedida directamente, sino a través de las funciones de esta librería. */
 typedef struct eth_iface eth_iface_t;
 
+/* Número máximo de tramas que se mueven en una única llamada a
+   'eth_send_burst()' o 'eth_recv_burst()'. */
+#define ETH_BURST_MAX 64
+
+/* Número máximo de tipos y de grupos multicast de 'eth_set_filter()' */
+#define ETH_FILTER_MAX_TYPES 16
+#define ETH_FILTER_MAX_GROUPS 16
+
+/* Número de tramas que un interfaz con anillo de transmisión ("mmap:")
+   acumula antes de avisar al núcleo para que las envíe. */
+#define ETH_TX_BATCH 32
+
+/* Número máximo de tipos de trama con manejador o cola propia por interfaz,
+   y longitud por defecto de cada cola (ver 'eth_register_queue()'). */
+#define ETH_MAX_PROTOCOLS 8
+#define ETH_QUEUE_LEN 32
+
+/* Descriptor de una trama para las operaciones en ráfaga.
+ *
+ * 'frame' apunta a un buffer propiedad del llamante con la trama completa: la
+ * cabecera ocupa los primeros 'ETH_HEADROOM' bytes y el payload empieza en
+ * 'frame + ETH_HEADROOM'.
+ */
+typedef struct eth_msg {
+    mac_addr_t addr;      /* Envío: MAC destino. Recepción: MAC origen. */
+    uint16_t type;        /* Campo 'Tipo' de la trama. */
+    unsigned char *frame; /* Buffer de la trama (cabecera + payload). */
+    int frame_size;       /* Recepción: tamaño en bytes del buffer 'frame'. */
+    int payload_len;      /* Envío: bytes de datos a enviar.
+                             Recepción: bytes de datos de la trama recibida,
+                             que puede ser mayor que lo que cabe en 'frame'. */
+} eth_msg_t;
+
+/* Contadores de un interfaz (ver 'eth_get_stats()').
+ *
+ * Las tramas recibidas se cuentan al leerlas del enlace, antes de filtrarlas;
+ * las que no llegan a entregarse se cuentan además en uno de los contadores
+ * de descarte 'rx_drop_*'.
+ */
+typedef struct eth_stats {
+    uint64_t tx_frames;          /* Tramas enviadas */
+    uint64_t tx_bytes;           /* Bytes enviados (cabeceras incluidas) */
+    uint64_t tx_errors;          /* Tramas que el enlace no ha aceptado */
+    uint64_t tx_drop_impaired;   /* Descartadas por las perturbaciones */
+
+    uint64_t rx_frames;          /* Tramas recibidas del enlace */
+    uint64_t rx_bytes;           /* Bytes recibidos (cabeceras incluidas) */
+    uint64_t rx_errors;          /* Errores del enlace al recibir */
+    uint64_t rx_truncated;       /* Tramas entregadas sin caber en el buffer */
+
+    uint64_t rx_drop_runt;       /* Más cortas que la cabecera Ethernet */
+    uint64_t rx_drop_not_for_us; /* Dirigidas a otra MAC o a otro grupo */
+    uint64_t rx_drop_wrong_type; /* De un tipo sin cola ni manejador */
+    uint64_t rx_drop_queue_full; /* De un tipo con la cola llena */
+} eth_stats_t;
+
+/* Manejador de las tramas de un tipo (ver 'eth_register_handler()'). La
+   trama 'msg->frame' sólo es válida durante la llamada. */
+typedef void (*eth_handler_t) ( eth_iface_t * iface, eth_msg_t * msg,
+                                void * arg );
+
 
 /* eth_iface_t * eth_open ( char* ifname );
  *
@@ -35,7 +109,22 @@ typedef struct eth_iface eth_iface_t;
  *
  * PARÁMETROS:
  *   'ifname': Cadena de texto con el nombre de la interfaz Ethernet que se
- *             desea inicializar.
+ *             desea inicializar. Por defecto se usa la librería rawnet; con
+ *             el prefijo "packet:" (p.ej. "packet:eth1") se abre un socket
+ *             AF_PACKET nativo que envía y recibe en ráfagas con
+ *             sendmmsg()/recvmmsg(), y con "mmap:" el mismo socket envía y
+ *             recibe a través de anillos TPACKET_V3 mapeados en memoria.
+ *             Con "xdp:" se usa un socket AF_XDP, sin copias ni llamadas
+ *             al sistema por trama, y con "uring:" un socket AF_PACKET
+ *             cuyos envíos y recepciones van en vuelo en un io_uring.
+ *             Con "tap:" se usa un interfaz TAP, y con "pipe:" (p.ej.
+ *             "pipe:lab") un cable virtual hasta el otro interfaz abierto con
+ *             el mismo nombre, sin tarjeta de red ni privilegios. Con
+ *             "shm:" (p.ej. "shm:lab/r1") se conecta a un segmento en
+ *             memoria compartida con los demás extremos del mismo nombre
+ *             de segmento ("shm:lab/r2", ...). Con
+ *             "file:" (p.ej. "file:traza.pcap,salida.pcap") y "replay:" las
+ *             tramas se leen de un fichero pcap/pcapng. Ver 'eth_backend.h'.
  *
  * VALOR DEVUELTO:
  *   Manejador de la interfaz Ethernet inicializada.
@@ -117,6 +206,37 @@ int eth_send
   mac_addr_t dst, uint16_t type, unsigned char * payload, int payload_len );
 
 
+/* int eth_send_frame
+ * ( eth_iface_t * iface,
+ *   mac_addr_t dst, uint16_t type, unsigned char * frame, int payload_len );
+ *
+ * DESCRIPCIÓN:
+ *   Esta función envía una trama Ethernet construida "in situ" por el
+ *   llamante. A diferencia de 'eth_send()', el payload no se copia: el
+ *   llamante escribe sus datos a partir de 'frame + ETH_HEADROOM' y esta
+ *   función sólo rellena los 'ETH_HEADER_SIZE' bytes iniciales antes de
+ *   entregar la misma memoria al interfaz.
+ *
+ * PARÁMETROS:
+ *       'iface': Manejador de la interfaz Ethernet por la que se quiere
+ *                enviar el paquete.
+ *         'dst': Dirección MAC del equipo destino.
+ *        'type': Valor del campo 'Tipo' de la trama Ethernet a enviar.
+ *       'frame': Buffer de al menos 'ETH_HEADROOM + payload_len' bytes. Los
+ *                datos a enviar deben estar ya en 'frame + ETH_HEADROOM'.
+ * 'payload_len': Longitud en bytes de los datos a enviar.
+ *
+ * VALOR DEVUELTO:
+ *   El número de bytes de datos que han podido ser enviados.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si se ha producido algún error.
+ */
+int eth_send_frame
+( eth_iface_t * iface,
+  mac_addr_t dst, uint16_t type, unsigned char * frame, int payload_len );
+
+
 /* int eth_recv 
  * ( eth_iface_t * iface, 
  *   mac_addr_t src, uint16_t type, unsigned char buffer[], long int timeout );
@@ -140,7 +260,10 @@ int eth_send
  *             memoria indicada, que debe estar reservada previamente.
  *     'type': Valor del campo 'Tipo' de la trama Ethernet que se desea
  *             recibir. 
- *             Las tramas con un valor 'type' diferente serán descartadas.
+ *             Las tramas con un valor 'type' diferente se entregan a su
+ *             manejador o se guardan en su cola si su tipo se ha registrado
+ *             (ver 'eth_register_handler()' y 'eth_register_queue()'), y se
+ *             descartan en caso contrario.
  *   'buffer': Array donde se almacenarán los datos de la trama recibida.
  *  'buf_len': Longitud del 'buffer' dónde se almacenarán los datos de la trama
  *             recibida. Si se reciben más datos de los que caben el en 'buffer'
@@ -163,6 +286,261 @@ int eth_recv
   int buf_len, long int timeout );
 
 
+/* int eth_send_burst ( eth_iface_t * iface, eth_msg_t msgs[], int num );
+ *
+ * DESCRIPCIÓN:
+ *   Esta función envía hasta 'num' tramas construidas "in situ" (ver
+ *   'eth_send_frame()') con el menor número posible de llamadas al sistema.
+ *   Para cada descriptor se usan los campos 'addr', 'type', 'frame' y
+ *   'payload_len'; sólo se escriben las cabeceras de cada trama.
+ *
+ *   Igual que 'eth_send()' y 'eth_send_frame()', puede llamarse desde varios
+ *   hilos a la vez sobre el mismo interfaz. Los tipos de enlace que sólo
+ *   admiten un productor ("mmap:", "xdp:", "uring:", "shm:", rawnet...) y
+ *   los interfaces con perturbaciones se serializan con un cerrojo; sólo
+ *   "packet:", "pipe:" y "tap:" envían de verdad en paralelo.
+ *
+ * PARÁMETROS:
+ *   'iface': Manejador de la interfaz Ethernet por la que se quiere enviar.
+ *    'msgs': Array de descriptores de las tramas a enviar.
+ *     'num': Número de descriptores en 'msgs'. Como mucho se enviarán
+ *            'ETH_BURST_MAX' tramas.
+ *
+ * VALOR DEVUELTO:
+ *   El número de tramas enviadas, que son siempre las primeras del array.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si no se ha podido enviar ninguna trama.
+ */
+int eth_send_burst ( eth_iface_t * iface, eth_msg_t msgs[], int num );
+
+
+/* int eth_recv_burst
+ * ( eth_iface_t * iface, uint16_t type, eth_msg_t msgs[], int num,
+ *   long int timeout );
+ *
+ * DESCRIPCIÓN:
+ *   Esta función espera como mucho 'timeout' milisegundos a que llegue alguna
+ *   trama del tipo indicado y devuelve todas las que ya estén disponibles,
+ *   hasta un máximo de 'num', sin volver a bloquearse.
+ *
+ *   Las tramas se escriben directamente en el buffer 'frame' de cada
+ *   descriptor y se rellenan 'addr', 'type' y 'payload_len'. Para no copiar
+ *   tramas descartadas, los buffers pueden intercambiarse entre descriptores
+ *   del mismo array.
+ *
+ *   Si 'msgs[0].frame' es NULL las tramas no se copian: 'frame' y
+ *   'frame_size' pasan a apuntar a memoria del propio interfaz (p.ej. el
+ *   anillo de un interfaz "mmap:"), válida hasta la siguiente recepción.
+ *
+ *   Si el tipo tiene cola (ver 'eth_register_queue()') y contiene tramas, se
+ *   devuelven éstas sin esperar. Las tramas de otros tipos se entregan a su
+ *   manejador o a su cola.
+ *
+ * PARÁMETROS:
+ *     'iface': Manejador de la interfaz Ethernet por la que se desea recibir.
+ *      'type': Valor del campo 'Tipo' de las tramas que se desea recibir.
+ *      'msgs': Array de descriptores con 'frame' y 'frame_size' rellenos.
+ *       'num': Número de descriptores en 'msgs' (como mucho 'ETH_BURST_MAX').
+ *   'timeout': Igual que en 'eth_recv()'.
+ *
+ * VALOR DEVUELTO:
+ *   El número de tramas recibidas, o '0' si ha expirado el temporizador.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si se ha producido algún error.
+ */
+int eth_recv_burst
+( eth_iface_t * iface, uint16_t type, eth_msg_t msgs[], int num,
+  long int timeout );
+
+
+/* int eth_set_filter
+ * ( eth_iface_t * iface, uint16_t types[], int ntypes,
+ *   mac_addr_t groups[], int ngroups );
+ *
+ * DESCRIPCIÓN:
+ *   Esta función restringe las tramas que se reciben por el interfaz a las
+ *   dirigidas a su dirección MAC, a la dirección de difusión o a uno de los
+ *   grupos multicast indicados, y cuyo campo 'Tipo' sea uno de los indicados.
+ *
+ *   En los interfaces nativos ("packet:" y "mmap:") se instala un filtro BPF
+ *   en el núcleo, de modo que el tráfico no deseado ni siquiera llega a la
+ *   aplicación. Con rawnet el filtro de grupos se aplica en 'eth_recv()'.
+ *
+ * PARÁMETROS:
+ *     'iface': Manejador de la interfaz Ethernet.
+ *     'types': Tipos de trama aceptados. Con 'ntypes' igual a 0 se acepta
+ *              cualquier tipo.
+ *    'ntypes': Número de tipos (como mucho 'ETH_FILTER_MAX_TYPES').
+ *    'groups': Direcciones MAC multicast aceptadas. Con 'ngroups' igual a 0
+ *              se acepta cualquier trama multicast.
+ *   'ngroups': Número de grupos (como mucho 'ETH_FILTER_MAX_GROUPS').
+ *
+ * VALOR DEVUELTO:
+ *   Devuelve 0 si el filtro se ha instalado correctamente.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si se ha producido algún error.
+ */
+int eth_set_filter
+( eth_iface_t * iface, uint16_t types[], int ntypes,
+  mac_addr_t groups[], int ngroups );
+
+
+/* int eth_register_queue ( eth_iface_t * iface, uint16_t type, int queue_len );
+ *
+ * DESCRIPCIÓN:
+ *   Esta función crea una cola de recepción para las tramas del tipo
+ *   indicado. Las tramas de ese tipo que lleguen mientras se espera otro
+ *   (p.ej. paquetes IPv4 durante 'arp_resolve()') se copian a la cola en
+ *   lugar de descartarse, y la siguiente llamada a 'eth_recv()' o
+ *   'eth_recv_burst()' con ese tipo las devuelve sin esperar, en orden de
+ *   llegada. Si la cola está llena se descarta la trama nueva.
+ *
+ * PARÁMETROS:
+ *       'iface': Manejador de la interfaz Ethernet.
+ *        'type': Valor del campo 'Tipo' de las tramas a encolar.
+ *   'queue_len': Número máximo de tramas en la cola. Con 0 se usa
+ *                'ETH_QUEUE_LEN'.
+ *
+ * VALOR DEVUELTO:
+ *   Devuelve 0 si la cola se ha creado correctamente.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si el tipo ya estaba registrado, si se han
+ *   registrado ya 'ETH_MAX_PROTOCOLS' tipos o si no hay memoria.
+ */
+int eth_register_queue ( eth_iface_t * iface, uint16_t type, int queue_len );
+
+
+/* int eth_register_handler
+ * ( eth_iface_t * iface, uint16_t type, eth_handler_t handler, void * arg );
+ *
+ * DESCRIPCIÓN:
+ *   Esta función registra una función que procesa inmediatamente las tramas
+ *   del tipo indicado que lleguen mientras se espera otro tipo, en lugar de
+ *   descartarlas (p.ej. responder peticiones ARP mientras se espera un
+ *   paquete IPv4). Las tramas que se esperan explícitamente con ese tipo se
+ *   siguen devolviendo al llamante de 'eth_recv()'.
+ *
+ *   El manejador puede enviar tramas, pero no debe recibir del mismo
+ *   interfaz.
+ *
+ * PARÁMETROS:
+ *     'iface': Manejador de la interfaz Ethernet.
+ *      'type': Valor del campo 'Tipo' de las tramas a procesar.
+ *   'handler': Función a la que se entrega cada trama.
+ *       'arg': Argumento que se pasa a 'handler' en cada llamada.
+ *
+ * VALOR DEVUELTO:
+ *   Devuelve 0 si el manejador se ha registrado correctamente.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si el tipo ya estaba registrado o si se han
+ *   registrado ya 'ETH_MAX_PROTOCOLS' tipos.
+ */
+int eth_register_handler
+( eth_iface_t * iface, uint16_t type, eth_handler_t handler, void * arg );
+
+
+/* unsigned char * eth_alloc_frame ( eth_iface_t * iface );
+ *
+ * DESCRIPCIÓN:
+ *   Esta función devuelve una trama de 'ETH_FRAME_MAX_LENGTH' bytes situada
+ *   directamente en el anillo de transmisión del interfaz, para construirla
+ *   "in situ" (datos en 'frame + ETH_HEADROOM') y enviarla después con
+ *   'eth_send_frame()' o 'eth_send_burst()' sin ninguna copia.
+ *
+ *   Toda trama obtenida así debe enviarse: las tramas del anillo salen en
+ *   orden y una trama reservada que no se envía retiene a las siguientes.
+ *   Por eso sólo un hilo puede reservar y enviar tramas del anillo; los
+ *   demás deben usar su propio buffer.
+ *
+ * PARÁMETROS:
+ *   'iface': Manejador de la interfaz Ethernet.
+ *
+ * VALOR DEVUELTO:
+ *   Puntero a la trama, o 'NULL' si el interfaz no tiene anillo de
+ *   transmisión. En ese caso el llamante debe usar su propio buffer.
+ */
+unsigned char * eth_alloc_frame ( eth_iface_t * iface );
+
+
+/* int eth_flush ( eth_iface_t * iface );
+ *
+ * DESCRIPCIÓN:
+ *   Esta función envía inmediatamente las tramas que el interfaz tenga
+ *   acumuladas en su anillo de transmisión. No es necesario llamarla antes
+ *   de 'eth_recv()', 'eth_poll()' o 'eth_close()', que ya lo hacen, pero sí
+ *   al final de un bucle que sólo envía.
+ *
+ *   También envía las tramas retenidas por las perturbaciones del interfaz
+ *   cuyo momento de salida ya ha llegado (ver 'eth_timeleft()').
+ *
+ * PARÁMETROS:
+ *   'iface': Manejador de la interfaz Ethernet.
+ *
+ * VALOR DEVUELTO:
+ *   El número de tramas que estaban pendientes de envío.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si se ha producido algún error.
+ */
+int eth_flush ( eth_iface_t * iface );
+
+
+/* long int eth_timeleft ( eth_iface_t * iface );
+ *
+ * DESCRIPCIÓN:
+ *   Esta función devuelve cuánto falta para que salga la siguiente trama
+ *   retenida por las perturbaciones del interfaz (ver
+ *   'eth_set_impairment()'). Un bucle que espera por su cuenta en el
+ *   descriptor de 'eth_getfd()' no debe hacerlo más de esto sin llamar a
+ *   'eth_flush()'; 'eth_recv()' y 'eth_poll()' ya lo tienen en cuenta.
+ *
+ * PARÁMETROS:
+ *   'iface': Manejador de la interfaz Ethernet.
+ *
+ * VALOR DEVUELTO:
+ *   Los milisegundos que faltan (0 si ya debería haber salido), o '-1' si no
+ *   hay tramas retenidas.
+ */
+long int eth_timeleft ( eth_iface_t * iface );
+
+
+/* int eth_getfd ( eth_iface_t * iface );
+ *
+ * DESCRIPCIÓN:
+ *   Esta función devuelve el descriptor de fichero en el que esperar con
+ *   poll()/epoll() a que lleguen tramas al interfaz.
+ *
+ * PARÁMETROS:
+ *   'iface': Manejador de la interfaz Ethernet.
+ *
+ * VALOR DEVUELTO:
+ *   El descriptor, o '-1' si el interfaz no tiene ninguno (interfaces de la
+ *   librería rawnet, que sólo se pueden consultar con 'eth_poll()').
+ */
+int eth_getfd ( eth_iface_t * iface );
+
+
+/* int eth_pending ( eth_iface_t * iface );
+ *
+ * DESCRIPCIÓN:
+ *   Esta función devuelve el número de tramas que esperan en las colas del
+ *   interfaz (ver 'eth_register_queue()'). Estas tramas ya no se notifican
+ *   en el descriptor de 'eth_getfd()'.
+ *
+ * PARÁMETROS:
+ *   'iface': Manejador de la interfaz Ethernet.
+ *
+ * VALOR DEVUELTO:
+ *   El número de tramas encoladas.
+ */
+int eth_pending ( eth_iface_t * iface );
+
+
 /* int eth_poll 
  * ( eth_iface_t * ifaces[], int ifnum, long int timeout );
  *
@@ -170,7 +548,8 @@ int eth_recv
  *   Esta función permite esperar paquetes en múltiples interfaces Ethernet
  *   simultaneamente. Cuando alguna de las interfaces indicadas reciba una
  *   trama, la función devolverá la primera interfaz que tiene una trama
- *   listo para ser recibida mediante la funcion 'eth_recv()'.
+ *   listo para ser recibida mediante la funcion 'eth_recv()'. Un interfaz
+ *   con tramas en alguna de sus colas se considera listo sin esperar.
  *
  *   Esta operación puede escuchar de los interfaces Ethernet indefinidamente
  *   o un tiempo limitado dependiento del parámetro 'timeout'.
@@ -196,6 +575,74 @@ int eth_poll
 ( eth_iface_t * ifaces[], int ifnum, long int timeout );
 
 
+/* int eth_get_stats ( eth_iface_t * iface, eth_stats_t * stats );
+ *
+ * DESCRIPCIÓN:
+ *   Esta función copia en 'stats' los contadores del interfaz desde que se
+ *   abrió. Los contadores se actualizan sin cerrojos, así que puede llamarse
+ *   desde otro hilo mientras se envía y recibe; cada contador es coherente
+ *   por sí mismo, pero no necesariamente con los demás.
+ *
+ * PARÁMETROS:
+ *   'iface': Manejador de la interfaz Ethernet.
+ *   'stats': Estructura donde se copian los contadores.
+ *
+ * VALOR DEVUELTO:
+ *   Devuelve 0 si se han copiado los contadores.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si se ha producido algún error.
+ */
+int eth_get_stats ( eth_iface_t * iface, eth_stats_t * stats );
+
+
+/* int eth_set_capture ( eth_iface_t * iface, eth_capture_t * cap );
+ *
+ * DESCRIPCIÓN:
+ *   Asocia el interfaz a una captura pcapng (ver 'eth_capture_open()'). A
+ *   partir de ese momento todas las tramas que se envían y todas las que se
+ *   leen del enlace (antes de filtrarlas) se copian a la captura, y ya no se
+ *   imprimen en la salida estándar al enviarlas.
+ *
+ * PARÁMETROS:
+ *   'iface': Manejador de la interfaz Ethernet.
+ *     'cap': Captura a la que se añade el interfaz, o 'NULL' para dejar de
+ *            capturar.
+ *
+ * VALOR DEVUELTO:
+ *   Devuelve 0 si se ha asociado (o desasociado) la captura.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si se ha producido algún error.
+ */
+int eth_set_capture ( eth_iface_t * iface, eth_capture_t * cap );
+
+
+/* int eth_set_impairment ( eth_iface_t * iface, eth_impair_config_t * config );
+ *
+ * DESCRIPCIÓN:
+ *   Interpone entre 'eth_send()' y el enlace una etapa que emula un enlace
+ *   degradado: pérdidas, duplicados, retraso fijo y variable, desorden y
+ *   caudal limitado (ver 'eth_impair_config_t'). Las decisiones aleatorias
+ *   salen de 'config->seed', así que las pruebas son reproducibles.
+ *
+ *   Las tramas descartadas se cuentan en 'tx_drop_impaired'; las retenidas
+ *   se cuentan como enviadas cuando salen de verdad al enlace.
+ *
+ * PARÁMETROS:
+ *    'iface': Manejador de la interfaz Ethernet.
+ *   'config': Perturbaciones a aplicar, o 'NULL' para quitarlas. Las tramas
+ *             que tuviera retenidas la configuración anterior se descartan.
+ *
+ * VALOR DEVUELTO:
+ *   Devuelve 0 si se ha cambiado la configuración.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si se ha producido algún error.
+ */
+int eth_set_impairment ( eth_iface_t * iface, eth_impair_config_t * config );
+
+
 /* int eth_close ( eth_iface_t * iface );
  * 
  * DESCRIPCIÓN:
@@ -0,0 +1,100 @@
+#ifndef _ETH_BACKEND_H
+#define _ETH_BACKEND_H
+
+#include "eth.h"
+
+/* Tipos de enlace ("backends") sobre los que funciona un 'eth_iface_t'.
+ *
+ * Cada tipo de enlace es una tabla de operaciones sobre un manejador propio
+ * ('dev') que 'eth.c' trata como opaco. 'eth_open()' elige el tipo según el
+ * prefijo del nombre del interfaz:
+ *
+ *   "eth0"        librería rawnet (por defecto)
+ *   "packet:eth0" socket AF_PACKET nativo con sendmmsg()/recvmmsg()
+ *   "mmap:eth0"   socket AF_PACKET con anillos TPACKET_V3 mapeados
+ *   "xdp:eth0"    socket AF_XDP con UMEM y anillos compartidos con el núcleo
+ *   "uring:eth0"  socket AF_PACKET con envíos y recepciones asíncronos en
+ *                 un io_uring
+ *   "tap:tap0"    interfaz TAP del núcleo (/dev/net/tun)
+ *   "pipe:lab"    tubería en memoria entre los dos interfaces abiertos con
+ *                 el mismo nombre, en el mismo proceso o en dos distintos
+ *   "shm:lab/r1"  extremo "r1" de un segmento Ethernet en memoria compartida,
+ *                 con tantos extremos como se quiera ("shm:lab/r1,MAC")
+ *   "file:a.pcap"  tramas leídas de un fichero pcap/pcapng, tan rápido como
+ *                 se pueda; "file:a.pcap,b.pcap" guarda las enviadas en b.pcap
+ *   "replay:a.pcap" igual, respetando los tiempos de la captura
+ *
+ * Las operaciones marcadas como opcionales pueden ser NULL.
+ */
+typedef struct eth_backend {
+    /* Prefijo del nombre del interfaz en 'eth_open()', "" para rawnet */
+    const char *prefix;
+
+    /* Abre el interfaz 'ifname' (sin el prefijo). Devuelve NULL si falla. */
+    void * (*open) ( char * ifname );
+
+    /* Nombre y dirección MAC del interfaz */
+    char * (*getname) ( void * dev );
+    void (*getaddr) ( void * dev, mac_addr_t addr );
+
+    /* Opcional. Descriptor en el que esperar con poll()/epoll(), o -1. */
+    int (*getfd) ( void * dev );
+
+    /* Sólo para enlaces sin descriptor. Espera como mucho 'timeout'
+       milisegundos a que alguno de los 'num' interfaces tenga una trama, y
+       devuelve su índice, '-2' si ha expirado el temporizador o '-1' si se
+       ha producido algún error. */
+    int (*poll) ( void * devs[], int num, long int timeout );
+
+    /* Igual que 'eth_packet_send()' y 'eth_packet_recv()' */
+    int (*send) ( void * dev, unsigned char * frames[], int lens[], int num );
+    int (*recv) ( void * dev, unsigned char * bufs[], int sizes[], int lens[],
+                  int num, long int timeout );
+
+    /* Opcional. Indica si 'recv' admite 'bufs[i] == NULL' para prestar
+       tramas de la memoria del propio interfaz. */
+    int (*can_lend) ( void * dev );
+
+    /* Opcionales. Igual que 'eth_alloc_frame()', 'eth_flush()' y
+       'eth_set_filter()'. */
+    unsigned char * (*tx_alloc) ( void * dev );
+    int (*flush) ( void * dev );
+    int (*set_filter) ( void * dev, uint16_t types[], int ntypes,
+                        mac_addr_t groups[], int ngroups );
+
+    /* Cierra el interfaz y libera 'dev' */
+    int (*close) ( void * dev );
+
+    /* 1 si 'send' puede llamarse desde varios hilos a la vez sobre el mismo
+       'dev' (cada llamada es un envío independiente al núcleo). Si es 0,
+       'eth.c' serializa los envíos del interfaz con un cerrojo. */
+    int shared_send;
+} eth_backend_t;
+
+/* Tipos de enlace disponibles */
+extern const eth_backend_t eth_rawnet_backend; /* eth_rawnet.c */
+extern const eth_backend_t eth_packet_backend; /* eth_packet.c */
+extern const eth_backend_t eth_mmap_backend;   /* eth_packet.c */
+extern const eth_backend_t eth_xdp_backend;    /* eth_xdp.c */
+extern const eth_backend_t eth_uring_backend;  /* eth_uring.c */
+extern const eth_backend_t eth_tap_backend;    /* eth_tap.c */
+extern const eth_backend_t eth_pipe_backend;   /* eth_pipe.c */
+extern const eth_backend_t eth_shm_backend;    /* eth_shm.c */
+extern const eth_backend_t eth_file_backend;   /* eth_file.c */
+extern const eth_backend_t eth_replay_backend; /* eth_file.c */
+
+
+/* eth_iface_t * eth_open_backend ( const eth_backend_t * backend, char * ifname );
+ *
+ * DESCRIPCIÓN:
+ *   Igual que 'eth_open()', pero con el tipo de enlace indicado en lugar de
+ *   elegirlo por el prefijo de 'ifname'. Permite usar tipos de enlace
+ *   definidos fuera de esta librería.
+ *
+ * VALOR DEVUELTO:
+ *   Manejador de la interfaz Ethernet, o 'NULL' si se ha producido algún
+ *   error.
+ */
+eth_iface_t * eth_open_backend ( const eth_backend_t * backend, char * ifname );
+
+#endif /* _ETH_BACKEND_H */
@@ -0,0 +1,439 @@
+#include "eth_capture.h"
+#include "eth.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+/* Hueco del anillo. 'seq' indica de quién es el hueco (algoritmo de colas
+   acotadas de D. Vyukov): vale 'pos' cuando está libre para el productor
+   de la posición 'pos', y 'pos + 1' cuando ya está lleno para el escritor. */
+struct eth_capture_slot {
+    uint64_t seq;
+    uint64_t timestamp;         /* Nanosegundos desde el 1/1/1970 */
+    int kind;                   /* ETH_CAPTURE_FRAME o ETH_CAPTURE_IFACE */
+    int if_id;
+    int direction;
+    int frame_len;              /* Longitud real de la trama */
+    int data_len;               /* Bytes guardados en 'data' */
+    unsigned char data[ETH_FRAME_MAX_LENGTH]; /* Trama, o nombre del interfaz */
+};
+
+/* Tipos de registro del anillo */
+#define ETH_CAPTURE_FRAME 0
+#define ETH_CAPTURE_IFACE 1
+
+/* Estructura de una captura */
+struct eth_capture {
+    FILE *file;
+    int error;                  /* 1 si ha fallado alguna escritura */
+    pthread_t writer;
+
+    struct eth_capture_slot *ring;
+    uint64_t ring_mask;         /* Número de huecos - 1 (potencia de 2) */
+    uint64_t tail;              /* Siguiente posición a llenar (productores) */
+    uint64_t head;              /* Siguiente posición a escribir (escritor) */
+
+    pthread_mutex_t iface_lock; /* Reparte los identificadores de interfaz
+                                   en el mismo orden que sus descripciones
+                                   entran en el anillo */
+    int nifaces;                /* Interfaces añadidos */
+    uint64_t stalls;            /* Esperas por anillo lleno */
+    int stop;                   /* 1 cuando el escritor debe terminar */
+};
+
+/* Tiempo que duerme el escritor cuando el anillo está vacío */
+#define ETH_CAPTURE_IDLE_NS 1000000
+
+/* Buffer de escritura del fichero */
+#define ETH_CAPTURE_FILE_BUFFER (1 << 20)
+
+/* Bloques y opciones de pcapng */
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_LINKTYPE_ETHERNET 1
+#define PCAPNG_OPT_ENDOFOPT 0
+#define PCAPNG_OPT_IF_NAME 2
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define PCAPNG_OPT_EPB_FLAGS 2
+
+/* Longitud de 'len' redondeada a múltiplo de 4 */
+#define PCAPNG_PAD(len) (((len) + 3) & ~3)
+
+
+/* static void eth_capture_put
+ * ( eth_capture_t * cap, const void * data, size_t len );
+ *
+ * DESCRIPCIÓN:
+ *   Escribe 'len' bytes en el fichero, seguidos del relleno hasta múltiplo
+ *   de 4.
+ */
+static void eth_capture_put(eth_capture_t *cap, const void *data, size_t len) {
+    static const unsigned char padding[3] = {0, 0, 0};
+
+    if ((fwrite(data, 1, len, cap->file) != len) ||
+        (fwrite(padding, 1, PCAPNG_PAD(len) - len, cap->file) != PCAPNG_PAD(len) - len)) {
+        cap->error = 1;
+    }
+}
+
+
+/* static void eth_capture_put_option
+ * ( eth_capture_t * cap, uint16_t code, const void * value, uint16_t len );
+ */
+static void eth_capture_put_option
+        (eth_capture_t *cap, uint16_t code, const void *value, uint16_t len) {
+    uint16_t header[2] = {code, len};
+    eth_capture_put(cap, header, sizeof(header));
+    if (len > 0) {
+        eth_capture_put(cap, value, len);
+    }
+}
+
+
+/* static void eth_capture_write_shb ( eth_capture_t * cap );
+ *
+ * DESCRIPCIÓN:
+ *   Escribe la cabecera de sección (Section Header Block) del fichero.
+ */
+static void eth_capture_write_shb(eth_capture_t *cap) {
+    uint32_t block[7];
+    block[0] = PCAPNG_SHB;
+    block[1] = sizeof(block);
+    block[2] = PCAPNG_BYTE_ORDER_MAGIC;
+    block[3] = 1;                         /* Versión 1.0 */
+    block[4] = 0xFFFFFFFF;                /* Longitud de sección desconocida */
+    block[5] = 0xFFFFFFFF;
+    block[6] = sizeof(block);
+    eth_capture_put(cap, block, sizeof(block));
+}
+
+
+/* static void eth_capture_write_idb
+ * ( eth_capture_t * cap, struct eth_capture_slot * slot );
+ *
+ * DESCRIPCIÓN:
+ *   Escribe la descripción de un interfaz (Interface Description Block),
+ *   con su nombre y marcas de tiempo en nanosegundos.
+ */
+static void eth_capture_write_idb(eth_capture_t *cap, struct eth_capture_slot *slot) {
+    uint8_t tsresol = 9;
+    uint32_t len = 20 + 4 + PCAPNG_PAD(slot->data_len) + 4 + 4 + 4;
+
+    uint32_t header[4];
+    header[0] = PCAPNG_IDB;
+    header[1] = len;
+    header[2] = PCAPNG_LINKTYPE_ETHERNET;  /* Tipo de enlace y reservado */
+    header[3] = ETH_FRAME_MAX_LENGTH;     /* snaplen */
+    eth_capture_put(cap, header, sizeof(header));
+    eth_capture_put_option(cap, PCAPNG_OPT_IF_NAME, slot->data, slot->data_len);
+    eth_capture_put_option(cap, PCAPNG_OPT_IF_TSRESOL, &tsresol, 1);
+    eth_capture_put_option(cap, PCAPNG_OPT_ENDOFOPT, NULL, 0);
+    eth_capture_put(cap, &len, sizeof(len));
+}
+
+
+/* static void eth_capture_write_epb
+ * ( eth_capture_t * cap, struct eth_capture_slot * slot );
+ *
+ * DESCRIPCIÓN:
+ *   Escribe una trama (Enhanced Packet Block), con su sentido en la opción
+ *   'epb_flags'.
+ */
+static void eth_capture_write_epb(eth_capture_t *cap, struct eth_capture_slot *slot) {
+    uint32_t flags = slot->direction;
+    uint32_t len = 28 + PCAPNG_PAD(slot->data_len) + 4 + 4 + 4 + 4;
+
+    uint32_t header[7];
+    header[0] = PCAPNG_EPB;
+    header[1] = len;
+    header[2] = slot->if_id;
+    header[3] = (uint32_t) (slot->timestamp >> 32);
+    header[4] = (uint32_t) slot->timestamp;
+    header[5] = slot->data_len;
+    header[6] = slot->frame_len;
+    eth_capture_put(cap, header, sizeof(header));
+    eth_capture_put(cap, slot->data, slot->data_len);
+    eth_capture_put_option(cap, PCAPNG_OPT_EPB_FLAGS, &flags, sizeof(flags));
+    eth_capture_put_option(cap, PCAPNG_OPT_ENDOFOPT, NULL, 0);
+    eth_capture_put(cap, &len, sizeof(len));
+}
+
+
+/* static void * eth_capture_writer ( void * arg );
+ *
+ * DESCRIPCIÓN:
+ *   Hilo escritor: vuelca los registros del anillo en orden y, cuando lo
+ *   encuentra vacío, vacía el buffer del fichero y duerme un momento.
+ */
+static void *eth_capture_writer(void *arg) {
+    eth_capture_t *cap = arg;
+    uint64_t ring_len = cap->ring_mask + 1;
+
+    for (;;) {
+        struct eth_capture_slot *slot = &cap->ring[cap->head & cap->ring_mask];
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+        if (seq != cap->head + 1) {
+            /* Anillo vacío */
+            if (__atomic_load_n(&cap->stop, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            fflush(cap->file);
+            struct timespec idle = {0, ETH_CAPTURE_IDLE_NS};
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        if (slot->kind == ETH_CAPTURE_IFACE) {
+            eth_capture_write_idb(cap, slot);
+        } else {
+            eth_capture_write_epb(cap, slot);
+        }
+
+        /* Devolver el hueco a los productores de la siguiente vuelta */
+        __atomic_store_n(&slot->seq, cap->head + ring_len, __ATOMIC_RELEASE);
+        cap->head++;
+    }
+
+    return NULL;
+}
+
+
+/* static struct eth_capture_slot * eth_capture_reserve
+ * ( eth_capture_t * cap, uint64_t * pos );
+ *
+ * DESCRIPCIÓN:
+ *   Reserva el siguiente hueco libre del anillo, esperando al escritor si
+ *   está lleno. Devuelve el hueco y su posición en 'pos'.
+ */
+static struct eth_capture_slot *eth_capture_reserve(eth_capture_t *cap, uint64_t *pos) {
+    uint64_t tail = __atomic_load_n(&cap->tail, __ATOMIC_RELAXED);
+
+    for (;;) {
+        struct eth_capture_slot *slot = &cap->ring[tail & cap->ring_mask];
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t) seq - (int64_t) tail;
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&cap->tail, &tail, tail + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *pos = tail;
+                return slot;
+            }
+            /* Otro productor se ha llevado el hueco; 'tail' ya está
+               actualizado */
+        } else if (diff < 0) {
+            /* Anillo lleno: esperar a que el escritor libere el hueco */
+            __atomic_fetch_add(&cap->stalls, 1, __ATOMIC_RELAXED);
+            sched_yield();
+            tail = __atomic_load_n(&cap->tail, __ATOMIC_RELAXED);
+        } else {
+            tail = __atomic_load_n(&cap->tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+
+/* static void eth_capture_push
+ * ( eth_capture_t * cap, int kind, int if_id, int direction,
+ *   const void * data, int data_len, int frame_len );
+ *
+ * DESCRIPCIÓN:
+ *   Copia un registro al anillo y lo publica para el escritor.
+ */
+static void eth_capture_push
+        (eth_capture_t *cap, int kind, int if_id, int direction,
+         const void *data, int data_len, int frame_len) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    uint64_t pos;
+    struct eth_capture_slot *slot = eth_capture_reserve(cap, &pos);
+    slot->timestamp = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+    slot->kind = kind;
+    slot->if_id = if_id;
+    slot->direction = direction;
+    slot->frame_len = frame_len;
+    if (data_len > ETH_FRAME_MAX_LENGTH) {
+        data_len = ETH_FRAME_MAX_LENGTH;
+    }
+    slot->data_len = data_len;
+    memcpy(slot->data, data, data_len);
+
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+
+/* eth_capture_t * eth_capture_open ( char * path, int ring_len );
+ *
+ * DESCRIPCIÓN:
+ *   Crea el fichero pcapng 'path' y arranca el hilo escritor.
+ *
+ * PARÁMETROS:
+ *       'path': Ruta del fichero a crear (se trunca si existe).
+ *   'ring_len': Número de tramas del anillo. Con 0 se usa
+ *               'ETH_CAPTURE_RING'.
+ *
+ * VALOR DEVUELTO:
+ *   Manejador de la captura, o 'NULL' si se ha producido algún error.
+ */
+eth_capture_t *eth_capture_open(char *path, int ring_len) {
+    if ((path == NULL) || (ring_len < 0)) {
+        fprintf(stderr, "eth_capture_open(): ERROR: parámetros incorrectos\n");
+        return NULL;
+    }
+    if (ring_len == 0) {
+        ring_len = ETH_CAPTURE_RING;
+    }
+
+    eth_capture_t *cap = calloc(1, sizeof(struct eth_capture));
+    if (cap == NULL) {
+        fprintf(stderr, "eth_capture_open(): ERROR en calloc()\n");
+        return NULL;
+    }
+
+    /* El anillo tiene un número de huecos potencia de 2 */
+    uint64_t slots = 1;
+    while (slots < (uint64_t) ring_len) {
+        slots <<= 1;
+    }
+    cap->ring = malloc(slots * sizeof(struct eth_capture_slot));
+    if (cap->ring == NULL) {
+        fprintf(stderr, "eth_capture_open(): ERROR en malloc()\n");
+        free(cap);
+        return NULL;
+    }
+    cap->ring_mask = slots - 1;
+    uint64_t i;
+    for (i = 0; i < slots; i++) {
+        cap->ring[i].seq = i;
+    }
+
+    cap->file = fopen(path, "wb");
+    if (cap->file == NULL) {
+        fprintf(stderr, "eth_capture_open(): ERROR en fopen(%s): %s\n",
+                path, strerror(errno));
+        free(cap->ring);
+        free(cap);
+        return NULL;
+    }
+    setvbuf(cap->file, NULL, _IOFBF, ETH_CAPTURE_FILE_BUFFER);
+    eth_capture_write_shb(cap);
+
+    pthread_mutex_init(&cap->iface_lock, NULL);
+    int err = pthread_create(&cap->writer, NULL, eth_capture_writer, cap);
+    if (err != 0) {
+        fprintf(stderr, "eth_capture_open(): ERROR en pthread_create(): %s\n",
+                strerror(err));
+        pthread_mutex_destroy(&cap->iface_lock);
+        fclose(cap->file);
+        free(cap->ring);
+        free(cap);
+        return NULL;
+    }
+
+    return cap;
+}
+
+
+/* int eth_capture_add_iface ( eth_capture_t * cap, char * name );
+ *
+ * DESCRIPCIÓN:
+ *   Añade un interfaz a la captura. Normalmente no se llama directamente
+ *   sino a través de 'eth_set_capture()'.
+ *
+ * VALOR DEVUELTO:
+ *   Identificador del interfaz en el fichero, o '-1' si no caben más.
+ */
+int eth_capture_add_iface(eth_capture_t *cap, char *name) {
+    if ((cap == NULL) || (name == NULL)) {
+        return -1;
+    }
+
+    /* El identificador es la posición de su descripción en el fichero, así
+       que se asigna y se encola sin que otro interfaz se cuele en medio */
+    pthread_mutex_lock(&cap->iface_lock);
+    int if_id = cap->nifaces;
+    if (if_id >= ETH_CAPTURE_MAX_IFACES) {
+        pthread_mutex_unlock(&cap->iface_lock);
+        fprintf(stderr, "eth_capture_add_iface(): ERROR: demasiados interfaces\n");
+        return -1;
+    }
+    cap->nifaces++;
+
+    /* La descripción del interfaz pasa por el anillo para que llegue al
+       fichero antes que sus tramas */
+    eth_capture_push(cap, ETH_CAPTURE_IFACE, if_id, 0, name, strlen(name), 0);
+    pthread_mutex_unlock(&cap->iface_lock);
+
+    return if_id;
+}
+
+
+/* void eth_capture_frame
+ * ( eth_capture_t * cap, int if_id, int direction,
+ *   unsigned char * frame, int frame_len );
+ *
+ * DESCRIPCIÓN:
+ *   Copia una trama al anillo de la captura. Puede llamarse desde varios
+ *   hilos a la vez. 'direction' es 'ETH_CAPTURE_IN' o 'ETH_CAPTURE_OUT'.
+ */
+void eth_capture_frame
+        (eth_capture_t *cap, int if_id, int direction,
+         unsigned char *frame, int frame_len) {
+    if ((cap != NULL) && (if_id >= 0) && (frame_len >= 0)) {
+        eth_capture_push(cap, ETH_CAPTURE_FRAME, if_id, direction,
+                         frame, frame_len, frame_len);
+    }
+}
+
+
+/* uint64_t eth_capture_stalls ( eth_capture_t * cap );
+ *
+ * DESCRIPCIÓN:
+ *   Devuelve cuántas veces se ha tenido que esperar al escritor porque el
+ *   anillo estaba lleno. Si no es 0 conviene un anillo mayor.
+ */
+uint64_t eth_capture_stalls(eth_capture_t *cap) {
+    return (cap != NULL) ? __atomic_load_n(&cap->stalls, __ATOMIC_RELAXED) : 0;
+}
+
+
+/* int eth_capture_close ( eth_capture_t * cap );
+ *
+ * DESCRIPCIÓN:
+ *   Espera a que el escritor vuelque todas las tramas del anillo, cierra el
+ *   fichero y libera la captura. Antes deben haberse desasociado o cerrado
+ *   todos sus interfaces.
+ *
+ * VALOR DEVUELTO:
+ *   '0' si el fichero se ha escrito correctamente, '-1' en caso contrario.
+ */
+int eth_capture_close(eth_capture_t *cap) {
+    if (cap == NULL) {
+        return -1;
+    }
+
+    __atomic_store_n(&cap->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(cap->writer, NULL);
+
+    if (fclose(cap->file) != 0) {
+        cap->error = 1;
+    }
+    int err = cap->error ? -1 : 0;
+    if (err == -1) {
+        fprintf(stderr, "eth_capture_close(): ERROR al escribir la captura\n");
+    }
+    pthread_mutex_destroy(&cap->iface_lock);
+    free(cap->ring);
+    free(cap);
+
+    return err;
+}
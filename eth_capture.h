@@ -0,0 +1,92 @@
+#ifndef _ETH_CAPTURE_H
+#define _ETH_CAPTURE_H
+
+#include <stdint.h>
+
+/* Captura de tramas a un fichero pcapng.
+ *
+ * 'eth_send()'/'eth_recv()' copian cada trama de los interfaces asociados
+ * (ver 'eth_set_capture()') a un anillo sin cerrojos, y un hilo escritor las
+ * vuelca al fichero en segundo plano. Cada registro lleva la marca de tiempo
+ * en nanosegundos, el interfaz y el sentido (entrada o salida), así que se
+ * puede dejar activa sin el coste de imprimir las tramas al enviarlas.
+ *
+ * La captura no pierde tramas: si el anillo se llena porque el disco no da
+ * abasto, quien envía o recibe espera a que el escritor libere un hueco.
+ */
+typedef struct eth_capture eth_capture_t;
+
+/* Número de tramas del anillo por defecto */
+#define ETH_CAPTURE_RING 4096
+
+/* Número máximo de interfaces por captura */
+#define ETH_CAPTURE_MAX_IFACES 32
+
+/* Sentido de una trama capturada */
+#define ETH_CAPTURE_IN 1
+#define ETH_CAPTURE_OUT 2
+
+
+/* eth_capture_t * eth_capture_open ( char * path, int ring_len );
+ *
+ * DESCRIPCIÓN:
+ *   Crea el fichero pcapng 'path' y arranca el hilo escritor.
+ *
+ * PARÁMETROS:
+ *       'path': Ruta del fichero a crear (se trunca si existe).
+ *   'ring_len': Número de tramas del anillo. Con 0 se usa
+ *               'ETH_CAPTURE_RING'.
+ *
+ * VALOR DEVUELTO:
+ *   Manejador de la captura, o 'NULL' si se ha producido algún error.
+ */
+eth_capture_t * eth_capture_open ( char * path, int ring_len );
+
+
+/* int eth_capture_add_iface ( eth_capture_t * cap, char * name );
+ *
+ * DESCRIPCIÓN:
+ *   Añade un interfaz a la captura. Normalmente no se llama directamente
+ *   sino a través de 'eth_set_capture()'.
+ *
+ * VALOR DEVUELTO:
+ *   Identificador del interfaz en el fichero, o '-1' si no caben más.
+ */
+int eth_capture_add_iface ( eth_capture_t * cap, char * name );
+
+
+/* void eth_capture_frame
+ * ( eth_capture_t * cap, int if_id, int direction,
+ *   unsigned char * frame, int frame_len );
+ *
+ * DESCRIPCIÓN:
+ *   Copia una trama al anillo de la captura. Puede llamarse desde varios
+ *   hilos a la vez. 'direction' es 'ETH_CAPTURE_IN' o 'ETH_CAPTURE_OUT'.
+ */
+void eth_capture_frame
+( eth_capture_t * cap, int if_id, int direction,
+  unsigned char * frame, int frame_len );
+
+
+/* uint64_t eth_capture_stalls ( eth_capture_t * cap );
+ *
+ * DESCRIPCIÓN:
+ *   Devuelve cuántas veces se ha tenido que esperar al escritor porque el
+ *   anillo estaba lleno. Si no es 0 conviene un anillo mayor.
+ */
+uint64_t eth_capture_stalls ( eth_capture_t * cap );
+
+
+/* int eth_capture_close ( eth_capture_t * cap );
+ *
+ * DESCRIPCIÓN:
+ *   Espera a que el escritor vuelque todas las tramas del anillo, cierra el
+ *   fichero y libera la captura. Antes deben haberse desasociado o cerrado
+ *   todos sus interfaces.
+ *
+ * VALOR DEVUELTO:
+ *   '0' si el fichero se ha escrito correctamente, '-1' en caso contrario.
+ */
+int eth_capture_close ( eth_capture_t * cap );
+
+#endif /* _ETH_CAPTURE_H */
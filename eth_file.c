@@ -0,0 +1,574 @@
+#include "eth_backend.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Tipos de enlace "file:" y "replay:": un interfaz que recibe las tramas
+   Ethernet de un fichero pcap o pcapng en lugar de la red, para medir el
+   camino de recepción con tráfico real sin red ni privilegios.
+
+     "file:entrada.pcapng"             tan rápido como se lean
+     "replay:entrada.pcap"             respetando los tiempos de la captura
+     "file:entrada.pcap,salida.pcap"   las tramas enviadas van a 'salida.pcap'
+
+   Sin fichero de salida las tramas enviadas se descartan. El fichero de
+   entrada se mapea en memoria y las tramas se prestan sin copiarlas. Al
+   llegar al final del fichero 'eth_recv()' devuelve un error, para que los
+   bucles de recepción terminen.
+
+   La dirección MAC del interfaz es el destino de la primera trama unicast
+   del fichero, de modo que el tráfico se recibe como lo recibió el equipo
+   en el que se capturó. */
+
+/* Número máximo de interfaces de un fichero pcapng */
+#define ETH_FILE_MAX_IFACES 32
+
+/* Formatos de fichero */
+#define PCAP_MAGIC_US 0xA1B2C3D4
+#define PCAP_MAGIC_NS 0xA1B23C4D
+#define PCAP_HEADER_SIZE 24
+#define PCAP_RECORD_SIZE 16
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_PB  0x00000002
+#define PCAPNG_SPB 0x00000003
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define LINKTYPE_ETHERNET 1
+
+/* Manejador de un interfaz leído de fichero */
+struct eth_file {
+    char *name;                 /* Nombre, sin el prefijo */
+    int realtime;               /* 1 si se respetan los tiempos ("replay:") */
+    mac_addr_t mac_address;
+
+    unsigned char *data;        /* Fichero de entrada mapeado en memoria */
+    size_t size;
+    size_t offset;              /* Posición del siguiente registro */
+    int pcapng;                 /* 1 si es pcapng, 0 si es pcap */
+    int swapped;                /* 1 si el orden de bytes es el contrario */
+    uint64_t pcap_ns;           /* pcap: nanosegundos por unidad de fracción */
+    int niface;                 /* pcapng: interfaces de la sección */
+    int linktype[ETH_FILE_MAX_IFACES];
+    int tsresol[ETH_FILE_MAX_IFACES]; /* Valor de 'if_tsresol' (6 por defecto) */
+
+    /* Siguiente trama del fichero */
+    int eof;
+    unsigned char *frame;
+    int frame_len;
+    uint64_t frame_ts;          /* Nanosegundos */
+
+    /* Reproducción en tiempo real */
+    int started;
+    uint64_t first_ts;          /* Marca de tiempo de la primera trama */
+    uint64_t start;             /* CLOCK_MONOTONIC al recibirla */
+
+    FILE *out;                  /* Fichero pcap de salida, o NULL */
+};
+
+
+static uint16_t eth_file_rd16(struct eth_file *file, const unsigned char *p) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return file->swapped ? __builtin_bswap16(v) : v;
+}
+
+
+static uint32_t eth_file_rd32(struct eth_file *file, const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return file->swapped ? __builtin_bswap32(v) : v;
+}
+
+
+static uint64_t eth_file_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+/* static uint64_t eth_file_pcapng_ts
+ * ( struct eth_file * file, int if_id, uint64_t ts );
+ *
+ * DESCRIPCIÓN:
+ *   Convierte una marca de tiempo pcapng a nanosegundos según el
+ *   'if_tsresol' de su interfaz: 10^-N segundos, o 2^-N con el bit alto.
+ */
+static uint64_t eth_file_pcapng_ts(struct eth_file *file, int if_id, uint64_t ts) {
+    int tsresol = file->tsresol[if_id];
+    int exp = tsresol & 0x7F;
+
+    if (tsresol & 0x80) {
+        return (uint64_t) ((long double) ts * 1e9L / (long double) (1ULL << exp));
+    }
+    for (; exp < 9; exp++) {
+        ts *= 10;
+    }
+    for (; exp > 9; exp--) {
+        ts /= 10;
+    }
+
+    return ts;
+}
+
+
+/* static void eth_file_pcapng_idb
+ * ( struct eth_file * file, unsigned char * block, uint32_t block_len );
+ *
+ * DESCRIPCIÓN:
+ *   Registra un interfaz de la sección con su tipo de enlace y su
+ *   resolución de marcas de tiempo.
+ */
+static void eth_file_pcapng_idb
+        (struct eth_file *file, unsigned char *block, uint32_t block_len) {
+    if ((file->niface >= ETH_FILE_MAX_IFACES) || (block_len < 20)) {
+        return;
+    }
+    int if_id = file->niface++;
+    file->linktype[if_id] = eth_file_rd16(file, block + 8);
+    file->tsresol[if_id] = 6;
+
+    /* Opciones: código, longitud y valor rellenado a múltiplo de 4 */
+    uint32_t opt = 16;
+    while (opt + 4 <= block_len - 4) {
+        uint16_t code = eth_file_rd16(file, block + opt);
+        uint16_t len = eth_file_rd16(file, block + opt + 2);
+        if ((code == 0) || (opt + 4 + len > block_len - 4)) {
+            break;
+        }
+        if ((code == PCAPNG_OPT_IF_TSRESOL) && (len >= 1)) {
+            file->tsresol[if_id] = block[opt + 4];
+        }
+        opt += 4 + ((len + 3) & ~3);
+    }
+}
+
+
+/* static void eth_file_next ( struct eth_file * file );
+ *
+ * DESCRIPCIÓN:
+ *   Avanza hasta la siguiente trama Ethernet del fichero, saltando los
+ *   bloques y tramas de otros tipos de enlace, y la deja en
+ *   'frame'/'frame_len'/'frame_ts'. Al final del fichero, o si el
+ *   fichero está cortado, activa 'eof'.
+ */
+static void eth_file_next(struct eth_file *file) {
+    while (!file->eof) {
+        unsigned char *rec = file->data + file->offset;
+        size_t left = file->size - file->offset;
+
+        if (!file->pcapng) {
+            if (left < PCAP_RECORD_SIZE) {
+                break;
+            }
+            uint32_t caplen = eth_file_rd32(file, rec + 8);
+            if (caplen > left - PCAP_RECORD_SIZE) {
+                break;
+            }
+            file->frame = rec + PCAP_RECORD_SIZE;
+            file->frame_len = caplen;
+            file->frame_ts = (uint64_t) eth_file_rd32(file, rec) * 1000000000 +
+                             (uint64_t) eth_file_rd32(file, rec + 4) * file->pcap_ns;
+            file->offset += PCAP_RECORD_SIZE + caplen;
+            return;
+        }
+
+        if (left < 12) {
+            break;
+        }
+        uint32_t type;
+        memcpy(&type, rec, sizeof(type));
+        if (type == PCAPNG_SHB) {
+            /* Nueva sección: puede cambiar el orden de bytes */
+            uint32_t magic;
+            memcpy(&magic, rec + 8, sizeof(magic));
+            if (magic == PCAPNG_BYTE_ORDER_MAGIC) {
+                file->swapped = 0;
+            } else if (magic == __builtin_bswap32(PCAPNG_BYTE_ORDER_MAGIC)) {
+                file->swapped = 1;
+            } else {
+                break;
+            }
+            file->niface = 0;
+        } else {
+            type = eth_file_rd32(file, rec);
+        }
+
+        uint32_t block_len = eth_file_rd32(file, rec + 4);
+        if ((block_len < 12) || (block_len > left) || (block_len % 4 != 0)) {
+            break;
+        }
+        file->offset += block_len;
+
+        int if_id = 0;
+        uint32_t caplen;
+        uint64_t ts = file->frame_ts;
+        unsigned char *frame;
+        if (type == PCAPNG_IDB) {
+            eth_file_pcapng_idb(file, rec, block_len);
+            continue;
+        } else if ((type == PCAPNG_EPB) && (block_len >= 32)) {
+            if_id = eth_file_rd32(file, rec + 8);
+            caplen = eth_file_rd32(file, rec + 20);
+            frame = rec + 28;
+        } else if ((type == PCAPNG_PB) && (block_len >= 32)) {
+            if_id = eth_file_rd16(file, rec + 8);
+            caplen = eth_file_rd32(file, rec + 20);
+            frame = rec + 28;
+        } else if ((type == PCAPNG_SPB) && (block_len >= 16)) {
+            /* Sin marca de tiempo: la de la trama anterior */
+            caplen = eth_file_rd32(file, rec + 8);
+            if (caplen > block_len - 16) {
+                caplen = block_len - 16;
+            }
+            frame = rec + 12;
+        } else {
+            continue;
+        }
+
+        if ((if_id >= file->niface) || (file->linktype[if_id] != LINKTYPE_ETHERNET) ||
+            (frame + caplen > rec + block_len - 4)) {
+            continue;
+        }
+        if (type != PCAPNG_SPB) {
+            ts = ((uint64_t) eth_file_rd32(file, rec + 12) << 32) |
+                 eth_file_rd32(file, rec + 16);
+            ts = eth_file_pcapng_ts(file, if_id, ts);
+        }
+        file->frame = frame;
+        file->frame_len = caplen;
+        file->frame_ts = ts;
+        return;
+    }
+
+    file->eof = 1;
+}
+
+
+/* static int eth_file_map ( struct eth_file * file, char * path );
+ *
+ * DESCRIPCIÓN:
+ *   Mapea el fichero de entrada y reconoce su formato. El mapeo es privado
+ *   y de escritura para que las capas superiores puedan modificar las
+ *   tramas prestadas sin tocar el fichero.
+ */
+static int eth_file_map(struct eth_file *file, char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "eth_open(): ERROR en open(%s): %s\n", path, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if ((fstat(fd, &st) == -1) || (st.st_size < PCAP_HEADER_SIZE)) {
+        fprintf(stderr, "eth_open(): ERROR: '%s' no es un fichero pcap\n", path);
+        close(fd);
+        return -1;
+    }
+    file->size = st.st_size;
+    file->data = mmap(NULL, file->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file->data == MAP_FAILED) {
+        fprintf(stderr, "eth_open(): ERROR en mmap(%s): %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    uint32_t magic;
+    memcpy(&magic, file->data, sizeof(magic));
+    if (magic == PCAPNG_SHB) {
+        file->pcapng = 1;
+        file->offset = 0;
+        return 0;
+    }
+
+    file->swapped = ((magic == __builtin_bswap32(PCAP_MAGIC_US)) ||
+                     (magic == __builtin_bswap32(PCAP_MAGIC_NS)));
+    magic = eth_file_rd32(file, file->data);
+    if (((magic != PCAP_MAGIC_US) && (magic != PCAP_MAGIC_NS)) ||
+        (eth_file_rd32(file, file->data + 20) != LINKTYPE_ETHERNET)) {
+        fprintf(stderr, "eth_open(): ERROR: '%s' no es un fichero pcap de "
+                        "tramas Ethernet\n", path);
+        munmap(file->data, file->size);
+        return -1;
+    }
+    file->pcap_ns = (magic == PCAP_MAGIC_NS) ? 1 : 1000;
+    file->offset = PCAP_HEADER_SIZE;
+
+    return 0;
+}
+
+
+/* static void * eth_file_open_mode ( char * name, int realtime );
+ *
+ * DESCRIPCIÓN:
+ *   Abre el fichero de entrada y, si se indica tras una coma, crea el de
+ *   salida.
+ */
+static void *eth_file_open_mode(char *name, int realtime) {
+    if ((name == NULL) || (name[0] == '\0')) {
+        fprintf(stderr, "eth_open(): ERROR: falta el fichero de entrada\n");
+        return NULL;
+    }
+
+    struct eth_file *file = calloc(1, sizeof(struct eth_file));
+    if (file == NULL) {
+        fprintf(stderr, "eth_open(): ERROR en calloc()\n");
+        return NULL;
+    }
+    file->name = strdup(name);
+    if (file->name == NULL) {
+        fprintf(stderr, "eth_open(): ERROR en strdup()\n");
+        free(file);
+        return NULL;
+    }
+    file->realtime = realtime;
+
+    char *in_path = strdup(name);
+    char *out_path = (in_path != NULL) ? strchr(in_path, ',') : NULL;
+    if (out_path != NULL) {
+        *out_path++ = '\0';
+    }
+    if ((in_path == NULL) || (eth_file_map(file, in_path) == -1)) {
+        free(in_path);
+        free(file->name);
+        free(file);
+        return NULL;
+    }
+
+    if (out_path != NULL) {
+        file->out = fopen(out_path, "wb");
+        if (file->out == NULL) {
+            fprintf(stderr, "eth_open(): ERROR en fopen(%s): %s\n",
+                    out_path, strerror(errno));
+            munmap(file->data, file->size);
+            free(in_path);
+            free(file->name);
+            free(file);
+            return NULL;
+        }
+        uint32_t header[6];
+        header[0] = PCAP_MAGIC_NS;
+        header[1] = 2 | (4 << 16);          /* Versión 2.4 */
+        header[2] = 0;                      /* Zona horaria */
+        header[3] = 0;                      /* Precisión */
+        header[4] = ETH_FRAME_MAX_LENGTH;   /* snaplen */
+        header[5] = LINKTYPE_ETHERNET;
+        fwrite(header, sizeof(header), 1, file->out);
+    }
+    free(in_path);
+
+    /* MAC: destino de la primera trama unicast */
+    size_t offset = file->offset;
+    eth_file_next(file);
+    while (!file->eof &&
+           ((file->frame_len < MAC_ADDR_SIZE) || (file->frame[0] & 0x01))) {
+        eth_file_next(file);
+    }
+    if (!file->eof) {
+        memcpy(file->mac_address, file->frame, MAC_ADDR_SIZE);
+    } else {
+        /* 02:46:49 ("FI"): no hay tramas unicast */
+        file->mac_address[0] = 0x02;
+        file->mac_address[1] = 0x46;
+        file->mac_address[2] = 0x49;
+    }
+    file->offset = offset;
+    file->eof = 0;
+    file->niface = 0;
+    eth_file_next(file);
+
+    return file;
+}
+
+
+static void *eth_file_open(char *name) {
+    return eth_file_open_mode(name, 0);
+}
+
+
+static void *eth_replay_open(char *name) {
+    return eth_file_open_mode(name, 1);
+}
+
+
+static char *eth_file_getname(void *dev) {
+    return ((struct eth_file *) dev)->name;
+}
+
+
+static void eth_file_getaddr(void *dev, mac_addr_t addr) {
+    memcpy(addr, ((struct eth_file *) dev)->mac_address, MAC_ADDR_SIZE);
+}
+
+
+static int eth_file_can_lend(void *dev) {
+    (void) dev;
+    return 1;
+}
+
+
+/* static uint64_t eth_file_wait ( struct eth_file * file );
+ *
+ * DESCRIPCIÓN:
+ *   Devuelve los nanosegundos que faltan para que toque entregar la
+ *   siguiente trama (0 si ya toca, o si se ha llegado al final).
+ */
+static uint64_t eth_file_wait(struct eth_file *file) {
+    if (!file->realtime || file->eof) {
+        return 0;
+    }
+    if (!file->started) {
+        file->started = 1;
+        file->first_ts = file->frame_ts;
+        file->start = eth_file_now();
+    }
+
+    uint64_t due = file->start +
+                   ((file->frame_ts > file->first_ts) ? file->frame_ts - file->first_ts : 0);
+    uint64_t now = eth_file_now();
+
+    return (due > now) ? due - now : 0;
+}
+
+
+static void eth_file_sleep(uint64_t ns) {
+    struct timespec delay = {ns / 1000000000, ns % 1000000000};
+    while ((nanosleep(&delay, &delay) == -1) && (errno == EINTR));
+}
+
+
+/* Espera a que toque la siguiente trama de alguno de los interfaces */
+static int eth_file_poll(void *devs[], int num, long int timeout) {
+    int first = -1;
+    uint64_t min_wait = 0;
+    int i;
+    for (i = 0; i < num; i++) {
+        uint64_t wait = eth_file_wait(devs[i]);
+        if ((first == -1) || (wait < min_wait)) {
+            first = i;
+            min_wait = wait;
+        }
+    }
+
+    if ((timeout >= 0) && (min_wait > (uint64_t) timeout * 1000000)) {
+        eth_file_sleep((uint64_t) timeout * 1000000);
+        return -2;
+    }
+    eth_file_sleep(min_wait);
+
+    return first;
+}
+
+
+/* Las tramas se prestan directamente del fichero mapeado, o se copian si
+   se pasa un buffer. Al final del fichero se devuelve '-1'. */
+static int eth_file_recv
+        (void *dev, unsigned char *bufs[], int sizes[], int lens[],
+         int num, long int timeout) {
+    struct eth_file *file = dev;
+
+    if (file->eof) {
+        fprintf(stderr, "eth_recv(): Fin del fichero '%s'\n", file->name);
+        return -1;
+    }
+
+    uint64_t wait = eth_file_wait(file);
+    if (wait > 0) {
+        if ((timeout >= 0) && (wait > (uint64_t) timeout * 1000000)) {
+            eth_file_sleep((uint64_t) timeout * 1000000);
+            return 0;
+        }
+        eth_file_sleep(wait);
+    }
+
+    int i;
+    for (i = 0; (i < num) && !file->eof && (eth_file_wait(file) == 0); i++) {
+        if (bufs[i] == NULL) {
+            bufs[i] = file->frame;
+            sizes[i] = file->frame_len;
+        } else {
+            memcpy(bufs[i], file->frame,
+                   (file->frame_len < sizes[i]) ? file->frame_len : sizes[i]);
+        }
+        lens[i] = file->frame_len;
+        eth_file_next(file);
+    }
+
+    return i;
+}
+
+
+static int eth_file_send(void *dev, unsigned char *frames[], int lens[], int num) {
+    struct eth_file *file = dev;
+
+    if (file->out == NULL) {
+        return num;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    int i;
+    for (i = 0; i < num; i++) {
+        uint32_t record[4];
+        record[0] = now.tv_sec;
+        record[1] = now.tv_nsec;
+        record[2] = lens[i];
+        record[3] = lens[i];
+        if ((fwrite(record, sizeof(record), 1, file->out) != 1) ||
+            (fwrite(frames[i], lens[i], 1, file->out) != 1)) {
+            fprintf(stderr, "eth_send(): ERROR al escribir la salida de '%s'\n",
+                    file->name);
+            break;
+        }
+    }
+
+    return (i == 0) ? -1 : i;
+}
+
+
+static int eth_file_close(void *dev) {
+    struct eth_file *file = dev;
+
+    int err = 0;
+    if ((file->out != NULL) && (fclose(file->out) != 0)) {
+        err = -1;
+    }
+    munmap(file->data, file->size);
+    free(file->name);
+    free(file);
+
+    return err;
+}
+
+
+const eth_backend_t eth_file_backend = {
+        .prefix = "file:",
+        .open = eth_file_open,
+        .getname = eth_file_getname,
+        .getaddr = eth_file_getaddr,
+        .poll = eth_file_poll,
+        .send = eth_file_send,
+        .recv = eth_file_recv,
+        .can_lend = eth_file_can_lend,
+        .close = eth_file_close,
+};
+
+const eth_backend_t eth_replay_backend = {
+        .prefix = "replay:",
+        .open = eth_replay_open,
+        .getname = eth_file_getname,
+        .getaddr = eth_file_getaddr,
+        .poll = eth_file_poll,
+        .send = eth_file_send,
+        .recv = eth_file_recv,
+        .can_lend = eth_file_can_lend,
+        .close = eth_file_close,
+};
@@ -0,0 +1,331 @@
+#include "eth_impair.h"
+#include "eth.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* Trama retenida en la rueda */
+struct eth_impair_frame {
+    struct eth_impair_frame *next;
+    uint64_t tick;              /* Tick en que debe salir */
+    int frame_len;
+    unsigned char frame[ETH_FRAME_MAX_LENGTH];
+};
+
+/* Posición de la rueda: lista de las tramas cuyo tick es congruente con
+   ella, en orden de llegada */
+struct eth_impair_slot {
+    struct eth_impair_frame *head;
+    struct eth_impair_frame *tail;
+};
+
+#define ETH_IMPAIR_MASK (ETH_IMPAIR_SLOTS - 1)
+
+/* Estructura de una etapa de perturbaciones */
+struct eth_impair {
+    eth_impair_config_t config;
+    uint64_t rng;               /* Estado del generador (splitmix64) */
+
+    struct eth_impair_frame *pool; /* Todas las tramas, reservadas al crear */
+    struct eth_impair_frame *free; /* Tramas libres */
+    struct eth_impair_frame *released; /* Devueltas por la última llamada a
+                                          'eth_impair_due()' */
+    int queued;                 /* Tramas retenidas en la rueda */
+
+    struct eth_impair_slot slots[ETH_IMPAIR_SLOTS];
+    uint64_t cursor;            /* Primer tick cuya posición puede tener
+                                   tramas vencidas. Nunca pasa de "ahora". */
+    uint64_t last_due_us;       /* Salida de la última trama no adelantada,
+                                   para que el jitter no desordene */
+    uint64_t link_free_us;      /* Momento en que el enlace emulado acaba de
+                                   transmitir lo que tiene (ver 'rate_bps') */
+};
+
+
+/* static uint64_t eth_impair_now ( void );
+ *
+ * DESCRIPCIÓN:
+ *   Devuelve el reloj monotónico en microsegundos.
+ */
+static uint64_t eth_impair_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000ULL + (uint64_t) ts.tv_nsec / 1000;
+}
+
+
+/* static double eth_impair_random ( eth_impair_t * imp );
+ *
+ * DESCRIPCIÓN:
+ *   Devuelve un número pseudoaleatorio uniforme en [0, 1).
+ */
+static double eth_impair_random(eth_impair_t *imp) {
+    uint64_t z = (imp->rng += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z = z ^ (z >> 31);
+    return (double) (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+eth_impair_t *eth_impair_create(eth_impair_config_t *config) {
+    if (config == NULL) {
+        fprintf(stderr, "eth_impair_create(): ERROR: config == NULL\n");
+        return NULL;
+    }
+    if ((config->loss < 0.0) || (config->loss > 1.0) ||
+        (config->duplicate < 0.0) || (config->duplicate > 1.0) ||
+        (config->reorder < 0.0) || (config->reorder > 1.0) ||
+        (config->delay_us < 0) || (config->jitter_us < 0) ||
+        (config->limit < 0)) {
+        fprintf(stderr, "eth_impair_create(): ERROR: Configuración inválida\n");
+        return NULL;
+    }
+
+    eth_impair_t *imp = calloc(1, sizeof(struct eth_impair));
+    if (imp == NULL) {
+        fprintf(stderr, "eth_impair_create(): ERROR en calloc()\n");
+        return NULL;
+    }
+    imp->config = *config;
+    if (imp->config.limit == 0) {
+        imp->config.limit = ETH_IMPAIR_LIMIT;
+    }
+    imp->rng = config->seed;
+
+    /* Además de las retenidas, hacen falta las que 'eth_impair_due()' ha
+       devuelto y todavía se están enviando */
+    int pool_len = imp->config.limit + ETH_BURST_MAX;
+    imp->pool = malloc(pool_len * sizeof(struct eth_impair_frame));
+    if (imp->pool == NULL) {
+        fprintf(stderr, "eth_impair_create(): ERROR en malloc()\n");
+        free(imp);
+        return NULL;
+    }
+    int i;
+    for (i = 0; i < pool_len; i++) {
+        imp->pool[i].next = imp->free;
+        imp->free = &imp->pool[i];
+    }
+
+    uint64_t now = eth_impair_now();
+    imp->cursor = now / ETH_IMPAIR_TICK_US;
+    imp->last_due_us = now;
+    imp->link_free_us = now;
+
+    return imp;
+}
+
+
+/* static int eth_impair_hold
+ * ( eth_impair_t * imp, unsigned char * frame, int frame_len, uint64_t now );
+ *
+ * DESCRIPCIÓN:
+ *   Calcula cuándo debe salir una copia de la trama y la guarda en la rueda.
+ *
+ * VALOR DEVUELTO:
+ *   '1' si se ha retenido la copia, '0' si no cabe.
+ */
+static int eth_impair_hold
+        (eth_impair_t *imp, unsigned char *frame, int frame_len, uint64_t now) {
+    eth_impair_config_t *config = &imp->config;
+    if ((imp->queued >= config->limit) || (imp->free == NULL)) {
+        return 0;
+    }
+
+    /* Primero el cuello de botella: la trama espera a que el enlace termine
+       con las anteriores y ocupa el tiempo de transmitirla */
+    uint64_t due = now;
+    if (config->rate_bps > 0) {
+        if (imp->link_free_us > due) {
+            due = imp->link_free_us;
+        }
+        due += ((uint64_t) frame_len * 8 * 1000000ULL) / config->rate_bps;
+        imp->link_free_us = due;
+    }
+
+    /* Después la propagación, salvo que la trama se adelante a las demás */
+    int reordered = (config->reorder > 0.0) &&
+                    (eth_impair_random(imp) < config->reorder);
+    if (!reordered) {
+        long int delay = config->delay_us;
+        if (config->jitter_us > 0) {
+            delay += (long int) (eth_impair_random(imp) *
+                                 (2 * config->jitter_us + 1)) - config->jitter_us;
+        }
+        if (delay > 0) {
+            due += delay;
+        }
+        if (due < imp->last_due_us) {
+            due = imp->last_due_us;
+        }
+        imp->last_due_us = due;
+    }
+
+    /* Las posiciones anteriores al cursor ya se han revisado */
+    uint64_t tick = due / ETH_IMPAIR_TICK_US;
+    if (tick < imp->cursor) {
+        tick = imp->cursor;
+    }
+
+    struct eth_impair_frame *held = imp->free;
+    imp->free = held->next;
+    held->next = NULL;
+    held->tick = tick;
+    held->frame_len = frame_len;
+    memcpy(held->frame, frame, frame_len);
+
+    struct eth_impair_slot *slot = &imp->slots[tick & ETH_IMPAIR_MASK];
+    if (slot->tail == NULL) {
+        slot->head = held;
+    } else {
+        slot->tail->next = held;
+    }
+    slot->tail = held;
+    imp->queued++;
+
+    return 1;
+}
+
+
+int eth_impair_submit(eth_impair_t *imp, unsigned char *frame, int frame_len) {
+    if ((imp == NULL) || (frame == NULL) ||
+        (frame_len < 0) || (frame_len > ETH_FRAME_MAX_LENGTH)) {
+        fprintf(stderr, "eth_impair_submit(): ERROR: Trama incorrecta\n");
+        return 0;
+    }
+
+    eth_impair_config_t *config = &imp->config;
+    if ((config->loss > 0.0) && (eth_impair_random(imp) < config->loss)) {
+        return 0;
+    }
+
+    uint64_t now = eth_impair_now();
+    int held = eth_impair_hold(imp, frame, frame_len, now);
+    if ((held > 0) && (config->duplicate > 0.0) &&
+        (eth_impair_random(imp) < config->duplicate)) {
+        held += eth_impair_hold(imp, frame, frame_len, now);
+    }
+
+    return held;
+}
+
+
+int eth_impair_due
+        (eth_impair_t *imp, unsigned char *frames[], int lens[], int num) {
+    if (imp == NULL) {
+        return 0;
+    }
+
+    /* Las tramas devueltas la vez anterior ya se han enviado */
+    while (imp->released != NULL) {
+        struct eth_impair_frame *done = imp->released;
+        imp->released = done->next;
+        done->next = imp->free;
+        imp->free = done;
+    }
+
+    uint64_t now_tick = eth_impair_now() / ETH_IMPAIR_TICK_US;
+    if (imp->queued == 0) {
+        /* Sin tramas no hace falta recorrer las posiciones vacías */
+        imp->cursor = now_tick;
+        return 0;
+    }
+
+    struct eth_impair_frame *last = NULL;
+    int n = 0;
+    int visited = 0;
+    while (n < num) {
+        /* Sacar de la posición del cursor las tramas vencidas. Las de
+           vueltas posteriores se quedan. */
+        struct eth_impair_slot *slot = &imp->slots[imp->cursor & ETH_IMPAIR_MASK];
+        struct eth_impair_frame *prev = NULL;
+        struct eth_impair_frame *held = slot->head;
+        while ((held != NULL) && (n < num)) {
+            struct eth_impair_frame *next = held->next;
+            if (held->tick > now_tick) {
+                prev = held;
+                held = next;
+                continue;
+            }
+
+            if (prev == NULL) {
+                slot->head = next;
+            } else {
+                prev->next = next;
+            }
+            if (slot->tail == held) {
+                slot->tail = prev;
+            }
+            imp->queued--;
+
+            held->next = NULL;
+            if (last == NULL) {
+                imp->released = held;
+            } else {
+                last->next = held;
+            }
+            last = held;
+            frames[n] = held->frame;
+            lens[n] = held->frame_len;
+            n++;
+            held = next;
+        }
+        if ((held != NULL) || (imp->cursor >= now_tick)) {
+            /* Quedan tramas vencidas en esta posición, o se ha llegado al
+               presente: seguir desde aquí la próxima vez */
+            break;
+        }
+
+        /* Tras una vuelta completa ya se han visto todas las posiciones */
+        if (++visited >= ETH_IMPAIR_SLOTS) {
+            imp->cursor = now_tick;
+            break;
+        }
+        imp->cursor++;
+    }
+
+    return n;
+}
+
+
+long int eth_impair_timeleft(eth_impair_t *imp) {
+    if ((imp == NULL) || (imp->queued == 0)) {
+        return -1;
+    }
+
+    /* Buscar la primera posición, desde el cursor, con una trama de esta
+       vuelta. Si no hay ninguna, la más próxima de las vistas. */
+    uint64_t next_tick = UINT64_MAX;
+    uint64_t k;
+    for (k = 0; k < ETH_IMPAIR_SLOTS; k++) {
+        uint64_t tick = imp->cursor + k;
+        struct eth_impair_frame *held = imp->slots[tick & ETH_IMPAIR_MASK].head;
+        for (; held != NULL; held = held->next) {
+            if (held->tick < next_tick) {
+                next_tick = held->tick;
+            }
+        }
+        if (next_tick <= tick) {
+            break;
+        }
+    }
+
+    uint64_t due = next_tick * ETH_IMPAIR_TICK_US;
+    uint64_t now = eth_impair_now();
+    if (due <= now) {
+        return 0;
+    }
+
+    return (long int) ((due - now + 999) / 1000);
+}
+
+
+void eth_impair_destroy(eth_impair_t *imp) {
+    if (imp != NULL) {
+        free(imp->pool);
+        free(imp);
+    }
+}
@@ -0,0 +1,107 @@
+#ifndef _ETH_IMPAIR_H
+#define _ETH_IMPAIR_H
+
+#include <stdint.h>
+
+/* Emulación de un enlace degradado.
+ *
+ * Las tramas que envía un interfaz con perturbaciones (ver
+ * 'eth_set_impairment()') no se entregan directamente a su enlace: pasan por
+ * esta etapa, que puede descartarlas, duplicarlas, retrasarlas, desordenarlas
+ * o limitar el caudal con que salen. Las tramas retenidas esperan en una
+ * rueda de temporizadores y se entregan al enlace cuando vencen, durante las
+ * llamadas a 'eth_send()', 'eth_recv()', 'eth_poll()' o 'eth_flush()' del
+ * mismo interfaz (no hay ningún hilo en segundo plano).
+ *
+ * Todas las decisiones aleatorias salen de un generador con semilla, así que
+ * dos ejecuciones con la misma configuración y el mismo tráfico pierden y
+ * desordenan exactamente las mismas tramas.
+ */
+typedef struct eth_impair eth_impair_t;
+
+/* Configuración de las perturbaciones. Un campo a 0 desactiva la suya. */
+typedef struct eth_impair_config {
+    double loss;         /* Probabilidad [0, 1] de descartar una trama */
+    double duplicate;    /* Probabilidad [0, 1] de enviar una trama dos veces */
+    double reorder;      /* Probabilidad [0, 1] de que una trama se adelante
+                            a las retenidas, saliendo sin retraso */
+    long int delay_us;   /* Retraso fijo en microsegundos */
+    long int jitter_us;  /* Variación uniforme del retraso, +/- microsegundos.
+                            No desordena las tramas por sí misma. */
+    uint64_t rate_bps;   /* Caudal máximo en bits por segundo */
+    int limit;           /* Número máximo de tramas retenidas. Con 0 se usa
+                            'ETH_IMPAIR_LIMIT'. Las que no caben se descartan. */
+    uint32_t seed;       /* Semilla del generador aleatorio */
+} eth_impair_config_t;
+
+/* Número máximo de tramas retenidas por defecto */
+#define ETH_IMPAIR_LIMIT 1024
+
+/* Resolución de la rueda de temporizadores, en microsegundos */
+#define ETH_IMPAIR_TICK_US 100
+
+/* Número de posiciones de la rueda (potencia de 2). Los retrasos mayores de
+   una vuelta (ETH_IMPAIR_SLOTS * ETH_IMPAIR_TICK_US) también funcionan, pero
+   sus tramas se revisan en cada vuelta. */
+#define ETH_IMPAIR_SLOTS 4096
+
+
+/* eth_impair_t * eth_impair_create ( eth_impair_config_t * config );
+ *
+ * DESCRIPCIÓN:
+ *   Crea una etapa de perturbaciones con la configuración indicada.
+ *   Normalmente no se llama directamente sino a través de
+ *   'eth_set_impairment()'.
+ *
+ * VALOR DEVUELTO:
+ *   Manejador de la etapa, o 'NULL' si se ha producido algún error.
+ */
+eth_impair_t * eth_impair_create ( eth_impair_config_t * config );
+
+
+/* int eth_impair_submit
+ * ( eth_impair_t * imp, unsigned char * frame, int frame_len );
+ *
+ * DESCRIPCIÓN:
+ *   Copia una trama a la etapa, que decide si se pierde y cuándo debe salir
+ *   ella y su posible duplicado.
+ *
+ * VALOR DEVUELTO:
+ *   El número de copias retenidas (0 si se ha descartado).
+ */
+int eth_impair_submit
+( eth_impair_t * imp, unsigned char * frame, int frame_len );
+
+
+/* int eth_impair_due
+ * ( eth_impair_t * imp, unsigned char * frames[], int lens[], int num );
+ *
+ * DESCRIPCIÓN:
+ *   Devuelve en 'frames'/'lens' hasta 'num' tramas cuyo momento de salida ya
+ *   ha llegado, en el orden en que deben enviarse. Los punteros son válidos
+ *   hasta la siguiente llamada a esta función.
+ *
+ * VALOR DEVUELTO:
+ *   El número de tramas devueltas.
+ */
+int eth_impair_due
+( eth_impair_t * imp, unsigned char * frames[], int lens[], int num );
+
+
+/* long int eth_impair_timeleft ( eth_impair_t * imp );
+ *
+ * DESCRIPCIÓN:
+ *   Devuelve los milisegundos que faltan para que venza la siguiente trama
+ *   retenida (0 si ya ha vencido), o '-1' si no hay ninguna.
+ */
+long int eth_impair_timeleft ( eth_impair_t * imp );
+
+
+/* void eth_impair_destroy ( eth_impair_t * imp );
+ *
+ * DESCRIPCIÓN:
+ *   Libera la etapa, descartando las tramas que tuviera retenidas.
+ */
+void eth_impair_destroy ( eth_impair_t * imp );
+
+#endif /* _ETH_IMPAIR_H */
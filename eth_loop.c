@@ -0,0 +1,532 @@
+#include "eth_loop.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+/* Interfaz registrado en el bucle */
+struct eth_loop_iface {
+    eth_iface_t *iface;         /* NULL si la posición está libre */
+    eth_loop_iface_cb_t cb;
+    void *arg;
+    int fd;                     /* Descriptor, o -1 para interfaces rawnet */
+};
+
+/* Temporizador del bucle */
+struct eth_loop_timer {
+    long long int expiry;       /* Instante de vencimiento (ms monotónicos) */
+    long int period;            /* Periodo, o 0 si no se repite */
+    eth_loop_timer_cb_t cb;
+    void *arg;
+    int heap_pos;               /* Posición en el montículo, o -1 si libre */
+};
+
+/* Estructura del bucle de eventos */
+struct eth_loop {
+    int epfd;                   /* Instancia de epoll */
+    struct eth_loop_iface ifaces[ETH_LOOP_MAX_IFACES];
+    int raw_count;              /* Interfaces registrados sin descriptor */
+
+    struct eth_loop_timer *timers; /* Temporizadores, indexados por id */
+    int *heap;                  /* Montículo de ids ordenado por 'expiry' */
+    int heap_len;               /* Temporizadores activos */
+    int timers_size;            /* Tamaño de 'timers' y de 'heap' */
+
+    int stop;                   /* 1 si 'eth_loop_run()' debe terminar */
+};
+
+/* Tamaño inicial de la tabla de temporizadores */
+#define ETH_LOOP_TIMERS_INIT 16
+
+
+/* static long long int eth_loop_now ( void );
+ *
+ * DESCRIPCIÓN:
+ *   Devuelve el tiempo actual en milisegundos de un reloj monotónico.
+ */
+static long long int eth_loop_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (long long int) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/* Operaciones del montículo de temporizadores */
+
+static void eth_loop_heap_set(eth_loop_t *loop, int pos, int timer) {
+    loop->heap[pos] = timer;
+    loop->timers[timer].heap_pos = pos;
+}
+
+static int eth_loop_heap_less(eth_loop_t *loop, int a, int b) {
+    return loop->timers[loop->heap[a]].expiry < loop->timers[loop->heap[b]].expiry;
+}
+
+static void eth_loop_heap_swap(eth_loop_t *loop, int a, int b) {
+    int timer = loop->heap[a];
+    eth_loop_heap_set(loop, a, loop->heap[b]);
+    eth_loop_heap_set(loop, b, timer);
+}
+
+static void eth_loop_heap_up(eth_loop_t *loop, int pos) {
+    while ((pos > 0) && eth_loop_heap_less(loop, pos, (pos - 1) / 2)) {
+        eth_loop_heap_swap(loop, pos, (pos - 1) / 2);
+        pos = (pos - 1) / 2;
+    }
+}
+
+static void eth_loop_heap_down(eth_loop_t *loop, int pos) {
+    for (;;) {
+        int min = pos;
+        int child = 2 * pos + 1;
+        if ((child < loop->heap_len) && eth_loop_heap_less(loop, child, min)) {
+            min = child;
+        }
+        child++;
+        if ((child < loop->heap_len) && eth_loop_heap_less(loop, child, min)) {
+            min = child;
+        }
+        if (min == pos) {
+            return;
+        }
+        eth_loop_heap_swap(loop, pos, min);
+        pos = min;
+    }
+}
+
+static void eth_loop_heap_push(eth_loop_t *loop, int timer) {
+    eth_loop_heap_set(loop, loop->heap_len, timer);
+    loop->heap_len++;
+    eth_loop_heap_up(loop, loop->heap_len - 1);
+}
+
+static void eth_loop_heap_remove(eth_loop_t *loop, int pos) {
+    int timer = loop->heap[pos];
+    loop->heap_len--;
+    if (pos != loop->heap_len) {
+        int moved = loop->heap[loop->heap_len];
+        eth_loop_heap_set(loop, pos, moved);
+        eth_loop_heap_up(loop, pos);
+        eth_loop_heap_down(loop, loop->timers[moved].heap_pos);
+    }
+    loop->timers[timer].heap_pos = -1;
+}
+
+
+/* eth_loop_t * eth_loop_create ( void );
+ *
+ * DESCRIPCIÓN:
+ *   Crea un bucle de eventos vacío. Debe liberarse con 'eth_loop_destroy()'.
+ *
+ * VALOR DEVUELTO:
+ *   Manejador del bucle, o 'NULL' si se ha producido algún error.
+ */
+eth_loop_t *eth_loop_create(void) {
+    eth_loop_t *loop = calloc(1, sizeof(struct eth_loop));
+    if (loop == NULL) {
+        fprintf(stderr, "eth_loop_create(): ERROR en calloc()\n");
+        return NULL;
+    }
+    loop->epfd = -1;
+
+    loop->timers = malloc(ETH_LOOP_TIMERS_INIT * sizeof(struct eth_loop_timer));
+    loop->heap = malloc(ETH_LOOP_TIMERS_INIT * sizeof(int));
+    if ((loop->timers == NULL) || (loop->heap == NULL)) {
+        fprintf(stderr, "eth_loop_create(): ERROR en malloc()\n");
+        eth_loop_destroy(loop);
+        return NULL;
+    }
+    loop->timers_size = ETH_LOOP_TIMERS_INIT;
+    int i;
+    for (i = 0; i < loop->timers_size; i++) {
+        loop->timers[i].heap_pos = -1;
+    }
+
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epfd == -1) {
+        fprintf(stderr, "eth_loop_create(): ERROR en epoll_create1(): %s\n",
+                strerror(errno));
+        eth_loop_destroy(loop);
+        return NULL;
+    }
+
+    return loop;
+}
+
+
+/* int eth_loop_add_iface
+ * ( eth_loop_t * loop, eth_iface_t * iface, eth_loop_iface_cb_t cb,
+ *   void * arg );
+ *
+ * DESCRIPCIÓN:
+ *   Registra un interfaz. Cada vez que tenga tramas listas se llamará a
+ *   'cb' con 'arg'.
+ *
+ * VALOR DEVUELTO:
+ *   '0' si el interfaz se ha registrado, '-1' en caso contrario.
+ */
+int eth_loop_add_iface
+        (eth_loop_t *loop, eth_iface_t *iface, eth_loop_iface_cb_t cb, void *arg) {
+    if ((loop == NULL) || (iface == NULL) || (cb == NULL)) {
+        fprintf(stderr, "eth_loop_add_iface(): ERROR: parámetros incorrectos\n");
+        return -1;
+    }
+
+    int slot = -1;
+    int i;
+    for (i = 0; i < ETH_LOOP_MAX_IFACES; i++) {
+        if (loop->ifaces[i].iface == iface) {
+            fprintf(stderr, "eth_loop_add_iface(): ERROR: interfaz ya registrado\n");
+            return -1;
+        }
+        if ((slot == -1) && (loop->ifaces[i].iface == NULL)) {
+            slot = i;
+        }
+    }
+    if (slot == -1) {
+        fprintf(stderr, "eth_loop_add_iface(): ERROR: demasiados interfaces\n");
+        return -1;
+    }
+
+    int fd = eth_getfd(iface);
+    if (fd != -1) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u32 = slot;
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            fprintf(stderr, "eth_loop_add_iface(): ERROR en epoll_ctl(): %s\n",
+                    strerror(errno));
+            return -1;
+        }
+    } else {
+        loop->raw_count++;
+    }
+
+    loop->ifaces[slot].iface = iface;
+    loop->ifaces[slot].cb = cb;
+    loop->ifaces[slot].arg = arg;
+    loop->ifaces[slot].fd = fd;
+
+    return 0;
+}
+
+
+/* int eth_loop_remove_iface ( eth_loop_t * loop, eth_iface_t * iface );
+ *
+ * DESCRIPCIÓN:
+ *   Elimina un interfaz del bucle. Puede llamarse desde una función del
+ *   propio bucle. No cierra el interfaz.
+ *
+ * VALOR DEVUELTO:
+ *   '0' si el interfaz estaba registrado, '-1' en caso contrario.
+ */
+int eth_loop_remove_iface(eth_loop_t *loop, eth_iface_t *iface) {
+    if ((loop == NULL) || (iface == NULL)) {
+        return -1;
+    }
+
+    int i;
+    for (i = 0; i < ETH_LOOP_MAX_IFACES; i++) {
+        struct eth_loop_iface *entry = &loop->ifaces[i];
+        if (entry->iface != iface) {
+            continue;
+        }
+        if (entry->fd != -1) {
+            epoll_ctl(loop->epfd, EPOLL_CTL_DEL, entry->fd, NULL);
+        } else {
+            loop->raw_count--;
+        }
+        entry->iface = NULL;
+        return 0;
+    }
+
+    return -1;
+}
+
+
+/* int eth_loop_add_timer
+ * ( eth_loop_t * loop, long int delay, long int period,
+ *   eth_loop_timer_cb_t cb, void * arg );
+ *
+ * DESCRIPCIÓN:
+ *   Programa un temporizador que vence dentro de 'delay' milisegundos. Si
+ *   'period' es mayor que 0 se reprograma automáticamente cada 'period'
+ *   milisegundos hasta que se cancele; si no, se cancela solo al vencer.
+ *
+ * VALOR DEVUELTO:
+ *   Identificador del temporizador (mayor o igual que 0), o '-1' si se ha
+ *   producido algún error. Los identificadores se reutilizan después de
+ *   cancelar el temporizador.
+ */
+int eth_loop_add_timer
+        (eth_loop_t *loop, long int delay, long int period,
+         eth_loop_timer_cb_t cb, void *arg) {
+    if ((loop == NULL) || (cb == NULL) || (delay < 0)) {
+        fprintf(stderr, "eth_loop_add_timer(): ERROR: parámetros incorrectos\n");
+        return -1;
+    }
+
+    /* Ampliar las tablas si están todos los temporizadores en uso */
+    if (loop->heap_len == loop->timers_size) {
+        int size = 2 * loop->timers_size;
+        struct eth_loop_timer *timers =
+                realloc(loop->timers, size * sizeof(struct eth_loop_timer));
+        if (timers == NULL) {
+            fprintf(stderr, "eth_loop_add_timer(): ERROR en realloc()\n");
+            return -1;
+        }
+        loop->timers = timers;
+        int *heap = realloc(loop->heap, size * sizeof(int));
+        if (heap == NULL) {
+            fprintf(stderr, "eth_loop_add_timer(): ERROR en realloc()\n");
+            return -1;
+        }
+        loop->heap = heap;
+        int i;
+        for (i = loop->timers_size; i < size; i++) {
+            loop->timers[i].heap_pos = -1;
+        }
+        loop->timers_size = size;
+    }
+
+    int timer = 0;
+    while (loop->timers[timer].heap_pos != -1) {
+        timer++;
+    }
+
+    struct eth_loop_timer *entry = &loop->timers[timer];
+    entry->expiry = eth_loop_now() + delay;
+    entry->period = (period > 0) ? period : 0;
+    entry->cb = cb;
+    entry->arg = arg;
+    eth_loop_heap_push(loop, timer);
+
+    return timer;
+}
+
+
+/* int eth_loop_cancel_timer ( eth_loop_t * loop, int timer );
+ *
+ * DESCRIPCIÓN:
+ *   Cancela un temporizador. Puede llamarse desde una función del propio
+ *   bucle, incluida la del temporizador que se cancela.
+ *
+ * VALOR DEVUELTO:
+ *   '0' si el temporizador estaba activo, '-1' en caso contrario.
+ */
+int eth_loop_cancel_timer(eth_loop_t *loop, int timer) {
+    if ((loop == NULL) || (timer < 0) || (timer >= loop->timers_size) ||
+        (loop->timers[timer].heap_pos == -1)) {
+        return -1;
+    }
+
+    eth_loop_heap_remove(loop, loop->timers[timer].heap_pos);
+
+    return 0;
+}
+
+
+/* static int eth_loop_run_timers ( eth_loop_t * loop );
+ *
+ * DESCRIPCIÓN:
+ *   Llama a las funciones de todos los temporizadores vencidos. Los
+ *   periódicos se reprograman antes de la llamada, para que la función
+ *   pueda cancelarlos.
+ *
+ * VALOR DEVUELTO:
+ *   El número de temporizadores vencidos.
+ */
+static int eth_loop_run_timers(eth_loop_t *loop) {
+    long long int now = eth_loop_now();
+    int fired = 0;
+
+    /* Un periódico muy corto no debe acaparar la vuelta: atender como mucho
+       los que había al empezar */
+    int max = loop->heap_len;
+    while ((fired < max) && (loop->heap_len > 0)) {
+        int timer = loop->heap[0];
+        struct eth_loop_timer *entry = &loop->timers[timer];
+        if (entry->expiry > now) {
+            break;
+        }
+
+        eth_loop_timer_cb_t cb = entry->cb;
+        void *arg = entry->arg;
+        if (entry->period > 0) {
+            entry->expiry += entry->period;
+            if (entry->expiry <= now) {
+                /* Nos hemos retrasado más de un periodo: no recuperarlos */
+                entry->expiry = now + entry->period;
+            }
+            eth_loop_heap_down(loop, 0);
+        } else {
+            eth_loop_heap_remove(loop, 0);
+        }
+
+        cb(loop, timer, arg);
+        fired++;
+    }
+
+    return fired;
+}
+
+
+/* int eth_loop_run_once ( eth_loop_t * loop, long int timeout );
+ *
+ * DESCRIPCIÓN:
+ *   Envía las tramas pendientes de todos los interfaces, espera como mucho
+ *   'timeout' milisegundos (indefinidamente si es negativo) a que haya algún
+ *   interfaz listo o venza algún temporizador, y atiende todos los eventos
+ *   listos.
+ *
+ * VALOR DEVUELTO:
+ *   El número de eventos atendidos, o '0' si no ha habido ninguno.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si se ha producido algún error.
+ */
+int eth_loop_run_once(eth_loop_t *loop, long int timeout) {
+    if (loop == NULL) {
+        fprintf(stderr, "eth_loop_run_once(): ERROR: loop == NULL\n");
+        return -1;
+    }
+
+    /* Sacar lo pendiente antes de dormir, no dormir si ya hay tramas
+       encoladas en algún interfaz, ni más allá de la salida de la siguiente
+       trama retenida por sus perturbaciones */
+    long int wait = timeout;
+    int i;
+    for (i = 0; i < ETH_LOOP_MAX_IFACES; i++) {
+        eth_iface_t *iface = loop->ifaces[i].iface;
+        if (iface != NULL) {
+            eth_flush(iface);
+            if (eth_pending(iface) > 0) {
+                wait = 0;
+            }
+            long int hold = eth_timeleft(iface);
+            if ((hold >= 0) && ((wait < 0) || (hold < wait))) {
+                wait = hold;
+            }
+        }
+    }
+
+    /* No dormir más allá del próximo temporizador */
+    if (loop->heap_len > 0) {
+        long long int left = loop->timers[loop->heap[0]].expiry - eth_loop_now();
+        if (left < 0) {
+            left = 0;
+        }
+        if ((wait < 0) || (left < wait)) {
+            wait = (long int) left;
+        }
+    }
+    if ((loop->raw_count > 0) && ((wait < 0) || (wait > ETH_LOOP_RAW_SLICE))) {
+        wait = ETH_LOOP_RAW_SLICE;
+    }
+
+    struct epoll_event evs[ETH_LOOP_MAX_IFACES];
+    int n = epoll_wait(loop->epfd, evs, ETH_LOOP_MAX_IFACES, (int) wait);
+    if (n == -1) {
+        if (errno != EINTR) {
+            fprintf(stderr, "eth_loop_run_once(): ERROR en epoll_wait(): %s\n",
+                    strerror(errno));
+            return -1;
+        }
+        n = 0;
+    }
+
+    /* Interfaces listos: los notificados por epoll, los que tienen tramas
+       encoladas y los rawnet que tengan alguna trama. Cada uno una vez. */
+    int ready[ETH_LOOP_MAX_IFACES];
+    memset(ready, 0, sizeof(ready));
+    for (i = 0; i < n; i++) {
+        ready[evs[i].data.u32] = 1;
+    }
+    for (i = 0; i < ETH_LOOP_MAX_IFACES; i++) {
+        eth_iface_t *iface = loop->ifaces[i].iface;
+        if ((iface == NULL) || ready[i]) {
+            continue;
+        }
+        if (eth_pending(iface) > 0) {
+            ready[i] = 1;
+        } else if ((loop->ifaces[i].fd == -1) && (eth_poll(&iface, 1, 0) == 0)) {
+            ready[i] = 1;
+        }
+    }
+
+    int events = 0;
+    for (i = 0; i < ETH_LOOP_MAX_IFACES; i++) {
+        /* Comprobar de nuevo: una función anterior puede haberlo eliminado */
+        struct eth_loop_iface *entry = &loop->ifaces[i];
+        if (ready[i] && (entry->iface != NULL)) {
+            entry->cb(loop, entry->iface, entry->arg);
+            events++;
+        }
+    }
+
+    events += eth_loop_run_timers(loop);
+
+    return events;
+}
+
+
+/* int eth_loop_run ( eth_loop_t * loop );
+ *
+ * DESCRIPCIÓN:
+ *   Atiende eventos hasta que se llame a 'eth_loop_stop()' o se produzca un
+ *   error.
+ *
+ * VALOR DEVUELTO:
+ *   '0' si el bucle se ha detenido con 'eth_loop_stop()', '-1' si se ha
+ *   producido algún error.
+ */
+int eth_loop_run(eth_loop_t *loop) {
+    if (loop == NULL) {
+        fprintf(stderr, "eth_loop_run(): ERROR: loop == NULL\n");
+        return -1;
+    }
+
+    loop->stop = 0;
+    while (!loop->stop) {
+        if (eth_loop_run_once(loop, -1) == -1) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/* void eth_loop_stop ( eth_loop_t * loop );
+ *
+ * DESCRIPCIÓN:
+ *   Hace que 'eth_loop_run()' termine al acabar la vuelta en curso.
+ */
+void eth_loop_stop(eth_loop_t *loop) {
+    if (loop != NULL) {
+        loop->stop = 1;
+    }
+}
+
+
+/* void eth_loop_destroy ( eth_loop_t * loop );
+ *
+ * DESCRIPCIÓN:
+ *   Libera el bucle y sus temporizadores. No cierra los interfaces.
+ */
+void eth_loop_destroy(eth_loop_t *loop) {
+    if (loop != NULL) {
+        if (loop->epfd != -1) {
+            close(loop->epfd);
+        }
+        free(loop->timers);
+        free(loop->heap);
+        free(loop);
+    }
+}
@@ -0,0 +1,149 @@
+#ifndef _ETH_LOOP_H
+#define _ETH_LOOP_H
+
+#include "eth.h"
+
+/* Bucle de eventos para varios interfaces Ethernet y temporizadores.
+ *
+ * Sustituye a los bucles que alternan 'eth_poll()' y 'eth_recv()' con
+ * timeouts cortos: todos los interfaces se registran en una única instancia
+ * de epoll, los temporizadores (reintentos ARP, actualizaciones RIP,
+ * caducidad de rutas...) se guardan en un montículo ordenado por
+ * vencimiento, y cada vuelta del bucle atiende todos los eventos listos
+ * antes de volver a dormir, sin esperas activas.
+ *
+ * Los interfaces rawnet no tienen descriptor; si hay alguno registrado el
+ * bucle los consulta cada 'ETH_LOOP_RAW_SLICE' milisegundos.
+ */
+typedef struct eth_loop eth_loop_t;
+
+/* Número máximo de interfaces registrados en un bucle */
+#define ETH_LOOP_MAX_IFACES 32
+
+/* Intervalo en milisegundos entre consultas a los interfaces rawnet */
+#define ETH_LOOP_RAW_SLICE 10
+
+/* Función llamada cuando un interfaz tiene tramas listas para 'eth_recv()'.
+   Se vuelve a llamar en la siguiente vuelta si no las recibe todas. */
+typedef void (*eth_loop_iface_cb_t)
+( eth_loop_t * loop, eth_iface_t * iface, void * arg );
+
+/* Función llamada cuando vence un temporizador */
+typedef void (*eth_loop_timer_cb_t) ( eth_loop_t * loop, int timer, void * arg );
+
+
+/* eth_loop_t * eth_loop_create ( void );
+ *
+ * DESCRIPCIÓN:
+ *   Crea un bucle de eventos vacío. Debe liberarse con 'eth_loop_destroy()'.
+ *
+ * VALOR DEVUELTO:
+ *   Manejador del bucle, o 'NULL' si se ha producido algún error.
+ */
+eth_loop_t * eth_loop_create ( void );
+
+
+/* int eth_loop_add_iface
+ * ( eth_loop_t * loop, eth_iface_t * iface, eth_loop_iface_cb_t cb,
+ *   void * arg );
+ *
+ * DESCRIPCIÓN:
+ *   Registra un interfaz. Cada vez que tenga tramas listas se llamará a
+ *   'cb' con 'arg'.
+ *
+ * VALOR DEVUELTO:
+ *   '0' si el interfaz se ha registrado, '-1' en caso contrario.
+ */
+int eth_loop_add_iface
+( eth_loop_t * loop, eth_iface_t * iface, eth_loop_iface_cb_t cb, void * arg );
+
+
+/* int eth_loop_remove_iface ( eth_loop_t * loop, eth_iface_t * iface );
+ *
+ * DESCRIPCIÓN:
+ *   Elimina un interfaz del bucle. Puede llamarse desde una función del
+ *   propio bucle. No cierra el interfaz.
+ *
+ * VALOR DEVUELTO:
+ *   '0' si el interfaz estaba registrado, '-1' en caso contrario.
+ */
+int eth_loop_remove_iface ( eth_loop_t * loop, eth_iface_t * iface );
+
+
+/* int eth_loop_add_timer
+ * ( eth_loop_t * loop, long int delay, long int period,
+ *   eth_loop_timer_cb_t cb, void * arg );
+ *
+ * DESCRIPCIÓN:
+ *   Programa un temporizador que vence dentro de 'delay' milisegundos. Si
+ *   'period' es mayor que 0 se reprograma automáticamente cada 'period'
+ *   milisegundos hasta que se cancele; si no, se cancela solo al vencer.
+ *
+ * VALOR DEVUELTO:
+ *   Identificador del temporizador (mayor o igual que 0), o '-1' si se ha
+ *   producido algún error. Los identificadores se reutilizan después de
+ *   cancelar el temporizador.
+ */
+int eth_loop_add_timer
+( eth_loop_t * loop, long int delay, long int period,
+  eth_loop_timer_cb_t cb, void * arg );
+
+
+/* int eth_loop_cancel_timer ( eth_loop_t * loop, int timer );
+ *
+ * DESCRIPCIÓN:
+ *   Cancela un temporizador. Puede llamarse desde una función del propio
+ *   bucle, incluida la del temporizador que se cancela.
+ *
+ * VALOR DEVUELTO:
+ *   '0' si el temporizador estaba activo, '-1' en caso contrario.
+ */
+int eth_loop_cancel_timer ( eth_loop_t * loop, int timer );
+
+
+/* int eth_loop_run_once ( eth_loop_t * loop, long int timeout );
+ *
+ * DESCRIPCIÓN:
+ *   Envía las tramas pendientes de todos los interfaces, espera como mucho
+ *   'timeout' milisegundos (indefinidamente si es negativo) a que haya algún
+ *   interfaz listo o venza algún temporizador, y atiende todos los eventos
+ *   listos.
+ *
+ * VALOR DEVUELTO:
+ *   El número de eventos atendidos, o '0' si ha expirado 'timeout'.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si se ha producido algún error.
+ */
+int eth_loop_run_once ( eth_loop_t * loop, long int timeout );
+
+
+/* int eth_loop_run ( eth_loop_t * loop );
+ *
+ * DESCRIPCIÓN:
+ *   Atiende eventos hasta que se llame a 'eth_loop_stop()' o se produzca un
+ *   error.
+ *
+ * VALOR DEVUELTO:
+ *   '0' si el bucle se ha detenido con 'eth_loop_stop()', '-1' si se ha
+ *   producido algún error.
+ */
+int eth_loop_run ( eth_loop_t * loop );
+
+
+/* void eth_loop_stop ( eth_loop_t * loop );
+ *
+ * DESCRIPCIÓN:
+ *   Hace que 'eth_loop_run()' termine al acabar la vuelta en curso.
+ */
+void eth_loop_stop ( eth_loop_t * loop );
+
+
+/* void eth_loop_destroy ( eth_loop_t * loop );
+ *
+ * DESCRIPCIÓN:
+ *   Libera el bucle y sus temporizadores. No cierra los interfaces.
+ */
+void eth_loop_destroy ( eth_loop_t * loop );
+
+#endif /* _ETH_LOOP_H */
@@ -0,0 +1,902 @@
+#define _GNU_SOURCE /* sendmmsg() y recvmmsg() */
+
+#include "eth_packet.h"
+#include "eth_backend.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+
+/* Estructura del manejador del socket AF_PACKET */
+struct eth_packet {
+    int fd;                     /* Socket AF_PACKET */
+    int ifindex;                /* Índice del interfaz en el núcleo */
+    char name[IFNAMSIZ];        /* Nombre del interfaz */
+    mac_addr_t mac_address;     /* Dirección MAC del interfaz */
+
+    /* Anillos TPACKET_V3, mapeados juntos en 'ring' */
+    uint8_t *ring;              /* Memoria compartida con el núcleo */
+    size_t ring_len;            /* Tamaño en bytes de 'ring' */
+
+    /* Anillo de recepción (NULL si no se usa) */
+    uint8_t *rx_ring;
+    int rx_block;               /* Bloque en curso */
+    int rx_block_held;          /* 1 si el bloque en curso es nuestro */
+    int rx_pkts_left;           /* Tramas sin leer del bloque en curso */
+    uint8_t *rx_next_pkt;       /* Siguiente trama del bloque en curso */
+    int rx_loaned;              /* 1 si se han prestado tramas del bloque */
+
+    /* Anillo de transmisión (NULL si no se usa) */
+    uint8_t *tx_ring;
+    int tx_frame_nr;            /* Número de ranuras del anillo */
+    int tx_next;                /* Siguiente ranura a entregar */
+    int tx_pending;             /* Tramas listas que aún no se han enviado */
+
+    /* Un proceso hijo (fork()) hereda los anillos, pero no puede usarlos:
+       sus índices son una copia de los del padre y ambos escribirían en las
+       mismas ranuras. En el hijo las tramas se envían por un socket propio
+       sin anillos, como con "packet:", y no se puede recibir. */
+    pid_t pid;                  /* Proceso que abrió el socket */
+    int fork_fd;                /* Socket de envío del hijo, o -1 */
+};
+
+
+/* Identificador del proceso, que el hijo actualiza tras fork(). Se guarda
+   para no hacer una llamada al sistema en cada envío. */
+static pid_t eth_packet_getpid_value;
+static pthread_once_t eth_packet_getpid_once = PTHREAD_ONCE_INIT;
+
+static void eth_packet_getpid_update(void) {
+    eth_packet_getpid_value = getpid();
+}
+
+static void eth_packet_getpid_init(void) {
+    eth_packet_getpid_update();
+    pthread_atfork(NULL, NULL, eth_packet_getpid_update);
+}
+
+static pid_t eth_packet_getpid(void) {
+    pthread_once(&eth_packet_getpid_once, eth_packet_getpid_init);
+
+    return eth_packet_getpid_value;
+}
+
+
+/* static int eth_packet_setup_rings ( eth_packet_t * iface, int flags );
+ *
+ * DESCRIPCIÓN:
+ *   Configura el socket con TPACKET_V3 y crea los anillos de recepción y/o
+ *   transmisión indicados en 'flags'. Ambos anillos se mapean con un único
+ *   mmap(): primero el de recepción y a continuación el de transmisión.
+ *   Debe llamarse antes de bind().
+ *
+ * VALOR DEVUELTO:
+ *   '0' si los anillos se han creado correctamente, '-1' en caso contrario.
+ */
+static int eth_packet_setup_rings(eth_packet_t *iface, int flags) {
+    int version = TPACKET_V3;
+    if (setsockopt(iface->fd, SOL_PACKET, PACKET_VERSION,
+                   &version, sizeof(version)) == -1) {
+        fprintf(stderr, "eth_packet_open(): ERROR en PACKET_VERSION: %s\n",
+                strerror(errno));
+        return -1;
+    }
+
+    struct tpacket_req3 req;
+    size_t rx_len = 0;
+    size_t tx_len = 0;
+
+    if (flags & ETH_PACKET_RX_RING) {
+        memset(&req, 0, sizeof(req));
+        req.tp_block_size = ETH_RING_BLOCK_SIZE;
+        req.tp_block_nr = ETH_RING_BLOCK_NR;
+        req.tp_frame_size = ETH_RING_FRAME_SIZE;
+        req.tp_frame_nr = (ETH_RING_BLOCK_SIZE / ETH_RING_FRAME_SIZE) * ETH_RING_BLOCK_NR;
+        req.tp_retire_blk_tov = ETH_RING_BLOCK_TOV;
+        if (setsockopt(iface->fd, SOL_PACKET, PACKET_RX_RING,
+                       &req, sizeof(req)) == -1) {
+            fprintf(stderr, "eth_packet_open(): ERROR en PACKET_RX_RING: %s\n",
+                    strerror(errno));
+            return -1;
+        }
+        rx_len = (size_t) ETH_RING_BLOCK_SIZE * ETH_RING_BLOCK_NR;
+    }
+
+    if (flags & ETH_PACKET_TX_RING) {
+        /* En transmisión el anillo se recorre por ranuras de tamaño fijo */
+        memset(&req, 0, sizeof(req));
+        req.tp_block_size = ETH_RING_BLOCK_SIZE;
+        req.tp_block_nr = ETH_TX_RING_BLOCK_NR;
+        req.tp_frame_size = ETH_RING_FRAME_SIZE;
+        req.tp_frame_nr = (ETH_RING_BLOCK_SIZE / ETH_RING_FRAME_SIZE) * ETH_TX_RING_BLOCK_NR;
+        if (setsockopt(iface->fd, SOL_PACKET, PACKET_TX_RING,
+                       &req, sizeof(req)) == -1) {
+            fprintf(stderr, "eth_packet_open(): ERROR en PACKET_TX_RING: %s\n",
+                    strerror(errno));
+            return -1;
+        }
+        tx_len = (size_t) ETH_RING_BLOCK_SIZE * ETH_TX_RING_BLOCK_NR;
+        iface->tx_frame_nr = req.tp_frame_nr;
+    }
+
+    iface->ring_len = rx_len + tx_len;
+    void *ring = mmap(NULL, iface->ring_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, iface->fd, 0);
+    if (ring == MAP_FAILED) {
+        fprintf(stderr, "eth_packet_open(): ERROR en mmap(): %s\n",
+                strerror(errno));
+        iface->ring_len = 0;
+        return -1;
+    }
+    iface->ring = ring;
+    if (rx_len > 0) {
+        iface->rx_ring = ring;
+    }
+    if (tx_len > 0) {
+        iface->tx_ring = (uint8_t *) ring + rx_len;
+    }
+
+    return 0;
+}
+
+
+/* static struct tpacket3_hdr * eth_packet_tx_slot
+ * ( eth_packet_t * iface, int index );
+ *
+ * DESCRIPCIÓN:
+ *   Devuelve la cabecera de la ranura 'index' del anillo de transmisión.
+ *   Los datos de la trama empiezan en 'ETH_TX_SLOT_DATA' bytes después.
+ */
+#define ETH_TX_SLOT_DATA (TPACKET_ALIGN(sizeof(struct tpacket3_hdr)))
+
+static struct tpacket3_hdr *eth_packet_tx_slot(eth_packet_t *iface, int index) {
+    return (struct tpacket3_hdr *)
+            (iface->tx_ring + (size_t) index * ETH_RING_FRAME_SIZE);
+}
+
+
+/* static int eth_packet_ring_recv
+ * ( eth_packet_t * iface, unsigned char * bufs[], int sizes[], int lens[],
+ *   int num, long int timeout );
+ *
+ * DESCRIPCIÓN:
+ *   Versión de 'eth_packet_recv()' para el anillo TPACKET_V3. Una llamada
+ *   nunca devuelve tramas de dos bloques distintos, de modo que un bloque se
+ *   devuelve al núcleo sólo cuando ya no queda ninguna trama prestada de él.
+ */
+static int eth_packet_ring_recv
+        (eth_packet_t *iface, unsigned char *bufs[], int sizes[], int lens[],
+         int num, long int timeout) {
+    int received = 0;
+
+    while (received == 0) {
+        struct tpacket_block_desc *block = (struct tpacket_block_desc *)
+                (iface->rx_ring + (size_t) iface->rx_block * ETH_RING_BLOCK_SIZE);
+
+        /* Devolver al núcleo el bloque en curso si ya se ha consumido */
+        if (iface->rx_block_held && (iface->rx_pkts_left == 0)) {
+            __sync_synchronize();
+            block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+            iface->rx_block_held = 0;
+            iface->rx_block = (iface->rx_block + 1) % ETH_RING_BLOCK_NR;
+            block = (struct tpacket_block_desc *)
+                    (iface->rx_ring + (size_t) iface->rx_block * ETH_RING_BLOCK_SIZE);
+        }
+
+        /* Esperar a que el núcleo nos entregue el siguiente bloque */
+        if (!iface->rx_block_held) {
+            if ((block->hdr.bh1.block_status & TP_STATUS_USER) == 0) {
+                struct pollfd pfd;
+                pfd.fd = iface->fd;
+                pfd.events = POLLIN | POLLERR;
+                int err = poll(&pfd, 1, (timeout < 0) ? -1 : (int) timeout);
+                if (err == -1) {
+                    if (errno == EINTR) {
+                        return 0;
+                    }
+                    fprintf(stderr, "eth_packet_recv(): ERROR en poll(): %s\n",
+                            strerror(errno));
+                    return -1;
+                }
+                if ((block->hdr.bh1.block_status & TP_STATUS_USER) == 0) {
+                    /* Timeout! */
+                    return 0;
+                }
+            }
+            __sync_synchronize();
+            iface->rx_block_held = 1;
+            iface->rx_loaned = 0;
+            iface->rx_pkts_left = block->hdr.bh1.num_pkts;
+            iface->rx_next_pkt = (uint8_t *) block + block->hdr.bh1.offset_to_first_pkt;
+        }
+
+        /* Leer tramas del bloque en curso */
+        while ((received < num) && (iface->rx_pkts_left > 0)) {
+            struct tpacket3_hdr *pkt = (struct tpacket3_hdr *) iface->rx_next_pkt;
+            struct sockaddr_ll *sll = (struct sockaddr_ll *)
+                    ((uint8_t *) pkt + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+            iface->rx_next_pkt += pkt->tp_next_offset;
+            iface->rx_pkts_left--;
+
+            if (sll->sll_pkttype == PACKET_OUTGOING) {
+                continue;
+            }
+
+            unsigned char *frame = (uint8_t *) pkt + pkt->tp_mac;
+            if (bufs[received] == NULL) {
+                bufs[received] = frame;
+                sizes[received] = pkt->tp_snaplen;
+                iface->rx_loaned = 1;
+            } else {
+                memcpy(bufs[received], frame,
+                       (pkt->tp_snaplen < (unsigned int) sizes[received]) ?
+                       pkt->tp_snaplen : (unsigned int) sizes[received]);
+            }
+            lens[received] = pkt->tp_len;
+            received++;
+        }
+
+        /* Si no se ha prestado nada se puede devolver ya el bloque */
+        if (!iface->rx_loaned && (iface->rx_pkts_left == 0)) {
+            __sync_synchronize();
+            block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+            iface->rx_block_held = 0;
+            iface->rx_block = (iface->rx_block + 1) % ETH_RING_BLOCK_NR;
+        }
+    }
+
+    return received;
+}
+
+
+/* eth_packet_t * eth_packet_open ( char * ifname, int flags );
+ *
+ * DESCRIPCIÓN:
+ *   Abre un socket AF_PACKET asociado al interfaz indicado, que recibe todas
+ *   las tramas (incluidas las multicast) excepto las que envía el propio
+ *   equipo. 'flags' es una combinación de las opciones 'ETH_PACKET_*'.
+ *
+ * VALOR DEVUELTO:
+ *   Manejador del interfaz, o 'NULL' si se ha producido algún error.
+ */
+eth_packet_t *eth_packet_open(char *ifname, int flags) {
+    if ((ifname == NULL) || (strlen(ifname) >= IFNAMSIZ)) {
+        fprintf(stderr, "eth_packet_open(): ERROR: nombre de interfaz incorrecto\n");
+        return NULL;
+    }
+
+    struct eth_packet *iface = malloc(sizeof(struct eth_packet));
+    if (iface == NULL) {
+        fprintf(stderr, "eth_packet_open(): ERROR en malloc()\n");
+        return NULL;
+    }
+    memset(iface, 0, sizeof(struct eth_packet));
+    strcpy(iface->name, ifname);
+    iface->pid = eth_packet_getpid();
+    iface->fork_fd = -1;
+
+    iface->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (iface->fd == -1) {
+        fprintf(stderr, "eth_packet_open(): ERROR en socket(): %s\n",
+                strerror(errno));
+        free(iface);
+        return NULL;
+    }
+
+    /* Obtener el índice y la dirección MAC del interfaz */
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strcpy(ifr.ifr_name, ifname);
+    if (ioctl(iface->fd, SIOCGIFINDEX, &ifr) == -1) {
+        fprintf(stderr, "eth_packet_open(): ERROR en SIOCGIFINDEX(%s): %s\n",
+                ifname, strerror(errno));
+        eth_packet_close(iface);
+        return NULL;
+    }
+    iface->ifindex = ifr.ifr_ifindex;
+
+    if (ioctl(iface->fd, SIOCGIFHWADDR, &ifr) == -1) {
+        fprintf(stderr, "eth_packet_open(): ERROR en SIOCGIFHWADDR(%s): %s\n",
+                ifname, strerror(errno));
+        eth_packet_close(iface);
+        return NULL;
+    }
+    memcpy(iface->mac_address, ifr.ifr_hwaddr.sa_data, MAC_ADDR_SIZE);
+
+    /* Los anillos deben configurarse antes de asociar el socket */
+    if ((flags & (ETH_PACKET_RX_RING | ETH_PACKET_TX_RING)) &&
+        (eth_packet_setup_rings(iface, flags) == -1)) {
+        eth_packet_close(iface);
+        return NULL;
+    }
+
+    /* Asociar el socket únicamente a este interfaz */
+    struct sockaddr_ll sll;
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = iface->ifindex;
+    if (bind(iface->fd, (struct sockaddr *) &sll, sizeof(sll)) == -1) {
+        fprintf(stderr, "eth_packet_open(): ERROR en bind(%s): %s\n",
+                ifname, strerror(errno));
+        eth_packet_close(iface);
+        return NULL;
+    }
+
+    /* Recibir todo el tráfico multicast (p.ej. RIPv2 a 224.0.0.9) */
+    struct packet_mreq mreq;
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.mr_ifindex = iface->ifindex;
+    mreq.mr_type = PACKET_MR_ALLMULTI;
+    if (setsockopt(iface->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP,
+                   &mreq, sizeof(mreq)) == -1) {
+        fprintf(stderr, "eth_packet_open(): AVISO: PACKET_MR_ALLMULTI: %s\n",
+                strerror(errno));
+    }
+
+    /* Sin anillo, las ráfagas se acumulan en el buffer del socket */
+    if (iface->rx_ring == NULL) {
+        int rcvbuf = ETH_PACKET_RCVBUF;
+        setsockopt(iface->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+
+    /* No devolver las tramas que envía este mismo equipo. Si el núcleo no lo
+       soporta se descartan en eth_packet_recv() mirando 'sll_pkttype'. */
+    int one = 1;
+    setsockopt(iface->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+
+    return iface;
+}
+
+
+/* char * eth_packet_getname ( eth_packet_t * iface );
+ *
+ * DESCRIPCIÓN:
+ *   Devuelve el nombre del interfaz asociado al socket.
+ */
+char *eth_packet_getname(eth_packet_t *iface) {
+    return (iface != NULL) ? iface->name : NULL;
+}
+
+
+/* void eth_packet_getaddr ( eth_packet_t * iface, mac_addr_t addr );
+ *
+ * DESCRIPCIÓN:
+ *   Copia en 'addr' la dirección MAC del interfaz asociado al socket.
+ */
+void eth_packet_getaddr(eth_packet_t *iface, mac_addr_t addr) {
+    if (iface != NULL) {
+        memcpy(addr, iface->mac_address, MAC_ADDR_SIZE);
+    }
+}
+
+
+/* int eth_packet_getfd ( eth_packet_t * iface );
+ *
+ * DESCRIPCIÓN:
+ *   Devuelve el descriptor del socket, para poder esperar en él con
+ *   poll()/epoll().
+ */
+int eth_packet_getfd(eth_packet_t *iface) {
+    return (iface != NULL) ? iface->fd : -1;
+}
+
+
+/* static int eth_packet_sendmmsg
+ * ( int fd, unsigned char * frames[], int lens[], int num );
+ *
+ * DESCRIPCIÓN:
+ *   Envía las tramas por un socket sin anillo de transmisión.
+ */
+static int eth_packet_sendmmsg(int fd, unsigned char *frames[], int lens[], int num) {
+    struct mmsghdr msgs[num];
+    struct iovec iovs[num];
+    int i;
+    for (i = 0; i < num; i++) {
+        iovs[i].iov_base = frames[i];
+        iovs[i].iov_len = lens[i];
+        memset(&msgs[i], 0, sizeof(struct mmsghdr));
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    /* sendmmsg() puede enviar menos tramas de las pedidas; se reintenta con
+       el resto mientras progrese. */
+    int sent = 0;
+    while (sent < num) {
+        int n = sendmmsg(fd, &msgs[sent], num - sent, 0);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (sent == 0) {
+                fprintf(stderr, "eth_packet_send(): ERROR en sendmmsg(): %s\n",
+                        strerror(errno));
+                return -1;
+            }
+            break;
+        }
+        sent += n;
+    }
+
+    return sent;
+}
+
+
+/* static int eth_packet_fork_send
+ * ( eth_packet_t * iface, unsigned char * frames[], int lens[], int num );
+ *
+ * DESCRIPCIÓN:
+ *   Envía desde un proceso hijo, que no puede tocar el anillo de
+ *   transmisión del padre. La primera vez abre un socket propio sin anillos
+ *   (protocolo 0, así que el núcleo no le entrega tramas).
+ */
+static int eth_packet_fork_send
+        (eth_packet_t *iface, unsigned char *frames[], int lens[], int num) {
+    if (iface->fork_fd == -1) {
+        int fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, 0);
+        struct sockaddr_ll sll;
+        memset(&sll, 0, sizeof(sll));
+        sll.sll_family = AF_PACKET;
+        sll.sll_ifindex = iface->ifindex;
+        if ((fd == -1) || (bind(fd, (struct sockaddr *) &sll, sizeof(sll)) == -1)) {
+            fprintf(stderr, "eth_packet_send(): ERROR al abrir el socket del "
+                            "proceso hijo: %s\n", strerror(errno));
+            if (fd != -1) {
+                close(fd);
+            }
+            return -1;
+        }
+        iface->fork_fd = fd;
+    }
+
+    return eth_packet_sendmmsg(iface->fork_fd, frames, lens, num);
+}
+
+
+/* int eth_packet_send
+ * ( eth_packet_t * iface, unsigned char * frames[], int lens[], int num );
+ *
+ * DESCRIPCIÓN:
+ *   Envía 'num' tramas completas (cabecera incluida) con una única llamada a
+ *   sendmmsg().
+ *
+ * VALOR DEVUELTO:
+ *   El número de tramas enviadas [0, num].
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si no se ha podido enviar ninguna trama.
+ */
+int eth_packet_send
+        (eth_packet_t *iface, unsigned char *frames[], int lens[], int num) {
+    if ((iface == NULL) || (num <= 0)) {
+        return (num == 0) ? 0 : -1;
+    }
+
+    if ((iface->tx_ring != NULL) && (eth_packet_getpid() != iface->pid)) {
+        return eth_packet_fork_send(iface, frames, lens, num);
+    }
+
+    if (iface->tx_ring != NULL) {
+        /* Dejar cada trama en su ranura y avisar al núcleo sólo cuando se
+           hayan acumulado 'ETH_TX_BATCH' */
+        int i;
+        for (i = 0; i < num; i++) {
+            unsigned char *data = frames[i];
+            if ((data < iface->tx_ring) ||
+                (data >= iface->tx_ring + (size_t) iface->tx_frame_nr * ETH_RING_FRAME_SIZE)) {
+                /* La trama no se ha construido en el anillo: copiarla */
+                data = eth_packet_tx_alloc(iface);
+                if (data == NULL) {
+                    break;
+                }
+                memcpy(data, frames[i], lens[i]);
+            }
+            int index = (data - iface->tx_ring) / ETH_RING_FRAME_SIZE;
+            struct tpacket3_hdr *slot = eth_packet_tx_slot(iface, index);
+            slot->tp_len = lens[i];
+            slot->tp_snaplen = lens[i];
+            __sync_synchronize();
+            slot->tp_status = TP_STATUS_SEND_REQUEST;
+            iface->tx_pending++;
+        }
+        if ((iface->tx_pending >= ETH_TX_BATCH) && (eth_packet_flush(iface) == -1)) {
+            return -1;
+        }
+        return (i == 0) ? -1 : i;
+    }
+
+    return eth_packet_sendmmsg(iface->fd, frames, lens, num);
+}
+
+
+/* int eth_packet_recv
+ * ( eth_packet_t * iface, unsigned char * bufs[], int sizes[], int lens[],
+ *   int num, long int timeout );
+ *
+ * DESCRIPCIÓN:
+ *   Espera como mucho 'timeout' milisegundos a que llegue alguna trama y
+ *   recoge con una única llamada a recvmmsg() todas las disponibles, hasta
+ *   un máximo de 'num'. Cada trama se copia en 'bufs[i]' (truncada a
+ *   'sizes[i]' bytes) y su longitud real se devuelve en 'lens[i]'.
+ *
+ * VALOR DEVUELTO:
+ *   El número de tramas recibidas, o '0' si ha expirado el temporizador.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si se ha producido algún error.
+ */
+int eth_packet_recv
+        (eth_packet_t *iface, unsigned char *bufs[], int sizes[], int lens[],
+         int num, long int timeout) {
+    if ((iface == NULL) || (num <= 0)) {
+        return -1;
+    }
+
+    if ((iface->rx_ring != NULL) && (eth_packet_getpid() != iface->pid)) {
+        fprintf(stderr, "eth_packet_recv(): ERROR: el anillo de recepción de "
+                        "'%s' sólo puede usarlo el proceso que lo abrió\n", iface->name);
+        return -1;
+    }
+
+    if (iface->rx_ring != NULL) {
+        return eth_packet_ring_recv(iface, bufs, sizes, lens, num, timeout);
+    }
+
+    struct pollfd pfd;
+    pfd.fd = iface->fd;
+    pfd.events = POLLIN;
+    int err = poll(&pfd, 1, (timeout < 0) ? -1 : (int) timeout);
+    if (err == -1) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        fprintf(stderr, "eth_packet_recv(): ERROR en poll(): %s\n",
+                strerror(errno));
+        return -1;
+    } else if (err == 0) {
+        /* Timeout! */
+        return 0;
+    }
+
+    struct mmsghdr msgs[num];
+    struct iovec iovs[num];
+    struct sockaddr_ll addrs[num];
+    int i;
+    for (i = 0; i < num; i++) {
+        iovs[i].iov_base = bufs[i];
+        iovs[i].iov_len = sizes[i];
+        memset(&msgs[i], 0, sizeof(struct mmsghdr));
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_ll);
+    }
+
+    /* MSG_TRUNC hace que 'msg_len' sea la longitud real de la trama aunque
+       no quepa entera en el buffer, igual que indica eth_recv(). */
+    int n = recvmmsg(iface->fd, msgs, num, MSG_DONTWAIT | MSG_TRUNC, NULL);
+    if (n == -1) {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) {
+            return 0;
+        }
+        fprintf(stderr, "eth_packet_recv(): ERROR en recvmmsg(): %s\n",
+                strerror(errno));
+        return -1;
+    }
+
+    /* Compactar descartando las tramas enviadas por nosotros mismos */
+    int received = 0;
+    for (i = 0; i < n; i++) {
+        if (addrs[i].sll_pkttype == PACKET_OUTGOING) {
+            continue;
+        }
+        if (received != i) {
+            memcpy(bufs[received], bufs[i],
+                   (msgs[i].msg_len < (unsigned int) sizes[received]) ?
+                   msgs[i].msg_len : (unsigned int) sizes[received]);
+        }
+        lens[received] = msgs[i].msg_len;
+        received++;
+    }
+
+    return received;
+}
+
+
+/* unsigned char * eth_packet_tx_alloc ( eth_packet_t * iface );
+ *
+ * DESCRIPCIÓN:
+ *   Reserva la siguiente ranura libre del anillo de transmisión y devuelve
+ *   un puntero de 'ETH_FRAME_MAX_LENGTH' bytes donde construir la trama. Si
+ *   el anillo está lleno se envían las tramas pendientes para liberarlo.
+ *
+ * VALOR DEVUELTO:
+ *   Puntero a la ranura, o 'NULL' si no hay anillo o no se ha podido liberar
+ *   ninguna ranura.
+ */
+unsigned char *eth_packet_tx_alloc(eth_packet_t *iface) {
+    if ((iface == NULL) || (iface->tx_ring == NULL) || (eth_packet_getpid() != iface->pid)) {
+        return NULL;
+    }
+
+    struct tpacket3_hdr *slot = eth_packet_tx_slot(iface, iface->tx_next);
+    if (slot->tp_status & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING)) {
+        /* Anillo lleno: send() sin MSG_DONTWAIT espera a que se vacíe */
+        if (eth_packet_flush(iface) == -1) {
+            return NULL;
+        }
+        if (slot->tp_status & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING)) {
+            fprintf(stderr, "eth_packet_tx_alloc(): ERROR: anillo lleno\n");
+            return NULL;
+        }
+    }
+    if (slot->tp_status == TP_STATUS_WRONG_FORMAT) {
+        fprintf(stderr, "eth_packet_tx_alloc(): AVISO: trama descartada por el núcleo\n");
+    }
+    slot->tp_status = TP_STATUS_AVAILABLE;
+
+    iface->tx_next = (iface->tx_next + 1) % iface->tx_frame_nr;
+
+    return (unsigned char *) slot + ETH_TX_SLOT_DATA;
+}
+
+
+/* int eth_packet_flush ( eth_packet_t * iface );
+ *
+ * DESCRIPCIÓN:
+ *   Pide al núcleo, con una única llamada a send(), que transmita todas las
+ *   tramas pendientes del anillo de transmisión.
+ *
+ * VALOR DEVUELTO:
+ *   El número de tramas que estaban pendientes.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si se ha producido algún error.
+ */
+int eth_packet_flush(eth_packet_t *iface) {
+    if ((iface == NULL) || (iface->tx_ring == NULL) || (iface->tx_pending == 0) ||
+        (eth_packet_getpid() != iface->pid)) {
+        return 0;
+    }
+
+    int pending = iface->tx_pending;
+    while (send(iface->fd, NULL, 0, 0) == -1) {
+        if (errno != EINTR) {
+            fprintf(stderr, "eth_packet_flush(): ERROR en send(): %s\n",
+                    strerror(errno));
+            return -1;
+        }
+    }
+    iface->tx_pending = 0;
+
+    return pending;
+}
+
+
+/* int eth_packet_set_filter
+ * ( eth_packet_t * iface, uint16_t types[], int ntypes,
+ *   mac_addr_t groups[], int ngroups );
+ *
+ * DESCRIPCIÓN:
+ *   Compila y asocia al socket un filtro BPF clásico para que el núcleo sólo
+ *   entregue las tramas dirigidas a la MAC del interfaz, a difusión o a uno
+ *   de los 'ngroups' grupos multicast indicados (a cualquier multicast si
+ *   'ngroups' es 0), y cuyo tipo sea uno de los 'ntypes' indicados (de
+ *   cualquier tipo si 'ntypes' es 0).
+ *
+ *   El programa generado es:
+ *
+ *       ldh [12]                    ; Campo 'Tipo'
+ *       jeq #tipo_i, mac, sig       ; ... uno por tipo
+ *       ret #0
+ *   mac:
+ *       ld [0] / jeq / ldh [4] / jeq ; ... uno por MAC aceptada
+ *       ldb [0] / jset #1            ; sólo si se acepta cualquier multicast
+ *       ret #0
+ *       ret #ETH_FILTER_SNAPLEN
+ *
+ * VALOR DEVUELTO:
+ *   '0' si el filtro se ha instalado, '-1' en caso contrario.
+ */
+int eth_packet_set_filter
+        (eth_packet_t *iface, uint16_t types[], int ntypes,
+         mac_addr_t groups[], int ngroups) {
+    if ((iface == NULL) || (ntypes < 0) || (ntypes > ETH_FILTER_MAX_TYPES) ||
+        (ngroups < 0) || (ngroups > ETH_FILTER_MAX_GROUPS)) {
+        fprintf(stderr, "eth_packet_set_filter(): ERROR: parámetros incorrectos\n");
+        return -1;
+    }
+
+    /* Tipos + (propia, difusión y grupos) * 4 + multicast + ret * 2 */
+    struct sock_filter prog[2 + ETH_FILTER_MAX_TYPES + (2 + ETH_FILTER_MAX_GROUPS) * 4 + 4];
+    int accept_jumps[2 + ETH_FILTER_MAX_GROUPS + 1];
+    int naccept = 0;
+    int n = 0;
+    int i;
+
+    /* Filtrar por tipo: cada 'jeq' salta, si coincide, por encima de los que
+       le siguen y del 'ret #0' */
+    if (ntypes > 0) {
+        prog[n++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12);
+        for (i = 0; i < ntypes; i++) {
+            prog[n++] = (struct sock_filter)
+                    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, types[i], ntypes - i, 0);
+        }
+        prog[n++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0);
+    }
+
+    /* Filtrar por MAC destino comparando los 4 primeros bytes y los 2
+       últimos por separado */
+    int nmacs = 2 + ngroups;
+    for (i = 0; i < nmacs; i++) {
+        unsigned char *mac = (i == 0) ? iface->mac_address :
+                             (i == 1) ? MAC_BCAST_ADDR : groups[i - 2];
+        uint32_t hi = ((uint32_t) mac[0] << 24) | ((uint32_t) mac[1] << 16) |
+                      ((uint32_t) mac[2] << 8) | (uint32_t) mac[3];
+        uint32_t lo = ((uint32_t) mac[4] << 8) | (uint32_t) mac[5];
+
+        prog[n++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 0);
+        prog[n++] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, hi, 0, 2);
+        prog[n++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 4);
+        accept_jumps[naccept++] = n;
+        prog[n++] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, lo, 0, 0);
+    }
+    if (ngroups == 0) {
+        prog[n++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0);
+        accept_jumps[naccept++] = n;
+        prog[n++] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x01, 0, 0);
+    }
+    prog[n++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0);
+    prog[n++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, ETH_FILTER_SNAPLEN);
+
+    /* Resolver los saltos a la instrucción de aceptación (la última) */
+    for (i = 0; i < naccept; i++) {
+        prog[accept_jumps[i]].jt = (n - 1) - (accept_jumps[i] + 1);
+    }
+
+    struct sock_fprog fprog;
+    fprog.len = n;
+    fprog.filter = prog;
+    if (setsockopt(iface->fd, SOL_SOCKET, SO_ATTACH_FILTER,
+                   &fprog, sizeof(fprog)) == -1) {
+        fprintf(stderr, "eth_packet_set_filter(): ERROR en SO_ATTACH_FILTER: %s\n",
+                strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* int eth_packet_has_rx_ring ( eth_packet_t * iface );
+ *
+ * DESCRIPCIÓN:
+ *   Indica si el socket recibe a través de un anillo TPACKET_V3, y por tanto
+ *   admite 'bufs[i] == NULL' en 'eth_packet_recv()'.
+ */
+int eth_packet_has_rx_ring(eth_packet_t *iface) {
+    return (iface != NULL) && (iface->rx_ring != NULL);
+}
+
+
+/* int eth_packet_close ( eth_packet_t * iface );
+ *
+ * DESCRIPCIÓN:
+ *   Cierra el socket y libera la memoria del manejador.
+ */
+int eth_packet_close(eth_packet_t *iface) {
+    int err = -1;
+
+    if (iface != NULL) {
+        eth_packet_flush(iface);
+        if (iface->ring != NULL) {
+            munmap(iface->ring, iface->ring_len);
+        }
+        if (iface->fork_fd != -1) {
+            close(iface->fork_fd);
+        }
+        err = close(iface->fd);
+        free(iface);
+    }
+
+    return err;
+}
+
+
+/* Tipos de enlace "packet:" y "mmap:" (ver 'eth_backend.h') */
+
+static void *eth_packet_backend_open(char *ifname) {
+    return eth_packet_open(ifname, 0);
+}
+
+static void *eth_mmap_backend_open(char *ifname) {
+    return eth_packet_open(ifname, ETH_PACKET_RX_RING | ETH_PACKET_TX_RING);
+}
+
+static char *eth_packet_backend_getname(void *dev) {
+    return eth_packet_getname(dev);
+}
+
+static void eth_packet_backend_getaddr(void *dev, mac_addr_t addr) {
+    eth_packet_getaddr(dev, addr);
+}
+
+static int eth_packet_backend_getfd(void *dev) {
+    return eth_packet_getfd(dev);
+}
+
+static int eth_packet_backend_send
+        (void *dev, unsigned char *frames[], int lens[], int num) {
+    return eth_packet_send(dev, frames, lens, num);
+}
+
+static int eth_packet_backend_recv
+        (void *dev, unsigned char *bufs[], int sizes[], int lens[],
+         int num, long int timeout) {
+    return eth_packet_recv(dev, bufs, sizes, lens, num, timeout);
+}
+
+static int eth_packet_backend_can_lend(void *dev) {
+    return eth_packet_has_rx_ring(dev);
+}
+
+static unsigned char *eth_packet_backend_tx_alloc(void *dev) {
+    return eth_packet_tx_alloc(dev);
+}
+
+static int eth_packet_backend_flush(void *dev) {
+    return eth_packet_flush(dev);
+}
+
+static int eth_packet_backend_set_filter
+        (void *dev, uint16_t types[], int ntypes,
+         mac_addr_t groups[], int ngroups) {
+    return eth_packet_set_filter(dev, types, ntypes, groups, ngroups);
+}
+
+static int eth_packet_backend_close(void *dev) {
+    return eth_packet_close(dev);
+}
+
+const eth_backend_t eth_packet_backend = {
+        .prefix = "packet:",
+        .open = eth_packet_backend_open,
+        .getname = eth_packet_backend_getname,
+        .getaddr = eth_packet_backend_getaddr,
+        .getfd = eth_packet_backend_getfd,
+        .send = eth_packet_backend_send,
+        .recv = eth_packet_backend_recv,
+        .flush = eth_packet_backend_flush,
+        .set_filter = eth_packet_backend_set_filter,
+        .close = eth_packet_backend_close,
+        .shared_send = 1,
+};
+
+const eth_backend_t eth_mmap_backend = {
+        .prefix = "mmap:",
+        .open = eth_mmap_backend_open,
+        .getname = eth_packet_backend_getname,
+        .getaddr = eth_packet_backend_getaddr,
+        .getfd = eth_packet_backend_getfd,
+        .send = eth_packet_backend_send,
+        .recv = eth_packet_backend_recv,
+        .can_lend = eth_packet_backend_can_lend,
+        .tx_alloc = eth_packet_backend_tx_alloc,
+        .flush = eth_packet_backend_flush,
+        .set_filter = eth_packet_backend_set_filter,
+        .close = eth_packet_backend_close,
+};
@@ -0,0 +1,200 @@
+#ifndef _ETH_PACKET_H
+#define _ETH_PACKET_H
+
+#include "eth.h"
+
+/* Interfaz Ethernet nativo sobre un socket AF_PACKET de Linux.
+ *
+ * Es el equivalente de 'rawiface_t' de la librería rawnet, pero expone las
+ * llamadas en ráfaga del núcleo (sendmmsg/recvmmsg) para que 'eth.c' pueda
+ * mover varias tramas por llamada al sistema. Se selecciona desde
+ * 'eth_open()' anteponiendo "packet:" al nombre del interfaz.
+ *
+ * Con el prefijo "mmap:" la recepción usa además un anillo TPACKET_V3
+ * compartido con el núcleo: las tramas se leen directamente de los bloques
+ * mapeados en memoria y cada bloque se devuelve al núcleo de una vez cuando
+ * se han consumido todas sus tramas. La transmisión usa un anillo
+ * PACKET_TX_RING: cada trama se deja en una ranura y el núcleo las envía
+ * todas juntas con un único send() cada 'ETH_TX_BATCH' tramas o al llamar a
+ * 'eth_packet_flush()'.
+ *
+ * Los anillos pertenecen al proceso que abrió el socket. Un proceso hijo
+ * creado con fork() después (p.ej. el de las actualizaciones periódicas de
+ * 'ripv2_server') no comparte el anillo de transmisión: envía por un socket
+ * propio sin anillos, igual que con "packet:", y no puede recibir.
+ */
+typedef struct eth_packet eth_packet_t;
+
+/* Opciones de 'eth_packet_open()' */
+#define ETH_PACKET_RX_RING 0x01 /* Recibir a través de un anillo TPACKET_V3 */
+#define ETH_PACKET_TX_RING 0x02 /* Enviar a través de un anillo PACKET_TX_RING */
+
+/* Geometría del anillo de recepción: ETH_RING_BLOCK_NR bloques de
+   ETH_RING_BLOCK_SIZE bytes. El núcleo entrega un bloque a medio llenar
+   cuando pasan ETH_RING_BLOCK_TOV milisegundos sin completarlo. */
+#define ETH_RING_BLOCK_SIZE (1 << 16)
+#define ETH_RING_BLOCK_NR 64
+#define ETH_RING_FRAME_SIZE 2048
+#define ETH_RING_BLOCK_TOV 1
+
+/* Bytes de cada trama aceptada por el filtro BPF (la trama completa) */
+#define ETH_FILTER_SNAPLEN 0x40000
+
+/* Tamaño del buffer de recepción de un socket sin anillo */
+#define ETH_PACKET_RCVBUF (1 << 22)
+
+/* Bloques del anillo de transmisión (ranuras de ETH_RING_FRAME_SIZE bytes) */
+#define ETH_TX_RING_BLOCK_NR 16
+
+
+/* eth_packet_t * eth_packet_open ( char * ifname, int flags );
+ *
+ * DESCRIPCIÓN:
+ *   Abre un socket AF_PACKET asociado al interfaz indicado, que recibe todas
+ *   las tramas (incluidas las multicast) excepto las que envía el propio
+ *   equipo. 'flags' es una combinación de las opciones 'ETH_PACKET_*'.
+ *
+ * VALOR DEVUELTO:
+ *   Manejador del interfaz, o 'NULL' si se ha producido algún error.
+ */
+eth_packet_t * eth_packet_open ( char * ifname, int flags );
+
+
+/* char * eth_packet_getname ( eth_packet_t * iface );
+ *
+ * DESCRIPCIÓN:
+ *   Devuelve el nombre del interfaz asociado al socket.
+ */
+char * eth_packet_getname ( eth_packet_t * iface );
+
+
+/* void eth_packet_getaddr ( eth_packet_t * iface, mac_addr_t addr );
+ *
+ * DESCRIPCIÓN:
+ *   Copia en 'addr' la dirección MAC del interfaz asociado al socket.
+ */
+void eth_packet_getaddr ( eth_packet_t * iface, mac_addr_t addr );
+
+
+/* int eth_packet_getfd ( eth_packet_t * iface );
+ *
+ * DESCRIPCIÓN:
+ *   Devuelve el descriptor del socket, para poder esperar en él con
+ *   poll()/epoll().
+ */
+int eth_packet_getfd ( eth_packet_t * iface );
+
+
+/* int eth_packet_send
+ * ( eth_packet_t * iface, unsigned char * frames[], int lens[], int num );
+ *
+ * DESCRIPCIÓN:
+ *   Envía 'num' tramas completas (cabecera incluida) con una única llamada a
+ *   sendmmsg(). Con anillo de transmisión las tramas sólo se dejan en sus
+ *   ranuras (copiándolas si no se obtuvieron con 'eth_packet_tx_alloc()').
+ *
+ * VALOR DEVUELTO:
+ *   El número de tramas enviadas [0, num].
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si no se ha podido enviar ninguna trama.
+ */
+int eth_packet_send
+( eth_packet_t * iface, unsigned char * frames[], int lens[], int num );
+
+
+/* int eth_packet_recv
+ * ( eth_packet_t * iface, unsigned char * bufs[], int sizes[], int lens[],
+ *   int num, long int timeout );
+ *
+ * DESCRIPCIÓN:
+ *   Espera como mucho 'timeout' milisegundos a que llegue alguna trama y
+ *   recoge con una única llamada a recvmmsg() todas las disponibles, hasta
+ *   un máximo de 'num'. Cada trama se copia en 'bufs[i]' (truncada a
+ *   'sizes[i]' bytes) y su longitud real se devuelve en 'lens[i]'.
+ *
+ *   Con anillo de recepción las tramas se leen del bloque en curso sin
+ *   llamadas al sistema. Si 'bufs[i]' es NULL no se copia nada: se devuelve
+ *   en 'bufs[i]'/'sizes[i]' la trama dentro del anillo, que sigue siendo
+ *   válida hasta la siguiente llamada a esta función.
+ *
+ * VALOR DEVUELTO:
+ *   El número de tramas recibidas, o '0' si ha expirado el temporizador.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si se ha producido algún error.
+ */
+int eth_packet_recv
+( eth_packet_t * iface, unsigned char * bufs[], int sizes[], int lens[],
+  int num, long int timeout );
+
+
+/* unsigned char * eth_packet_tx_alloc ( eth_packet_t * iface );
+ *
+ * DESCRIPCIÓN:
+ *   Reserva la siguiente ranura libre del anillo de transmisión y devuelve
+ *   un puntero de 'ETH_FRAME_MAX_LENGTH' bytes donde construir la trama. Si
+ *   el anillo está lleno se envían las tramas pendientes para liberarlo.
+ *
+ *   La trama debe entregarse después con 'eth_packet_send()'; las ranuras se
+ *   transmiten en orden, así que una ranura reservada y nunca enviada
+ *   detiene las siguientes.
+ *
+ * VALOR DEVUELTO:
+ *   Puntero a la ranura, o 'NULL' si no hay anillo o no se ha podido liberar
+ *   ninguna ranura.
+ */
+unsigned char * eth_packet_tx_alloc ( eth_packet_t * iface );
+
+
+/* int eth_packet_flush ( eth_packet_t * iface );
+ *
+ * DESCRIPCIÓN:
+ *   Pide al núcleo, con una única llamada a send(), que transmita todas las
+ *   tramas pendientes del anillo de transmisión.
+ *
+ * VALOR DEVUELTO:
+ *   El número de tramas que estaban pendientes.
+ *
+ * ERRORES:
+ *   La función devuelve '-1' si se ha producido algún error.
+ */
+int eth_packet_flush ( eth_packet_t * iface );
+
+
+/* int eth_packet_set_filter
+ * ( eth_packet_t * iface, uint16_t types[], int ntypes,
+ *   mac_addr_t groups[], int ngroups );
+ *
+ * DESCRIPCIÓN:
+ *   Compila y asocia al socket un filtro BPF clásico para que el núcleo sólo
+ *   entregue las tramas dirigidas a la MAC del interfaz, a difusión o a uno
+ *   de los 'ngroups' grupos multicast indicados (a cualquier multicast si
+ *   'ngroups' es 0), y cuyo tipo sea uno de los 'ntypes' indicados (de
+ *   cualquier tipo si 'ntypes' es 0).
+ *
+ * VALOR DEVUELTO:
+ *   '0' si el filtro se ha instalado, '-1' en caso contrario.
+ */
+int eth_packet_set_filter
+( eth_packet_t * iface, uint16_t types[], int ntypes,
+  mac_addr_t groups[], int ngroups );
+
+
+/* int eth_packet_has_rx_ring ( eth_packet_t * iface );
+ *
+ * DESCRIPCIÓN:
+ *   Indica si el socket recibe a través de un anillo TPACKET_V3, y por tanto
+ *   admite 'bufs[i] == NULL' en 'eth_packet_recv()'.
+ */
+int eth_packet_has_rx_ring ( eth_packet_t * iface );
+
+
+/* int eth_packet_close ( eth_packet_t * iface );
+ *
+ * DESCRIPCIÓN:
+ *   Cierra el socket y libera la memoria del manejador.
+ */
+int eth_packet_close ( eth_packet_t * iface );
+
+#endif /* _ETH_PACKET_H */
@@ -0,0 +1,100 @@
+#include "eth_backend.h"
+#include <rawnet.h>
+
+#include <stdio.h>
+
+/* Tipo de enlace por defecto: la librería rawnet. No dispone de operaciones
+   en ráfaga ni de descriptor, así que las tramas se envían y reciben de una
+   en una y la espera se hace con rawnet_poll(). */
+
+
+static void *eth_rawnet_open(char *ifname) {
+    rawiface_t *raw_iface = rawiface_open(ifname);
+    if (raw_iface == NULL) {
+        fprintf(stderr, "eth_open(): ERROR en rawiface_open(): %s\n",
+                rawnet_strerror());
+    }
+
+    return raw_iface;
+}
+
+
+static char *eth_rawnet_getname(void *dev) {
+    return rawiface_getname(dev);
+}
+
+
+static void eth_rawnet_getaddr(void *dev, mac_addr_t addr) {
+    rawiface_getaddr(dev, addr);
+}
+
+
+static int eth_rawnet_poll(void *devs[], int num, long int timeout) {
+    rawiface_t *raw_ifaces[num];
+    int i;
+    for (i = 0; i < num; i++) {
+        raw_ifaces[i] = devs[i];
+    }
+
+    int iface_index = rawnet_poll(raw_ifaces, num, timeout);
+    if (iface_index == -1) {
+        fprintf(stderr, "eth_poll(): ERROR en rawnet_poll(): %s\n",
+                rawnet_strerror());
+    }
+
+    return iface_index;
+}
+
+
+static int eth_rawnet_send(void *dev, unsigned char *frames[], int lens[], int num) {
+    int i;
+    for (i = 0; i < num; i++) {
+        if (rawnet_send(dev, frames[i], lens[i]) == -1) {
+            fprintf(stderr, "eth_send(): ERROR en rawnet_send(): %s\n",
+                    rawnet_strerror());
+            break;
+        }
+    }
+
+    return (i == 0) ? -1 : i;
+}
+
+
+/* La primera trama se espera como mucho 'timeout' milisegundos; las
+   siguientes se piden con un timeout de 0 para no volver a bloquearse. */
+static int eth_rawnet_recv
+        (void *dev, unsigned char *bufs[], int sizes[], int lens[],
+         int num, long int timeout) {
+    int i;
+    for (i = 0; i < num; i++) {
+        int frame_len = rawnet_recv(dev, bufs[i], sizes[i],
+                                    (i == 0) ? timeout : 0);
+        if (frame_len < 0) {
+            fprintf(stderr, "eth_recv(): ERROR en rawnet_recv(): %s\n",
+                    rawnet_strerror());
+            return (i == 0) ? -1 : i;
+        } else if (frame_len == 0) {
+            break;
+        }
+        lens[i] = frame_len;
+    }
+
+    return i;
+}
+
+
+static int eth_rawnet_close(void *dev) {
+    return rawiface_close(dev);
+}
+
+
+const eth_backend_t eth_rawnet_backend = {
+        .prefix = "",
+        .open = eth_rawnet_open,
+        .getname = eth_rawnet_getname,
+        .getaddr = eth_rawnet_getaddr,
+        .poll = eth_rawnet_poll,
+        .send = eth_rawnet_send,
+        .recv = eth_rawnet_recv,
+        .close = eth_rawnet_close,
+};
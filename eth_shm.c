@@ -0,0 +1,615 @@
+#include "eth_backend.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Tipo de enlace "shm:": un segmento Ethernet simulado en memoria
+   compartida POSIX, al que se conectan extremos con nombre de cualquier
+   proceso del mismo equipo ("shm:lab/cliente", "shm:lab/servidor"). No hace
+   falta tarjeta de red, ni root, ni rawnet.
+
+   Cada par (origen, destino) de extremos tiene su propio anillo de un solo
+   productor y un solo consumidor, así que no hay cerrojos. Una trama
+   unicast va sólo al extremo con esa MAC destino (si no hay ninguno se
+   descarta), y una de difusión o multicast se copia a todos los extremos
+   conectados menos el que la envía. Si el anillo de un destino está lleno
+   la trama se descarta para ese destino, como en una tarjeta saturada.
+
+   La MAC de cada extremo se puede indicar tras una coma
+   ("shm:lab/r1,02:00:00:00:00:01"); si no, se deriva del nombre. El
+   segmento (/dev/shm/eth-shm-LAB) se mantiene entre ejecuciones.
+
+   Para poder esperar con poll()/epoll() cada extremo tiene además un
+   socket "timbre" AF_UNIX: quien envía sólo toca el timbre si el destino ha
+   avisado de que tiene sus anillos vacíos, así que con tráfico continuo no
+   hay llamadas al sistema por trama.
+
+   Cada anillo tiene un solo productor también entre procesos: si el
+   proceso que abrió el extremo hace fork() y el hijo envía (como las
+   actualizaciones periódicas de 'ripv2_server'), el hijo ocupa la primera
+   vez otro extremo sólo de envío, con el mismo nombre y MAC, que nadie
+   elige como destino. El hijo no puede recibir: los anillos de entrada son
+   del padre. */
+
+/* Extremos por segmento y tramas por anillo */
+#define ETH_SHM_MAX_ENDPOINTS 8
+#define ETH_SHM_RING_LEN 256
+
+/* Longitud máxima de los nombres del segmento y de los extremos */
+#define ETH_SHM_NAME_MAX 32
+
+/* Estado de un extremo en el segmento */
+#define ETH_SHM_FREE 0
+#define ETH_SHM_CLAIMED 1       /* Reservado, aún sin nombre ni MAC */
+#define ETH_SHM_READY 2
+#define ETH_SHM_SENDER 3        /* Sólo de envío, de un proceso hijo */
+
+/* Trama de un anillo */
+struct eth_shm_slot {
+    uint32_t len;
+    unsigned char data[ETH_FRAME_MAX_LENGTH];
+};
+
+/* Anillo de un solo productor y un solo consumidor. Los índices crecen sin
+   límite y están en líneas de caché distintas. */
+struct eth_shm_ring {
+    uint32_t head __attribute__((aligned(64)));  /* Consumidor */
+    uint32_t tail __attribute__((aligned(64)));  /* Productor */
+    struct eth_shm_slot slots[ETH_SHM_RING_LEN] __attribute__((aligned(64)));
+};
+
+/* Extremo del segmento */
+struct eth_shm_endpoint {
+    uint32_t state;
+    pid_t pid;
+    char name[ETH_SHM_NAME_MAX];
+    mac_addr_t mac_address;
+    uint32_t armed;             /* 1 si espera que le toquen el timbre */
+};
+
+/* Contenido del segmento compartido */
+struct eth_shm_segment {
+    struct eth_shm_endpoint endpoints[ETH_SHM_MAX_ENDPOINTS];
+    struct eth_shm_ring rings[ETH_SHM_MAX_ENDPOINTS][ETH_SHM_MAX_ENDPOINTS]; /* [origen][destino] */
+};
+
+/* Manejador de un extremo */
+struct eth_shm {
+    struct eth_shm_segment *seg;
+    struct eth_shm_endpoint *me;
+    int index;                  /* Posición de este extremo en el segmento */
+    char lab[ETH_SHM_NAME_MAX];
+    char name[2 * ETH_SHM_NAME_MAX]; /* "lab/extremo" */
+    mac_addr_t mac_address;
+    int fd;                     /* Timbre */
+    int held[ETH_SHM_MAX_ENDPOINTS]; /* Tramas prestadas de cada anillo */
+    int next_src;               /* Anillo por el que empezar a recibir */
+    pid_t pid;                  /* Proceso que abrió el extremo */
+    pid_t tx_pid;               /* Proceso hijo que ocupa 'tx_index' */
+    int tx_index;               /* Extremo de envío del hijo, o -1 */
+};
+
+
+/* Identificador del proceso, que el hijo actualiza tras fork(). Se guarda
+   para no hacer una llamada al sistema en cada envío. */
+static pid_t eth_shm_getpid_value;
+static pthread_once_t eth_shm_getpid_once = PTHREAD_ONCE_INIT;
+
+static void eth_shm_getpid_update(void) {
+    eth_shm_getpid_value = getpid();
+}
+
+static void eth_shm_getpid_init(void) {
+    eth_shm_getpid_update();
+    pthread_atfork(NULL, NULL, eth_shm_getpid_update);
+}
+
+static pid_t eth_shm_getpid(void) {
+    pthread_once(&eth_shm_getpid_once, eth_shm_getpid_init);
+
+    return eth_shm_getpid_value;
+}
+
+
+/* static socklen_t eth_shm_doorbell
+ * ( struct sockaddr_un * addr, char * lab, int index );
+ *
+ * DESCRIPCIÓN:
+ *   Dirección abstracta del timbre del extremo 'index' del segmento 'lab'.
+ */
+static socklen_t eth_shm_doorbell(struct sockaddr_un *addr, char *lab, int index) {
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    int len = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1,
+                       "eth-shm/%s/%d", lab, index);
+
+    return offsetof(struct sockaddr_un, sun_path) + 1 + len;
+}
+
+
+/* static int eth_shm_reserve ( struct eth_shm * shm );
+ *
+ * DESCRIPCIÓN:
+ *   Ocupa el primer extremo libre, o uno sólo de envío cuyo proceso ha
+ *   terminado.
+ *
+ * VALOR DEVUELTO:
+ *   Posición del extremo, o '-1' si no queda ninguno.
+ */
+static int eth_shm_reserve(struct eth_shm *shm) {
+    int i;
+    for (i = 0; i < ETH_SHM_MAX_ENDPOINTS; i++) {
+        struct eth_shm_endpoint *ep = &shm->seg->endpoints[i];
+        uint32_t state = __atomic_load_n(&ep->state, __ATOMIC_ACQUIRE);
+        if ((state == ETH_SHM_SENDER) &&
+            ((kill(ep->pid, 0) == 0) || (errno != ESRCH))) {
+            continue;
+        }
+        if (((state == ETH_SHM_FREE) || (state == ETH_SHM_SENDER)) &&
+            __atomic_compare_exchange_n(&ep->state, &state, ETH_SHM_CLAIMED, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+
+/* static int eth_shm_claim ( struct eth_shm * shm, char * name );
+ *
+ * DESCRIPCIÓN:
+ *   Ocupa un extremo del segmento: el que ya tenía ese nombre si su proceso
+ *   ha terminado, o el primero libre.
+ *
+ * VALOR DEVUELTO:
+ *   Posición del extremo, o '-1' si el nombre está en uso o no quedan
+ *   extremos libres.
+ */
+static int eth_shm_claim(struct eth_shm *shm, char *name) {
+    int i;
+    for (i = 0; i < ETH_SHM_MAX_ENDPOINTS; i++) {
+        struct eth_shm_endpoint *ep = &shm->seg->endpoints[i];
+        uint32_t state = __atomic_load_n(&ep->state, __ATOMIC_ACQUIRE);
+        if ((state == ETH_SHM_READY) && (strcmp(ep->name, name) == 0)) {
+            if ((kill(ep->pid, 0) == 0) || (errno != ESRCH)) {
+                fprintf(stderr, "eth_open(): ERROR: el extremo 'shm:%s/%s' ya "
+                                "está abierto\n", shm->lab, name);
+                return -1;
+            }
+            /* Su proceso ha terminado sin cerrarlo */
+            if (__atomic_compare_exchange_n(&ep->state, &state, ETH_SHM_CLAIMED, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                return i;
+            }
+        }
+    }
+    i = eth_shm_reserve(shm);
+    if (i == -1) {
+        fprintf(stderr, "eth_open(): ERROR: el segmento 'shm:%s' ya tiene %d extremos\n",
+                shm->lab, ETH_SHM_MAX_ENDPOINTS);
+    }
+
+    return i;
+}
+
+
+/* static void * eth_shm_open ( char * ifname );
+ *
+ * DESCRIPCIÓN:
+ *   Conecta el extremo "segmento/nombre[,MAC]", creando el segmento si no
+ *   existe.
+ */
+static void *eth_shm_open(char *ifname) {
+    char *slash = (ifname != NULL) ? strchr(ifname, '/') : NULL;
+    if ((slash == NULL) || (slash == ifname) ||
+        (slash - ifname >= ETH_SHM_NAME_MAX)) {
+        fprintf(stderr, "eth_open(): ERROR: el nombre debe ser "
+                        "\"shm:segmento/extremo[,MAC]\"\n");
+        return NULL;
+    }
+
+    struct eth_shm *shm = calloc(1, sizeof(struct eth_shm));
+    if (shm == NULL) {
+        fprintf(stderr, "eth_open(): ERROR en calloc()\n");
+        return NULL;
+    }
+    shm->fd = -1;
+    shm->pid = eth_shm_getpid();
+    shm->tx_index = -1;
+    memcpy(shm->lab, ifname, slash - ifname);
+
+    char name[ETH_SHM_NAME_MAX];
+    char *comma = strchr(slash + 1, ',');
+    size_t name_len = (comma != NULL) ? (size_t) (comma - slash - 1) : strlen(slash + 1);
+    if ((name_len == 0) || (name_len >= ETH_SHM_NAME_MAX)) {
+        fprintf(stderr, "eth_open(): ERROR: nombre de extremo incorrecto\n");
+        free(shm);
+        return NULL;
+    }
+    memcpy(name, slash + 1, name_len);
+    name[name_len] = '\0';
+    snprintf(shm->name, sizeof(shm->name), "%s/%s", shm->lab, name);
+
+    if (comma != NULL) {
+        if (mac_str_addr(comma + 1, shm->mac_address) != 0) {
+            fprintf(stderr, "eth_open(): ERROR: MAC '%s' incorrecta\n", comma + 1);
+            free(shm);
+            return NULL;
+        }
+    } else {
+        /* 02:53:48 ("SH") + 24 bits de un hash FNV-1a de "segmento/extremo" */
+        uint32_t hash = 2166136261u;
+        int i;
+        for (i = 0; shm->name[i] != '\0'; i++) {
+            hash = (hash ^ (unsigned char) shm->name[i]) * 16777619u;
+        }
+        shm->mac_address[0] = 0x02;
+        shm->mac_address[1] = 0x53;
+        shm->mac_address[2] = 0x48;
+        shm->mac_address[3] = (hash >> 16) & 0xFF;
+        shm->mac_address[4] = (hash >> 8) & 0xFF;
+        shm->mac_address[5] = hash & 0xFF;
+    }
+
+    /* Crear o abrir el segmento. ftruncate() lo rellena con ceros, que
+       es un segmento sin extremos y con todos los anillos vacíos. */
+    char path[ETH_SHM_NAME_MAX + 16];
+    snprintf(path, sizeof(path), "/eth-shm-%s", shm->lab);
+    int fd = shm_open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        fprintf(stderr, "eth_open(): ERROR en shm_open(%s): %s\n", path, strerror(errno));
+        free(shm);
+        return NULL;
+    }
+    struct stat st;
+    if ((fstat(fd, &st) == -1) ||
+        ((st.st_size < (off_t) sizeof(struct eth_shm_segment)) &&
+         (ftruncate(fd, sizeof(struct eth_shm_segment)) == -1))) {
+        fprintf(stderr, "eth_open(): ERROR en ftruncate(%s): %s\n", path, strerror(errno));
+        close(fd);
+        free(shm);
+        return NULL;
+    }
+    shm->seg = mmap(NULL, sizeof(struct eth_shm_segment), PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm->seg == MAP_FAILED) {
+        fprintf(stderr, "eth_open(): ERROR en mmap(%s): %s\n", path, strerror(errno));
+        free(shm);
+        return NULL;
+    }
+
+    shm->index = eth_shm_claim(shm, name);
+    if (shm->index == -1) {
+        munmap(shm->seg, sizeof(struct eth_shm_segment));
+        free(shm);
+        return NULL;
+    }
+    shm->me = &shm->seg->endpoints[shm->index];
+
+    shm->fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr;
+    socklen_t addr_len = eth_shm_doorbell(&addr, shm->lab, shm->index);
+    if ((shm->fd == -1) || (bind(shm->fd, (struct sockaddr *) &addr, addr_len) == -1)) {
+        fprintf(stderr, "eth_open(): ERROR en el timbre de 'shm:%s': %s\n",
+                shm->name, strerror(errno));
+        if (shm->fd != -1) {
+            close(shm->fd);
+        }
+        __atomic_store_n(&shm->me->state, ETH_SHM_FREE, __ATOMIC_RELEASE);
+        munmap(shm->seg, sizeof(struct eth_shm_segment));
+        free(shm);
+        return NULL;
+    }
+
+    /* Descartar lo que otros extremos enviaron a un dueño anterior */
+    int src;
+    for (src = 0; src < ETH_SHM_MAX_ENDPOINTS; src++) {
+        struct eth_shm_ring *ring = &shm->seg->rings[src][shm->index];
+        __atomic_store_n(&ring->head, __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE),
+                         __ATOMIC_RELEASE);
+    }
+
+    strcpy(shm->me->name, name);
+    memcpy(shm->me->mac_address, shm->mac_address, MAC_ADDR_SIZE);
+    shm->me->pid = shm->pid;
+    shm->me->armed = 1; /* Pedir el timbre desde el principio, para que
+                           'eth_poll()' despierte aunque aún no se haya
+                           llamado a 'eth_recv()' */
+    __atomic_store_n(&shm->me->state, ETH_SHM_READY, __ATOMIC_RELEASE);
+
+    return shm;
+}
+
+
+static char *eth_shm_getname(void *dev) {
+    return ((struct eth_shm *) dev)->name;
+}
+
+
+static void eth_shm_getaddr(void *dev, mac_addr_t addr) {
+    memcpy(addr, ((struct eth_shm *) dev)->mac_address, MAC_ADDR_SIZE);
+}
+
+
+static int eth_shm_getfd(void *dev) {
+    return ((struct eth_shm *) dev)->fd;
+}
+
+
+static int eth_shm_can_lend(void *dev) {
+    (void) dev;
+    return 1;
+}
+
+
+/* static int eth_shm_source ( struct eth_shm * shm );
+ *
+ * DESCRIPCIÓN:
+ *   Extremo desde el que envía este proceso: el propio en el proceso que lo
+ *   abrió, o uno sólo de envío en un proceso hijo, que se ocupa la primera
+ *   vez que envía.
+ *
+ * VALOR DEVUELTO:
+ *   Posición del extremo, o '-1' si no queda ninguno libre.
+ */
+static int eth_shm_source(struct eth_shm *shm) {
+    pid_t pid = eth_shm_getpid();
+    if (pid == shm->pid) {
+        return shm->index;
+    }
+    if ((shm->tx_index != -1) && (shm->tx_pid == pid)) {
+        return shm->tx_index;
+    }
+
+    int index = eth_shm_reserve(shm);
+    if (index == -1) {
+        fprintf(stderr, "eth_send(): ERROR: el segmento 'shm:%s' no tiene "
+                        "extremos libres para el proceso %d\n", shm->lab, (int) pid);
+        return -1;
+    }
+    struct eth_shm_endpoint *ep = &shm->seg->endpoints[index];
+    strcpy(ep->name, shm->me->name);
+    memcpy(ep->mac_address, shm->mac_address, MAC_ADDR_SIZE);
+    ep->pid = pid;
+    ep->armed = 0;
+    __atomic_store_n(&ep->state, ETH_SHM_SENDER, __ATOMIC_RELEASE);
+    shm->tx_pid = pid;
+    shm->tx_index = index;
+
+    return index;
+}
+
+
+/* static int eth_shm_push
+ * ( struct eth_shm * shm, int src, int dst, unsigned char * frame, int len );
+ *
+ * DESCRIPCIÓN:
+ *   Copia la trama al anillo de 'src' hacia 'dst'. Devuelve 1 si ha cabido
+ *   y el destino está esperando, para que se le toque el timbre después.
+ */
+static int eth_shm_push
+        (struct eth_shm *shm, int src, int dst, unsigned char *frame, int len) {
+    struct eth_shm_ring *ring = &shm->seg->rings[src][dst];
+    uint32_t tail = ring->tail;
+    if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) >= ETH_SHM_RING_LEN) {
+        return 0;
+    }
+
+    struct eth_shm_slot *slot = &ring->slots[tail % ETH_SHM_RING_LEN];
+    slot->len = len;
+    memcpy(slot->data, frame, len);
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+
+    return __atomic_load_n(&shm->seg->endpoints[dst].armed, __ATOMIC_SEQ_CST);
+}
+
+
+/* Copia cada trama al anillo de su destino (o de todos, si es de difusión o
+   multicast) y, al final de la ráfaga, toca el timbre de los destinos que
+   estaban esperando */
+static int eth_shm_send(void *dev, unsigned char *frames[], int lens[], int num) {
+    struct eth_shm *shm = dev;
+    int ring_bell[ETH_SHM_MAX_ENDPOINTS] = {0};
+
+    int src = eth_shm_source(shm);
+    if (src == -1) {
+        return -1;
+    }
+
+    int i;
+    for (i = 0; i < num; i++) {
+        int len = (lens[i] < ETH_FRAME_MAX_LENGTH) ? lens[i] : ETH_FRAME_MAX_LENGTH;
+        int multicast = (frames[i][0] & 0x01);
+        int dst;
+        for (dst = 0; dst < ETH_SHM_MAX_ENDPOINTS; dst++) {
+            struct eth_shm_endpoint *ep = &shm->seg->endpoints[dst];
+            if ((dst == shm->index) ||
+                (__atomic_load_n(&ep->state, __ATOMIC_ACQUIRE) != ETH_SHM_READY)) {
+                continue;
+            }
+            if (multicast || (memcmp(ep->mac_address, frames[i], MAC_ADDR_SIZE) == 0)) {
+                ring_bell[dst] |= eth_shm_push(shm, src, dst, frames[i], len);
+            }
+        }
+    }
+
+    int dst;
+    for (dst = 0; dst < ETH_SHM_MAX_ENDPOINTS; dst++) {
+        if (ring_bell[dst] &&
+            __atomic_exchange_n(&shm->seg->endpoints[dst].armed, 0, __ATOMIC_SEQ_CST)) {
+            struct sockaddr_un addr;
+            socklen_t addr_len = eth_shm_doorbell(&addr, shm->lab, dst);
+            char bell = 0;
+            sendto(shm->fd, &bell, 1, MSG_DONTWAIT, (struct sockaddr *) &addr, addr_len);
+        }
+    }
+
+    return num;
+}
+
+
+/* static int eth_shm_take
+ * ( struct eth_shm * shm, unsigned char * bufs[], int sizes[], int lens[],
+ *   int num );
+ *
+ * DESCRIPCIÓN:
+ *   Recoge hasta 'num' tramas de los anillos de entrada, empezando cada vez
+ *   por un origen distinto para repartir entre todos.
+ */
+static int eth_shm_take
+        (struct eth_shm *shm, unsigned char *bufs[], int sizes[], int lens[], int num) {
+    int received = 0;
+    int n;
+    for (n = 0; (n < ETH_SHM_MAX_ENDPOINTS) && (received < num); n++) {
+        int src = (shm->next_src + n) % ETH_SHM_MAX_ENDPOINTS;
+        struct eth_shm_ring *ring = &shm->seg->rings[src][shm->index];
+        uint32_t head = ring->head + shm->held[src];
+        uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        uint32_t consumed = 0;
+        for (; (head != tail) && (received < num); head++) {
+            struct eth_shm_slot *slot = &ring->slots[head % ETH_SHM_RING_LEN];
+            int len = slot->len;
+            if (bufs[received] == NULL) {
+                bufs[received] = slot->data;
+                sizes[received] = len;
+                shm->held[src]++;
+            } else {
+                memcpy(bufs[received], slot->data, (len < sizes[received]) ? len : sizes[received]);
+                consumed++;
+            }
+            lens[received] = len;
+            received++;
+        }
+        if (consumed > 0) {
+            /* Si se mezclan tramas copiadas y prestadas, las copiadas no
+               liberan su hueco hasta que se devuelven las prestadas */
+            if (shm->held[src] == 0) {
+                __atomic_store_n(&ring->head, ring->head + consumed, __ATOMIC_RELEASE);
+            } else {
+                shm->held[src] += consumed;
+            }
+        }
+    }
+    shm->next_src = (shm->next_src + 1) % ETH_SHM_MAX_ENDPOINTS;
+
+    return received;
+}
+
+
+/* static void eth_shm_arm ( struct eth_shm * shm );
+ *
+ * DESCRIPCIÓN:
+ *   Vacía el timbre y pide a los demás extremos que lo toquen con la
+ *   siguiente trama. Si ya había tramas pendientes se toca a sí mismo, para
+ *   que quien espere en el descriptor no se quede dormido con ellas.
+ */
+static void eth_shm_arm(struct eth_shm *shm) {
+    char bell[16];
+    while (recv(shm->fd, bell, sizeof(bell), MSG_DONTWAIT) > 0);
+
+    __atomic_store_n(&shm->me->armed, 1, __ATOMIC_SEQ_CST);
+
+    int src;
+    for (src = 0; src < ETH_SHM_MAX_ENDPOINTS; src++) {
+        struct eth_shm_ring *ring = &shm->seg->rings[src][shm->index];
+        if (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) != ring->head + shm->held[src]) {
+            if (__atomic_exchange_n(&shm->me->armed, 0, __ATOMIC_SEQ_CST)) {
+                struct sockaddr_un addr;
+                socklen_t addr_len = eth_shm_doorbell(&addr, shm->lab, shm->index);
+                sendto(shm->fd, bell, 1, MSG_DONTWAIT, (struct sockaddr *) &addr, addr_len);
+            }
+            break;
+        }
+    }
+}
+
+
+/* Las tramas prestadas en la llamada anterior se liberan al empezar esta.
+   Sólo se hacen llamadas al sistema si no hay tramas que recoger. */
+static int eth_shm_recv
+        (void *dev, unsigned char *bufs[], int sizes[], int lens[],
+         int num, long int timeout) {
+    struct eth_shm *shm = dev;
+
+    if (eth_shm_getpid() != shm->pid) {
+        fprintf(stderr, "eth_recv(): ERROR: 'shm:%s' sólo puede recibir en el "
+                        "proceso que lo abrió\n", shm->name);
+        return -1;
+    }
+
+    int src;
+    for (src = 0; src < ETH_SHM_MAX_ENDPOINTS; src++) {
+        if (shm->held[src] > 0) {
+            struct eth_shm_ring *ring = &shm->seg->rings[src][shm->index];
+            __atomic_store_n(&ring->head, ring->head + shm->held[src], __ATOMIC_RELEASE);
+            shm->held[src] = 0;
+        }
+    }
+
+    int received = eth_shm_take(shm, bufs, sizes, lens, num);
+    if ((received == 0) && (timeout != 0)) {
+        eth_shm_arm(shm);
+        struct pollfd pfd = {shm->fd, POLLIN, 0};
+        int err = poll(&pfd, 1, (timeout < 0) ? -1 : (int) timeout);
+        if ((err == -1) && (errno != EINTR)) {
+            fprintf(stderr, "eth_recv(): ERROR en poll(shm:%s): %s\n",
+                    shm->name, strerror(errno));
+            return -1;
+        }
+        received = eth_shm_take(shm, bufs, sizes, lens, num);
+    }
+
+    /* Sin más tramas pendientes, pedir el timbre para 'eth_poll()' y
+       'eth_loop' */
+    if (received < num) {
+        eth_shm_arm(shm);
+    }
+
+    return received;
+}
+
+
+static int eth_shm_close(void *dev) {
+    struct eth_shm *shm = dev;
+
+    /* Un proceso hijo sólo libera su extremo de envío */
+    pid_t pid = eth_shm_getpid();
+    if (pid == shm->pid) {
+        __atomic_store_n(&shm->me->state, ETH_SHM_FREE, __ATOMIC_RELEASE);
+    } else if ((shm->tx_index != -1) && (shm->tx_pid == pid)) {
+        __atomic_store_n(&shm->seg->endpoints[shm->tx_index].state, ETH_SHM_FREE,
+                         __ATOMIC_RELEASE);
+    }
+    int err = close(shm->fd);
+    munmap(shm->seg, sizeof(struct eth_shm_segment));
+    free(shm);
+
+    return err;
+}
+
+
+const eth_backend_t eth_shm_backend = {
+        .prefix = "shm:",
+        .open = eth_shm_open,
+        .getname = eth_shm_getname,
+        .getaddr = eth_shm_getaddr,
+        .getfd = eth_shm_getfd,
+        .send = eth_shm_send,
+        .recv = eth_shm_recv,
+        .can_lend = eth_shm_can_lend,
+        .close = eth_shm_close,
+};
@@ -0,0 +1,187 @@
+#include "eth_backend.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <linux/if_tun.h>
+
+/* Tipo de enlace "tap:": un interfaz TAP del núcleo. Cada trama que el
+   núcleo envía por el interfaz se lee del descriptor, y cada trama que se
+   escribe en él aparece como recibida por el interfaz. Si el interfaz no
+   existe hace falta CAP_NET_ADMIN para crearlo; uno persistente creado con
+   "ip tuntap add mode tap user ..." se puede abrir sin privilegios. */
+
+/* Manejador de un interfaz TAP */
+struct eth_tap {
+    int fd;                     /* Descriptor de /dev/net/tun */
+    char name[IFNAMSIZ];        /* Nombre del interfaz */
+    mac_addr_t mac_address;     /* Dirección MAC de este extremo */
+};
+
+#define ETH_TAP_DEVICE "/dev/net/tun"
+
+
+/* static void * eth_tap_open ( char * ifname );
+ *
+ * DESCRIPCIÓN:
+ *   Abre (o crea) el interfaz TAP indicado. La MAC del interfaz en el núcleo
+ *   es la del otro extremo, así que este extremo usa una dirección
+ *   localmente administrada derivada del nombre, que no cambia entre
+ *   ejecuciones.
+ */
+static void *eth_tap_open(char *ifname) {
+    if ((ifname == NULL) || (strlen(ifname) >= IFNAMSIZ)) {
+        fprintf(stderr, "eth_open(): ERROR: nombre de interfaz TAP incorrecto\n");
+        return NULL;
+    }
+
+    struct eth_tap *tap = malloc(sizeof(struct eth_tap));
+    if (tap == NULL) {
+        fprintf(stderr, "eth_open(): ERROR en malloc()\n");
+        return NULL;
+    }
+
+    tap->fd = open(ETH_TAP_DEVICE, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (tap->fd == -1) {
+        fprintf(stderr, "eth_open(): ERROR en open(%s): %s\n",
+                ETH_TAP_DEVICE, strerror(errno));
+        free(tap);
+        return NULL;
+    }
+
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+    strcpy(ifr.ifr_name, ifname);
+    if (ioctl(tap->fd, TUNSETIFF, &ifr) == -1) {
+        fprintf(stderr, "eth_open(): ERROR en TUNSETIFF(%s): %s\n",
+                ifname, strerror(errno));
+        close(tap->fd);
+        free(tap);
+        return NULL;
+    }
+    strcpy(tap->name, ifr.ifr_name);
+
+    /* 02:54:41 ("TA") + 24 bits de un hash FNV-1a del nombre */
+    uint32_t hash = 2166136261u;
+    int i;
+    for (i = 0; tap->name[i] != '\0'; i++) {
+        hash = (hash ^ (unsigned char) tap->name[i]) * 16777619u;
+    }
+    tap->mac_address[0] = 0x02;
+    tap->mac_address[1] = 0x54;
+    tap->mac_address[2] = 0x41;
+    tap->mac_address[3] = (hash >> 16) & 0xFF;
+    tap->mac_address[4] = (hash >> 8) & 0xFF;
+    tap->mac_address[5] = hash & 0xFF;
+
+    return tap;
+}
+
+
+static char *eth_tap_getname(void *dev) {
+    return ((struct eth_tap *) dev)->name;
+}
+
+
+static void eth_tap_getaddr(void *dev, mac_addr_t addr) {
+    memcpy(addr, ((struct eth_tap *) dev)->mac_address, MAC_ADDR_SIZE);
+}
+
+
+static int eth_tap_getfd(void *dev) {
+    return ((struct eth_tap *) dev)->fd;
+}
+
+
+/* El descriptor de TAP no admite sendmmsg(): una escritura por trama */
+static int eth_tap_send(void *dev, unsigned char *frames[], int lens[], int num) {
+    struct eth_tap *tap = dev;
+
+    int i;
+    for (i = 0; i < num; i++) {
+        ssize_t n;
+        do {
+            n = write(tap->fd, frames[i], lens[i]);
+        } while ((n == -1) && (errno == EINTR));
+        if (n == -1) {
+            if (i == 0) {
+                fprintf(stderr, "eth_send(): ERROR en write(%s): %s\n",
+                        tap->name, strerror(errno));
+            }
+            break;
+        }
+    }
+
+    return (i == 0) ? -1 : i;
+}
+
+
+/* Espera a la primera trama y lee sin bloquear las que ya estén listas. Las
+   tramas más largas que su buffer se truncan. */
+static int eth_tap_recv
+        (void *dev, unsigned char *bufs[], int sizes[], int lens[],
+         int num, long int timeout) {
+    struct eth_tap *tap = dev;
+
+    struct pollfd pfd;
+    pfd.fd = tap->fd;
+    pfd.events = POLLIN;
+    int err = poll(&pfd, 1, (timeout < 0) ? -1 : (int) timeout);
+    if (err == -1) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        fprintf(stderr, "eth_recv(): ERROR en poll(%s): %s\n",
+                tap->name, strerror(errno));
+        return -1;
+    } else if (err == 0) {
+        /* Timeout! */
+        return 0;
+    }
+
+    int i;
+    for (i = 0; i < num; i++) {
+        ssize_t len = read(tap->fd, bufs[i], sizes[i]);
+        if (len == -1) {
+            if ((errno == EAGAIN) || (errno == EINTR)) {
+                break;
+            }
+            fprintf(stderr, "eth_recv(): ERROR en read(%s): %s\n",
+                    tap->name, strerror(errno));
+            return (i == 0) ? -1 : i;
+        }
+        lens[i] = (int) len;
+    }
+
+    return i;
+}
+
+
+static int eth_tap_close(void *dev) {
+    struct eth_tap *tap = dev;
+
+    int err = close(tap->fd);
+    free(tap);
+
+    return err;
+}
+
+
+const eth_backend_t eth_tap_backend = {
+        .prefix = "tap:",
+        .open = eth_tap_open,
+        .getname = eth_tap_getname,
+        .getaddr = eth_tap_getaddr,
+        .getfd = eth_tap_getfd,
+        .send = eth_tap_send,
+        .recv = eth_tap_recv,
+        .close = eth_tap_close,
+        .shared_send = 1,
+};
@@ -0,0 +1,503 @@
+#include "eth_backend.h"
+#include "eth_packet.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/* Tipo de enlace "uring:": el mismo socket AF_PACKET que "packet:", pero
+   manejado de forma asíncrona con io_uring (sin liburing, con las llamadas
+   al sistema directamente).
+
+   Siempre hay 'ETH_URING_RX_DEPTH' recepciones en curso, cada una sobre su
+   propio buffer; las tramas que llegan se recogen en lote de la cola de
+   completados y se prestan sin copiarlas. 'eth_send()' copia la trama a un
+   buffer de transmisión (o la construye ya en él con 'eth_alloc_frame()'),
+   encola el envío y vuelve sin esperar a que se complete: un único hilo
+   puede tener muchos envíos y recepciones en vuelo por interfaz. Todos los
+   envíos de una ráfaga, y las recepciones que se rearman, se entregan al
+   núcleo con una única llamada a io_uring_enter().
+
+   El descriptor del interfaz ('eth_getfd()') es el del propio io_uring,
+   que está listo cuando hay completados, así que funciona con 'eth_poll()'
+   y con el bucle de 'eth_loop.h'. */
+
+/* Recepciones en vuelo y buffers de transmisión */
+#define ETH_URING_RX_DEPTH 64
+#define ETH_URING_TX_DEPTH 128
+
+/* Entradas de la cola de envíos (la de completados tiene el doble) */
+#define ETH_URING_ENTRIES 256
+
+/* 'user_data' de cada operación: tipo en el bit alto e índice del buffer */
+#define ETH_URING_TX_TAG (1ULL << 32)
+
+/* Manejador de un interfaz io_uring */
+struct eth_uring {
+    eth_packet_t *packet;       /* Socket AF_PACKET */
+    int sock;
+    int fd;                     /* io_uring */
+
+    /* Cola de envíos */
+    void *sq_map;
+    size_t sq_map_len;
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t sq_mask;
+    uint32_t *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    uint32_t sq_local_tail;     /* Entradas preparadas, aún sin publicar */
+    int to_submit;
+
+    /* Cola de completados */
+    void *cq_map;
+    size_t cq_map_len;
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* Recepción: buffers completados listos para entregar, en orden */
+    unsigned char rx_buf[ETH_URING_RX_DEPTH][ETH_FRAME_MAX_LENGTH];
+    int rx_ready[ETH_URING_RX_DEPTH];
+    int rx_ready_len[ETH_URING_RX_DEPTH];
+    int rx_ready_head;
+    int rx_nready;
+    int rx_lent[ETH_URING_RX_DEPTH]; /* Prestados en la última recepción */
+    int rx_nlent;
+
+    /* Transmisión: pila de buffers libres */
+    unsigned char tx_buf[ETH_URING_TX_DEPTH][ETH_FRAME_MAX_LENGTH];
+    int tx_free[ETH_URING_TX_DEPTH];
+    int tx_nfree;
+};
+
+
+static int eth_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+                           unsigned int flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+
+/* static struct io_uring_sqe * eth_uring_get_sqe ( struct eth_uring * ur );
+ *
+ * DESCRIPCIÓN:
+ *   Devuelve la siguiente entrada libre de la cola de envíos. Las entradas
+ *   preparadas no ven el núcleo hasta 'eth_uring_submit()'.
+ */
+static struct io_uring_sqe *eth_uring_get_sqe(struct eth_uring *ur) {
+    uint32_t head = __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE);
+    if (ur->sq_local_tail - head > ur->sq_mask) {
+        return NULL;
+    }
+    uint32_t index = ur->sq_local_tail & ur->sq_mask;
+    struct io_uring_sqe *sqe = &ur->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ur->sq_array[index] = index;
+    ur->sq_local_tail++;
+    ur->to_submit++;
+
+    return sqe;
+}
+
+
+/* static int eth_uring_submit
+ * ( struct eth_uring * ur, unsigned int min_complete );
+ *
+ * DESCRIPCIÓN:
+ *   Publica las entradas preparadas y se las entrega al núcleo con una
+ *   única llamada, esperando si se pide a 'min_complete' completados.
+ */
+static int eth_uring_submit(struct eth_uring *ur, unsigned int min_complete) {
+    __atomic_store_n(ur->sq_tail, ur->sq_local_tail, __ATOMIC_RELEASE);
+    if ((ur->to_submit == 0) && (min_complete == 0)) {
+        return 0;
+    }
+
+    int n;
+    do {
+        n = eth_uring_enter(ur->fd, ur->to_submit, min_complete,
+                            (min_complete > 0) ? IORING_ENTER_GETEVENTS : 0);
+    } while ((n == -1) && (errno == EINTR));
+    if (n == -1) {
+        fprintf(stderr, "eth_uring: ERROR en io_uring_enter(): %s\n", strerror(errno));
+        return -1;
+    }
+    ur->to_submit -= n;
+
+    return 0;
+}
+
+
+/* static void eth_uring_prep_recv ( struct eth_uring * ur, int slot );
+ *
+ * DESCRIPCIÓN:
+ *   Prepara una recepción sobre el buffer 'slot'. Con MSG_TRUNC el
+ *   completado indica la longitud real de la trama.
+ */
+static void eth_uring_prep_recv(struct eth_uring *ur, int slot) {
+    struct io_uring_sqe *sqe = eth_uring_get_sqe(ur);
+    if (sqe == NULL) {
+        eth_uring_submit(ur, 0);
+        sqe = eth_uring_get_sqe(ur);
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = ur->sock;
+    sqe->addr = (uintptr_t) ur->rx_buf[slot];
+    sqe->len = ETH_FRAME_MAX_LENGTH;
+    sqe->msg_flags = MSG_TRUNC;
+    sqe->user_data = slot;
+}
+
+
+/* static void eth_uring_reap ( struct eth_uring * ur );
+ *
+ * DESCRIPCIÓN:
+ *   Recoge en lote todos los completados: las tramas recibidas pasan a la
+ *   lista de listas para entregar, y los buffers de las tramas enviadas
+ *   vuelven a la pila de libres. Una recepción fallida se rearma.
+ */
+static void eth_uring_reap(struct eth_uring *ur) {
+    uint32_t head = *ur->cq_head;
+    uint32_t tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &ur->cqes[head & ur->cq_mask];
+        if (cqe->user_data & ETH_URING_TX_TAG) {
+            if (cqe->res < 0) {
+                fprintf(stderr, "eth_send(): ERROR en el envío asíncrono: %s\n",
+                        strerror(-cqe->res));
+            }
+            ur->tx_free[ur->tx_nfree++] = (int) (cqe->user_data & 0xFFFFFFFF);
+        } else {
+            int slot = (int) cqe->user_data;
+            if (cqe->res < 0) {
+                if (cqe->res != -ECANCELED) {
+                    fprintf(stderr, "eth_recv(): ERROR en la recepción asíncrona: %s\n",
+                            strerror(-cqe->res));
+                    eth_uring_prep_recv(ur, slot);
+                }
+                continue;
+            }
+            int pos = (ur->rx_ready_head + ur->rx_nready) % ETH_URING_RX_DEPTH;
+            ur->rx_ready[pos] = slot;
+            ur->rx_ready_len[pos] = cqe->res;
+            ur->rx_nready++;
+        }
+    }
+    __atomic_store_n(ur->cq_head, head, __ATOMIC_RELEASE);
+}
+
+
+static int eth_uring_close(void *dev);
+
+
+/* static void * eth_uring_open ( char * ifname );
+ *
+ * DESCRIPCIÓN:
+ *   Abre el socket AF_PACKET, crea el io_uring y deja en vuelo todas las
+ *   recepciones.
+ */
+static void *eth_uring_open(char *ifname) {
+    struct eth_uring *ur = calloc(1, sizeof(struct eth_uring));
+    if (ur == NULL) {
+        fprintf(stderr, "eth_open(): ERROR en calloc()\n");
+        return NULL;
+    }
+    ur->fd = -1;
+    ur->packet = eth_packet_open(ifname, 0);
+    if (ur->packet == NULL) {
+        free(ur);
+        return NULL;
+    }
+    ur->sock = eth_packet_getfd(ur->packet);
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ur->fd = syscall(__NR_io_uring_setup, ETH_URING_ENTRIES, &params);
+    if (ur->fd == -1) {
+        fprintf(stderr, "eth_open(): ERROR en io_uring_setup(): %s\n", strerror(errno));
+        eth_uring_close(ur);
+        return NULL;
+    }
+
+    /* Mapear las colas: con IORING_FEAT_SINGLE_MMAP comparten zona */
+    ur->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    ur->cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ur->cq_map_len > ur->sq_map_len) {
+            ur->sq_map_len = ur->cq_map_len;
+        }
+    }
+    ur->sq_map = mmap(NULL, ur->sq_map_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQ_RING);
+    if (ur->sq_map == MAP_FAILED) {
+        ur->sq_map = NULL;
+    } else if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ur->cq_map = ur->sq_map;
+    } else {
+        ur->cq_map = mmap(NULL, ur->cq_map_len, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_CQ_RING);
+        if (ur->cq_map == MAP_FAILED) {
+            ur->cq_map = NULL;
+        }
+    }
+    ur->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ur->sqes = mmap(NULL, ur->sqes_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQES);
+    if (ur->sqes == MAP_FAILED) {
+        ur->sqes = NULL;
+    }
+    if ((ur->sq_map == NULL) || (ur->cq_map == NULL) || (ur->sqes == NULL)) {
+        fprintf(stderr, "eth_open(): ERROR en mmap(io_uring): %s\n", strerror(errno));
+        eth_uring_close(ur);
+        return NULL;
+    }
+
+    char *sq = ur->sq_map;
+    ur->sq_head = (uint32_t *) (sq + params.sq_off.head);
+    ur->sq_tail = (uint32_t *) (sq + params.sq_off.tail);
+    ur->sq_mask = *(uint32_t *) (sq + params.sq_off.ring_mask);
+    ur->sq_array = (uint32_t *) (sq + params.sq_off.array);
+    ur->sq_local_tail = *ur->sq_tail;
+    char *cq = ur->cq_map;
+    ur->cq_head = (uint32_t *) (cq + params.cq_off.head);
+    ur->cq_tail = (uint32_t *) (cq + params.cq_off.tail);
+    ur->cq_mask = *(uint32_t *) (cq + params.cq_off.ring_mask);
+    ur->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    int i;
+    for (i = 0; i < ETH_URING_TX_DEPTH; i++) {
+        ur->tx_free[i] = ETH_URING_TX_DEPTH - 1 - i;
+    }
+    ur->tx_nfree = ETH_URING_TX_DEPTH;
+    for (i = 0; i < ETH_URING_RX_DEPTH; i++) {
+        eth_uring_prep_recv(ur, i);
+    }
+    if (eth_uring_submit(ur, 0) == -1) {
+        eth_uring_close(ur);
+        return NULL;
+    }
+
+    return ur;
+}
+
+
+static char *eth_uring_getname(void *dev) {
+    return eth_packet_getname(((struct eth_uring *) dev)->packet);
+}
+
+
+static void eth_uring_getaddr(void *dev, mac_addr_t addr) {
+    eth_packet_getaddr(((struct eth_uring *) dev)->packet, addr);
+}
+
+
+static int eth_uring_getfd(void *dev) {
+    return ((struct eth_uring *) dev)->fd;
+}
+
+
+static int eth_uring_can_lend(void *dev) {
+    (void) dev;
+    return 1;
+}
+
+
+static int eth_uring_set_filter
+        (void *dev, uint16_t types[], int ntypes,
+         mac_addr_t groups[], int ngroups) {
+    return eth_packet_set_filter(((struct eth_uring *) dev)->packet,
+                                 types, ntypes, groups, ngroups);
+}
+
+
+/* Devuelve un buffer de transmisión libre, esperando a que se complete
+   algún envío si están todos en vuelo */
+static unsigned char *eth_uring_tx_alloc(void *dev) {
+    struct eth_uring *ur = dev;
+
+    eth_uring_reap(ur);
+    while (ur->tx_nfree == 0) {
+        if (eth_uring_submit(ur, 1) == -1) {
+            return NULL;
+        }
+        eth_uring_reap(ur);
+    }
+
+    return ur->tx_buf[ur->tx_free[--ur->tx_nfree]];
+}
+
+
+/* Encola los envíos y vuelve sin esperar a que se completen. Las tramas que
+   no se han construido con 'eth_uring_tx_alloc()' se copian antes. */
+static int eth_uring_send(void *dev, unsigned char *frames[], int lens[], int num) {
+    struct eth_uring *ur = dev;
+    unsigned char *tx_start = ur->tx_buf[0];
+    unsigned char *tx_end = ur->tx_buf[ETH_URING_TX_DEPTH];
+
+    int i;
+    for (i = 0; i < num; i++) {
+        unsigned char *data = frames[i];
+        if ((data < tx_start) || (data >= tx_end)) {
+            data = eth_uring_tx_alloc(ur);
+            if (data == NULL) {
+                break;
+            }
+            memcpy(data, frames[i], lens[i]);
+        }
+        struct io_uring_sqe *sqe = eth_uring_get_sqe(ur);
+        if (sqe == NULL) {
+            eth_uring_submit(ur, 0);
+            sqe = eth_uring_get_sqe(ur);
+        }
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = ur->sock;
+        sqe->addr = (uintptr_t) data;
+        sqe->len = lens[i];
+        sqe->user_data = ETH_URING_TX_TAG | (uint64_t) ((data - tx_start) / ETH_FRAME_MAX_LENGTH);
+    }
+    if (eth_uring_submit(ur, 0) == -1) {
+        return -1;
+    }
+
+    return (i == 0) ? -1 : i;
+}
+
+
+/* Entrega las tramas ya completadas y, si no hay ninguna, espera en el
+   io_uring. Los buffers prestados en la llamada anterior se rearman al
+   empezar esta. */
+static int eth_uring_recv
+        (void *dev, unsigned char *bufs[], int sizes[], int lens[],
+         int num, long int timeout) {
+    struct eth_uring *ur = dev;
+
+    int i;
+    for (i = 0; i < ur->rx_nlent; i++) {
+        eth_uring_prep_recv(ur, ur->rx_lent[i]);
+    }
+    ur->rx_nlent = 0;
+    if (eth_uring_submit(ur, 0) == -1) {
+        return -1;
+    }
+    eth_uring_reap(ur);
+
+    /* Esperar: el io_uring también se despierta con los envíos
+       completados, así que se vuelve a esperar el tiempo restante */
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while ((ur->rx_nready == 0) && (timeout != 0)) {
+        long int left = -1;
+        if (timeout > 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            left = timeout - ((now.tv_sec - start.tv_sec) * 1000 +
+                              (now.tv_nsec - start.tv_nsec) / 1000000);
+            if (left <= 0) {
+                break;
+            }
+        }
+        struct pollfd pfd = {ur->fd, POLLIN, 0};
+        int err = poll(&pfd, 1, (int) left);
+        if (err == -1) {
+            if (errno == EINTR) {
+                return 0;
+            }
+            fprintf(stderr, "eth_recv(): ERROR en poll(io_uring): %s\n", strerror(errno));
+            return -1;
+        }
+        eth_uring_reap(ur);
+    }
+
+    for (i = 0; (i < num) && (ur->rx_nready > 0); i++) {
+        int slot = ur->rx_ready[ur->rx_ready_head];
+        int len = ur->rx_ready_len[ur->rx_ready_head];
+        ur->rx_ready_head = (ur->rx_ready_head + 1) % ETH_URING_RX_DEPTH;
+        ur->rx_nready--;
+
+        int caplen = (len < ETH_FRAME_MAX_LENGTH) ? len : ETH_FRAME_MAX_LENGTH;
+        if (bufs[i] == NULL) {
+            bufs[i] = ur->rx_buf[slot];
+            sizes[i] = caplen;
+            ur->rx_lent[ur->rx_nlent++] = slot;
+        } else {
+            memcpy(bufs[i], ur->rx_buf[slot], (caplen < sizes[i]) ? caplen : sizes[i]);
+            eth_uring_prep_recv(ur, slot);
+        }
+        lens[i] = len;
+    }
+    if (eth_uring_submit(ur, 0) == -1) {
+        return -1;
+    }
+
+    return i;
+}
+
+
+/* Recoge los envíos completados y devuelve cuántos siguen en vuelo */
+static int eth_uring_flush(void *dev) {
+    struct eth_uring *ur = dev;
+
+    if (eth_uring_submit(ur, 0) == -1) {
+        return -1;
+    }
+    eth_uring_reap(ur);
+
+    return ETH_URING_TX_DEPTH - ur->tx_nfree;
+}
+
+
+/* Espera a que salgan los envíos en vuelo; las recepciones se cancelan al
+   cerrar el io_uring */
+static int eth_uring_close(void *dev) {
+    struct eth_uring *ur = dev;
+
+    if ((ur->sqes != NULL) && (ur->cq_map != NULL)) {
+        eth_uring_reap(ur);
+        while ((ur->tx_nfree < ETH_URING_TX_DEPTH) && (eth_uring_submit(ur, 1) == 0)) {
+            eth_uring_reap(ur);
+        }
+    }
+    if (ur->sqes != NULL) {
+        munmap(ur->sqes, ur->sqes_len);
+    }
+    if ((ur->cq_map != NULL) && (ur->cq_map != ur->sq_map)) {
+        munmap(ur->cq_map, ur->cq_map_len);
+    }
+    if (ur->sq_map != NULL) {
+        munmap(ur->sq_map, ur->sq_map_len);
+    }
+    if (ur->fd != -1) {
+        close(ur->fd);
+    }
+    int err = eth_packet_close(ur->packet);
+    free(ur);
+
+    return err;
+}
+
+
+const eth_backend_t eth_uring_backend = {
+        .prefix = "uring:",
+        .open = eth_uring_open,
+        .getname = eth_uring_getname,
+        .getaddr = eth_uring_getaddr,
+        .getfd = eth_uring_getfd,
+        .send = eth_uring_send,
+        .recv = eth_uring_recv,
+        .can_lend = eth_uring_can_lend,
+        .tx_alloc = eth_uring_tx_alloc,
+        .flush = eth_uring_flush,
+        .set_filter = eth_uring_set_filter,
+        .close = eth_uring_close,
+};
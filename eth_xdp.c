@@ -0,0 +1,635 @@
+#include "eth_backend.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <net/if.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+/* Tipo de enlace "xdp:": un socket AF_XDP ("xdp:eth1", o "xdp:eth1@2" para
+   la cola de recepción 2). Las tramas se reciben y envían a través de una
+   zona de memoria ('UMEM') compartida con el núcleo y de cuatro anillos:
+   recepción, transmisión, rellenado (huecos libres para recibir) y
+   completado (tramas ya enviadas). No hay ninguna copia ni llamada al
+   sistema por trama: las recibidas se prestan directamente de la UMEM, y
+   'eth_alloc_frame()' reserva tramas de transmisión dentro de ella.
+
+   Un pequeño programa XDP, cargado sin libbpf, desvía al socket todas las
+   tramas de su cola, que ya no llegan a la pila del núcleo. Se intenta
+   primero el modo nativo del controlador y, si no lo soporta, el modo
+   genérico ("SKB"), que funciona en cualquier interfaz (p.ej. un par veth
+   en un espacio de nombres de red). Igualmente se intenta el modo sin
+   copias y, si el controlador no lo soporta, el modo con copia. Hace falta
+   CAP_NET_ADMIN y CAP_BPF (o ser root). */
+
+/* Geometría de la UMEM: la primera mitad de las tramas es para recibir y la
+   segunda para transmitir. Cada anillo tiene tantas entradas como tramas su
+   mitad, así que nunca se llena. */
+#define ETH_XDP_FRAME_SIZE 2048
+#define ETH_XDP_NUM_FRAMES 4096
+#define ETH_XDP_RING_SIZE (ETH_XDP_NUM_FRAMES / 2)
+
+/* Milisegundos que se espera como mucho a que el núcleo complete alguna
+   transmisión cuando no quedan tramas libres */
+#define ETH_XDP_TX_WAIT 100
+
+/* Número máximo de colas de recepción del interfaz */
+#define ETH_XDP_MAX_QUEUES 64
+
+/* Anillo productor/consumidor compartido con el núcleo */
+struct eth_xdp_ring {
+    uint32_t *producer;
+    uint32_t *consumer;
+    uint32_t *flags;
+    void *entries;              /* 'struct xdp_desc' o direcciones 'uint64_t' */
+    void *map;                  /* Zona mapeada y su tamaño */
+    size_t map_len;
+};
+
+/* Manejador de un socket AF_XDP */
+struct eth_xdp {
+    int fd;                     /* Socket AF_XDP */
+    int ifindex;
+    int queue;                  /* Cola de recepción del interfaz */
+    char name[IFNAMSIZ + 8];    /* Nombre, con la cola si no es la 0 */
+    mac_addr_t mac_address;
+
+    unsigned char *umem;        /* Memoria de las tramas */
+    struct eth_xdp_ring rx;
+    struct eth_xdp_ring tx;
+    struct eth_xdp_ring fill;
+    struct eth_xdp_ring comp;
+
+    int map_fd;                 /* XSKMAP: cola -> socket */
+    int prog_fd;                /* Programa XDP */
+    int link_fd;                /* Programa asociado al interfaz */
+
+    uint64_t rx_lent[ETH_XDP_RING_SIZE]; /* Tramas prestadas en la última
+                                            recepción, a devolver al núcleo */
+    int rx_nlent;
+
+    uint64_t tx_free[ETH_XDP_RING_SIZE]; /* Pila de tramas de transmisión
+                                            libres */
+    int tx_nfree;
+    int tx_pending;             /* Tramas en el anillo sin avisar al núcleo */
+};
+
+
+static int eth_xdp_bpf(int cmd, union bpf_attr *attr) {
+    return syscall(__NR_bpf, cmd, attr, sizeof(union bpf_attr));
+}
+
+
+/* static int eth_xdp_load_prog ( struct eth_xdp * xdp );
+ *
+ * DESCRIPCIÓN:
+ *   Crea el XSKMAP y carga el programa XDP que desvía cada trama al socket
+ *   de su cola, o la deja pasar a la pila del núcleo si la cola no tiene
+ *   socket:
+ *
+ *       r2 = ctx->rx_queue_index
+ *       r1 = xskmap
+ *       r3 = XDP_PASS
+ *       call bpf_redirect_map
+ *       exit
+ */
+static int eth_xdp_load_prog(struct eth_xdp *xdp) {
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = ETH_XDP_MAX_QUEUES;
+    xdp->map_fd = eth_xdp_bpf(BPF_MAP_CREATE, &attr);
+    if (xdp->map_fd == -1) {
+        fprintf(stderr, "eth_open(): ERROR en BPF_MAP_CREATE: %s\n", strerror(errno));
+        return -1;
+    }
+
+    struct bpf_insn prog[] = {
+            {.code = BPF_LDX | BPF_MEM | BPF_W, .dst_reg = BPF_REG_2, .src_reg = BPF_REG_1,
+             .off = offsetof(struct xdp_md, rx_queue_index)},
+            {.code = BPF_LD | BPF_DW | BPF_IMM, .dst_reg = BPF_REG_1,
+             .src_reg = BPF_PSEUDO_MAP_FD, .imm = xdp->map_fd},
+            {.code = 0},
+            {.code = BPF_ALU64 | BPF_MOV | BPF_K, .dst_reg = BPF_REG_3, .imm = XDP_PASS},
+            {.code = BPF_JMP | BPF_CALL, .imm = BPF_FUNC_redirect_map},
+            {.code = BPF_JMP | BPF_EXIT},
+    };
+    char log[1024] = "";
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uintptr_t) prog;
+    attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+    attr.license = (uintptr_t) "GPL";
+    attr.log_buf = (uintptr_t) log;
+    attr.log_size = sizeof(log);
+    attr.log_level = 1;
+    xdp->prog_fd = eth_xdp_bpf(BPF_PROG_LOAD, &attr);
+    if (xdp->prog_fd == -1) {
+        fprintf(stderr, "eth_open(): ERROR en BPF_PROG_LOAD: %s\n%s",
+                strerror(errno), log);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* static int eth_xdp_attach ( struct eth_xdp * xdp );
+ *
+ * DESCRIPCIÓN:
+ *   Asocia el programa al interfaz en modo nativo o, si el controlador no
+ *   lo soporta, en modo genérico. El programa se desasocia solo al cerrar
+ *   'link_fd', aunque el proceso termine de forma anormal.
+ */
+static int eth_xdp_attach(struct eth_xdp *xdp) {
+    static const uint32_t modes[] = {XDP_FLAGS_DRV_MODE, XDP_FLAGS_SKB_MODE};
+
+    int i;
+    for (i = 0; i < 2; i++) {
+        union bpf_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.link_create.prog_fd = xdp->prog_fd;
+        attr.link_create.target_ifindex = xdp->ifindex;
+        attr.link_create.attach_type = BPF_XDP;
+        attr.link_create.flags = modes[i];
+        xdp->link_fd = eth_xdp_bpf(BPF_LINK_CREATE, &attr);
+        if (xdp->link_fd != -1) {
+            return 0;
+        }
+    }
+
+    fprintf(stderr, "eth_open(): ERROR en BPF_LINK_CREATE(%s): %s\n",
+            xdp->name, strerror(errno));
+    return -1;
+}
+
+
+/* static int eth_xdp_map_ring
+ * ( struct eth_xdp * xdp, struct eth_xdp_ring * ring,
+ *   struct xdp_ring_offset * off, size_t entry_size, off_t pgoff );
+ */
+static int eth_xdp_map_ring
+        (struct eth_xdp *xdp, struct eth_xdp_ring *ring,
+         struct xdp_ring_offset *off, size_t entry_size, off_t pgoff) {
+    ring->map_len = off->desc + ETH_XDP_RING_SIZE * entry_size;
+    ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, xdp->fd, pgoff);
+    if (ring->map == MAP_FAILED) {
+        ring->map = NULL;
+        fprintf(stderr, "eth_open(): ERROR en mmap(anillo XDP): %s\n", strerror(errno));
+        return -1;
+    }
+    ring->producer = (uint32_t *) ((char *) ring->map + off->producer);
+    ring->consumer = (uint32_t *) ((char *) ring->map + off->consumer);
+    ring->flags = (uint32_t *) ((char *) ring->map + off->flags);
+    ring->entries = (char *) ring->map + off->desc;
+
+    return 0;
+}
+
+
+static void eth_xdp_unmap_rings(struct eth_xdp *xdp) {
+    struct eth_xdp_ring *rings[] = {&xdp->rx, &xdp->tx, &xdp->fill, &xdp->comp};
+    int i;
+    for (i = 0; i < 4; i++) {
+        if (rings[i]->map != NULL) {
+            munmap(rings[i]->map, rings[i]->map_len);
+            rings[i]->map = NULL;
+        }
+    }
+}
+
+
+/* static int eth_xdp_socket ( struct eth_xdp * xdp, uint16_t bind_flags );
+ *
+ * DESCRIPCIÓN:
+ *   Crea el socket, registra la UMEM, mapea los anillos y asocia el socket
+ *   a la cola del interfaz con 'bind_flags' (XDP_ZEROCOPY o XDP_COPY). Si
+ *   falla deja el manejador como estaba para poder reintentarlo.
+ */
+static int eth_xdp_socket(struct eth_xdp *xdp, uint16_t bind_flags) {
+    xdp->fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+    if (xdp->fd == -1) {
+        fprintf(stderr, "eth_open(): ERROR en socket(AF_XDP): %s\n", strerror(errno));
+        return -1;
+    }
+
+    struct xdp_umem_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.addr = (uintptr_t) xdp->umem;
+    reg.len = (uint64_t) ETH_XDP_NUM_FRAMES * ETH_XDP_FRAME_SIZE;
+    reg.chunk_size = ETH_XDP_FRAME_SIZE;
+    int ring_size = ETH_XDP_RING_SIZE;
+    struct xdp_mmap_offsets off;
+    socklen_t off_len = sizeof(off);
+    if ((setsockopt(xdp->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) == -1) ||
+        (setsockopt(xdp->fd, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size, sizeof(int)) == -1) ||
+        (setsockopt(xdp->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &ring_size, sizeof(int)) == -1) ||
+        (setsockopt(xdp->fd, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(int)) == -1) ||
+        (setsockopt(xdp->fd, SOL_XDP, XDP_TX_RING, &ring_size, sizeof(int)) == -1) ||
+        (getsockopt(xdp->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &off_len) == -1)) {
+        fprintf(stderr, "eth_open(): ERROR al configurar el socket AF_XDP: %s\n",
+                strerror(errno));
+        close(xdp->fd);
+        return -1;
+    }
+
+    if ((eth_xdp_map_ring(xdp, &xdp->rx, &off.rx, sizeof(struct xdp_desc),
+                          XDP_PGOFF_RX_RING) == -1) ||
+        (eth_xdp_map_ring(xdp, &xdp->tx, &off.tx, sizeof(struct xdp_desc),
+                          XDP_PGOFF_TX_RING) == -1) ||
+        (eth_xdp_map_ring(xdp, &xdp->fill, &off.fr, sizeof(uint64_t),
+                          XDP_UMEM_PGOFF_FILL_RING) == -1) ||
+        (eth_xdp_map_ring(xdp, &xdp->comp, &off.cr, sizeof(uint64_t),
+                          XDP_UMEM_PGOFF_COMPLETION_RING) == -1)) {
+        eth_xdp_unmap_rings(xdp);
+        close(xdp->fd);
+        return -1;
+    }
+
+    struct sockaddr_xdp sxdp;
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = xdp->ifindex;
+    sxdp.sxdp_queue_id = xdp->queue;
+    sxdp.sxdp_flags = bind_flags;
+    if (bind(xdp->fd, (struct sockaddr *) &sxdp, sizeof(sxdp)) == -1) {
+        eth_xdp_unmap_rings(xdp);
+        close(xdp->fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* static void eth_xdp_fill ( struct eth_xdp * xdp, uint64_t addrs[], int num );
+ *
+ * DESCRIPCIÓN:
+ *   Devuelve 'num' tramas de recepción al núcleo a través del anillo de
+ *   rellenado.
+ */
+static void eth_xdp_fill(struct eth_xdp *xdp, uint64_t addrs[], int num) {
+    uint64_t *entries = xdp->fill.entries;
+    uint32_t prod = *xdp->fill.producer;
+    int i;
+    for (i = 0; i < num; i++) {
+        entries[(prod + i) & (ETH_XDP_RING_SIZE - 1)] =
+                addrs[i] & ~((uint64_t) ETH_XDP_FRAME_SIZE - 1);
+    }
+    __atomic_store_n(xdp->fill.producer, prod + num, __ATOMIC_RELEASE);
+}
+
+
+/* static void eth_xdp_complete ( struct eth_xdp * xdp );
+ *
+ * DESCRIPCIÓN:
+ *   Recupera en la pila de tramas libres las que el núcleo ya ha enviado.
+ */
+static void eth_xdp_complete(struct eth_xdp *xdp) {
+    uint64_t *entries = xdp->comp.entries;
+    uint32_t cons = *xdp->comp.consumer;
+    uint32_t prod = __atomic_load_n(xdp->comp.producer, __ATOMIC_ACQUIRE);
+    for (; cons != prod; cons++) {
+        xdp->tx_free[xdp->tx_nfree++] = entries[cons & (ETH_XDP_RING_SIZE - 1)];
+    }
+    __atomic_store_n(xdp->comp.consumer, cons, __ATOMIC_RELEASE);
+}
+
+
+static int eth_xdp_close(void *dev);
+
+
+/* static void * eth_xdp_open ( char * ifname );
+ *
+ * DESCRIPCIÓN:
+ *   Abre un socket AF_XDP en la cola indicada del interfaz ("eth1@2"), o en
+ *   la 0 si no se indica.
+ */
+static void *eth_xdp_open(char *ifname) {
+    char *at = (ifname != NULL) ? strchr(ifname, '@') : NULL;
+    size_t name_len = (at != NULL) ? (size_t) (at - ifname) :
+                      (ifname != NULL) ? strlen(ifname) : 0;
+    if ((ifname == NULL) || (name_len == 0) || (name_len >= IFNAMSIZ)) {
+        fprintf(stderr, "eth_open(): ERROR: nombre de interfaz XDP incorrecto\n");
+        return NULL;
+    }
+
+    struct eth_xdp *xdp = calloc(1, sizeof(struct eth_xdp));
+    if (xdp == NULL) {
+        fprintf(stderr, "eth_open(): ERROR en calloc()\n");
+        return NULL;
+    }
+    xdp->fd = -1;
+    xdp->map_fd = -1;
+    xdp->prog_fd = -1;
+    xdp->link_fd = -1;
+    snprintf(xdp->name, sizeof(xdp->name), "%s", ifname);
+    xdp->queue = (at != NULL) ? atoi(at + 1) : 0;
+    if ((xdp->queue < 0) || (xdp->queue >= ETH_XDP_MAX_QUEUES)) {
+        fprintf(stderr, "eth_open(): ERROR: cola XDP incorrecta\n");
+        free(xdp);
+        return NULL;
+    }
+
+    /* Índice y dirección MAC del interfaz */
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    memcpy(ifr.ifr_name, ifname, name_len);
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if ((sock == -1) || (ioctl(sock, SIOCGIFINDEX, &ifr) == -1)) {
+        fprintf(stderr, "eth_open(): ERROR en SIOCGIFINDEX(%s): %s\n",
+                ifr.ifr_name, strerror(errno));
+        if (sock != -1) {
+            close(sock);
+        }
+        free(xdp);
+        return NULL;
+    }
+    xdp->ifindex = ifr.ifr_ifindex;
+    if (ioctl(sock, SIOCGIFHWADDR, &ifr) == -1) {
+        fprintf(stderr, "eth_open(): ERROR en SIOCGIFHWADDR(%s): %s\n",
+                ifr.ifr_name, strerror(errno));
+        close(sock);
+        free(xdp);
+        return NULL;
+    }
+    memcpy(xdp->mac_address, ifr.ifr_hwaddr.sa_data, MAC_ADDR_SIZE);
+    close(sock);
+
+    xdp->umem = mmap(NULL, (size_t) ETH_XDP_NUM_FRAMES * ETH_XDP_FRAME_SIZE,
+                     PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (xdp->umem == MAP_FAILED) {
+        fprintf(stderr, "eth_open(): ERROR en mmap(UMEM): %s\n", strerror(errno));
+        free(xdp);
+        return NULL;
+    }
+
+    /* Sin copias si el controlador lo soporta; si no, con copia */
+    if ((eth_xdp_socket(xdp, XDP_ZEROCOPY) == -1) &&
+        (eth_xdp_socket(xdp, XDP_COPY) == -1)) {
+        fprintf(stderr, "eth_open(): ERROR en bind(AF_XDP, %s): %s\n",
+                xdp->name, strerror(errno));
+        xdp->fd = -1;
+        eth_xdp_close(xdp);
+        return NULL;
+    }
+
+    /* La primera mitad de la UMEM para recibir y la segunda para enviar */
+    int i;
+    for (i = 0; i < ETH_XDP_RING_SIZE; i++) {
+        xdp->rx_lent[i] = (uint64_t) i * ETH_XDP_FRAME_SIZE;
+        xdp->tx_free[i] = (uint64_t) (ETH_XDP_RING_SIZE + i) * ETH_XDP_FRAME_SIZE;
+    }
+    eth_xdp_fill(xdp, xdp->rx_lent, ETH_XDP_RING_SIZE);
+    xdp->tx_nfree = ETH_XDP_RING_SIZE;
+
+    /* Desviar al socket las tramas de su cola */
+    if ((eth_xdp_load_prog(xdp) == -1) || (eth_xdp_attach(xdp) == -1)) {
+        eth_xdp_close(xdp);
+        return NULL;
+    }
+    union bpf_attr attr;
+    uint32_t key = xdp->queue;
+    uint32_t value = xdp->fd;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = xdp->map_fd;
+    attr.key = (uintptr_t) &key;
+    attr.value = (uintptr_t) &value;
+    if (eth_xdp_bpf(BPF_MAP_UPDATE_ELEM, &attr) == -1) {
+        fprintf(stderr, "eth_open(): ERROR en BPF_MAP_UPDATE_ELEM: %s\n", strerror(errno));
+        eth_xdp_close(xdp);
+        return NULL;
+    }
+
+    return xdp;
+}
+
+
+static char *eth_xdp_getname(void *dev) {
+    return ((struct eth_xdp *) dev)->name;
+}
+
+
+static void eth_xdp_getaddr(void *dev, mac_addr_t addr) {
+    memcpy(addr, ((struct eth_xdp *) dev)->mac_address, MAC_ADDR_SIZE);
+}
+
+
+static int eth_xdp_getfd(void *dev) {
+    return ((struct eth_xdp *) dev)->fd;
+}
+
+
+static int eth_xdp_can_lend(void *dev) {
+    (void) dev;
+    return 1;
+}
+
+
+/* static int eth_xdp_kick ( struct eth_xdp * xdp );
+ *
+ * DESCRIPCIÓN:
+ *   Avisa al núcleo de que hay tramas en el anillo de transmisión. Que el
+ *   núcleo esté ocupado no es un error: las tramas salen en el siguiente
+ *   aviso.
+ */
+static int eth_xdp_kick(struct eth_xdp *xdp) {
+    if ((sendto(xdp->fd, NULL, 0, MSG_DONTWAIT, NULL, 0) == -1) &&
+        (errno != EAGAIN) && (errno != EBUSY) && (errno != ENOBUFS) &&
+        (errno != EINTR)) {
+        fprintf(stderr, "eth_flush(): ERROR en sendto(%s): %s\n",
+                xdp->name, strerror(errno));
+        return -1;
+    }
+    xdp->tx_pending = 0;
+
+    return 0;
+}
+
+
+static int eth_xdp_flush(void *dev) {
+    struct eth_xdp *xdp = dev;
+
+    int pending = xdp->tx_pending;
+    if ((pending > 0) && (eth_xdp_kick(xdp) == -1)) {
+        return -1;
+    }
+    eth_xdp_complete(xdp);
+
+    return pending;
+}
+
+
+/* Reserva una trama de transmisión de la UMEM. Si no queda ninguna libre se
+   avisa al núcleo y se espera un momento a que complete alguna. */
+static unsigned char *eth_xdp_tx_alloc(void *dev) {
+    struct eth_xdp *xdp = dev;
+
+    eth_xdp_complete(xdp);
+    int tries;
+    for (tries = 0; (xdp->tx_nfree == 0) && (tries < ETH_XDP_TX_WAIT); tries++) {
+        if (eth_xdp_kick(xdp) == -1) {
+            return NULL;
+        }
+        struct pollfd pfd = {xdp->fd, POLLOUT, 0};
+        poll(&pfd, 1, 1);
+        eth_xdp_complete(xdp);
+    }
+    if (xdp->tx_nfree == 0) {
+        fprintf(stderr, "eth_alloc_frame(): ERROR: anillo XDP lleno\n");
+        return NULL;
+    }
+
+    return xdp->umem + xdp->tx_free[--xdp->tx_nfree];
+}
+
+
+/* Las tramas reservadas con 'eth_xdp_tx_alloc()' se envían sin copiarlas; el
+   resto se copian a una trama de la UMEM. Se avisa al núcleo cada
+   'ETH_TX_BATCH' tramas, o en 'eth_flush()'. */
+static int eth_xdp_send(void *dev, unsigned char *frames[], int lens[], int num) {
+    struct eth_xdp *xdp = dev;
+    unsigned char *tx_area = xdp->umem + (size_t) ETH_XDP_RING_SIZE * ETH_XDP_FRAME_SIZE;
+    unsigned char *umem_end = xdp->umem + (size_t) ETH_XDP_NUM_FRAMES * ETH_XDP_FRAME_SIZE;
+
+    struct xdp_desc *entries = xdp->tx.entries;
+    uint32_t prod = *xdp->tx.producer;
+    int i;
+    for (i = 0; i < num; i++) {
+        unsigned char *data = frames[i];
+        if ((lens[i] > ETH_XDP_FRAME_SIZE) || (data < tx_area) || (data >= umem_end)) {
+            data = eth_xdp_tx_alloc(xdp);
+            if ((data == NULL) || (lens[i] > ETH_XDP_FRAME_SIZE)) {
+                break;
+            }
+            memcpy(data, frames[i], lens[i]);
+        }
+        struct xdp_desc *desc = &entries[(prod + i) & (ETH_XDP_RING_SIZE - 1)];
+        desc->addr = data - xdp->umem;
+        desc->len = lens[i];
+        desc->options = 0;
+    }
+    __atomic_store_n(xdp->tx.producer, prod + i, __ATOMIC_RELEASE);
+    xdp->tx_pending += i;
+
+    if ((xdp->tx_pending >= ETH_TX_BATCH) && (eth_xdp_flush(xdp) == -1)) {
+        return -1;
+    }
+
+    return (i == 0) ? -1 : i;
+}
+
+
+/* Las tramas prestadas en la recepción anterior se devuelven al núcleo al
+   empezar la siguiente */
+static int eth_xdp_recv
+        (void *dev, unsigned char *bufs[], int sizes[], int lens[],
+         int num, long int timeout) {
+    struct eth_xdp *xdp = dev;
+
+    if (xdp->rx_nlent > 0) {
+        eth_xdp_fill(xdp, xdp->rx_lent, xdp->rx_nlent);
+        xdp->rx_nlent = 0;
+    }
+
+    uint32_t cons = *xdp->rx.consumer;
+    uint32_t prod = __atomic_load_n(xdp->rx.producer, __ATOMIC_ACQUIRE);
+    if ((prod == cons) && (timeout != 0)) {
+        struct pollfd pfd = {xdp->fd, POLLIN, 0};
+        int err = poll(&pfd, 1, (timeout < 0) ? -1 : (int) timeout);
+        if (err == -1) {
+            if (errno == EINTR) {
+                return 0;
+            }
+            fprintf(stderr, "eth_recv(): ERROR en poll(%s): %s\n",
+                    xdp->name, strerror(errno));
+            return -1;
+        }
+        prod = __atomic_load_n(xdp->rx.producer, __ATOMIC_ACQUIRE);
+    }
+
+    struct xdp_desc *entries = xdp->rx.entries;
+    uint64_t done[num];
+    int ndone = 0;
+    int i;
+    for (i = 0; (i < num) && (cons != prod); i++, cons++) {
+        struct xdp_desc *desc = &entries[cons & (ETH_XDP_RING_SIZE - 1)];
+        unsigned char *frame = xdp->umem + desc->addr;
+        if (bufs[i] == NULL) {
+            bufs[i] = frame;
+            sizes[i] = desc->len;
+            xdp->rx_lent[xdp->rx_nlent++] = desc->addr;
+        } else {
+            memcpy(bufs[i], frame,
+                   ((int) desc->len < sizes[i]) ? (int) desc->len : sizes[i]);
+            done[ndone++] = desc->addr;
+        }
+        lens[i] = desc->len;
+    }
+    __atomic_store_n(xdp->rx.consumer, cons, __ATOMIC_RELEASE);
+    if (ndone > 0) {
+        eth_xdp_fill(xdp, done, ndone);
+    }
+
+    return i;
+}
+
+
+static int eth_xdp_close(void *dev) {
+    struct eth_xdp *xdp = dev;
+
+    int err = 0;
+    if (xdp->link_fd != -1) {
+        close(xdp->link_fd);
+    }
+    if (xdp->prog_fd != -1) {
+        close(xdp->prog_fd);
+    }
+    if (xdp->map_fd != -1) {
+        close(xdp->map_fd);
+    }
+    if (xdp->fd != -1) {
+        eth_xdp_flush(xdp);
+        eth_xdp_unmap_rings(xdp);
+        err = close(xdp->fd);
+    }
+    munmap(xdp->umem, (size_t) ETH_XDP_NUM_FRAMES * ETH_XDP_FRAME_SIZE);
+    free(xdp);
+
+    return err;
+}
+
+
+const eth_backend_t eth_xdp_backend = {
+        .prefix = "xdp:",
+        .open = eth_xdp_open,
+        .getname = eth_xdp_getname,
+        .getaddr = eth_xdp_getaddr,
+        .getfd = eth_xdp_getfd,
+        .send = eth_xdp_send,
+        .recv = eth_xdp_recv,
+        .can_lend = eth_xdp_can_lend,
+        .tx_alloc = eth_xdp_tx_alloc,
+        .flush = eth_xdp_flush,
+        .close = eth_xdp_close,
+};
@@ -13,9 +13,11 @@
 typedef struct ipv4_layer {
 
     eth_iface_t *iface;
+    arp_iface_t *arp; //estado ARP (cache y vecinas pendientes) de iface
     ipv4_addr_t addr;
     ipv4_addr_t network;
     ipv4_route_table_t *routing_table;
+    char neighbor_file[IPv4_FILENAME_MAX_LENGTH]; //vacio si no se guardan las vecinas
 
 } ipv4_layer_t;
 
@@ -149,7 +151,8 @@ ipv4_layer_t *ipv4_open(char *file_config, char *file_conf_route) {
 
     //Leemos el fichero de config y guardamos el nombre de la interfaz, la ip y
     //la mascara asociadas a estas
-    if (ipv4_config_read(file_config, ifname, ipv4_layer->addr, ipv4_layer->network) != 0) {
+    if (ipv4_config_read(file_config, ifname, ipv4_layer->addr, ipv4_layer->network,
+                         ipv4_layer->neighbor_file) != 0) {
         return NULL;
     }
 
@@ -161,6 +164,53 @@ ipv4_layer_t *ipv4_open(char *file_config, char *file_conf_route) {
 
     //Finalmente abrimos a nivel eth con el nombre que nos pasaron;
     ipv4_layer->iface = eth_open(ifname);
+    if (ipv4_layer->iface == NULL) {
+        ipv4_route_table_free(ipv4_layer->routing_table);
+        free(ipv4_layer);
+        return NULL;
+    }
+
+    //Estado ARP propio del interfaz, con la politica de reintentos por defecto
+    ipv4_layer->arp = arp_open(ipv4_layer->iface, NULL);
+    if (ipv4_layer->arp == NULL) {
+        eth_close(ipv4_layer->iface);
+        ipv4_route_table_free(ipv4_layer->routing_table);
+        free(ipv4_layer);
+        return NULL;
+    }
+
+    //Solo nos interesan IPv4 y ARP, y del multicast solo el grupo de RIPv2.
+    //En los interfaces nativos el resto se descarta ya en el nucleo
+    uint16_t types[] = {IPV4_PROTOCOL, ARP_TYPE};
+    mac_addr_t groups[1];
+    memcpy(groups[0], MAC_MULTICAST_ADDR, sizeof(mac_addr_t));
+    eth_set_filter(ipv4_layer->iface, types, 2, groups, 1);
+
+    //Los paquetes IPv4 que lleguen mientras se recogen respuestas ARP se guardan
+    //en vez de perderse, y los mensajes ARP que lleguen mientras esperamos IPv4
+    //se procesan en el momento (respuestas que liberan los envios pendientes)
+    eth_register_queue(ipv4_layer->iface, IPV4_PROTOCOL, 0);
+    eth_register_handler(ipv4_layer->iface, ARP_TYPE, arp_handler, ipv4_layer->arp);
+
+    //Respondemos a quien pregunte por nuestra direccion
+    arp_add_address(ipv4_layer->arp, ipv4_layer->addr);
+
+    //Recuperamos las vecinas de la ejecucion anterior, si se guardan
+    if (ipv4_layer->neighbor_file[0] != '\0') {
+        arp_cache_load(ipv4_layer->arp, ipv4_layer->neighbor_file);
+    }
+
+    //Y preguntamos a la vez por todas las pasarelas de la tabla de rutas, sin
+    //esperar: las respuestas las recoge arp_handler y el primer envio a cada una
+    //ya no tiene que esperar
+    int i;
+    for (i = 0; i < IPv4_ROUTE_TABLE_SIZE; i++) {
+        ipv4_route_t *route = ipv4_route_table_get(ipv4_layer->routing_table, i);
+        if ((route != NULL) &&
+            (memcmp(route->gateway_addr, IPv4_ZERO_ADDR, IPv4_ADDR_SIZE) != 0)) {
+            arp_prefetch(ipv4_layer->arp, ipv4_layer->addr, route->gateway_addr);
+        }
+    }
 
     return ipv4_layer;
 
@@ -169,7 +219,22 @@ ipv4_layer_t *ipv4_open(char *file_config, char *file_conf_route) {
 
 int ipv4_send(ipv4_layer_t *layer, ipv4_addr_t dst, uint8_t protocol,
               unsigned char *payload, int payload_len) {
-    //int is_multicast;
+    //Hacemos comprobaciones de los datos
+    if (payload_len < 0 || payload_len > MRU) {
+        fprintf(stderr, "Error en la longitud de Payload. Imposible enviar el datagrama.\n");
+        return -1;
+    }
+
+    //El payload del llamante no tiene hueco para las cabeceras, asi que lo
+    //copiamos una sola vez a una trama del tamaño justo y la enviamos in situ
+    unsigned char frame[IPV4_HEADROOM + payload_len];
+    memcpy(frame + IPV4_HEADROOM, payload, payload_len);
+
+    return ipv4_send_frame(layer, dst, protocol, frame, payload_len);
+}
+
+int ipv4_send_frame(ipv4_layer_t *layer, ipv4_addr_t dst, uint8_t protocol,
+                    unsigned char *frame, int payload_len) {
     //Hacemos comprobaciones de los datos
     if (layer == NULL) {
         fprintf(stderr, "Error en el IPv4 Layer.\n");
@@ -180,74 +245,68 @@ int ipv4_send(ipv4_layer_t *layer, ipv4_addr_t dst, uint8_t protocol,
         fprintf(stderr, "Error en el envío de datos.\n");
         return -1;
     }
-    if (payload_len < 0) {
+    if (payload_len < 0 || payload_len > MRU) {
         fprintf(stderr, "Error en la longitud de Payload. Imposible enviar el datagrama.\n");
         return -1;
     }
 
     //Miramos en las tablas el siguiente salto para llegar a dst
-    //if (memcmp(dst, IPv4_MULTICAST_ADDR, sizeof(IPv4_ADDR_SIZE)) == 0) {
-      //  is_broadcast = 1;
-    //}
-
-    //si no es broadcast comprobamos el siguiente salto
-    //if (!is_broadcast) {
-        ipv4_route_t *next_jump = ipv4_route_table_lookup(layer->routing_table, dst);
+    ipv4_route_t *next_jump = ipv4_route_table_lookup(layer->routing_table, dst);
 
+    if (next_jump == NULL) {
+        fprintf(stderr, "No hay ruta disponible para transmitir los datos.\n");
+        return -1;
+    }
 
-        if (next_jump->gateway_addr == NULL) {
-            fprintf(stderr, "No hay ruta disponible para transmitir los datos.\n");
-            return -1;
-        }
-    //}
-        //Si nos devuelve 0.0.0.0, es que no hay siguiente salto y la ip esta en nuestra
-        //subred, por lo tanto el siguiente salto es el propio dst
-    else if (memcmp(next_jump->gateway_addr, IPv4_ZERO_ADDR, sizeof(ipv4_addr_t)) == 0) {
+    //Si nos devuelve 0.0.0.0, es que no hay siguiente salto y la ip esta en nuestra
+    //subred, por lo tanto el siguiente salto es el propio dst. Lo guardamos en una
+    //copia local para no modificar la ruta de la tabla
+    ipv4_addr_t next_hop;
+    if (memcmp(next_jump->gateway_addr, IPv4_ZERO_ADDR, sizeof(ipv4_addr_t)) == 0) {
         printf("El siguiente salto es el propio destino\n");
-        memcpy(next_jump->gateway_addr, dst, sizeof(ipv4_addr_t));
+        memcpy(next_hop, dst, sizeof(ipv4_addr_t));
+    } else {
+        memcpy(next_hop, next_jump->gateway_addr, sizeof(ipv4_addr_t));
     }
     mac_addr_t your_mac = "\0";
 
     /*CABECERA IP*/
 
-    ipv4_message_t ipv4_frame;
+    //La cabecera se escribe justo delante del payload, dejando hueco para la Ethernet
+    ipv4_message_t *ipv4_frame = (ipv4_message_t *) (frame + ETH_HEADROOM);
     int ipv4_frame_len = payload_len + IPV4_HEADER_SIZE;
 
     //RELLENAR TODOS LOS VALORES
-    ipv4_frame.version = IPV4_VERSION;
-    ipv4_frame.type = IPV4_TYPE;
-    ipv4_frame.total_len = htons(ipv4_frame_len);
-    ipv4_frame.id = htons(1);
-    ipv4_frame.flags_offset = 0;
-    ipv4_frame.TTL = IPV4_DEFAULT_TTL;
-    ipv4_frame.protocol = protocol;
-    ipv4_frame.checksum = IPV4_CHECKSUM_INIT;
-    memcpy(ipv4_frame.source, layer->addr, sizeof(ipv4_addr_t));
-    memcpy(ipv4_frame.dest, dst, sizeof(ipv4_addr_t));
+    ipv4_frame->version = IPV4_VERSION;
+    ipv4_frame->type = IPV4_TYPE;
+    ipv4_frame->total_len = htons(ipv4_frame_len);
+    ipv4_frame->id = htons(1);
+    ipv4_frame->flags_offset = 0;
+    ipv4_frame->TTL = IPV4_DEFAULT_TTL;
+    ipv4_frame->protocol = protocol;
+    ipv4_frame->checksum = IPV4_CHECKSUM_INIT;
+    memcpy(ipv4_frame->source, layer->addr, sizeof(ipv4_addr_t));
+    memcpy(ipv4_frame->dest, dst, sizeof(ipv4_addr_t));
 
     ipv4_route_t multicast;
     memcpy(multicast.subnet_addr, IPv4_MULTICAST_ADDR, sizeof(ipv4_addr_t));
     memcpy(multicast.subnet_mask, IPv4_MULTICAST_NETWORK, sizeof(ipv4_addr_t));
-    if (ipv4_route_lookup(&multicast, dst) == 4 ) ipv4_frame.TTL = 1;
-
-    ipv4_frame.checksum = htons(ipv4_checksum((unsigned char *) &ipv4_frame, IPV4_HEADER_SIZE));
+    int dst_is_multicast = (ipv4_route_lookup(&multicast, dst) == 4);
+    if (dst_is_multicast) ipv4_frame->TTL = 1;
 
-    memcpy(ipv4_frame.data, payload, payload_len);
+    ipv4_frame->checksum = htons(ipv4_checksum((unsigned char *) ipv4_frame, IPV4_HEADER_SIZE));
 
-    if (ipv4_route_lookup(&multicast, dst) != 4 ) {
-        //Mandamos ARP resolve para conocer la MAC del siguiente salto
-        //if (!is_broadcast) {
-        if (arp_resolve(layer->iface, layer->addr, next_jump->gateway_addr, your_mac) <= 0) {
-            //No hace falta mandar mensaje, ya lo hace arp_resolve
-            return -1;
-        }
+    int bytes_send;
+    if (!dst_is_multicast) {
+        //La capa ARP lo envia a la MAC del siguiente salto sin esperar: si aun no
+        //la conoce guarda el datagrama y lo envia cuando llegue la respuesta
+        bytes_send = arp_send_frame(layer->arp, layer->addr, next_hop, IPV4_PROTOCOL, frame, ipv4_frame_len);
     }
     else {
         memcpy(your_mac, MAC_MULTICAST_ADDR, sizeof(mac_addr_t));
+        bytes_send = eth_send_frame(layer->iface, your_mac, IPV4_PROTOCOL, frame, ipv4_frame_len);
     }
 
-    int bytes_send = eth_send(layer->iface, your_mac, IPV4_PROTOCOL, (unsigned char *) &ipv4_frame,
-                              ipv4_frame_len);
     if (bytes_send == -1) {
         printf("Problema al enviar los datos ipv4\n");
         return -1;
@@ -255,6 +314,14 @@ int ipv4_send(ipv4_layer_t *layer, ipv4_addr_t dst, uint8_t protocol,
     return (bytes_send - IPV4_HEADER_SIZE);
 }
 
+int ipv4_flush(ipv4_layer_t *layer) {
+    if (layer == NULL) {
+        fprintf(stderr, "Error en el IPv4 Layer.\n");
+        return -1;
+    }
+    return eth_flush(layer->iface);
+}
+
 int is_multicast(ipv4_addr_t addr) {
     int is_multicast = 1;
 
@@ -284,8 +351,13 @@ int ipv4_recv(ipv4_layer_t *layer, uint8_t protocol, unsigned char buffer[], ipv
 
     while (1) {
 
-        //Miramos cuanto tiempo nos falta
+        //Miramos cuanto tiempo nos falta, sin pasarnos del siguiente reintento ARP
         long int time_left = timerms_left(&timer);
+        long int arp_left = arp_service(layer->arp);
+        int arp_wait = (arp_left >= 0) && ((time_left < 0) || (arp_left < time_left));
+        if (arp_wait) {
+            time_left = arp_left;
+        }
 
         //recibimos el mensaje
         frame_len = eth_recv(layer->iface, mac, IPV4_PROTOCOL, ipv4_buffer, ipv4_buffer_len, time_left);
@@ -296,6 +368,9 @@ int ipv4_recv(ipv4_layer_t *layer, uint8_t protocol, unsigned char buffer[], ipv
             printf("No se recibio el paquete\n");
             return -1;
         } else if (frame_len == 0) {
+            if (arp_wait) {
+                continue;
+            }
             return 0;
         }
             //si por alguna razon el buffer que nos devuelve es menor que
@@ -309,6 +384,19 @@ int ipv4_recv(ipv4_layer_t *layer, uint8_t protocol, unsigned char buffer[], ipv
         //Hacemos casting para manejar el buffer como una estructura ip
         ipv4_frame = (ipv4_message_t *) ipv4_buffer;
 
+        //Si el emisor esta en nuestra subred y la cabecera es valida, ya sabemos su
+        //MAC para contestarle sin preguntar (si la capa ARP aprende de IPv4)
+        int on_link = 1;
+        int i;
+        for (i = 0; i < IPv4_ADDR_SIZE; i++) {
+            if ((ipv4_frame->source[i] & layer->network[i]) != (layer->addr[i] & layer->network[i])) {
+                on_link = 0;
+            }
+        }
+        if (on_link && (ipv4_checksum((unsigned char *) ipv4_frame, IPV4_HEADER_SIZE) == 0)) {
+            arp_learn(layer->arp, ipv4_frame->source, mac, ARP_LEARN_IPV4);
+        }
+
         //Aqui comprobamos que en el datagram IP sea del tipo que esperamos
         //y va dirigido a nuestra IP, si es asi, guardamos la payload->sender en sender
         //hacemos break. Tambien acceptamos direccion multicast;
@@ -341,6 +429,10 @@ int ipv4_close(ipv4_layer_t *ipv4_layer) {
 
 
     ipv4_route_table_free(ipv4_layer->routing_table);
+    if (ipv4_layer->neighbor_file[0] != '\0') {
+        arp_cache_save(ipv4_layer->arp, ipv4_layer->neighbor_file);
+    }
+    arp_forget(ipv4_layer->arp);
 
     if (!eth_close(ipv4_layer->iface)) {
         return -1;
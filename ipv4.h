@@ -3,6 +3,8 @@
 
 #include <stdint.h>
 
+#include "eth.h"
+
 #define IPv4_ADDR_SIZE 4
 #define IPv4_STR_MAX_LENGTH 16
 
@@ -16,6 +18,10 @@
 #define IPV4_TYPE 4
 #define IPV4_HEADER_SIZE 20
 
+/* Espacio a reservar delante del payload IPv4 para construir la trama "in
+   situ" con 'ipv4_send_frame()': cabecera Ethernet + cabecera IPv4. */
+#define IPV4_HEADROOM (ETH_HEADROOM + IPV4_HEADER_SIZE)
+
 typedef unsigned char ipv4_addr_t[IPv4_ADDR_SIZE];
 
 /* Dirección IPv4 a cero "0.0.0.0" */
@@ -85,6 +91,16 @@ ipv4_layer_t *ipv4_open(char *file_config, char *file_conf_route);
 
 int ipv4_send(ipv4_layer_t *layer, ipv4_addr_t dst, uint8_t protocol, unsigned char *payload, int payload_len);
 
+/* Igual que 'ipv4_send()', pero sin copiar el payload: 'frame' debe tener al
+ * menos 'IPV4_HEADROOM + payload_len' bytes con los datos ya escritos en
+ * 'frame + IPV4_HEADROOM'. Se rellenan las cabeceras IPv4 y Ethernet delante
+ * y se entrega el mismo buffer a 'eth_send_frame()'.
+ */
+int ipv4_send_frame(ipv4_layer_t *layer, ipv4_addr_t dst, uint8_t protocol, unsigned char *frame, int payload_len);
+
+/* Envía ya los datagramas que el interfaz tenga acumulados (ver 'eth_flush()') */
+int ipv4_flush(ipv4_layer_t *layer);
+
 int is_multicast(ipv4_addr_t addr);
 
 int ipv4_recv(ipv4_layer_t *layer, uint8_t protocol, unsigned char payload[], ipv4_addr_t sender, int payload_len,
@@ -5,13 +5,17 @@
 #include <string.h>
 
 /* int ipv4_config_read
- * ( char* filename, char ifname[], ipv4_addr_t addr, ipv4_addr_t netmask );
+ * ( char* filename, char ifname[], ipv4_addr_t addr, ipv4_addr_t netmask,
+ *   char neighbor_file[] );
  *
  * DESCRIPCIÓN: 
  *   Esta función lee el fichero de configuración IPv4 especificado y devuelve
  *   el nombre del interfaz, la direccion IPv4 del mismo, y la máscara de
  *   subred.
  *
+ *   Opcionalmente, la variable 'NeighborFile' indica el fichero donde se
+ *   guardan las vecinas ARP entre ejecuciones (ver 'arp_cache_load()').
+ *
  *   La memoria del nombre del interfaz y de las direcciones IPv4 debe haber
  *   sido reservada previamente. Deben reservarse al menos 'IFACE_NAME_MAX_LENGTH'
  *   bytes para almacenar el nombre del interfaz.
@@ -24,6 +28,10 @@
  *                leida del fichero de configuración.
  *     'netmask': Variable donde se copiará la máscara de subred leida del
  *                fichero de configuración.
+ * 'neighbor_file': Variable donde se copiará el nombre del fichero de
+ *                vecinas, o una cadena vacía si no se indica. Deben
+ *                reservarse al menos 'IPv4_FILENAME_MAX_LENGTH' bytes. Con
+ *                'NULL' la variable 'NeighborFile' se acepta y se ignora.
  *
  * VALOR DEVUELTO:
  *   La función devuelve '0' si el fichero de configuración se ha leido
@@ -34,7 +42,8 @@
  *   fichero de configuración.
  */
 int ipv4_config_read
-( char* filename, char ifname[], ipv4_addr_t addr, ipv4_addr_t netmask )
+( char* filename, char ifname[], ipv4_addr_t addr, ipv4_addr_t netmask,
+  char neighbor_file[] )
 {
   int err = 0;
 
@@ -54,6 +63,9 @@ int ipv4_config_read
   ifname[0] = '\0';
   memset(addr, 0x00, IPv4_ADDR_SIZE);
   memset(netmask, 0x00, IPv4_ADDR_SIZE);
+  if (neighbor_file != NULL) {
+    neighbor_file[0] = '\0';
+  }
 
   int linenum = 0;
   char line_buf[1024];
@@ -108,6 +120,12 @@ int ipv4_config_read
         } else {
           netmask_read = 1;
         }
+      } else if (strcasecmp(name_str, "NeighborFile") == 0) {
+        if (neighbor_file != NULL) {
+          strncpy(neighbor_file, value_str, IPv4_FILENAME_MAX_LENGTH - 1);
+          neighbor_file[IPv4_FILENAME_MAX_LENGTH - 1] = '\0';
+        }
+        err = 0;
       } else {
         fprintf(stderr, "%s:%d: Unknown variable: '%s'\n", 
                 filename, linenum, name_str);
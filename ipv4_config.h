@@ -4,14 +4,21 @@
 #include "ipv4.h"
 #include <stdio.h>
 
+/* Longitud máxima del nombre de un fichero indicado en la configuración */
+#define IPv4_FILENAME_MAX_LENGTH 256
+
 /* int ipv4_config_read
- * ( char* filename, char ifname[], ipv4_addr_t addr, ipv4_addr_t netmask );
+ * ( char* filename, char ifname[], ipv4_addr_t addr, ipv4_addr_t netmask,
+ *   char neighbor_file[] );
  *
  * DESCRIPCIÓN: 
  *   Esta función lee el fichero de configuración IPv4 especificado y devuelve
  *   el nombre del interfaz, la direccion IPv4 del mismo, y la máscara de
  *   subred.
  *
+ *   Opcionalmente, la variable 'NeighborFile' indica el fichero donde se
+ *   guardan las vecinas ARP entre ejecuciones (ver 'arp_cache_load()').
+ *
  *   La memoria del nombre del interfaz y de las direcciones IPv4 debe haber
  *   sido reservada previamente. Deben reservarse al menos 'IFACE_NAME_MAX_LENGTH'
  *   bytes para almacenar el nombre del interfaz.
@@ -24,6 +31,10 @@
  *                leida del fichero de configuración.
  *     'netmask': Variable donde se copiará la máscara de subred leida del
  *                fichero de configuración.
+ * 'neighbor_file': Variable donde se copiará el nombre del fichero de
+ *                vecinas, o una cadena vacía si no se indica. Deben
+ *                reservarse al menos 'IPv4_FILENAME_MAX_LENGTH' bytes. Con
+ *                'NULL' la variable 'NeighborFile' se acepta y se ignora.
  *
  * VALOR DEVUELTO:
  *   La función devuelve '0' si el fichero de configuración se ha leido
@@ -34,7 +45,8 @@
  *   fichero de configuración.
  */
 int ipv4_config_read
-( char* filename, char ifname[], ipv4_addr_t addr, ipv4_addr_t netmask );
+( char* filename, char ifname[], ipv4_addr_t addr, ipv4_addr_t netmask,
+  char neighbor_file[] );
 
 
 #endif /* _IPv4_CONFIG_H*/
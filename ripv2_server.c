@@ -96,6 +96,7 @@ int main(int argc, char *argv[]) {
             udp_send(udp_layer, RIPv2_MULTICAST_ADDR, RIP_PORT, (unsigned char *) &msg,
                      sizeof(entrada_rip_t) * index + RIP_HEADER_SIZE); //probablemente me esta dando error
                                                                                  //porque ya esta en uso
+            udp_flush(udp_layer); //este proceso no recibe nunca, asi que sacamos el envio ya
 
             printf("Enviador mensaje periodico\n");
 
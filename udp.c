@@ -33,28 +33,41 @@ udp_layer_t *udp_open(uint16_t src_port, char *ip_config, char *route_config) {
 
 int udp_send(udp_layer_t *layer, ipv4_addr_t dst, uint16_t port_out, unsigned char payload[], int payload_len) {
 
+    if (payload_len <= 0 || payload_len > UDP_PACKET_LEN) {
+        printf("Payload de UDP no valido\n");
+        return -1;
+    }
+
+    //Copiamos los datos una sola vez a una trama con hueco para todas las cabeceras
+    unsigned char frame[UDP_HEADROOM + payload_len];
+    memcpy(frame + UDP_HEADROOM, payload, payload_len);
+
+    return udp_send_frame(layer, dst, port_out, frame, payload_len);
+}
+
+int udp_send_frame(udp_layer_t *layer, ipv4_addr_t dst, uint16_t port_out, unsigned char *frame, int payload_len) {
+
     if (layer == NULL) {
         printf("Hubo un fallo al inicializar el UDP layer\n");
         return -1;
     }
 
-    if (payload_len <= 0) {
+    if (payload_len <= 0 || payload_len > UDP_PACKET_LEN) {
         printf("Payload de UDP no valido\n");
         return -1;
     }
 
-    //Rellenamos paquete
-    udp_packet_t udp_frame;
-    udp_frame.src_port = htons(layer->source_port);
-    udp_frame.dst_port = htons(port_out);
-    udp_frame.checksum = 0x000;
+    //Rellenamos la cabecera delante de los datos, que ya estan en su sitio
+    udp_packet_t *udp_frame = (udp_packet_t *) (frame + IPV4_HEADROOM);
+    udp_frame->src_port = htons(layer->source_port);
+    udp_frame->dst_port = htons(port_out);
+    udp_frame->checksum = 0x000;
     int udp_frame_len = UDP_HEADER_LEN + payload_len;
-    udp_frame.len = htons(udp_frame_len);
-    memcpy(udp_frame.payload, (unsigned char *) payload, payload_len);
+    udp_frame->len = htons(udp_frame_len);
 
 
     //bonito asi parece ser
-    int bytes_send = ipv4_send(layer->ipv4_layer, dst, UDP_PROTOCOL, (unsigned char *) &udp_frame, udp_frame_len);
+    int bytes_send = ipv4_send_frame(layer->ipv4_layer, dst, UDP_PROTOCOL, frame, udp_frame_len);
 
     if (bytes_send == -1) {
         //ya manda el warning el ipv4_send, no hace falta hacer printf
@@ -125,6 +138,14 @@ udp_recv(udp_layer_t *layer, long int timeout, ipv4_addr_t sender, uint16_t *por
 
 }
 
+int udp_flush(udp_layer_t *layer) {
+    if (layer == NULL) {
+        printf("Error al inicializar UDP layer. \n");
+        return -1;
+    }
+    return ipv4_flush(layer->ipv4_layer);
+}
+
 void udp_close(udp_layer_t *my_layer) {
 
     ipv4_close(my_layer->ipv4_layer);
@@ -11,6 +11,8 @@
 #define UDP_PROTOCOL 0x11
 #define UDP_PACKET_LEN 1472
 #define UDP_HEADER_LEN 8
+/* Espacio a reservar delante de los datos para 'udp_send_frame()' */
+#define UDP_HEADROOM (IPV4_HEADROOM + UDP_HEADER_LEN)
 #define ERROR 001
 
 
@@ -34,8 +36,15 @@ udp_layer_t *udp_open(uint16_t src_port, char *ip_config, char *route_config);
 
 int udp_send(udp_layer_t *layer, ipv4_addr_t dst, uint16_t port_out, unsigned char data[], int payload_len);
 
+/* Igual que 'udp_send()', pero con los datos ya escritos en 'frame + UDP_HEADROOM'.
+ * Las cabeceras UDP, IPv4 y Ethernet se rellenan delante sin copiar el payload. */
+int udp_send_frame(udp_layer_t *layer, ipv4_addr_t dst, uint16_t port_out, unsigned char *frame, int payload_len);
+
 int udp_recv(udp_layer_t *layer, long int timeout, ipv4_addr_t sender, uint16_t *port, unsigned char * payload, int payload_len);
 
+/* Envía ya los datagramas acumulados en el interfaz (ver 'eth_flush()') */
+int udp_flush(udp_layer_t *layer);
+
 void udp_close(udp_layer_t *my_layer);
 
 #endif //RYSCA_UDP_H